@@ -0,0 +1,44 @@
+#!/bin/sh
+# Check that the programs --emit-c writes print exactly what noviq -e
+# prints, errors and exit status included. Run from the top of the tree
+# after make and make runtime, or through make emit-check:
+#   sh example/emit/compare.sh [script.nvq ...]
+# With no scripts it checks every one next to it. A script the type
+# checker rejects is compared on what --emit-c itself prints.
+
+root=$(cd "$(dirname "$0")/../.." && pwd)
+[ $# -gt 0 ] || set -- "$root"/example/emit/*.nvq
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+passed=0
+failed=0
+for script in "$@"; do
+    dir=$(cd "$(dirname "$script")" && pwd)
+    name=$(basename "$script")
+
+    (cd "$dir" && "$root/noviq" -e "$name" </dev/null >"$work/expected" 2>&1; echo "exit $?" >>"$work/expected")
+
+    if "$root/noviq" --emit-c "$dir/$name" >"$work/program.c" 2>"$work/actual"; then
+        if ! gcc -O2 -pthread -I"$root" -o "$work/program" "$work/program.c" "$root/libnoviq.a" -lm 2>"$work/cc"; then
+            echo "FAIL $name: the C does not compile"
+            head -5 "$work/cc"
+            failed=$((failed + 1))
+            continue
+        fi
+        (cd "$dir" && "$work/program" </dev/null >"$work/actual" 2>&1; echo "exit $?" >>"$work/actual")
+    else
+        echo "exit 1" >>"$work/actual"
+    fi
+
+    if cmp -s "$work/expected" "$work/actual"; then
+        passed=$((passed + 1))
+    else
+        echo "FAIL $name"
+        diff "$work/expected" "$work/actual" | head -10
+        failed=$((failed + 1))
+    fi
+done
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,519 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include "lexer_array.h"
+#include "lexer_simd.h"
+#include "lexer_map.h"
+#include "lexer_parallel.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+#define ARRAY_MIN_CAPACITY 8
+// Elements of integer arithmetic checked for overflow at a time
+#define INT_CHECK_CHUNK 4096
+
+static size_t elementSize(ArrayKind kind) {
+    switch (kind) {
+        case ARRAY_INT: return sizeof(int64_t);
+        case ARRAY_FLOAT: return sizeof(double);
+        default: return sizeof(Variable);
+    }
+}
+
+Array *createArray(ArrayKind kind, size_t capacity) {
+    Array *array = memAlloc(sizeof(Array));
+    array->kind = kind;
+    array->length = 0;
+    array->capacity = capacity;
+    array->refCount = 1;
+    array->epoch = parallelEpoch;
+    array->data.ints = capacity ? memAlloc(capacity * elementSize(kind)) : NULL;
+    return array;
+}
+
+void retainArray(Array *array) {
+    refRetain(&array->refCount);
+}
+
+void releaseArray(Array *array) {
+    if (refRelease(&array->refCount) > 0) {
+        return;
+    }
+    if (array->kind == ARRAY_BOXED) {
+        for (size_t i = 0; i < array->length; i++) {
+            releaseValue(&array->data.boxed[i]);
+        }
+    }
+    memFree(array->data.ints);
+    memFree(array);
+}
+
+static void ensureCapacity(Array *array, size_t needed) {
+    if (needed <= array->capacity) {
+        return;
+    }
+    size_t capacity = array->capacity ? array->capacity : ARRAY_MIN_CAPACITY;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    array->data.ints = memRealloc(array->data.ints, capacity * elementSize(array->kind));
+    if (!array->data.ints) {
+        raiseError(ERROR_RUNTIME, currentLineNumber, "Out of memory growing array");
+    }
+    array->capacity = capacity;
+}
+
+// Integer elements are stored in 64 bits, as read_csv and array
+// arithmetic may make them, but the script's integers are ints
+static int elementInt(int64_t value) {
+    if (value < INT_MIN || value > INT_MAX) {
+        raiseError(ERROR_VALUE, currentLineNumber, "Array element %lld does not fit in an integer",
+                   (long long)value);
+    }
+    return (int)value;
+}
+
+// Switch the storage of an array to a wider kind, converting existing elements
+static void convertArray(Array *array, ArrayKind kind) {
+    if (array->kind == ARRAY_INT && kind == ARRAY_BOXED) {
+        for (size_t i = 0; i < array->length; i++) {
+            elementInt(array->data.ints[i]);
+        }
+    }
+    size_t capacity = array->capacity ? array->capacity : ARRAY_MIN_CAPACITY;
+    void *buffer = memAlloc(capacity * elementSize(kind));
+
+    for (size_t i = 0; i < array->length; i++) {
+        if (kind == ARRAY_FLOAT) {
+            ((double *)buffer)[i] = (double)array->data.ints[i];
+        } else {
+            Variable *slot = &((Variable *)buffer)[i];
+            slot->name = NULL;
+            if (array->kind == ARRAY_INT) {
+                slot->type = INT;
+                slot->value.intValue = (int)array->data.ints[i];  // Checked above
+            } else {
+                slot->type = FLOAT;
+                slot->value.floatValue = (float)array->data.floats[i];
+            }
+        }
+    }
+
+    memFree(array->data.ints);
+    array->data.ints = buffer;
+    array->capacity = capacity;
+    array->kind = kind;
+}
+
+// Make sure the array can hold value, retyping it if needed. An empty array
+// takes the kind of its first element; ints widen to floats and anything
+// non-numeric forces boxed storage.
+static void prepareForValue(Array *array, const Variable *value) {
+    ArrayKind wanted;
+    if (value->type == INT) {
+        wanted = ARRAY_INT;
+    } else if (value->type == FLOAT) {
+        wanted = ARRAY_FLOAT;
+    } else {
+        wanted = ARRAY_BOXED;
+    }
+
+    if (array->length == 0) {
+        if (array->kind != wanted) {
+            memFree(array->data.ints);
+            array->data.ints = NULL;
+            array->capacity = 0;
+            array->kind = wanted;
+        }
+        return;
+    }
+
+    if (array->kind == ARRAY_BOXED || array->kind == wanted) {
+        return;
+    }
+    if (array->kind == ARRAY_FLOAT && wanted == ARRAY_INT) {
+        return;
+    }
+    convertArray(array, wanted == ARRAY_BOXED ? ARRAY_BOXED : ARRAY_FLOAT);
+}
+
+static void storeValue(Array *array, size_t index, const Variable *value, int replace) {
+    switch (array->kind) {
+        case ARRAY_INT:
+            array->data.ints[index] = value->value.intValue;
+            break;
+        case ARRAY_FLOAT:
+            array->data.floats[index] = value->type == INT ?
+                (double)value->value.intValue : (double)value->value.floatValue;
+            break;
+        case ARRAY_BOXED:
+            if (replace) {
+                // Box first so that storing an element into itself stays valid
+                Variable old = array->data.boxed[index];
+                copyValue(&array->data.boxed[index], value);
+                releaseValue(&old);
+            } else {
+                copyValue(&array->data.boxed[index], value);
+            }
+            break;
+    }
+}
+
+void arrayAppend(Array *array, const Variable *value) {
+    checkWritable(array->epoch, "an array");
+    prepareForValue(array, value);
+    ensureCapacity(array, array->length + 1);
+    storeValue(array, array->length, value, 0);
+    array->length++;
+}
+
+static size_t resolveIndex(Array *array, long index) {
+    if (index < 0) {
+        index += (long)array->length;
+    }
+    if (index < 0 || (size_t)index >= array->length) {
+        raiseError(ERROR_INDEX, currentLineNumber, "Array index %ld out of range (length %zu)",
+                   index, array->length);
+    }
+    return (size_t)index;
+}
+
+void arrayGet(Array *array, long index, Variable *out) {
+    size_t i = resolveIndex(array, index);
+    out->name = NULL;
+    switch (array->kind) {
+        case ARRAY_INT:
+            out->type = INT;
+            out->value.intValue = elementInt(array->data.ints[i]);
+            break;
+        case ARRAY_FLOAT:
+            out->type = FLOAT;
+            out->value.floatValue = (float)array->data.floats[i];
+            break;
+        case ARRAY_BOXED:
+            copyValue(out, &array->data.boxed[i]);
+            break;
+    }
+}
+
+void arraySet(Array *array, long index, const Variable *value) {
+    checkWritable(array->epoch, "an array");
+    size_t i = resolveIndex(array, index);
+    prepareForValue(array, value);
+    storeValue(array, i, value, 1);
+}
+
+Array *arraySlice(Array *array, long start, long end) {
+    long length = (long)array->length;
+    if (start < 0) start += length;
+    if (end < 0) end += length;
+    if (start < 0) start = 0;
+    if (end > length) end = length;
+    if (end < start) end = start;
+
+    size_t count = (size_t)(end - start);
+    Array *slice = createArray(array->kind, count);
+    if (array->kind == ARRAY_BOXED) {
+        for (size_t i = 0; i < count; i++) {
+            copyValue(&slice->data.boxed[i], &array->data.boxed[start + i]);
+        }
+    } else if (count > 0) {
+        memcpy(slice->data.ints, (char *)array->data.ints + start * elementSize(array->kind),
+               count * elementSize(array->kind));
+    }
+    slice->length = count;
+    return slice;
+}
+
+// One side of an elementwise operation: a numeric array or a broadcast scalar
+typedef struct {
+    int isArray;
+    int isFloat;
+    size_t length;
+    const int64_t *ints;
+    const double *floats;
+    int64_t intScalar;
+    double floatScalar;
+} Operand;
+
+static void describeOperand(const Variable *value, Operand *operand) {
+    memset(operand, 0, sizeof(Operand));
+    if (value->type == ARRAY) {
+        Array *array = value->value.arrayValue;
+        if (array->kind == ARRAY_BOXED) {
+            raiseError(ERROR_TYPE, currentLineNumber, "Array arithmetic needs numeric arrays");
+        }
+        operand->isArray = 1;
+        operand->isFloat = array->kind == ARRAY_FLOAT;
+        operand->length = array->length;
+        operand->ints = array->data.ints;
+        operand->floats = array->data.floats;
+    } else if (value->type == INT) {
+        operand->intScalar = value->value.intValue;
+        operand->floatScalar = value->value.intValue;
+        operand->ints = &operand->intScalar;
+        operand->floats = &operand->floatScalar;
+    } else if (value->type == FLOAT) {
+        operand->isFloat = 1;
+        operand->floatScalar = value->value.floatValue;
+        operand->floats = &operand->floatScalar;
+    } else {
+        raiseError(ERROR_TYPE, currentLineNumber, "Array arithmetic needs numeric operands");
+    }
+}
+
+// Element i of an operand as a double, broadcasting scalars
+static double floatAt(const Operand *operand, size_t i) {
+    if (!operand->isArray) return operand->floatScalar;
+    return operand->isFloat ? operand->floats[i] : (double)operand->ints[i];
+}
+
+// Double buffer for an operand, converting integer arrays into scratch
+static const double *floatBuffer(const Operand *operand, double **scratch) {
+    *scratch = NULL;
+    if (!operand->isArray || operand->isFloat) {
+        return operand->floats;
+    }
+    *scratch = memAlloc((operand->length ? operand->length : 1) * sizeof(double));
+    for (size_t i = 0; i < operand->length; i++) {
+        (*scratch)[i] = (double)operand->ints[i];
+    }
+    return *scratch;
+}
+
+// Element i of an integer operand, broadcasting scalars
+static int64_t intAt(const Operand *operand, size_t i) {
+    return operand->isArray ? operand->ints[i] : operand->intScalar;
+}
+
+// Integer arithmetic is exact, but the kernels wrap like C, so the result
+// is checked. Products of small enough operands cannot wrap; larger ones
+// are checked one at a time.
+static int intOverflowed(const SimdKernels *kernels, KernelOp op, const int64_t *out, const int64_t *x,
+                         const int64_t *y, size_t n, BroadcastMode mode) {
+    if (op != KERNEL_MUL) {
+        return kernels->intWrapped(op, out, x, y, n, mode);
+    }
+    size_t strideX = mode != BROADCAST_LEFT, strideY = mode != BROADCAST_RIGHT;
+    uint64_t magnitudeX = kernels->intMagnitude(x, strideX ? n : 1);
+    uint64_t magnitudeY = kernels->intMagnitude(y, strideY ? n : 1);
+    int bitsX = magnitudeX ? 64 - __builtin_clzll(magnitudeX) : 0;
+    int bitsY = magnitudeY ? 64 - __builtin_clzll(magnitudeY) : 0;
+    if (bitsX + bitsY <= 62) {
+        return 0;
+    }
+    int64_t product;
+    for (size_t i = 0; i < n; i++) {
+        if (__builtin_mul_overflow(x[i * strideX], y[i * strideY], &product)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A float operand of // or % truncated to an integer element
+static int64_t truncateElement(double value) {
+    if (!(value >= -9223372036854775808.0 && value < 9223372036854775808.0)) {
+        raiseError(ERROR_ARITHMETIC, currentLineNumber, "%g does not fit in a 64-bit integer", value);
+    }
+    return (int64_t)value;
+}
+
+static void checkDivisor(const Operand *operand, size_t n, const char *what) {
+    size_t count = operand->isArray ? n : 1;
+    for (size_t i = 0; i < count; i++) {
+        if (floatAt(operand, i) == 0) {
+            raiseError(ERROR_ARITHMETIC, currentLineNumber, "%s by zero", what);
+        }
+    }
+}
+
+Array *arrayArithmetic(const Variable *left, const Variable *right, const char *operator) {
+    Operand a, b;
+    describeOperand(left, &a);
+    describeOperand(right, &b);
+
+    if (a.isArray && b.isArray && a.length != b.length) {
+        raiseError(ERROR_VALUE, currentLineNumber, "Array lengths differ (%zu and %zu)", a.length, b.length);
+    }
+    size_t n = a.isArray ? a.length : b.length;
+    BroadcastMode mode = !a.isArray ? BROADCAST_LEFT : (!b.isArray ? BROADCAST_RIGHT : BROADCAST_NONE);
+    const SimdKernels *kernels = simdKernels();
+
+    // **, // and % have no kernel
+    KernelOp op = KERNEL_ADD;
+    int hasKernel = operator[1] == '\0';
+    switch (operator[0]) {
+        case '+': op = KERNEL_ADD; break;
+        case '-': op = KERNEL_SUB; break;
+        case '*': op = KERNEL_MUL; break;
+        case '/': op = KERNEL_DIV; break;
+        default: hasKernel = 0; break;
+    }
+
+    // Integer + - * stay integer and use the integer kernels
+    if (hasKernel && !a.isFloat && !b.isFloat && op != KERNEL_DIV) {
+        // A chunk at a time, so that the check reads what is still in cache
+        Array *result = createArray(ARRAY_INT, n);
+        for (size_t done = 0; done < n; done += INT_CHECK_CHUNK) {
+            size_t count = n - done < INT_CHECK_CHUNK ? n - done : INT_CHECK_CHUNK;
+            int64_t *out = result->data.ints + done;
+            const int64_t *x = a.isArray ? a.ints + done : a.ints;
+            const int64_t *y = b.isArray ? b.ints + done : b.ints;
+            kernels->intOp(op, out, x, y, count, mode);
+            if (intOverflowed(kernels, op, out, x, y, count, mode)) {
+                releaseArray(result);
+                raiseError(ERROR_ARITHMETIC, currentLineNumber, "Array arithmetic overflows a 64-bit integer");
+            }
+        }
+        result->length = n;
+        return result;
+    }
+
+    if (hasKernel) {
+        if (op == KERNEL_DIV) {
+            checkDivisor(&b, n, "Division");
+        }
+        double *scratchA, *scratchB;
+        const double *bufferA = floatBuffer(&a, &scratchA);
+        const double *bufferB = floatBuffer(&b, &scratchB);
+        Array *result = createArray(ARRAY_FLOAT, n);
+        kernels->floatOp(op, result->data.floats, bufferA, bufferB, n, mode);
+        result->length = n;
+        memFree(scratchA);
+        memFree(scratchB);
+        return result;
+    }
+
+    // Floor division, modulo and powers follow the scalar rules element by element
+    if (strcmp(operator, "**") == 0) {
+        Array *result = createArray(ARRAY_FLOAT, n);
+        for (size_t i = 0; i < n; i++) {
+            result->data.floats[i] = pow(floatAt(&a, i), floatAt(&b, i));
+        }
+        result->length = n;
+        return result;
+    }
+
+    // Modulo truncates both sides first, so its divisor is checked after
+    // truncation: 0.5 is a zero divisor. Everything is checked before the
+    // result is made, so an error leaves nothing behind.
+    int isModulo = strcmp(operator, "%") == 0;
+    if (isModulo) {
+        size_t divisors = b.isArray ? n : 1;
+        for (size_t i = 0; i < divisors; i++) {
+            if ((b.isFloat ? truncateElement(floatAt(&b, i)) : intAt(&b, i)) == 0) {
+                raiseError(ERROR_ARITHMETIC, currentLineNumber, "Modulo by zero");
+            }
+        }
+        for (size_t i = 0; a.isFloat && i < n; i++) {
+            truncateElement(floatAt(&a, i));
+        }
+    } else {
+        checkDivisor(&b, n, "Division");
+        for (size_t i = 0; i < n; i++) {
+            truncateElement(floatAt(&a, i) / floatAt(&b, i));
+        }
+    }
+
+    Array *result = createArray(ARRAY_INT, n);
+    for (size_t i = 0; i < n; i++) {
+        if (!isModulo) {
+            result->data.ints[i] = (int64_t)(floatAt(&a, i) / floatAt(&b, i));
+            continue;
+        }
+        int64_t ix = a.isFloat ? (int64_t)floatAt(&a, i) : intAt(&a, i);
+        int64_t iy = b.isFloat ? (int64_t)floatAt(&b, i) : intAt(&b, i);
+        // INT64_MIN % -1 traps, though the remainder is 0
+        result->data.ints[i] = iy == -1 ? 0 : ix % iy;
+    }
+    result->length = n;
+    return result;
+}
+
+// Integer results are exact, so one an int cannot hold is an error rather
+// than a rounded float
+static Variable integerResult(int64_t value, const char *name) {
+    if (value < INT_MIN || value > INT_MAX) {
+        raiseError(ERROR_ARITHMETIC, currentLineNumber, "%s() of %lld does not fit in an integer", name,
+                   (long long)value);
+    }
+    Variable result;
+    result.name = NULL;
+    result.type = INT;
+    result.value.intValue = (int)value;
+    return result;
+}
+
+// Worked out in double and rounded once, to the precision floats have
+static Variable floatResult(double value) {
+    Variable result;
+    result.name = NULL;
+    result.type = FLOAT;
+    result.value.floatValue = (float)value;
+    return result;
+}
+
+static void requireNumeric(Array *array, const char *name) {
+    if (array->kind == ARRAY_BOXED) {
+        raiseError(ERROR_TYPE, currentLineNumber, "%s() needs a numeric array", name);
+    }
+}
+
+Variable arrayReduce(Array *array, const char *name) {
+    const SimdKernels *kernels = simdKernels();
+    requireNumeric(array, name);
+
+    if (strcmp(name, "sum") == 0) {
+        if (array->kind == ARRAY_INT) {
+            return integerResult(kernels->intSum(array->data.ints, array->length), name);
+        }
+        return floatResult(kernels->floatSum(array->data.floats, array->length));
+    }
+
+    if (array->length == 0) {
+        raiseError(ERROR_VALUE, currentLineNumber, "%s() of an empty array", name);
+    }
+
+    if (strcmp(name, "mean") == 0) {
+        double sum = array->kind == ARRAY_INT ?
+            (double)kernels->intSum(array->data.ints, array->length) :
+            kernels->floatSum(array->data.floats, array->length);
+        return floatResult(sum / (double)array->length);
+    }
+
+    int wantMax = strcmp(name, "max") == 0;
+    if (array->kind == ARRAY_INT) {
+        return integerResult(kernels->intMinMax(array->data.ints, array->length, wantMax), name);
+    }
+    return floatResult(kernels->floatMinMax(array->data.floats, array->length, wantMax));
+}
+
+Variable arrayDot(Array *left, Array *right) {
+    const SimdKernels *kernels = simdKernels();
+    requireNumeric(left, "dot");
+    requireNumeric(right, "dot");
+    if (left->length != right->length) {
+        raiseError(ERROR_VALUE, currentLineNumber, "Array lengths differ (%zu and %zu)",
+                   left->length, right->length);
+    }
+
+    if (left->kind == ARRAY_INT && right->kind == ARRAY_INT) {
+        return integerResult(kernels->intDot(left->data.ints, right->data.ints, left->length), "dot");
+    }
+
+    Variable leftValue = { NULL, ARRAY, { .arrayValue = left } };
+    Variable rightValue = { NULL, ARRAY, { .arrayValue = right } };
+    Operand a, b;
+    describeOperand(&leftValue, &a);
+    describeOperand(&rightValue, &b);
+    double *scratchA, *scratchB;
+    const double *bufferA = floatBuffer(&a, &scratchA);
+    const double *bufferB = floatBuffer(&b, &scratchB);
+    double sum = kernels->floatDot(bufferA, bufferB, left->length);
+    memFree(scratchA);
+    memFree(scratchB);
+    return floatResult(sum);
+}
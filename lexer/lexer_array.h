@@ -0,0 +1,43 @@
+#ifndef LEXER_ARRAY_H
+#define LEXER_ARRAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lexer_interpret.h"
+
+// Storage kind of an array. Arrays whose elements are all numbers keep them
+// unboxed in one contiguous buffer; mixed arrays fall back to boxed Variables.
+typedef enum { ARRAY_INT, ARRAY_FLOAT, ARRAY_BOXED } ArrayKind;
+
+typedef struct Array {
+    ArrayKind kind;
+    size_t length;
+    size_t capacity;
+    int refCount;
+    unsigned epoch;    // parallelEpoch when it was made, see lexer_parallel.h
+    union {
+        int64_t *ints;
+        double *floats;
+        Variable *boxed;
+    } data;
+} Array;
+
+// Arrays are shared by reference and freed when the last reference goes away
+Array *createArray(ArrayKind kind, size_t capacity);
+void retainArray(Array *array);
+void releaseArray(Array *array);
+
+void arrayAppend(Array *array, const Variable *value);
+void arrayGet(Array *array, long index, Variable *out);
+void arraySet(Array *array, long index, const Variable *value);
+Array *arraySlice(Array *array, long start, long end);
+
+// Elementwise arithmetic where at least one operand is a numeric array;
+// a scalar operand is applied to every element
+Array *arrayArithmetic(const Variable *left, const Variable *right, const char *operator);
+
+// Reductions over numeric arrays: "sum", "min", "max" and "mean"
+Variable arrayReduce(Array *array, const char *name);
+Variable arrayDot(Array *left, Array *right);
+
+#endif // LEXER_ARRAY_H
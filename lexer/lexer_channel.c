@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lexer_channel.h"
+#include "lexer_thread.h"
+#include "lexer_limit.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#endif
+
+// Times a thread looks at a full or empty channel again before it sleeps
+#define CHANNEL_SPINS 64
+// A sleeping thread wakes this often to see whether it still can be woken
+#define CHANNEL_WAIT_NS 50000000L
+
+typedef struct {
+    size_t turn;
+    Variable value;
+} ChannelSlot;
+
+// Position p uses slot p % capacity on round p / capacity. A slot's turn
+// is twice the round while it waits to be filled on that round and one
+// more while it waits to be emptied. Positions only grow, and each sits on
+// a cache line of its own so that senders and receivers do not slow each
+// other down.
+struct Channel {
+    int refCount;         // Updated atomically, channels are always shared
+    int type;
+    size_t capacity;
+    ChannelSlot *slots;
+    char sendLine[64];
+    size_t sendPosition;
+    char receiveLine[64];
+    size_t receivePosition;
+    char stateLine[64];
+    int closed;
+    int sleepers;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+};
+
+static const char *typeNames[] = { "int", "string", "float", "boolean", "array", "map", NULL, "channel" };
+static const char *typeArticles[] = { "an int", "a string", "a float", "a boolean", "an array", "a map",
+                                      "a generator", "a channel" };
+
+int channelTypeFromName(const char *name) {
+    for (int i = 0; i <= CHANNEL; i++) {
+        if (typeNames[i] && strcmp(typeNames[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+Channel *createChannel(long capacity, int type) {
+    Channel *channel = memCalloc(1, sizeof(Channel));
+    channel->refCount = 1;
+    channel->type = type;
+    channel->capacity = (size_t)capacity;
+    channel->slots = memAlloc(channel->capacity * sizeof(ChannelSlot));
+    for (size_t i = 0; i < channel->capacity; i++) {
+        channel->slots[i].turn = 0;
+    }
+#ifndef _WIN32
+    pthread_mutex_init(&channel->lock, NULL);
+    pthread_cond_init(&channel->changed, NULL);
+#endif
+    return channel;
+}
+
+void retainChannel(Channel *channel) {
+    __atomic_add_fetch(&channel->refCount, 1, __ATOMIC_RELAXED);
+}
+
+void releaseChannel(Channel *channel) {
+    if (__atomic_sub_fetch(&channel->refCount, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    for (size_t position = channel->receivePosition; position < channel->sendPosition; position++) {
+        releaseValue(&channel->slots[position % channel->capacity].value);
+    }
+#ifndef _WIN32
+    pthread_mutex_destroy(&channel->lock);
+    pthread_cond_destroy(&channel->changed);
+#endif
+    memFree(channel->slots);
+    memFree(channel);
+}
+
+// ---------------------------------------------------------------------------
+// The queue
+
+// How far the turn of the slot for position is from the one it needs
+static intptr_t turnDistance(Channel *channel, size_t position, size_t extra, int order) {
+    ChannelSlot *slot = &channel->slots[position % channel->capacity];
+    size_t wanted = position / channel->capacity * 2 + extra;
+    return (intptr_t)(__atomic_load_n(&slot->turn, order) - wanted);
+}
+
+static int tryPush(Channel *channel, const Variable *value) {
+    size_t position = __atomic_load_n(&channel->sendPosition, __ATOMIC_RELAXED);
+    for (;;) {
+        intptr_t difference = turnDistance(channel, position, 0, __ATOMIC_ACQUIRE);
+        if (difference == 0) {
+            // A failed exchange loads the position another sender moved to
+            if (__atomic_compare_exchange_n(&channel->sendPosition, &position, position + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                ChannelSlot *slot = &channel->slots[position % channel->capacity];
+                slot->value = *value;
+                __atomic_store_n(&slot->turn, position / channel->capacity * 2 + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (difference < 0) {
+            return 0;
+        } else {
+            position = __atomic_load_n(&channel->sendPosition, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static int tryPop(Channel *channel, Variable *out) {
+    size_t position = __atomic_load_n(&channel->receivePosition, __ATOMIC_RELAXED);
+    for (;;) {
+        intptr_t difference = turnDistance(channel, position, 1, __ATOMIC_ACQUIRE);
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&channel->receivePosition, &position, position + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                ChannelSlot *slot = &channel->slots[position % channel->capacity];
+                *out = slot->value;
+                __atomic_store_n(&slot->turn, position / channel->capacity * 2 + 2, __ATOMIC_RELEASE);
+                return 1;
+            }
+        } else if (difference < 0) {
+            return 0;
+        } else {
+            position = __atomic_load_n(&channel->receivePosition, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static int isClosed(Channel *channel) {
+    return __atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE);
+}
+
+static int canSend(Channel *channel) {
+    size_t position = __atomic_load_n(&channel->sendPosition, __ATOMIC_SEQ_CST);
+    return turnDistance(channel, position, 0, __ATOMIC_SEQ_CST) >= 0 || isClosed(channel);
+}
+
+static int canReceive(Channel *channel) {
+    size_t position = __atomic_load_n(&channel->receivePosition, __ATOMIC_SEQ_CST);
+    return turnDistance(channel, position, 1, __ATOMIC_SEQ_CST) >= 0 || isClosed(channel);
+}
+
+// Wake the threads sleeping on the channel. Waiters count themselves
+// before they look at the channel a last time, so either a waiter sees
+// the change or this sees the waiter.
+static void wake(Channel *channel) {
+#ifndef _WIN32
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&channel->sleepers, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&channel->lock);
+        pthread_cond_broadcast(&channel->changed);
+        pthread_mutex_unlock(&channel->lock);
+    }
+#else
+    (void)channel;
+#endif
+}
+
+#ifndef _WIN32
+
+// The threads sleeping in waitFor. Only a thread that is not waiting can
+// change a channel, so once every live thread waits for a channel that is
+// not ready, none of them can ever be woken.
+typedef struct Waiter {
+    Channel *channel;
+    int (*ready)(Channel *);
+    struct Waiter *next;
+} Waiter;
+
+static pthread_mutex_t waitersLock = PTHREAD_MUTEX_INITIALIZER;
+static Waiter *waiters = NULL;
+static int waiterCount = 0;
+
+// Count waiter among the sleeping threads; 0, leaving it out, if that
+// would leave every live thread waiting forever
+static int startWaiting(Waiter *waiter) {
+    pthread_mutex_lock(&waitersLock);
+    int stuck = waiterCount + 1 >= __atomic_load_n(&liveThreads, __ATOMIC_SEQ_CST) &&
+                !waiter->ready(waiter->channel);
+    for (Waiter *other = waiters; stuck && other; other = other->next) {
+        stuck = !other->ready(other->channel);
+    }
+    if (!stuck) {
+        waiter->next = waiters;
+        waiters = waiter;
+        waiterCount++;
+    }
+    pthread_mutex_unlock(&waitersLock);
+    return !stuck;
+}
+
+static void stopWaiting(Waiter *waiter) {
+    pthread_mutex_lock(&waitersLock);
+    Waiter **link = &waiters;
+    while (*link != waiter) {
+        link = &(*link)->next;
+    }
+    *link = waiter->next;
+    waiterCount--;
+    pthread_mutex_unlock(&waitersLock);
+}
+
+#endif
+
+// Sleep until ready(channel) may have become true
+static void waitFor(Channel *channel, int (*ready)(Channel *), const char *what) {
+#ifndef _WIN32
+    Waiter waiter = { channel, ready, NULL };
+    if (!startWaiting(&waiter)) {
+        raiseError(ERROR_RUNTIME, currentLineNumber,
+                   __atomic_load_n(&liveThreads, __ATOMIC_SEQ_CST) <= 1 ?
+                   "Deadlock, %s would wait forever with no other thread running" :
+                   "Deadlock, %s would wait forever with every other thread waiting too", what);
+    }
+    pthread_mutex_lock(&channel->lock);
+    __atomic_add_fetch(&channel->sleepers, 1, __ATOMIC_SEQ_CST);
+    if (!ready(channel)) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += CHANNEL_WAIT_NS;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&channel->changed, &channel->lock, &until);
+    }
+    __atomic_sub_fetch(&channel->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&channel->lock);
+    stopWaiting(&waiter);
+    checkDeadline();
+#else
+    (void)channel;
+    (void)ready;
+    raiseError(ERROR_RUNTIME, currentLineNumber,
+               "Deadlock, %s would wait forever with no other thread running", what);
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Sending and receiving
+
+// The copy of value to queue
+static Variable prepareSend(Channel *channel, const Variable *value, const char *what) {
+    if (isClosed(channel)) {
+        raiseError(ERROR_RUNTIME, currentLineNumber, "%s on a closed channel", what);
+    }
+    if (channel->type >= 0 && (int)value->type != channel->type) {
+        raiseError(ERROR_TYPE, currentLineNumber, "A channel of %s values cannot take %s",
+                   typeNames[channel->type], typeArticles[value->type]);
+    }
+    Variable copy;
+    if (!isolateValue(&copy, value)) {
+        raiseError(ERROR_TYPE, currentLineNumber, "Generators and tasks cannot be sent on a channel");
+    }
+    return copy;
+}
+
+void channelSend(Channel *channel, const Variable *value) {
+    Variable copy = prepareSend(channel, value, "send()");
+    for (int tries = 0; !tryPush(channel, &copy); tries++) {
+        if (isClosed(channel)) {
+            raiseError(ERROR_RUNTIME, currentLineNumber, "send() on a closed channel");
+        }
+        if (tries >= CHANNEL_SPINS) {
+            waitFor(channel, canSend, "send()");
+        }
+    }
+    wake(channel);
+}
+
+int channelTrySend(Channel *channel, const Variable *value) {
+    Variable copy = prepareSend(channel, value, "try_send()");
+    if (!tryPush(channel, &copy)) {
+        releaseValue(&copy);
+        return 0;
+    }
+    wake(channel);
+    return 1;
+}
+
+int channelRecv(Channel *channel, Variable *out) {
+    for (int tries = 0; !tryPop(channel, out); tries++) {
+        if (isClosed(channel)) {
+            // A value sent just before the channel was closed may have
+            // arrived since
+            return tryPop(channel, out);
+        }
+        if (tries >= CHANNEL_SPINS) {
+            waitFor(channel, canReceive, "recv()");
+        }
+    }
+    wake(channel);
+    return 1;
+}
+
+int channelTryRecv(Channel *channel, Variable *out) {
+    if (!tryPop(channel, out)) {
+        return 0;
+    }
+    wake(channel);
+    return 1;
+}
+
+void channelClose(Channel *channel) {
+    if (__atomic_exchange_n(&channel->closed, 1, __ATOMIC_SEQ_CST)) {
+        raiseError(ERROR_RUNTIME, currentLineNumber, "close() on a closed channel");
+    }
+    wake(channel);
+}
@@ -0,0 +1,33 @@
+#ifndef LEXER_CHANNEL_H
+#define LEXER_CHANNEL_H
+
+#include "lexer_interpret.h"
+
+// A bounded queue of values between threads. Values are copied in as
+// isolateValue copies them, so the sender keeps nothing the receiver gets.
+// The queue itself takes no lock: each slot carries a sequence number that
+// tells senders and receivers whose turn it is, so any number of threads
+// may send and receive at once. Only a thread that has to wait sleeps on
+// the channel's lock.
+typedef struct Channel Channel;
+
+// type is the type every value must have, or -1 for any
+Channel *createChannel(long capacity, int type);
+void retainChannel(Channel *channel);
+void releaseChannel(Channel *channel);
+
+// The type named "int", "float", "string", "boolean", "array", "map" or
+// "channel", or -1
+int channelTypeFromName(const char *name);
+
+// send waits while the channel is full; try_send returns 0 instead
+void channelSend(Channel *channel, const Variable *value);
+int channelTrySend(Channel *channel, const Variable *value);
+// recv waits while the channel is empty and returns 0 once it is closed
+// and empty; try_recv returns 0 without waiting
+int channelRecv(Channel *channel, Variable *out);
+int channelTryRecv(Channel *channel, Variable *out);
+// Values sent before close can still be received
+void channelClose(Channel *channel);
+
+#endif // LEXER_CHANNEL_H
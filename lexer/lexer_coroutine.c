@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_coroutine.h"
+#include "lexer_parallel.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+_Thread_local int yieldPending = 0;
+
+// The coroutine whose body is running on this thread, or NULL
+static _Thread_local Coroutine *current = NULL;
+
+// Spawned tasks that have not finished, each holding a reference
+static _Thread_local Coroutine **tasks = NULL;
+static _Thread_local int taskCount = 0;
+
+Coroutine *createCoroutine(Function *function, Expr **args, int argCount) {
+    checkArgumentCount(function, argCount);
+
+    Coroutine *coroutine = memCalloc(1, sizeof(Coroutine));
+    int slotCount = function->localCount + 1;
+    coroutine->function = function;
+    coroutine->slots = memAlloc(slotCount * sizeof(Variable));
+    for (int i = 0; i < slotCount; i++) {
+        coroutine->slots[i].name = NULL;
+        coroutine->slots[i].type = INT;
+    }
+    coroutine->refCount = 1;
+    coroutine->epoch = parallelEpoch;
+
+    // An argument that fails drops the coroutine with those before it
+    Variable partial;
+    Held held;
+    partial.name = NULL;
+    partial.type = COROUTINE;
+    partial.value.coroutineValue = coroutine;
+    holdValue(&held, &partial);
+    for (int i = 0; i < argCount; i++) {
+        Variable value;
+        evaluateNodeValue(args[i], &value);
+        coroutine->slots[i + 1] = value;
+        coroutine->slots[i + 1].name = function->localNames[i];
+    }
+    letGo(held.next);
+    runnerPushBlock(&coroutine->runner, function->script, function->bodyStart, function->bodyEnd);
+    return coroutine;
+}
+
+void retainCoroutine(Coroutine *coroutine) {
+    refRetain(&coroutine->refCount);
+}
+
+// Drop the locals, keeping the return value in slot 0
+static void releaseLocals(Coroutine *coroutine) {
+    for (int i = 1; i <= coroutine->function->localCount; i++) {
+        releaseValue(&coroutine->slots[i]);
+        coroutine->slots[i].name = NULL;
+        coroutine->slots[i].type = INT;
+    }
+}
+
+void releaseCoroutine(Coroutine *coroutine) {
+    if (refRelease(&coroutine->refCount) > 0) {
+        return;
+    }
+    runnerClear(&coroutine->runner);
+    releaseLocals(coroutine);
+    releaseValue(&coroutine->slots[0]);
+    if (coroutine->hasYielded) {
+        releaseValue(&coroutine->yielded);
+    }
+    memFree(coroutine->slots);
+    memFree(coroutine);
+}
+
+// Run the body up to its next yield. Returns 0 once it has finished.
+static int resume(Coroutine *coroutine) {
+    if (coroutine->finished) {
+        return 0;
+    }
+    checkWritable(coroutine->epoch, "a generator or task");
+    if (coroutine->running) {
+        raiseError(ERROR_RUNTIME, currentLineNumber, "%s() is already running", coroutine->function->name);
+    }
+
+    retainCoroutine(coroutine);
+    coroutine->running = 1;
+    int callerLine = currentLineNumber;
+    int callerColumn = currentColumn;
+    coroutine->caller = current;
+    current = coroutine;
+    enterFrame(coroutine->function, coroutine->slots);
+    coroutine->depth = frameDepth();
+    Runner *caller = runnerSwitch(&coroutine->runner);
+
+    int suspended = runnerRun(&coroutine->runner, 0);
+
+    runnerSwitch(caller);
+    leaveFrame();
+    current = coroutine->caller;
+    yieldPending = 0;
+    returnPending = 0;
+    currentLineNumber = callerLine;
+    currentColumn = callerColumn;
+    coroutine->running = 0;
+    if (!suspended) {
+        coroutine->finished = 1;
+        releaseLocals(coroutine);
+    }
+    releaseCoroutine(coroutine);
+    return suspended;
+}
+
+int coroutineNext(Coroutine *coroutine, Variable *out) {
+    while (!coroutine->hasYielded) {
+        if (!resume(coroutine)) {
+            return 0;
+        }
+    }
+    *out = coroutine->yielded;
+    coroutine->hasYielded = 0;
+    return 1;
+}
+
+int coroutineDone(Coroutine *coroutine) {
+    while (!coroutine->hasYielded && resume(coroutine)) {
+    }
+    return !coroutine->hasYielded;
+}
+
+void yieldStatement(const char *expr) {
+    // Calls a coroutine makes run on its runner too, but only its own body
+    // can stop it
+    if (!current || frameDepth() != current->depth) {
+        raiseError(ERROR_RUNTIME, currentLineNumber, "yield outside of a generator");
+    }
+
+    while (*expr == ' ' || *expr == '\t') expr++;
+    if (*expr) {
+        Variable value;
+        evaluateValue(expr, &value);
+        if (current->hasYielded) {
+            releaseValue(&current->yielded);
+        }
+        current->yielded = value;
+        current->hasYielded = 1;
+    }
+    yieldPending = 1;
+}
+
+Coroutine *runningCoroutine(void) {
+    return current;
+}
+
+void abandonCoroutines(Coroutine *outer) {
+    while (current && current != outer) {
+        Coroutine *coroutine = current;
+        current = coroutine->caller;
+        coroutine->running = 0;
+        coroutine->finished = 1;
+        releaseLocals(coroutine);
+        // The reference resume took
+        releaseCoroutine(coroutine);
+    }
+}
+
+Coroutine *spawnTask(Function *function, Expr **args, int argCount) {
+    Coroutine *task = createCoroutine(function, args, argCount);
+    task->isTask = 1;
+    retainCoroutine(task);
+    tasks = memRealloc(tasks, (taskCount + 1) * sizeof(Coroutine *));
+    tasks[taskCount++] = task;
+    return task;
+}
+
+// Give every task that is not running already one turn. Values a task
+// yields are dropped. Returns 0 if no task could run.
+static int runTasks(void) {
+    int ran = 0;
+    for (int i = 0; i < taskCount; i++) {
+        Coroutine *task = tasks[i];
+        if (task->running || task->finished) {
+            continue;
+        }
+        resume(task);
+        if (task->hasYielded) {
+            releaseValue(&task->yielded);
+            task->hasYielded = 0;
+        }
+        ran = 1;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < taskCount; i++) {
+        if (tasks[i]->finished) {
+            releaseCoroutine(tasks[i]);
+        } else {
+            tasks[kept++] = tasks[i];
+        }
+    }
+    taskCount = kept;
+    return ran;
+}
+
+int awaitTask(Coroutine *task, Variable *result) {
+    retainCoroutine(task);
+    while (!task->finished) {
+        // A task awaiting something stays on the C stack under whatever
+        // runs meanwhile, so nothing run from there can wait for it
+        if (task->running) {
+            raiseError(ERROR_RUNTIME, currentLineNumber, "Deadlock awaiting %s()", task->function->name);
+        }
+        if (task->isTask) {
+            runTasks();
+        } else {
+            // A generator that was never spawned runs on its own, its
+            // values dropped
+            Variable item;
+            if (coroutineNext(task, &item)) {
+                releaseValue(&item);
+            }
+        }
+    }
+
+    int returned = task->slots[0].name != NULL;
+    if (returned) {
+        copyValue(result, &task->slots[0]);
+    }
+    releaseCoroutine(task);
+    return returned;
+}
+
+void finishTasks(void) {
+    while (taskCount > 0 && runTasks()) {
+    }
+}
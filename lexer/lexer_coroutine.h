@@ -0,0 +1,58 @@
+#ifndef LEXER_COROUTINE_H
+#define LEXER_COROUTINE_H
+
+#include "lexer_function.h"
+#include "lexer_script.h"
+
+// A function call that runs a piece at a time. Calling a function whose
+// body yields makes a generator; spawn() makes a task of any call. The
+// locals and the frames of the statements in progress live on the heap,
+// so the body can stop at a yield and later carry on where it stopped.
+typedef struct Coroutine {
+    Function *function;
+    Variable *slots;     // Locals, slot 0 holds the return value
+    Runner runner;
+    int refCount;
+    unsigned epoch;      // parallelEpoch when it was made, see lexer_parallel.h
+    int depth;           // frameDepth() while its body runs
+    struct Coroutine *caller;  // The one running when it was resumed
+    int running;
+    int finished;
+    int isTask;
+    Variable yielded;    // Value of the last yield until it is taken
+    int hasYielded;
+} Coroutine;
+
+// Set by yield until the running coroutine has stopped
+extern _Thread_local int yieldPending;
+
+// Evaluate the arguments and set up the call, without running any of it
+Coroutine *createCoroutine(Function *function, Expr **args, int argCount);
+void retainCoroutine(Coroutine *coroutine);
+void releaseCoroutine(Coroutine *coroutine);
+
+// Run coroutine until it yields a value and store the value in out.
+// Returns 0 once the body has finished instead.
+int coroutineNext(Coroutine *coroutine, Variable *out);
+// Whether coroutine will yield no more values. Runs it up to its next
+// value to find out, which the next coroutineNext then hands out.
+int coroutineDone(Coroutine *coroutine);
+
+// Handle "yield" and "yield value"
+void yieldStatement(const char *expr);
+
+// The coroutine whose body is running on this thread, or NULL
+Coroutine *runningCoroutine(void);
+// Stop the coroutines an error has left running inside outer. They count
+// as finished, so they yield nothing more.
+void abandonCoroutines(Coroutine *outer);
+
+// Tasks are run in turn by a single scheduler, each up to its next yield.
+// awaitTask runs them until task has finished and stores the value it
+// returned in result, or returns 0 if it returned none.
+Coroutine *spawnTask(Function *function, Expr **args, int argCount);
+int awaitTask(Coroutine *task, Variable *result);
+// Run the tasks nothing awaited, once the script has ended
+void finishTasks(void);
+
+#endif // LEXER_COROUTINE_H
@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_csv.h"
+#include "lexer_simd.h"
+#include "lexer_stream.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define CSV_BLOCK_SIZE (1 << 16)
+#define CSV_MAX_THREADS 8
+#define CSV_THREAD_MIN_CELLS (1 << 16)
+
+typedef struct {
+    size_t start;
+    size_t length;
+    int escaped;    // Quoted and containing doubled quotes
+} CsvCell;
+
+// Every field of the file in row order, header row first
+typedef struct {
+    const char *fileName;
+    StringBuffer *source;
+    CsvCell *cells;
+    size_t count;
+    size_t capacity;
+    size_t columns;
+    size_t rows;        // Not counting the header
+} CsvTable;
+
+// Where the parser is inside the current field
+typedef struct {
+    size_t fieldStart;
+    size_t fieldEnd;    // Closing quote of a quoted field
+    int inQuotes;
+    int quoted;
+    int escaped;
+    size_t rowFields;
+} CsvState;
+
+// The cells are held while the text is scanned, so only the text itself
+// is released here
+static void csvError(const CsvTable *table, const char *message) {
+    stringBufferRelease(table->source);
+    raiseError(ERROR_VALUE, currentLineNumber, "%s in %s (row %zu)",
+               message, table->fileName, table->rows + 1);
+}
+
+static void endField(CsvTable *table, CsvState *state, const char *text, size_t end) {
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 1024;
+        table->cells = memRealloc(table->cells, table->capacity * sizeof(CsvCell));
+    }
+    CsvCell *cell = &table->cells[table->count++];
+    if (state->quoted) {
+        cell->start = state->fieldStart + 1;
+        cell->length = state->fieldEnd - cell->start;
+    } else {
+        if (end > state->fieldStart && text[end - 1] == '\r') {
+            end--;
+        }
+        cell->start = state->fieldStart;
+        cell->length = end - state->fieldStart;
+    }
+    cell->escaped = state->escaped;
+
+    state->quoted = 0;
+    state->escaped = 0;
+    state->rowFields++;
+}
+
+static void endRow(CsvTable *table, CsvState *state) {
+    CsvCell *last = &table->cells[table->count - 1];
+    if (state->rowFields == 1 && last->length == 0 && table->columns != 1) {
+        // Blank line
+        table->count--;
+    } else if (table->columns == 0) {
+        table->columns = state->rowFields;
+    } else if (state->rowFields != table->columns) {
+        csvError(table, "Wrong number of fields");
+    } else {
+        table->rows++;
+    }
+    state->rowFields = 0;
+}
+
+// Split text into cells. The vector kernel finds every delimiter, quote and
+// newline in a block; only those positions are looked at one by one.
+static void scanCells(CsvTable *table, const char *text, size_t length, char delimiter) {
+    const SimdKernels *kernels = simdKernels();
+    const char special[3] = { delimiter, '"', '\n' };
+    uint32_t *positions = memAlloc(CSV_BLOCK_SIZE * sizeof(uint32_t));
+    Held held;
+    holdBuffer(&held, &positions);
+    CsvState state = { 0, 0, 0, 0, 0, 0 };
+    size_t skipUntil = 0;
+
+    for (size_t blockStart = 0; blockStart < length; blockStart += CSV_BLOCK_SIZE) {
+        size_t blockLength = length - blockStart < CSV_BLOCK_SIZE ? length - blockStart : CSV_BLOCK_SIZE;
+        size_t found = kernels->findChars(text + blockStart, blockLength, special, positions);
+
+        for (size_t i = 0; i < found; i++) {
+            size_t position = blockStart + positions[i];
+            if (position < skipUntil) {
+                continue;
+            }
+            char c = text[position];
+
+            if (state.inQuotes) {
+                if (c == '"') {
+                    if (position + 1 < length && text[position + 1] == '"') {
+                        state.escaped = 1;
+                        skipUntil = position + 2;
+                    } else {
+                        state.inQuotes = 0;
+                        state.fieldEnd = position;
+                    }
+                }
+            } else if (c == '"') {
+                // Quotes only start a quoted field at its beginning
+                if (position == state.fieldStart) {
+                    state.inQuotes = 1;
+                    state.quoted = 1;
+                }
+            } else {
+                endField(table, &state, text, position);
+                if (c == '\n') {
+                    endRow(table, &state);
+                }
+                state.fieldStart = position + 1;
+            }
+        }
+    }
+
+    if (state.inQuotes) {
+        csvError(table, "Unterminated quoted field");
+    }
+    if (state.fieldStart < length || state.rowFields > 0) {
+        endField(table, &state, text, length);
+        endRow(table, &state);
+    }
+    letGo(held.next);
+    memFree(positions);
+}
+
+static int parseInt64(const char *text, size_t length, int64_t *out) {
+    size_t i = 0;
+    int negative = 0;
+    if (length > 0 && (text[0] == '-' || text[0] == '+')) {
+        negative = text[0] == '-';
+        i = 1;
+    }
+    if (i == length || length - i > 18) {
+        return 0;  // Empty, or too long to be sure it fits
+    }
+    int64_t value = 0;
+    for (; i < length; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return 0;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    *out = negative ? -value : value;
+    return 1;
+}
+
+static int parseDouble(const char *text, size_t length, double *out) {
+    char number[64];
+    if (length == 0 || length >= sizeof(number) ||
+        !((text[0] >= '0' && text[0] <= '9') || text[0] == '-' || text[0] == '+' || text[0] == '.')) {
+        return 0;
+    }
+    memcpy(number, text, length);
+    number[length] = '\0';
+    char *end;
+    *out = strtod(number, &end);
+    return end == number + length;
+}
+
+// Convert a column into an int or float array, or return NULL if one of
+// its fields is not a number
+static Array *convertNumeric(const CsvTable *table, const char *text, size_t column) {
+    const CsvCell *cells = table->cells + table->columns + column;
+    size_t rows = table->rows;
+    Array *array = createArray(ARRAY_INT, rows);
+
+    size_t row = 0;
+    for (; row < rows; row++) {
+        const CsvCell *cell = &cells[row * table->columns];
+        if (cell->escaped || !parseInt64(text + cell->start, cell->length, &array->data.ints[row])) {
+            break;
+        }
+    }
+
+    if (row < rows) {
+        Array *floats = createArray(ARRAY_FLOAT, rows);
+        for (size_t i = 0; i < row; i++) {
+            floats->data.floats[i] = (double)array->data.ints[i];
+        }
+        releaseArray(array);
+        array = floats;
+
+        for (; row < rows; row++) {
+            const CsvCell *cell = &cells[row * table->columns];
+            if (cell->escaped || !parseDouble(text + cell->start, cell->length, &array->data.floats[row])) {
+                releaseArray(array);
+                return NULL;
+            }
+        }
+    }
+
+    array->length = rows;
+    return array;
+}
+
+static void makeString(const CsvCell *cell, StringBuffer *source, String *string) {
+    const char *text = source->text + cell->start;
+    if (!cell->escaped) {
+        stringView(string, source, text, cell->length);
+        return;
+    }
+
+    // Collapse doubled quotes
+    char *unescaped = memAlloc(cell->length);
+    size_t length = 0;
+    for (size_t i = 0; i < cell->length; i++) {
+        unescaped[length++] = text[i];
+        if (text[i] == '"') {
+            i++;
+        }
+    }
+    stringInit(string, unescaped, length);
+    memFree(unescaped);
+}
+
+static Array *convertStrings(const CsvTable *table, StringBuffer *source, size_t column) {
+    Array *array = createArray(ARRAY_BOXED, table->rows);
+    Variable value;
+    value.name = NULL;
+    value.type = STRING;
+    for (size_t row = 0; row < table->rows; row++) {
+        makeString(&table->cells[(row + 1) * table->columns + column], source, &value.value.stringValue);
+        arrayAppend(array, &value);
+        releaseValue(&value);
+    }
+    return array;
+}
+
+// Numeric conversion of the columns congruent to first modulo stride.
+// Workers only allocate and fill their own arrays, so they share nothing.
+typedef struct {
+    const CsvTable *table;
+    const char *text;
+    size_t first;
+    size_t stride;
+    Array **columns;
+} ConvertJob;
+
+static void *convertColumns(void *argument) {
+    ConvertJob *job = argument;
+    for (size_t column = job->first; column < job->table->columns; column += job->stride) {
+        job->columns[column] = convertNumeric(job->table, job->text, column);
+    }
+    return NULL;
+}
+
+static size_t threadCount(const CsvTable *table) {
+    size_t threads = 1;
+#ifndef _WIN32
+    if (table->rows * table->columns >= CSV_THREAD_MIN_CELLS) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = processors > 1 ? (size_t)processors : 1;
+    }
+#endif
+    if (threads > CSV_MAX_THREADS) threads = CSV_MAX_THREADS;
+    if (threads > table->columns) threads = table->columns;
+    return threads ? threads : 1;
+}
+
+static void convertAllNumeric(const CsvTable *table, const char *text, Array **columns) {
+    size_t threads = threadCount(table);
+    ConvertJob jobs[CSV_MAX_THREADS];
+    for (size_t i = 0; i < threads; i++) {
+        jobs[i].table = table;
+        jobs[i].text = text;
+        jobs[i].first = i;
+        jobs[i].stride = threads;
+        jobs[i].columns = columns;
+    }
+
+#ifndef _WIN32
+    pthread_t workers[CSV_MAX_THREADS];
+    size_t started = 0;
+    for (size_t i = 1; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, convertColumns, &jobs[i]) != 0) {
+            break;
+        }
+        started = i;
+    }
+    convertColumns(&jobs[0]);
+    for (size_t i = 1; i <= started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    // Jobs whose thread could not be started run here
+    for (size_t i = started + 1; i < threads; i++) {
+        convertColumns(&jobs[i]);
+    }
+#else
+    for (size_t i = 0; i < threads; i++) {
+        convertColumns(&jobs[i]);
+    }
+#endif
+}
+
+// The header names become the keys of the result, so each may appear
+// only once. The cells are still held, as while scanning.
+static void checkHeaders(const CsvTable *table) {
+    Variable seen;
+    seen.name = NULL;
+    seen.type = MAP;
+    seen.value.mapValue = createMap();
+    Held *mark = heldMark();
+    Held held;
+    holdValue(&held, &seen);
+
+    Variable present;
+    present.name = NULL;
+    present.type = BOOLEAN;
+    present.value.boolValue = 1;
+    for (size_t column = 0; column < table->columns; column++) {
+        Variable name;
+        name.name = NULL;
+        name.type = STRING;
+        makeString(&table->cells[column], table->source, &name.value.stringValue);
+        if (mapGet(seen.value.mapValue, &name)) {
+            char header[64];
+            size_t length = stringLength(&name.value.stringValue);
+            length = length < sizeof(header) ? length : sizeof(header) - 1;
+            memcpy(header, stringData(&name.value.stringValue), length);
+            header[length] = '\0';
+            releaseValue(&name);
+            letGo(mark);
+            releaseValue(&seen);
+            stringBufferRelease(table->source);
+            raiseError(ERROR_VALUE, currentLineNumber, "Duplicate header \"%s\" in %s", header, table->fileName);
+        }
+        mapSet(seen.value.mapValue, &name, &present);
+        releaseValue(&name);
+    }
+    letGo(mark);
+    releaseValue(&seen);
+}
+
+Map *readCsv(const char *fileName, char delimiter) {
+    if (delimiter == '"' || delimiter == '\n' || delimiter == '\r') {
+        raiseError(ERROR_SYNTAX, currentLineNumber, "Invalid CSV delimiter");
+    }
+    StringBuffer *source = loadFile(fileName);
+    if (!source) {
+        raiseError(ERROR_IO, currentLineNumber, "Could not open file %s", fileName);
+    }
+
+    CsvTable table = { fileName, source, NULL, 0, 0, 0, 0 };
+    Held held;
+    holdBuffer(&held, &table.cells);
+    scanCells(&table, source->text, source->length, delimiter);
+    checkHeaders(&table);
+    letGo(held.next);
+
+    Array **columns = memCalloc(table.columns ? table.columns : 1, sizeof(Array *));
+    convertAllNumeric(&table, source->text, columns);
+
+    Map *map = createMap();
+    for (size_t column = 0; column < table.columns; column++) {
+        if (!columns[column]) {
+            columns[column] = convertStrings(&table, source, column);
+        }
+        Variable name;
+        name.name = NULL;
+        name.type = STRING;
+        makeString(&table.cells[column], source, &name.value.stringValue);
+        Variable value;
+        value.name = NULL;
+        value.type = ARRAY;
+        value.value.arrayValue = columns[column];
+        mapSet(map, &name, &value);
+        releaseValue(&name);
+        releaseValue(&value);
+    }
+
+    memFree(columns);
+    memFree(table.cells);
+    stringBufferRelease(source);
+    return map;
+}
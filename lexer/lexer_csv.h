@@ -0,0 +1,11 @@
+#ifndef LEXER_CSV_H
+#define LEXER_CSV_H
+
+#include "lexer_map.h"
+
+// Read a delimited file into a map from each header name to its column.
+// Columns where every field is an integer or a number become compact int
+// or float arrays; any other column is an array of strings.
+Map *readCsv(const char *fileName, char delimiter);
+
+#endif // LEXER_CSV_H
@@ -1,22 +1,36 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include "lexer_display.h"
 #include "lexer_interpret.h"
+#include "lexer_array.h"
+#include "lexer_map.h"
+#include "lexer_coroutine.h"
+#include "lexer_limit.h"
+#include "lexer_trace.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
 
 // Function to display text
 void display(const char *text) {
+    countOutput(strlen(text) + 1);
+    traceEvent(TRACE_DISPLAY, NULL);
     printf("%s\n", text);
 }
 
 // Function to display integer
 void displayInt(int value) {
-    printf("%d\n", value);
+    char text[16];
+    sprintf(text, "%d", value);
+    display(text);
 }
 
 // Add this function
 void displayFloat(float value) {
-    printf("%f\n", value);
+    char text[64];
+    snprintf(text, sizeof(text), "%f", value);
+    display(text);
 }
 
 // Add this helper function before displayFormatted
@@ -31,8 +45,152 @@ int isExpression(const char* str) {
     return 0;
 }
 
+// Growable buffer used while building formatted output
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} FormatBuffer;
+
+static void bufferInit(FormatBuffer *buffer) {
+    buffer->capacity = 256;
+    buffer->length = 0;
+    buffer->data = memAlloc(buffer->capacity);
+    buffer->data[0] = '\0';
+}
+
+static void bufferAppend(FormatBuffer *buffer, const char *text, size_t length) {
+    if (buffer->length + length + 1 > buffer->capacity) {
+        while (buffer->length + length + 1 > buffer->capacity) {
+            buffer->capacity *= 2;
+        }
+        buffer->data = memRealloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->length, text, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+}
+
+static void bufferAppendString(FormatBuffer *buffer, const char *text) {
+    bufferAppend(buffer, text, strlen(text));
+}
+
+// The arrays and maps being shown, innermost first. One that holds itself
+// is shown as [...] or {...} where it repeats.
+typedef struct Showing {
+    const void *container;
+    const struct Showing *outer;
+} Showing;
+
+static int isShowing(const Showing *showing, const void *container) {
+    for (; showing; showing = showing->outer) {
+        if (showing->container == container) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void appendValue(FormatBuffer *buffer, const Variable *var, const Showing *showing);
+
+// Inside arrays and maps strings are quoted
+static void appendElement(FormatBuffer *buffer, const Variable *var, const Showing *showing) {
+    if (var->type == STRING) {
+        bufferAppend(buffer, "\"", 1);
+        bufferAppend(buffer, stringData(&var->value.stringValue), stringLength(&var->value.stringValue));
+        bufferAppend(buffer, "\"", 1);
+    } else {
+        appendValue(buffer, var, showing);
+    }
+}
+
+// Arrays are shown as [a, b, c]
+static void appendArray(FormatBuffer *buffer, Array *array, const Showing *outer) {
+    char numStr[64];
+    if (isShowing(outer, array)) {
+        bufferAppend(buffer, "[...]", 5);
+        return;
+    }
+    Showing showing = { array, outer };
+    bufferAppend(buffer, "[", 1);
+    for (size_t i = 0; i < array->length; i++) {
+        if (i > 0) {
+            bufferAppend(buffer, ", ", 2);
+        }
+        if (array->kind == ARRAY_INT) {
+            bufferAppend(buffer, numStr, sprintf(numStr, "%" PRId64, array->data.ints[i]));
+        } else if (array->kind == ARRAY_FLOAT) {
+            bufferAppend(buffer, numStr, sprintf(numStr, "%.6f", array->data.floats[i]));
+        } else {
+            appendElement(buffer, &array->data.boxed[i], &showing);
+        }
+    }
+    bufferAppend(buffer, "]", 1);
+}
+
+// Maps are shown as {key: value, ...} in insertion order
+static void appendMap(FormatBuffer *buffer, Map *map, const Showing *outer) {
+    int first = 1;
+    if (isShowing(outer, map)) {
+        bufferAppend(buffer, "{...}", 5);
+        return;
+    }
+    Showing showing = { map, outer };
+    bufferAppend(buffer, "{", 1);
+    for (size_t i = 0; i < map->entryCount; i++) {
+        if (map->entries[i].deleted) {
+            continue;
+        }
+        if (!first) {
+            bufferAppend(buffer, ", ", 2);
+        }
+        first = 0;
+        appendElement(buffer, &map->entries[i].key, &showing);
+        bufferAppend(buffer, ": ", 2);
+        appendElement(buffer, &map->entries[i].value, &showing);
+    }
+    bufferAppend(buffer, "}", 1);
+}
+
+static void appendValue(FormatBuffer *buffer, const Variable *var, const Showing *showing) {
+    char numStr[32];
+    switch (var->type) {
+        case INT:
+            bufferAppend(buffer, numStr, sprintf(numStr, "%d", var->value.intValue));
+            break;
+        case FLOAT:
+            bufferAppend(buffer, numStr, sprintf(numStr, "%.6f", var->value.floatValue));
+            break;
+        case BOOLEAN:
+            bufferAppendString(buffer, var->value.boolValue ? "true" : "false");
+            break;
+        case STRING:
+            bufferAppend(buffer, stringData(&var->value.stringValue), stringLength(&var->value.stringValue));
+            break;
+        case ARRAY:
+            appendArray(buffer, var->value.arrayValue, showing);
+            break;
+        case MAP:
+            appendMap(buffer, var->value.mapValue, showing);
+            break;
+        case COROUTINE: {
+            Coroutine *coroutine = var->value.coroutineValue;
+            bufferAppendString(buffer, coroutine->isTask ? "<task " : "<generator ");
+            bufferAppendString(buffer, coroutine->function->name);
+            bufferAppend(buffer, ">", 1);
+            break;
+        }
+        case CHANNEL:
+            bufferAppendString(buffer, "<channel>");
+            break;
+    }
+}
+
 void displayFormatted(const char *format, char **vars, int varCount) {
-    char output[1024] = "";
+    FormatBuffer output;
+    Held held[2];
+    bufferInit(&output);
+    holdBuffer(&held[0], &output.data);
     
     while (*format) {
         if (*format == '%' && strncmp(format, "%var", 4) == 0) {
@@ -44,72 +202,40 @@ void displayFormatted(const char *format, char **vars, int varCount) {
             }
             
             if (varNum < 1 || varNum > varCount) {
-                fprintf(stderr, "Error on line %d: Invalid variable number %d\n", currentLineNumber, varNum);
-                exit(EXIT_FAILURE);
+                raiseError(ERROR_SYNTAX, currentLineNumber, "Invalid variable number %d", varNum);
             }
 
             // Get the variable or expression
             char *expr = vars[varNum - 1];
             while (*expr == ' ') expr++; // Skip leading spaces
 
-            // Use isExpression to check for all operator types
-            if (isExpression(expr)) {
-                // Handle expression
-                Variable *result = evaluateExpression(expr);
-                if (result) {
-                    char numStr[32];
-                    if (result->type == INT) {
-                        sprintf(numStr, "%d", result->value.intValue);
-                    } else {
-                        sprintf(numStr, "%.6f", result->value.floatValue);
-                    }
-                    strcat(output, numStr);
-                    free(result);
-                } else {
-                    fprintf(stderr, "Error on line %d: Invalid expression '%s'\n", currentLineNumber, expr);
-                    exit(EXIT_FAILURE);
-                }
-            } else {
-                // Handle simple variable
-                Variable *var = findVariable(expr);
-                if (!var) {
-                    fprintf(stderr, "Error on line %d: Variable '%s' not found\n", currentLineNumber, expr);
-                    exit(EXIT_FAILURE);
-                }
-
-                char numStr[32];
-                switch (var->type) {
-                    case INT:
-                        sprintf(numStr, "%d", var->value.intValue);
-                        strcat(output, numStr);
-                        break;
-                    case FLOAT:
-                        sprintf(numStr, "%.6f", var->value.floatValue);
-                        strcat(output, numStr);
-                        break;
-                    case BOOLEAN:
-                        strcat(output, var->value.boolValue ? "true" : "false");
-                        break;
-                    case STRING:
-                        strcat(output, var->value.stringValue);
-                        break;
+            // Variables, expressions, indexes and calls all evaluate to a value
+            Variable result;
+            if (!evaluateExpression(expr, &result)) {
+                if (isExpression(expr)) {
+                    raiseError(ERROR_SYNTAX, currentLineNumber, "Invalid expression '%s'", expr);
                 }
+                raiseError(ERROR_NAME, currentLineNumber, "Variable '%s' not found", expr);
             }
+            holdValue(&held[1], &result);
+            appendValue(&output, &result, NULL);
+            letGo(&held[0]);
+            releaseValue(&result);
             continue;
         }
         
-        int len = strlen(output);
-        output[len] = *format;
-        output[len + 1] = '\0';
+        bufferAppend(&output, format, 1);
         format++;
     }
     
-    printf("%s\n", output);
+    display(output.data);
+    letGo(held[0].next);
+    memFree(output.data);
 }
 
 char* createFormattedString(const char *format, char **vars, int varCount) {
-    char *output = malloc(1024);
-    output[0] = '\0';
+    FormatBuffer output;
+    bufferInit(&output);
     
     while (*format) {
         if (*format == '%' && strncmp(format, "%var", 4) == 0) {
@@ -121,37 +247,23 @@ char* createFormattedString(const char *format, char **vars, int varCount) {
             }
             
             if (varNum < 1 || varNum > varCount) {
-                free(output);
+                memFree(output.data);
                 return NULL;
             }
             
             Variable *var = findVariable(vars[varNum - 1]);
             if (var) {
-                if (var->type == INT) {
-                    char numStr[32];
-                    sprintf(numStr, "%d", var->value.intValue);
-                    strcat(output, numStr);
-                } else if (var->type == FLOAT) {
-                    char numStr[32];
-                    sprintf(numStr, "%.6f", var->value.floatValue);
-                    strcat(output, numStr);
-                } else if (var->type == BOOLEAN) {
-                    strcat(output, var->value.boolValue ? "true" : "false");
-                } else if (var->type == STRING) {
-                    strcat(output, var->value.stringValue);
-                }
+                appendValue(&output, var, NULL);
             } else {
-                free(output);
+                memFree(output.data);
                 return NULL;
             }
             continue;
         }
         
-        int len = strlen(output);
-        output[len] = *format;
-        output[len + 1] = '\0';
+        bufferAppend(&output, format, 1);
         format++;
     }
     
-    return output;
-}
\ No newline at end of file
+    return output.data;
+}
@@ -0,0 +1,664 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include "lexer_emit.h"
+#include "lexer_script.h"
+#include "lexer_interpret.h"
+#include "lexer_expr.h"
+#include "lexer_typecheck.h"
+#include "lexer_stream.h"
+#include "lexer_memory.h"
+
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+} Output;
+
+// The body of main, and the functions it calls for the expressions worked
+// out in C, are written to buffers first, since the tables they use have
+// to come before them
+typedef struct {
+    Script *script;
+    Output body;
+    Output functions;
+    const char **expressions;
+    int expressionCount;
+    const char **globals;
+    int globalCount;
+    int functionCount;
+    int loopCount;
+} Emitter;
+
+static void emit(Output *out, int depth, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    size_t wanted = out->length + depth * 4 + (size_t)needed + 2;
+    if (wanted > out->capacity) {
+        out->capacity = wanted > out->capacity * 2 ? wanted : out->capacity * 2;
+        out->text = memRealloc(out->text, out->capacity);
+    }
+    memset(out->text + out->length, ' ', depth * 4);
+    out->length += depth * 4;
+    va_start(args, format);
+    vsnprintf(out->text + out->length, (size_t)needed + 1, format, args);
+    va_end(args);
+    out->length += needed;
+    out->text[out->length++] = '\n';
+    out->text[out->length] = '\0';
+}
+
+// text as a C string literal, in a new string
+static char *quote(const char *text, size_t length) {
+    char *literal = memAlloc(length * 4 + 3);
+    char *out = literal;
+    *out++ = '"';
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = (char)c;
+        } else if (c == '\n') {
+            *out++ = '\\';
+            *out++ = 'n';
+        } else if (c < 0x20 || c >= 0x7f || c == '?') {
+            // Octal escapes are always three digits, so a digit after one
+            // is not taken as part of it. '?' would start a trigraph.
+            out += sprintf(out, "\\%03o", c);
+        } else {
+            *out++ = (char)c;
+        }
+    }
+    *out++ = '"';
+    *out = '\0';
+    return literal;
+}
+
+// Index in the table of the tree for text
+static int addExpression(Emitter *emitter, const char *text) {
+    emitter->expressions = memRealloc(emitter->expressions, (emitter->expressionCount + 1) * sizeof(char *));
+    emitter->expressions[emitter->expressionCount] = memStrdup(text);
+    return emitter->expressionCount++;
+}
+
+static void emitComment(Output *out, const ScriptLine *line, int depth) {
+    // A comment ending in a backslash would carry on onto the next line
+    size_t length = strlen(line->text);
+    if (length > 0 && line->text[length - 1] == '\\') {
+        emit(out, depth, "// line %d", line->lineNumber);
+    } else {
+        emit(out, depth, "// %d: %s", line->lineNumber, line->text);
+    }
+}
+
+// Index in the table of globals of the one called name
+static int addGlobal(Emitter *emitter, const char *name) {
+    for (int i = 0; i < emitter->globalCount; i++) {
+        if (strcmp(emitter->globals[i], name) == 0) {
+            return i;
+        }
+    }
+    emitter->globals = memRealloc(emitter->globals, (emitter->globalCount + 1) * sizeof(char *));
+    emitter->globals[emitter->globalCount] = memStrdup(name);
+    return emitter->globalCount++;
+}
+
+// Whether expr can be worked out in C: the type checker showed that it
+// only ever gives a number or a boolean, and that the variables it reads
+// are always set to one
+static int lowerable(const Expr *expr) {
+    if (!expr) {
+        return 0;
+    }
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            return expr->value.type == INT || expr->value.type == BOOLEAN ||
+                   (expr->value.type == FLOAT && isfinite(expr->value.value.floatValue));
+        case EXPR_VARIABLE:
+            return expr->types && !(expr->types & ~(TYPE_NUMERIC | TYPE_BIT(BOOLEAN)));
+        case EXPR_ARITHMETIC:
+        case EXPR_COMPARISON:
+            return expr->proven && lowerable(expr->children[0]) && lowerable(expr->children[1]);
+        case EXPR_LOGICAL:
+            return lowerable(expr->children[0]) && lowerable(expr->children[1]);
+        case EXPR_NOT:
+            return lowerable(expr->children[0]);
+        default:
+            return 0;
+    }
+}
+
+// A function being written for a lowerable expression. Each node becomes
+// a temporary, in the order evaluateNode goes through them, so errors are
+// raised in the same order; a variable that is not set returns missing.
+typedef struct {
+    Emitter *emitter;
+    int depth;
+    int temps;
+    const char *missing;
+} Lowering;
+
+static int lowerTruth(Lowering *lowering, const Expr *expr);
+
+// Writes "Variable v<n>" holding the value of expr; returns n
+static int lowerValue(Lowering *lowering, const Expr *expr) {
+    Output *out = &lowering->emitter->functions;
+    int depth = lowering->depth;
+    if (expr->kind == EXPR_LOGICAL || expr->kind == EXPR_NOT) {
+        int truth = lowerTruth(lowering, expr);
+        int temp = lowering->temps++;
+        emit(out, depth, "Variable v%d = { .type = BOOLEAN, .value.boolValue = t%d };", temp, truth);
+        return temp;
+    }
+    if (expr->kind == EXPR_VARIABLE) {
+        int temp = lowering->temps++;
+        emit(out, depth, "Variable v%d;", temp);
+        emit(out, depth, "if (!runtimeLoad(&globals[%d], &v%d)) return%s;",
+             addGlobal(lowering->emitter, expr->name), temp, lowering->missing);
+        return temp;
+    }
+    if (expr->kind == EXPR_LITERAL) {
+        int temp = lowering->temps++;
+        if (expr->value.type == FLOAT) {
+            emit(out, depth, "Variable v%d = { .type = FLOAT, .value.floatValue = %af };",
+                 temp, (double)expr->value.value.floatValue);
+        } else if (expr->value.type == BOOLEAN) {
+            emit(out, depth, "Variable v%d = { .type = BOOLEAN, .value.boolValue = %d };",
+                 temp, expr->value.value.boolValue);
+        } else {
+            emit(out, depth, "Variable v%d = { .type = INT, .value.intValue = %d };",
+                 temp, expr->value.value.intValue);
+        }
+        return temp;
+    }
+
+    int left = lowerValue(lowering, expr->children[0]);
+    int right = lowerValue(lowering, expr->children[1]);
+    int temp = lowering->temps++;
+    if (expr->kind == EXPR_ARITHMETIC) {
+        emit(out, depth, "Variable v%d = numericOperation(&v%d, &v%d, \"%s\");",
+             temp, left, right, expr->operator);
+    } else {
+        emit(out, depth, "Variable v%d = compareNumbers(numberAsFloat(&v%d), numberAsFloat(&v%d), \"%s\");",
+             temp, left, right, expr->operator);
+    }
+    return temp;
+}
+
+// Writes "int t<n>" holding whether expr is true, as evaluateTruth finds;
+// returns n. AND and OR only work out their right side when they need to.
+static int lowerTruth(Lowering *lowering, const Expr *expr) {
+    Output *out = &lowering->emitter->functions;
+    if (expr->kind == EXPR_LOGICAL) {
+        int truth = lowerTruth(lowering, expr->children[0]);
+        emit(out, lowering->depth, "if (%st%d) {", expr->operator[0] == 'O' ? "!" : "", truth);
+        lowering->depth++;
+        int right = lowerTruth(lowering, expr->children[1]);
+        emit(out, lowering->depth, "t%d = t%d;", truth, right);
+        lowering->depth--;
+        emit(out, lowering->depth, "}");
+        return truth;
+    }
+    if (expr->kind == EXPR_NOT) {
+        int operand = lowerTruth(lowering, expr->children[0]);
+        int temp = lowering->temps++;
+        emit(out, lowering->depth, "int t%d = !t%d;", temp, operand);
+        return temp;
+    }
+    int value = lowerValue(lowering, expr);
+    int temp = lowering->temps++;
+    if (expr->types == TYPE_BIT(BOOLEAN)) {
+        emit(out, lowering->depth, "int t%d = v%d.value.boolValue;", temp, value);
+    } else {
+        emit(out, lowering->depth, "int t%d = isTrue(&v%d);", temp, value);
+    }
+    return temp;
+}
+
+// "name = value" with a lowerable value, as a function that works it out
+// and stores it. Returns the function's name.
+static char *lowerAssignment(Emitter *emitter, const ScriptLine *line, const char *name, const Expr *value) {
+    char *function = memAlloc(32);
+    snprintf(function, 32, "assignment%d", emitter->functionCount++);
+    emitComment(&emitter->functions, line, 0);
+    emit(&emitter->functions, 0, "static void %s(void) {", function);
+    Lowering lowering = { emitter, 1, 0, "" };
+    int result = lowerValue(&lowering, value);
+    emit(&emitter->functions, 1, "runtimeStore(&globals[%d], &v%d);", addGlobal(emitter, name), result);
+    emit(&emitter->functions, 0, "}\n");
+    return function;
+}
+
+// The condition of line, lowerable, as a function returning whether it
+// holds. A condition that evaluates to nothing does not.
+static char *lowerCondition(Emitter *emitter, const ScriptLine *line, const Expr *condition) {
+    char *function = memAlloc(32);
+    snprintf(function, 32, "condition%d", emitter->functionCount++);
+    emitComment(&emitter->functions, line, 0);
+    emit(&emitter->functions, 0, "static int %s(void) {", function);
+    Lowering lowering = { emitter, 1, 0, " 0" };
+    int truth = lowerTruth(&lowering, condition);
+    emit(&emitter->functions, 1, "return t%d;", truth);
+    emit(&emitter->functions, 0, "}\n");
+    return function;
+}
+
+// Leave the statement at index, and the block it opens, to the interpreter
+static void emitInterpreted(Emitter *emitter, int index, int depth) {
+    emitComment(&emitter->body, &emitter->script->lines[index], depth);
+    emit(&emitter->body, depth, "executeStatement(script, %d);", index);
+}
+
+static int emitBlock(Emitter *emitter, int start, int end, int depth);
+
+// The condition of "if(...):" as extractCondition finds it, or NULL if the
+// statement is not valid
+static char *conditionText(const ScriptLine *line, size_t prefixLength) {
+    const char *start = line->text + prefixLength;
+    const char *end = start + strlen(start);
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    if (end - start < 3 || end[-1] != ':' || end[-2] != ')') {
+        return NULL;
+    }
+    size_t length = (size_t)(end - 2 - start);
+    char *condition = memAlloc(length + 1);
+    memcpy(condition, start, length);
+    condition[length] = '\0';
+    return condition;
+}
+
+static int hasBody(Emitter *emitter, int index) {
+    return emitter->script->lines[index].blockEnd != index + 1;
+}
+
+// An if/elseif/else chain becomes the same chain in C. A chain with a
+// branch the interpreter would stop on is left to it.
+static int emitIf(Emitter *emitter, int index, int depth) {
+    Script *script = emitter->script;
+    int indent = script->lines[index].indent;
+    int end = script->lines[index].blockEnd;
+    int valid = hasBody(emitter, index);
+    char *condition = conditionText(&script->lines[index], 3);
+    valid = valid && condition;
+    memFree(condition);
+
+    while (end < script->count && script->lines[end].indent == indent) {
+        ScriptLine *next = &script->lines[end];
+        if (strncmp(next->text, "elseif(", 7) == 0) {
+            condition = conditionText(next, 7);
+            valid = valid && condition && hasBody(emitter, end);
+            memFree(condition);
+        } else if (strcmp(next->text, "else:") == 0) {
+            valid = valid && hasBody(emitter, end);
+            end = next->blockEnd;
+            break;
+        } else {
+            break;
+        }
+        end = next->blockEnd;
+    }
+    if (!valid) {
+        emitInterpreted(emitter, index, depth);
+        return end;
+    }
+
+    for (int branch = index; branch < end; branch = script->lines[branch].blockEnd) {
+        ScriptLine *line = &script->lines[branch];
+        if (branch == index) {
+            emitComment(&emitter->body, line, depth);
+        }
+        if (line->text[0] == 'e' && line->text[4] == ':') {
+            emit(&emitter->body, depth, "} else {");
+        } else {
+            int isIf = line->text[0] == 'i';
+            condition = conditionText(line, isIf ? 3 : 7);
+            Expr *tree = parseExpression(condition);
+            char test[64];
+            if (lowerable(tree)) {
+                char *function = lowerCondition(emitter, line, tree);
+                snprintf(test, sizeof(test), "%s()", function);
+                memFree(function);
+            } else {
+                snprintf(test, sizeof(test), "runtimeCondition(expressions[%d])", addExpression(emitter, condition));
+            }
+            memFree(condition);
+            if (isIf) {
+                emit(&emitter->body, depth, "currentLineNumber = %d;", line->lineNumber);
+                emit(&emitter->body, depth, "if (%s) {", test);
+            } else {
+                emit(&emitter->body, depth, "} else if ((currentLineNumber = %d, %s)) {", line->lineNumber, test);
+            }
+        }
+        if (branch != index) {
+            emitComment(&emitter->body, line, depth + 1);
+        }
+        emitBlock(emitter, branch + 1, line->blockEnd, depth + 1);
+    }
+    emit(&emitter->body, depth, "}");
+    return end;
+}
+
+// "for name in source:" becomes a C loop over the items, as stepFor and
+// nextItem hand them out
+static int emitFor(Emitter *emitter, int index, int depth) {
+    ScriptLine *line = &emitter->script->lines[index];
+    char *header = memStrdup(line->text + 4);
+    size_t length = strlen(header);
+    char *in = strstr(header, " in ");
+    if (length == 0 || header[length - 1] != ':' || !in || !hasBody(emitter, index)) {
+        memFree(header);
+        emitInterpreted(emitter, index, depth);
+        return line->blockEnd;
+    }
+    header[length - 1] = '\0';
+    *in = '\0';
+
+    char *name = header;
+    while (*name == ' ') name++;
+    char *nameEnd = name + strlen(name);
+    while (nameEnd > name && nameEnd[-1] == ' ') *--nameEnd = '\0';
+
+    char *quoted = quote(name, strlen(name));
+    int loop = emitter->loopCount++;
+    emitComment(&emitter->body, line, depth);
+    emit(&emitter->body, depth, "currentLineNumber = %d;", line->lineNumber);
+    emit(&emitter->body, depth, "for (RuntimeLoop *loop%d = runtimeLoopStart(%s, expressions[%d]); runtimeLoopNext(loop%d);) {",
+         loop, quoted, addExpression(emitter, in + 4), loop);
+    emitBlock(emitter, index + 1, line->blockEnd, depth + 1);
+    emit(&emitter->body, depth, "}");
+    memFree(quoted);
+    memFree(header);
+    return line->blockEnd;
+}
+
+// display(...) with the arguments worked out the way interpretCommand
+// works them out. Returns 0 for one it would stop on.
+static int emitDisplay(Emitter *emitter, const ScriptLine *line, int depth) {
+    const char *text = line->text;
+    const char *closingParenthesis = strrchr(text + 8, ')');
+    if (!closingParenthesis) {
+        return 0;
+    }
+    size_t length = (size_t)(closingParenthesis - (text + 8));
+    char *content = memAlloc(length + 1);
+    memcpy(content, text + 8, length);
+    content[length] = '\0';
+
+    int emitted = 1;
+    if (strstr(content, "%var") != NULL && strchr(content, ',') != NULL) {
+        char *cursor = content;
+        char *format = nextArgument(&cursor);
+        char *vars[10];
+        int varCount = 0;
+        char *var;
+        while (emitted && (var = nextArgument(&cursor)) != NULL) {
+            if (varCount == 10) {
+                emitted = 0;
+            } else {
+                vars[varCount++] = var;
+            }
+        }
+        if (emitted && format && strlen(format) >= 2) {
+            char *quotedFormat = quote(format + 1, strlen(format) - 2);
+            size_t listLength = 16;
+            for (int i = 0; i < varCount; i++) {
+                listLength += strlen(vars[i]) * 4 + 4;
+            }
+            char *list = memAlloc(listLength);
+            strcpy(list, varCount ? "(char *[]){" : "NULL");
+            for (int i = 0; i < varCount; i++) {
+                char *quotedVar = quote(vars[i], strlen(vars[i]));
+                strcat(list, i ? ", " : "");
+                strcat(list, quotedVar);
+                memFree(quotedVar);
+            }
+            strcat(list, varCount ? "}" : "");
+            emit(&emitter->body, depth, "displayFormatted(%s, %s, %d);", quotedFormat, list, varCount);
+            memFree(list);
+            memFree(quotedFormat);
+        } else {
+            emitted = 0;
+        }
+    } else {
+        char *endptr;
+        long intValue = strtol(content, &endptr, 10);
+        size_t contentLength = strlen(content);
+        if (*endptr == '\0') {
+            emit(&emitter->body, depth, "displayInt(%d);", (int)intValue);
+        } else if (isFloat(content) && isfinite(parseFloat(content))) {
+            emit(&emitter->body, depth, "displayFloat(%af);", (double)parseFloat(content));
+        } else if ((content[0] == '"' && content[contentLength - 1] == '"') ||
+                   (content[0] == '\'' && content[contentLength - 1] == '\'')) {
+            content[contentLength - 1] = '\0';
+            char *quoted = quote(content + 1, strlen(content + 1));
+            emit(&emitter->body, depth, "display(%s);", quoted);
+            memFree(quoted);
+        } else {
+            emitted = 0;
+        }
+    }
+    memFree(content);
+    return emitted;
+}
+
+// The statements interpretCommand runs, where their meaning does not
+// depend on what the script has defined by then. Returns 0 for the rest.
+static int emitCommand(Emitter *emitter, const ScriptLine *line, int depth) {
+    const char *text = line->text;
+
+    if (strncmp(text, "import", 6) == 0) {
+        char varName[256];
+        char fileName[256];
+        if (strlen(text) >= sizeof(varName) ||
+            sscanf(text, "import %s from \"%[^\"]\"", varName, fileName) != 2) {
+            return 0;
+        }
+        char *quotedFile = quote(fileName, strlen(fileName));
+        char *quotedVar = quote(varName, strlen(varName));
+        emit(&emitter->body, depth, "importVariableFromFile(%s, %s);", quotedFile, quotedVar);
+        memFree(quotedFile);
+        memFree(quotedVar);
+        return 1;
+    }
+    if (strncmp(text, "display(", 8) == 0) {
+        return emitDisplay(emitter, line, depth);
+    }
+    if (strncmp(text, "append(", 7) == 0 || strncmp(text, "remove(", 7) == 0) {
+        return 0;
+    }
+    // Whether a call runs a function depends on what is defined by then
+    Expr *call = parseExpression(text);
+    if (call && call->kind == EXPR_CALL) {
+        return 0;
+    }
+
+    const char *equalsSign = strchr(text, '=');
+    if (!equalsSign) {
+        return 0;
+    }
+    const char *nameStart = text;
+    const char *nameEnd = equalsSign;
+    while (nameEnd > nameStart + 1 && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) nameEnd--;
+    while (nameStart < nameEnd && (*nameStart == ' ' || *nameStart == '\t')) nameStart++;
+    if (nameEnd > nameStart && nameEnd[-1] == ']') {
+        return 0;
+    }
+    const char *value = equalsSign + 1;
+    while (*value == ' ') value++;
+
+    Expr *tree = parseExpression(value);
+    if (lowerable(tree)) {
+        char *name = memAlloc((size_t)(nameEnd - nameStart) + 1);
+        memcpy(name, nameStart, (size_t)(nameEnd - nameStart));
+        name[nameEnd - nameStart] = '\0';
+        char *function = lowerAssignment(emitter, line, name, tree);
+        emit(&emitter->body, depth, "%s();", function);
+        memFree(function);
+        memFree(name);
+        return 1;
+    }
+    char *quotedName = quote(nameStart, (size_t)(nameEnd - nameStart));
+    emit(&emitter->body, depth, "runtimeAssign(%s, expressions[%d]);", quotedName, addExpression(emitter, value));
+    memFree(quotedName);
+    return 1;
+}
+
+// The index after "try:" and its catch, as stepTry returns
+static int tryEnd(const Script *script, int index) {
+    const ScriptLine *line = &script->lines[index];
+    int next = line->blockEnd;
+    if (next < script->count && script->lines[next].indent == line->indent &&
+        strncmp(script->lines[next].text, "catch", 5) == 0) {
+        next = script->lines[next].blockEnd;
+    }
+    return next;
+}
+
+// Returns the index of the statement after the one at index, as
+// stepStatement does
+static int emitStatement(Emitter *emitter, int index, int depth) {
+    ScriptLine *line = &emitter->script->lines[index];
+    const char *text = line->text;
+
+    if (strncmp(text, "if(", 3) == 0) {
+        return emitIf(emitter, index, depth);
+    }
+    if (strncmp(text, "for ", 4) == 0) {
+        return emitFor(emitter, index, depth);
+    }
+    if (strcmp(text, "try:") == 0) {
+        emitInterpreted(emitter, index, depth);
+        return tryEnd(emitter->script, index);
+    }
+    if (strncmp(text, "match(", 6) == 0 || strncmp(text, "parallel_for(", 13) == 0 ||
+        (strncmp(text, "task", 4) == 0 && (text[4] == ':' || text[4] == ' ')) ||
+        strncmp(text, "func ", 5) == 0) {
+        emitInterpreted(emitter, index, depth);
+        return line->blockEnd;
+    }
+    if (strncmp(text, "elseif(", 7) == 0 || strcmp(text, "else:") == 0 ||
+        strncmp(text, "case ", 5) == 0 || strcmp(text, "default:") == 0 ||
+        strcmp(text, "return") == 0 || strncmp(text, "return ", 7) == 0 ||
+        strcmp(text, "yield") == 0 || strncmp(text, "yield ", 6) == 0 ||
+        strcmp(text, "catch:") == 0 || strncmp(text, "catch ", 6) == 0) {
+        emitInterpreted(emitter, index, depth);
+        return index + 1;
+    }
+
+    // Only the text of the statement is needed to tell whether it can be
+    // written as C, so nothing is emitted until it is known
+    size_t mark = emitter->body.length;
+    int expressions = emitter->expressionCount;
+    emitComment(&emitter->body, line, depth);
+    emit(&emitter->body, depth, "currentLineNumber = %d;", line->lineNumber);
+    if (!emitCommand(emitter, line, depth)) {
+        emitter->body.length = mark;
+        while (emitter->expressionCount > expressions) {
+            memFree((char *)emitter->expressions[--emitter->expressionCount]);
+        }
+        emitInterpreted(emitter, index, depth);
+    }
+    return index + 1;
+}
+
+static int emitBlock(Emitter *emitter, int start, int end, int depth) {
+    int index = start;
+    while (index < end) {
+        index = emitStatement(emitter, index, depth);
+    }
+    return index;
+}
+
+int emitC(const char *path) {
+    StringBuffer *source = loadFile(path);
+    if (!source) {
+        return 0;
+    }
+    char *text = memAlloc(source->length + 1);
+    memcpy(text, source->text, source->length);
+    text[source->length] = '\0';
+    stringBufferRelease(source);
+
+    // The types the checker finds decide which expressions become C. A type
+    // error stops here, as it stops noviq -e.
+    Emitter emitter = { loadScript(text), { NULL, 0, 0 }, { NULL, 0, 0 }, NULL, 0, NULL, 0, 0, 0 };
+    if (typecheckScript(emitter.script, 0) > 0) {
+        exit(EXIT_FAILURE);
+    }
+    emitBlock(&emitter, 0, emitter.script->count, 1);
+
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    printf("// Written by noviq --emit-c from %s. Build it against the\n", name);
+    printf("// interpreter: make runtime, then\n");
+    printf("//   gcc -O2 -pthread -I<noviq> -o program program.c <noviq>/libnoviq.a -lm\n");
+    printf("#include \"lexer/lexer_runtime.h\"\n\n");
+
+    // Line by line, so that the literal reads like the script
+    printf("static const char source[] =\n");
+    const char *line = text;
+    if (!*line) {
+        printf("    \"\"");
+    }
+    while (*line) {
+        const char *end = strchr(line, '\n');
+        end = end ? end + 1 : line + strlen(line);
+        char *quoted = quote(line, (size_t)(end - line));
+        printf("    %s%s", quoted, *end ? "\n" : "");
+        memFree(quoted);
+        line = end;
+    }
+    printf(";\n\n");
+
+    if (emitter.expressionCount > 0) {
+        printf("static const char *const expressionTexts[%d] = {\n", emitter.expressionCount);
+        for (int i = 0; i < emitter.expressionCount; i++) {
+            char *quoted = quote(emitter.expressions[i], strlen(emitter.expressions[i]));
+            printf("    %s,\n", quoted);
+            memFree(quoted);
+        }
+        printf("};\nstatic Expr *expressions[%d];\n\n", emitter.expressionCount);
+    }
+
+    if (emitter.globalCount > 0) {
+        printf("static RuntimeGlobal globals[%d] = {\n", emitter.globalCount);
+        for (int i = 0; i < emitter.globalCount; i++) {
+            char *quoted = quote(emitter.globals[i], strlen(emitter.globals[i]));
+            printf("    { %s, 0 },\n", quoted);
+            memFree(quoted);
+        }
+        printf("};\n\n");
+    }
+    printf("%s", emitter.functions.text ? emitter.functions.text : "");
+
+    printf("int main(void) {\n");
+    printf("    Script *script = runtimeStart(source);\n");
+    if (emitter.expressionCount > 0) {
+        printf("    for (int i = 0; i < %d; i++) {\n", emitter.expressionCount);
+        printf("        expressions[i] = parseExpression(expressionTexts[i]);\n");
+        printf("    }\n");
+    }
+    printf("\n%s\n", emitter.body.text ? emitter.body.text : "");
+    printf("    runtimeFinish(script);\n");
+    printf("    return 0;\n");
+    printf("}\n");
+
+    for (int i = 0; i < emitter.expressionCount; i++) {
+        memFree((char *)emitter.expressions[i]);
+    }
+    memFree(emitter.expressions);
+    for (int i = 0; i < emitter.globalCount; i++) {
+        memFree((char *)emitter.globals[i]);
+    }
+    memFree(emitter.globals);
+    memFree(emitter.functions.text);
+    memFree(emitter.body.text);
+    freeScript(emitter.script);
+    memFree(text);
+    return 1;
+}
@@ -0,0 +1,15 @@
+#ifndef LEXER_EMIT_H
+#define LEXER_EMIT_H
+
+// Write a C program that runs the script at path to standard output. Only
+// the top level goes: if chains and for loops outside of functions become
+// C control flow, and assignments, displays and imports there become calls
+// into the runtime in lexer_runtime.h. Expressions the type checker proves
+// to give numbers or booleans are written as C; the rest are still
+// evaluated by the interpreter from their parsed trees, and functions,
+// match, try and the statements that run blocks on threads are run by it
+// statement by statement. Exits on a type error, as noviq -e does. Returns
+// 0 if the script cannot be read.
+int emitC(const char *path);
+
+#endif // LEXER_EMIT_H
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "lexer_error.h"
+#include "lexer_interpret.h"
+#include "lexer_parallel.h"
+#include "lexer_memory.h"
+
+_Thread_local int currentColumn = 0;
+_Thread_local ErrorHandler *errorHandlers = NULL;
+_Thread_local Held *heldItems = NULL;
+
+static const char *const kindNames[] = {
+    "runtime", "syntax", "name", "type", "value", "index", "arithmetic", "io"
+};
+
+const char *errorKindName(ErrorKind kind) {
+    return kindNames[kind];
+}
+
+ErrorHandler *pushHandler(ErrorHandler *handler) {
+    handler->held = heldItems;
+    handler->outer = errorHandlers;
+    errorHandlers = handler;
+    return handler;
+}
+
+void dropHandler(ErrorHandler *handler) {
+    errorHandlers = handler->outer;
+}
+
+void raiseError(ErrorKind kind, int line, const char *format, ...) {
+    va_list args;
+    ErrorHandler *handler = errorHandlers;
+    // Other threads may be using what the statement left half done
+    if (handler && !sharingValues()) {
+        errorHandlers = handler->outer;
+        handler->error.kind = kind;
+        handler->error.line = line;
+        handler->error.column = currentColumn;
+        va_start(args, format);
+        vsnprintf(handler->error.message, ERROR_MESSAGE_SIZE, format, args);
+        va_end(args);
+
+        // The frames holding them are still there until the jump
+        while (heldItems != handler->held) {
+            Held *held = heldItems;
+            heldItems = held->next;
+            if (held->isValue) {
+                releaseValue(held->pointer);
+            } else {
+                memFree(*(void **)held->pointer);
+            }
+        }
+        longjmp(handler->jump, 1);
+    }
+
+    fprintf(stderr, "Error on line %d: ", line);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(EXIT_FAILURE);
+}
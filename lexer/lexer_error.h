@@ -0,0 +1,97 @@
+#ifndef LEXER_ERROR_H
+#define LEXER_ERROR_H
+
+#include <setjmp.h>
+
+// What went wrong, so that a script can tell errors apart
+typedef enum {
+    ERROR_RUNTIME,      // Anything the others do not cover
+    ERROR_SYNTAX,       // A statement that cannot be read
+    ERROR_NAME,         // An unknown variable or function
+    ERROR_TYPE,         // A value of the wrong type, or a wrong number of them
+    ERROR_VALUE,        // A value of the right type that cannot be used
+    ERROR_INDEX,        // An index out of range or a key that is missing
+    ERROR_ARITHMETIC,   // Division or modulo by zero
+    ERROR_IO            // A file that cannot be read
+} ErrorKind;
+
+#define ERROR_MESSAGE_SIZE 256
+
+typedef struct {
+    ErrorKind kind;
+    int line;
+    int column;         // Of the first character of the statement
+    char message[ERROR_MESSAGE_SIZE];
+} ScriptError;
+
+// "index" for ERROR_INDEX, and so on
+const char *errorKindName(ErrorKind kind);
+
+// Column of the statement running on this thread, set with the line
+extern _Thread_local int currentColumn;
+
+// Temporaries of the running statement. Code holding a value or a buffer
+// of its own while it evaluates something that may raise an error links it
+// here with a Held on its own stack, and lets go by going back to the mark
+// it took before, once it is about to release the temporaries itself.
+// Before an error jumps to a handler, whatever was held since the handler
+// was pushed is released, so a statement that fails partway through
+// leaks nothing.
+typedef struct Held {
+    void *pointer;
+    int isValue;        // A Variable to release, or else a buffer to free
+    struct Held *next;
+} Held;
+
+extern _Thread_local Held *heldItems;
+
+static inline Held *heldMark(void) {
+    return heldItems;
+}
+
+static inline void letGo(Held *mark) {
+    heldItems = mark;
+}
+
+// value is a Variable, which must hold a value for as long as it is held
+static inline void holdValue(Held *held, void *value) {
+    held->pointer = value;
+    held->isValue = 1;
+    held->next = heldItems;
+    heldItems = held;
+}
+
+// buffer is where a pointer from memAlloc is kept, so that it may still
+// be reallocated while it is held
+static inline void holdBuffer(Held *held, void *buffer) {
+    held->pointer = buffer;
+    held->isValue = 0;
+    held->next = heldItems;
+    heldItems = held;
+}
+
+// Where an error raised on this thread goes. catchError pushes handler and
+// returns 0; when an error is raised it returns again, nonzero, with the
+// error in handler->error and the handler already popped. Code that ends
+// without an error pops the handler with dropHandler.
+typedef struct ErrorHandler {
+    jmp_buf jump;
+    ScriptError error;
+    Held *held;         // What was held when the handler was pushed
+    struct ErrorHandler *outer;
+} ErrorHandler;
+
+// The innermost handler on this thread, or NULL
+extern _Thread_local ErrorHandler *errorHandlers;
+
+ErrorHandler *pushHandler(ErrorHandler *handler);
+void dropHandler(ErrorHandler *handler);
+#define catchError(handler) setjmp(pushHandler(handler)->jump)
+
+// Stop the running statement with an error on line. The innermost handler
+// gets it; with none, or while threads share values, it is printed as
+// "Error on line N: message" and the script exits. Nothing is done until
+// an error happens, so code that raises none pays nothing for handlers.
+_Noreturn void raiseError(ErrorKind kind, int line, const char *format, ...);
+
+#endif // LEXER_ERROR_H
@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include "lexer_expr.h"
+#include "lexer_parallel.h"
+#include "lexer_memory.h"
+
+typedef enum { TOKEN_END, TOKEN_NUMBER, TOKEN_STRING, TOKEN_NAME, TOKEN_SYMBOL, TOKEN_INVALID } TokenKind;
+
+typedef struct {
+    TokenKind kind;
+    const char *start;
+    size_t length;
+} Token;
+
+typedef struct {
+    const char *cursor;
+    Token token;              // Current token
+    const char *previousEnd;  // End of the token before it
+    int failed;
+} Parser;
+
+// Longest symbols first so that "**" is not read as two "*"
+static const char *symbols[] = {
+    "**", "//", "==", ">=", "<=", "&&", "||",
+    "+", "-", "*", "/", "%", ">", "<", "!", "(", ")", "[", "]", "{", "}", ",", ":", NULL
+};
+
+static void advance(Parser *parser) {
+    parser->previousEnd = parser->token.start + parser->token.length;
+    const char *c = parser->cursor;
+    while (*c == ' ' || *c == '\t') c++;
+
+    Token *token = &parser->token;
+    token->start = c;
+    token->length = 0;
+
+    if (*c == '\0') {
+        token->kind = TOKEN_END;
+    } else if (isdigit((unsigned char)*c) || (*c == '.' && isdigit((unsigned char)c[1]))) {
+        const char *end = c;
+        while (isdigit((unsigned char)*end)) end++;
+        if (*end == '.') {
+            end++;
+            while (isdigit((unsigned char)*end)) end++;
+        }
+        token->kind = TOKEN_NUMBER;
+        token->length = end - c;
+    } else if (*c == '"' || *c == '\'') {
+        const char *end = strchr(c + 1, *c);
+        if (end) {
+            token->kind = TOKEN_STRING;
+            token->length = end + 1 - c;
+        } else {
+            token->kind = TOKEN_INVALID;
+        }
+    } else if (isalpha((unsigned char)*c) || *c == '_') {
+        const char *end = c;
+        while (isalnum((unsigned char)*end) || *end == '_') end++;
+        token->kind = TOKEN_NAME;
+        token->length = end - c;
+    } else {
+        token->kind = TOKEN_INVALID;
+        for (int i = 0; symbols[i]; i++) {
+            size_t length = strlen(symbols[i]);
+            if (strncmp(c, symbols[i], length) == 0) {
+                token->kind = TOKEN_SYMBOL;
+                token->length = length;
+                break;
+            }
+        }
+    }
+    parser->cursor = c + token->length;
+}
+
+static int isToken(const Parser *parser, TokenKind kind, const char *text) {
+    const Token *token = &parser->token;
+    return token->kind == kind && token->length == strlen(text) &&
+           strncmp(token->start, text, token->length) == 0;
+}
+
+static int isSymbol(const Parser *parser, const char *symbol) {
+    return isToken(parser, TOKEN_SYMBOL, symbol);
+}
+
+static int accept(Parser *parser, const char *symbol) {
+    if (isSymbol(parser, symbol)) {
+        advance(parser);
+        return 1;
+    }
+    return 0;
+}
+
+static int acceptWord(Parser *parser, const char *word) {
+    if (isToken(parser, TOKEN_NAME, word)) {
+        advance(parser);
+        return 1;
+    }
+    return 0;
+}
+
+static void expect(Parser *parser, const char *symbol) {
+    if (!accept(parser, symbol)) {
+        parser->failed = 1;
+    }
+}
+
+static Expr *newNode(ExprKind kind) {
+    Expr *node = memCalloc(1, sizeof(Expr));
+    node->kind = kind;
+    return node;
+}
+
+static void addChild(Expr *node, Expr *child) {
+    node->children = memRealloc(node->children, (node->childCount + 1) * sizeof(Expr *));
+    node->children[node->childCount++] = child;
+}
+
+// Record the source text of node, from start to the end of the last token
+static Expr *spanTo(Expr *node, const char *start, const Parser *parser) {
+    if (node) {
+        node->text = start;
+        node->textLength = (int)(parser->previousEnd - start);
+    }
+    return node;
+}
+
+static Expr *binaryNode(ExprKind kind, const char *operator, Expr *left, Expr *right) {
+    Expr *node = newNode(kind);
+    strcpy(node->operator, operator);
+    addChild(node, left);
+    addChild(node, right);
+    return node;
+}
+
+static void freeExpr(Expr *node) {
+    if (!node) return;
+    for (int i = 0; i < node->childCount; i++) {
+        freeExpr(node->children[i]);
+    }
+    memFree(node->children);
+    memFree(node->name);
+    if (node->kind == EXPR_LITERAL) {
+        releaseValue(&node->value);
+    }
+    memFree(node);
+}
+
+static Expr *parseOr(Parser *parser);
+
+static Expr *literalNumber(const Token *token, int negative) {
+    char text[64];
+    size_t length = token->length < sizeof(text) - 2 ? token->length : sizeof(text) - 2;
+    text[0] = '-';
+    memcpy(text + 1, token->start, length);
+    text[length + 1] = '\0';
+    const char *number = negative ? text : text + 1;
+
+    int isFloat = memchr(token->start, '.', token->length) != NULL;
+    long long value = isFloat ? 0 : strtoll(number, NULL, 10);
+    if (value < INT_MIN || value > INT_MAX) {
+        raiseError(ERROR_VALUE, currentLineNumber, "%s does not fit in an integer", number);
+    }
+
+    Expr *node = newNode(EXPR_LITERAL);
+    if (isFloat) {
+        node->value.type = FLOAT;
+        node->value.value.floatValue = parseFloat(number);
+    } else {
+        node->value.type = INT;
+        node->value.value.intValue = (int)value;
+    }
+    return node;
+}
+
+// Arguments, array elements or map entries up to the closing symbol
+static void parseList(Parser *parser, Expr *node, const char *closing, int pairs) {
+    if (accept(parser, closing)) {
+        return;
+    }
+    do {
+        addChild(node, parseOr(parser));
+        if (pairs) {
+            expect(parser, ":");
+            addChild(node, parseOr(parser));
+        }
+    } while (!parser->failed && accept(parser, ","));
+    expect(parser, closing);
+}
+
+static Expr *parseOperand(Parser *parser) {
+    Token token = parser->token;
+
+    if (token.kind == TOKEN_NUMBER) {
+        advance(parser);
+        return literalNumber(&token, 0);
+    }
+
+    if (token.kind == TOKEN_STRING) {
+        advance(parser);
+        Expr *node = newNode(EXPR_LITERAL);
+        node->value.type = STRING;
+        stringInit(&node->value.value.stringValue, token.start + 1, token.length - 2);
+        return node;
+    }
+
+    if (token.kind == TOKEN_NAME) {
+        advance(parser);
+        if ((token.length == 4 && strncmp(token.start, "true", 4) == 0) ||
+            (token.length == 5 && strncmp(token.start, "false", 5) == 0)) {
+            Expr *node = newNode(EXPR_LITERAL);
+            node->value.type = BOOLEAN;
+            node->value.value.boolValue = token.length == 4;
+            return node;
+        }
+
+        Expr *node = newNode(isSymbol(parser, "(") ? EXPR_CALL : EXPR_VARIABLE);
+        node->name = memAlloc(token.length + 1);
+        memcpy(node->name, token.start, token.length);
+        node->name[token.length] = '\0';
+        if (node->kind == EXPR_CALL) {
+            advance(parser);
+            parseList(parser, node, ")", 0);
+        }
+        return node;
+    }
+
+    if (accept(parser, "(")) {
+        Expr *node = parseOr(parser);
+        expect(parser, ")");
+        return node;
+    }
+
+    if (accept(parser, "[")) {
+        Expr *node = newNode(EXPR_ARRAY);
+        parseList(parser, node, "]", 0);
+        return node;
+    }
+
+    if (accept(parser, "{")) {
+        Expr *node = newNode(EXPR_MAP);
+        parseList(parser, node, "}", 1);
+        return node;
+    }
+
+    parser->failed = 1;
+    return NULL;
+}
+
+// Indexes and slices: base[index], base[start:end]
+static Expr *parsePostfix(Parser *parser) {
+    const char *start = parser->token.start;
+    Expr *node = spanTo(parseOperand(parser), start, parser);
+    while (!parser->failed && accept(parser, "[")) {
+        Expr *index = isSymbol(parser, ":") ? NULL : parseOr(parser);
+        if (accept(parser, ":")) {
+            Expr *slice = newNode(EXPR_SLICE);
+            addChild(slice, node);
+            addChild(slice, index);
+            addChild(slice, isSymbol(parser, "]") ? NULL : parseOr(parser));
+            node = slice;
+        } else {
+            node = binaryNode(EXPR_INDEX, "[", node, index);
+        }
+        expect(parser, "]");
+        spanTo(node, start, parser);
+    }
+    return node;
+}
+
+static Expr *parseUnary(Parser *parser);
+
+// ** binds tighter than a leading minus and groups to the right
+static Expr *parsePower(Parser *parser) {
+    const char *start = parser->token.start;
+    Expr *node = parsePostfix(parser);
+    if (!parser->failed && accept(parser, "**")) {
+        node = binaryNode(EXPR_ARITHMETIC, "**", node, parseUnary(parser));
+        spanTo(node, start, parser);
+    }
+    return node;
+}
+
+static Expr *parseUnary(Parser *parser) {
+    const char *start = parser->token.start;
+    if (!accept(parser, "-")) {
+        return parsePower(parser);
+    }
+
+    // Negative literals are folded, unless a ** follows: -2 ** 2 is -(2 ** 2)
+    if (parser->token.kind == TOKEN_NUMBER) {
+        const char *after = parser->cursor;
+        while (*after == ' ' || *after == '\t') after++;
+        if (strncmp(after, "**", 2) != 0) {
+            Token token = parser->token;
+            advance(parser);
+            return spanTo(literalNumber(&token, 1), start, parser);
+        }
+    }
+
+    // Anything else is subtracted from zero
+    Expr *zero = newNode(EXPR_LITERAL);
+    zero->value.type = INT;
+    return spanTo(binaryNode(EXPR_ARITHMETIC, "-", zero, parseUnary(parser)), start, parser);
+}
+
+static Expr *parseTerm(Parser *parser) {
+    const char *start = parser->token.start;
+    Expr *node = parseUnary(parser);
+    while (!parser->failed) {
+        const char *operator = isSymbol(parser, "*") ? "*" : isSymbol(parser, "/") ? "/" :
+                               isSymbol(parser, "//") ? "//" : isSymbol(parser, "%") ? "%" : NULL;
+        if (!operator) break;
+        advance(parser);
+        node = spanTo(binaryNode(EXPR_ARITHMETIC, operator, node, parseUnary(parser)), start, parser);
+    }
+    return node;
+}
+
+static Expr *parseAdditive(Parser *parser) {
+    const char *start = parser->token.start;
+    Expr *node = parseTerm(parser);
+    while (!parser->failed) {
+        const char *operator = isSymbol(parser, "+") ? "+" : isSymbol(parser, "-") ? "-" : NULL;
+        if (!operator) break;
+        advance(parser);
+        node = spanTo(binaryNode(EXPR_ARITHMETIC, operator, node, parseTerm(parser)), start, parser);
+    }
+    return node;
+}
+
+static Expr *parseComparison(Parser *parser) {
+    static const char *operators[] = { "==", ">=", "<=", ">", "<", NULL };
+    const char *start = parser->token.start;
+    Expr *node = parseAdditive(parser);
+    while (!parser->failed) {
+        const char *operator = NULL;
+        for (int i = 0; operators[i]; i++) {
+            if (isSymbol(parser, operators[i])) operator = operators[i];
+        }
+        if (!operator) break;
+        advance(parser);
+        node = spanTo(binaryNode(EXPR_COMPARISON, operator, node, parseAdditive(parser)), start, parser);
+    }
+    return node;
+}
+
+static Expr *parseNot(Parser *parser) {
+    const char *start = parser->token.start;
+    if (accept(parser, "!") || acceptWord(parser, "NOT")) {
+        Expr *node = newNode(EXPR_NOT);
+        addChild(node, parseNot(parser));
+        return spanTo(node, start, parser);
+    }
+    return parseComparison(parser);
+}
+
+static Expr *parseAnd(Parser *parser) {
+    const char *start = parser->token.start;
+    Expr *node = parseNot(parser);
+    while (!parser->failed && (accept(parser, "&&") || acceptWord(parser, "AND"))) {
+        node = spanTo(binaryNode(EXPR_LOGICAL, "AND", node, parseNot(parser)), start, parser);
+    }
+    return node;
+}
+
+static Expr *parseOr(Parser *parser) {
+    const char *start = parser->token.start;
+    Expr *node = parseAnd(parser);
+    while (!parser->failed && (accept(parser, "||") || acceptWord(parser, "OR"))) {
+        node = spanTo(binaryNode(EXPR_LOGICAL, "OR", node, parseAnd(parser)), start, parser);
+    }
+    return node;
+}
+
+static Expr *parseText(const char *text) {
+    Parser parser;
+    parser.cursor = text;
+    parser.token.start = text;
+    parser.token.length = 0;
+    parser.failed = 0;
+    advance(&parser);
+
+    Expr *node = parseOr(&parser);
+    if (parser.failed || parser.token.kind != TOKEN_END) {
+        freeExpr(node);
+        return NULL;
+    }
+    return node;
+}
+
+// ---------------------------------------------------------------------------
+// Cache of parsed expressions by text. Failed parses are kept too, so text
+// that is not an expression is only looked at once.
+
+typedef struct {
+    char *text;
+    Expr *expr;
+    int used;          // Looked up since the last refreshExpressionCache
+} CacheEntry;
+
+typedef struct {
+    CacheEntry *entries;
+    size_t capacity;
+    size_t count;
+} ExprCache;
+
+static ExprCache cache = { NULL, 0, 0 };
+// While threads share values the shared cache is only read, and text it
+// does not have is parsed into a cache of the thread's own
+static _Thread_local ExprCache threadCache = { NULL, 0, 0 };
+
+static uint32_t hashText(const char *text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static CacheEntry *findEntry(const ExprCache *table, const char *text, size_t length) {
+    size_t mask = table->capacity - 1;
+    for (size_t slot = hashText(text, length) & mask;; slot = (slot + 1) & mask) {
+        CacheEntry *entry = &table->entries[slot];
+        if (!entry->text ||
+            (strncmp(entry->text, text, length) == 0 && entry->text[length] == '\0')) {
+            return entry;
+        }
+    }
+}
+
+static void growCache(ExprCache *table) {
+    CacheEntry *old = table->entries;
+    size_t oldCapacity = table->capacity;
+    table->capacity = table->capacity ? table->capacity * 2 : 256;
+    table->entries = memCalloc(table->capacity, sizeof(CacheEntry));
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].text) {
+            *findEntry(table, old[i].text, strlen(old[i].text)) = old[i];
+        }
+    }
+    memFree(old);
+}
+
+static CacheEntry *lookupEntry(ExprCache *table, const char *text, size_t length) {
+    if ((table->count + 1) * 3 > table->capacity * 2) {
+        growCache(table);
+    }
+    CacheEntry *entry = findEntry(table, text, length);
+    if (!entry->text) {
+        entry->text = memAlloc(length + 1);
+        memcpy(entry->text, text, length);
+        entry->text[length] = '\0';
+        entry->expr = parseText(entry->text);
+        table->count++;
+    }
+    return entry;
+}
+
+Expr *parseExpression(const char *text) {
+    return parseExpressionPart(text, strlen(text));
+}
+
+Expr *parseExpressionPart(const char *text, size_t length) {
+    while (length > 0 && (*text == ' ' || *text == '\t')) {
+        text++;
+        length--;
+    }
+    while (length > 0 && (text[length - 1] == ' ' || text[length - 1] == '\t')) length--;
+
+    if (sharingValues()) {
+        CacheEntry *entry = cache.capacity ? findEntry(&cache, text, length) : NULL;
+        if (entry && entry->text) {
+            return entry->expr;
+        }
+        return lookupEntry(&threadCache, text, length)->expr;
+    }
+
+    CacheEntry *entry = lookupEntry(&cache, text, length);
+    entry->used = 1;
+    return entry->expr;
+}
+
+static void clearTypes(Expr *node) {
+    if (!node) {
+        return;
+    }
+    node->types = 0;
+    node->proven = 0;
+    for (int i = 0; i < node->childCount; i++) {
+        clearTypes(node->children[i]);
+    }
+}
+
+void refreshExpressionCache(void) {
+    CacheEntry *old = cache.entries;
+    size_t oldCapacity = cache.capacity;
+    cache.entries = memCalloc(cache.capacity, sizeof(CacheEntry));
+    cache.count = 0;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (!old[i].text) {
+            continue;
+        }
+        if (!old[i].used) {
+            freeExpr(old[i].expr);
+            memFree(old[i].text);
+            continue;
+        }
+        clearTypes(old[i].expr);
+        old[i].used = 0;
+        *findEntry(&cache, old[i].text, strlen(old[i].text)) = old[i];
+        cache.count++;
+    }
+    memFree(old);
+}
@@ -0,0 +1,74 @@
+#ifndef LEXER_EXPR_H
+#define LEXER_EXPR_H
+
+#include <stdint.h>
+#include "lexer_interpret.h"
+
+typedef enum {
+    EXPR_LITERAL,      // value
+    EXPR_VARIABLE,     // name
+    EXPR_ARRAY,        // children are the elements
+    EXPR_MAP,          // children alternate between keys and values
+    EXPR_INDEX,        // base, index
+    EXPR_SLICE,        // base, start, end; a missing bound is NULL
+    EXPR_CALL,         // name, children are the arguments
+    EXPR_ARITHMETIC,   // operator, left, right
+    EXPR_COMPARISON,   // operator, left, right
+    EXPR_LOGICAL,      // operator (AND or OR), left, right
+    EXPR_NOT           // operand
+} ExprKind;
+
+// Sets of types, as used by the type checker
+#define TYPE_BIT(type) (1u << (type))
+#define TYPE_NUMERIC (TYPE_BIT(INT) | TYPE_BIT(FLOAT))
+#define TYPE_ANY (TYPE_BIT(INT) | TYPE_BIT(STRING) | TYPE_BIT(FLOAT) | \
+                  TYPE_BIT(BOOLEAN) | TYPE_BIT(ARRAY) | TYPE_BIT(MAP) | TYPE_BIT(COROUTINE) | \
+                  TYPE_BIT(CHANNEL))
+// The value may be missing, as an unknown variable is
+#define TYPE_UNSET (1u << 8)
+
+typedef struct Expr {
+    ExprKind kind;
+    char operator[4];
+    char *name;
+    Variable value;
+    struct Expr **children;
+    int childCount;
+    const char *text;    // Source of the node, for error messages
+    int textLength;
+
+    // Filled in by the type checker. types is every type the node produced
+    // wherever it was checked, or 0 if it never was. A proven node's
+    // operands have types it can handle without checking them.
+    unsigned types;
+    int proven;
+
+    // Of a variable node: which local it names in the function it was last
+    // looked up in, kept by findLocalNode. One word, so that threads running
+    // different functions over the same tree always read a matching pair.
+    uint64_t local;
+} Expr;
+
+// Parse text into a tree. Trees are cached by text, so every statement
+// with the same expression shares one tree and it is only parsed once.
+// Returns NULL if text is not a valid expression.
+Expr *parseExpression(const char *text);
+// The same for the first length characters of text
+Expr *parseExpressionPart(const char *text, size_t length);
+
+// Before a changed script is checked again: free the trees nothing has
+// looked up since the last refresh, and clear the type checker's marks on
+// the others so that proofs about the old script do not carry over
+void refreshExpressionCache(void);
+
+// Evaluation lives with the rest of the interpreter. Both store the value
+// in result, which the caller provides and releases, so evaluating
+// allocates nothing for the value itself. evaluateNode returns 0, storing
+// nothing, for a missing variable; evaluateNodeValue stops with an error.
+int evaluateNode(Expr *expr, Variable *result);
+void evaluateNodeValue(Expr *expr, Variable *result);
+// Truth value of expr: 1, 0, or -1 if it uses a variable that does not
+// exist
+int evaluateTruth(Expr *expr);
+
+#endif // LEXER_EXPR_H
@@ -0,0 +1,527 @@
+#ifdef __linux__
+#define _GNU_SOURCE     // For pthread_getattr_np
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "lexer_function.h"
+#include "lexer_coroutine.h"
+#include "lexer_parallel.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+int callStackSize = DEFAULT_STACK_SIZE;
+_Thread_local int returnPending = 0;
+
+// Task blocks look functions up while others may be defined, so a longer
+// list is filled in before it replaces the old one, which is then kept
+static Function **functions = NULL;
+static int functionCount = 0;
+static int functionCapacity = 0;
+
+// Allocated on a thread's first call and reused by every call after it
+static _Thread_local Variable *frameStack = NULL;
+static _Thread_local int stackTop = 0;
+static _Thread_local CallFrame *frames = NULL;
+static _Thread_local int frameCount = 0;
+
+// Every call also recurses in C, so the thread's own stack may run out
+// before the slots do. The lowest address calls may reach, set on the
+// thread's first call.
+static _Thread_local char *cStackLimit = NULL;
+
+// Room left below the limit for what one more call needs before it gets
+// back here, such as a deeply nested expression
+#define C_STACK_MARGIN (256 * 1024)
+// Stack assumed where the thread's own cannot be looked up
+#define C_STACK_FALLBACK (512 * 1024)
+
+// Marks slot 0 of a frame once return has stored a value in it
+static char returnMarker[] = "return";
+
+// Ids of functions, which variable nodes keep their slots under; 0 is none
+static unsigned lastFunctionId = 0;
+
+static unsigned newFunctionId(void) {
+    return __atomic_add_fetch(&lastFunctionId, 1, __ATOMIC_RELAXED);
+}
+
+static char *trimCopy(const char *start, const char *end) {
+    while (start < end && (*start == ' ' || *start == '\t')) start++;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    char *copy = memAlloc(end - start + 1);
+    memcpy(copy, start, end - start);
+    copy[end - start] = '\0';
+    return copy;
+}
+
+static int isName(const char *name) {
+    if (!(isalpha((unsigned char)*name) || *name == '_')) return 0;
+    for (const char *c = name; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') return 0;
+    }
+    return 1;
+}
+
+static int localIndex(const Function *function, const char *name) {
+    for (int i = 0; i < function->localCount; i++) {
+        if (strcmp(function->localNames[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void addLocal(Function *function, char *name) {
+    if (localIndex(function, name) >= 0) {
+        memFree(name);
+        return;
+    }
+    function->localNames = memRealloc(function->localNames, (function->localCount + 1) * sizeof(char *));
+    function->localNames[function->localCount++] = name;
+}
+
+// The name a statement assigns to, loops over or catches an error in as a
+// new string, or NULL
+static char *assignedName(const char *text) {
+    char *name = NULL;
+    if (strncmp(text, "for ", 4) == 0) {
+        const char *in = strstr(text, " in ");
+        if (in) {
+            name = trimCopy(text + 4, in);
+        }
+    } else if (strncmp(text, "catch ", 6) == 0) {
+        const char *colon = strrchr(text, ':');
+        if (colon) {
+            name = trimCopy(text + 6, colon);
+        }
+    } else if (strncmp(text, "if(", 3) == 0 || strncmp(text, "elseif(", 7) == 0 ||
+               strncmp(text, "display(", 8) == 0 || strncmp(text, "return", 6) == 0 ||
+               strncmp(text, "func ", 5) == 0 || strncmp(text, "match(", 6) == 0 ||
+               strncmp(text, "case ", 5) == 0 || strcmp(text, "yield") == 0 ||
+               strncmp(text, "yield ", 6) == 0 || strncmp(text, "parallel_for(", 13) == 0) {
+        return NULL;
+    } else {
+        const char *equals = strchr(text, '=');
+        if (equals && equals[1] != '=') {
+            name = trimCopy(text, equals);
+        }
+    }
+
+    if (name && !isName(name)) {
+        memFree(name);
+        name = NULL;
+    }
+    return name;
+}
+
+// Give every name the body assigns to, or loops over, a slot of its own
+static void collectLocals(Function *function) {
+    for (int i = function->bodyStart; i < function->bodyEnd; i++) {
+        char *name = assignedName(function->script->lines[i].text);
+        if (name) {
+            addLocal(function, name);
+        }
+    }
+}
+
+int blockAssigns(const Script *script, int start, int end, const char *name) {
+    for (int i = start; i < end; i++) {
+        char *assigned = assignedName(script->lines[i].text);
+        int found = assigned && strcmp(assigned, name) == 0;
+        memFree(assigned);
+        if (found) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether the body has a yield of its own, outside any nested function
+static int containsYield(const Script *script, int start, int end) {
+    for (int i = start; i < end; i++) {
+        const char *text = script->lines[i].text;
+        if (strncmp(text, "func ", 5) == 0) {
+            i = script->lines[i].blockEnd - 1;
+        } else if (strcmp(text, "yield") == 0 || strncmp(text, "yield ", 6) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The body would carry on after a yield with the try around it gone
+static void checkTryYields(const Script *script, int start, int end) {
+    for (int i = start; i < end; i++) {
+        const ScriptLine *line = &script->lines[i];
+        if (strncmp(line->text, "func ", 5) == 0) {
+            i = line->blockEnd - 1;
+        } else if (strcmp(line->text, "try:") == 0 && containsYield(script, i + 1, line->blockEnd)) {
+            raiseError(ERROR_SYNTAX, line->lineNumber, "yield inside try");
+        }
+    }
+}
+
+Function *findFunction(const char *name) {
+    // The list stored before the count is at least as long as the count
+    int count = __atomic_load_n(&functionCount, __ATOMIC_ACQUIRE);
+    Function **list = __atomic_load_n(&functions, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(list[i]->name, name) == 0) {
+            return list[i];
+        }
+    }
+    return NULL;
+}
+
+Function **definedFunctions(int *count) {
+    *count = functionCount;
+    return functions;
+}
+
+static void addFunction(Function *function) {
+    if (functionCount == functionCapacity) {
+        functionCapacity = functionCapacity ? functionCapacity * 2 : 16;
+        Function **list = memAlloc(functionCapacity * sizeof(Function *));
+        if (functionCount > 0) {
+            memcpy(list, functions, functionCount * sizeof(Function *));
+        }
+        Function **old = functions;
+        __atomic_store_n(&functions, list, __ATOMIC_RELEASE);
+        if (!sharingValues()) {
+            memFree(old);
+        }
+    }
+    functions[functionCount] = function;
+    __atomic_store_n(&functionCount, functionCount + 1, __ATOMIC_RELEASE);
+}
+
+// Handle "func name(a, b):"; returns the index after the function body
+int defineFunction(Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    const char *header = line->text + 5;
+    const char *open = strchr(header, '(');
+    const char *end = header + strlen(header);
+    while (end > header && (end[-1] == ' ' || end[-1] == '\t')) end--;
+
+    if (!open || end - open < 3 || end[-1] != ':' || end[-2] != ')') {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Invalid func statement syntax");
+    }
+    char *name = trimCopy(header, open);
+    if (!isName(name)) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Invalid function name '%s'", name);
+    }
+    if (line->blockEnd == index + 1) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Expected an indented block");
+    }
+
+    // Running a definition again, say in a loop, is fine; a second function
+    // with the same name is not
+    parallelLock();
+    Function *function = findFunction(name);
+    if (function) {
+        if (function->script != script || function->bodyStart != index + 1) {
+            raiseError(ERROR_RUNTIME, line->lineNumber, "Function '%s' is already defined", name);
+        }
+        parallelUnlock();
+        memFree(name);
+        return line->blockEnd;
+    }
+
+    function = memAlloc(sizeof(Function));
+    function->name = name;
+    function->id = newFunctionId();
+    function->paramCount = 0;
+    function->localNames = NULL;
+    function->localCount = 0;
+    function->script = script;
+    function->bodyStart = index + 1;
+    function->bodyEnd = line->blockEnd;
+    function->generator = containsYield(script, index + 1, line->blockEnd);
+    if (function->generator) {
+        checkTryYields(script, index + 1, line->blockEnd);
+    }
+
+    char *params = trimCopy(open + 1, end - 2);
+    char *cursor = params;
+    char *param;
+    while ((param = nextArgument(&cursor)) != NULL) {
+        if (!isName(param) || localIndex(function, param) >= 0) {
+            raiseError(ERROR_SYNTAX, line->lineNumber, "Invalid parameter '%s'", param);
+        }
+        addLocal(function, memStrdup(param));
+        function->paramCount++;
+    }
+    memFree(params);
+
+    collectLocals(function);
+    // Other threads can only find it once it is complete
+    addFunction(function);
+    parallelUnlock();
+    return line->blockEnd;
+}
+
+Function *createBlockFunction(Script *script, int index, const char *param) {
+    ScriptLine *line = &script->lines[index];
+    const char *open = strchr(line->text, '(');
+    Function *function = memCalloc(1, sizeof(Function));
+    function->name = open ? trimCopy(line->text, open) : memStrdup(line->text);
+    function->id = newFunctionId();
+    function->script = script;
+    function->bodyStart = index + 1;
+    function->bodyEnd = line->blockEnd;
+    addLocal(function, memStrdup(param));
+    function->paramCount = 1;
+    collectLocals(function);
+    return function;
+}
+
+void freeBlockFunction(Function *function) {
+    for (int i = 0; i < function->localCount; i++) {
+        memFree(function->localNames[i]);
+    }
+    memFree(function->localNames);
+    memFree(function->name);
+    memFree(function);
+}
+
+int functionLocal(const Function *function, const char *name) {
+    return localIndex(function, name);
+}
+
+Variable *findLocal(const char *name) {
+    if (frameCount == 0) {
+        return NULL;
+    }
+    const CallFrame *frame = &frames[frameCount - 1];
+    int index = localIndex(frame->function, name);
+    if (index < 0 && frame->outer) {
+        frame = frame->outer;
+        index = localIndex(frame->function, name);
+    }
+    return index < 0 ? NULL : &frame->slots[index + 1];
+}
+
+// Where a variable node finds its local, as kept in the node: the slot of
+// the local in the frame's function, or with LOCAL_OUTER set, in the outer
+// frame's function; 0 if it is no local of either. The outer frame of a
+// block is always one of the function its statement is in.
+#define LOCAL_OUTER 0x80000000u
+
+static unsigned localCode(const CallFrame *frame, const char *name) {
+    int index = localIndex(frame->function, name);
+    if (index >= 0) {
+        return (unsigned)index + 1;
+    }
+    if (frame->outer) {
+        index = localIndex(frame->outer->function, name);
+        if (index >= 0) {
+            return LOCAL_OUTER | ((unsigned)index + 1);
+        }
+    }
+    return 0;
+}
+
+Variable *findLocalNode(Expr *expr) {
+    if (frameCount == 0) {
+        return NULL;
+    }
+    const CallFrame *frame = &frames[frameCount - 1];
+    uint64_t kept = __atomic_load_n(&expr->local, __ATOMIC_RELAXED);
+    unsigned code;
+    if ((unsigned)(kept >> 32) == frame->function->id) {
+        code = (unsigned)kept;
+    } else {
+        code = localCode(frame, expr->name);
+        kept = ((uint64_t)frame->function->id << 32) | code;
+        __atomic_store_n(&expr->local, kept, __ATOMIC_RELAXED);
+    }
+
+    if (code & LOCAL_OUTER) {
+        frame = frame->outer;
+        code &= ~LOCAL_OUTER;
+    }
+    return code == 0 ? NULL : &frame->slots[code];
+}
+
+int storeLocal(const char *name, VarType type, void *value) {
+    if (frameCount == 0) {
+        return 0;
+    }
+    CallFrame *frame = &frames[frameCount - 1];
+    int index = localIndex(frame->function, name);
+    if (index < 0) {
+        return 0;
+    }
+    Variable *slot = &frame->slots[index + 1];
+    setVariableValue(slot, type, value);
+    slot->name = frame->function->localNames[index];
+    return 1;
+}
+
+void checkArgumentCount(const Function *function, int argCount) {
+    if (argCount != function->paramCount) {
+        raiseError(ERROR_TYPE, currentLineNumber, "%s() expects %d argument%s",
+                   function->name, function->paramCount, function->paramCount == 1 ? "" : "s");
+    }
+}
+
+static void findStackLimit(void) {
+    char here;
+    char *low = &here - C_STACK_FALLBACK;
+#ifdef __linux__
+    pthread_attr_t attributes;
+    void *start;
+    size_t size;
+    if (pthread_getattr_np(pthread_self(), &attributes) == 0) {
+        if (pthread_attr_getstack(&attributes, &start, &size) == 0 && size > 2 * C_STACK_MARGIN) {
+            low = (char *)start;
+        }
+        pthread_attr_destroy(&attributes);
+    }
+#endif
+    cStackLimit = low + C_STACK_MARGIN;
+}
+
+static void allocateStack(void) {
+    if (!frameStack) {
+        frameStack = memAlloc(callStackSize * sizeof(Variable));
+        frames = memAlloc(callStackSize * sizeof(CallFrame));
+        findStackLimit();
+    }
+}
+
+void enterFrame(Function *function, Variable *slots) {
+    enterInnerFrame(function, slots, NULL);
+}
+
+void enterInnerFrame(Function *function, Variable *slots, const CallFrame *outer) {
+    allocateStack();
+    if (frameCount == callStackSize) {
+        raiseError(ERROR_RUNTIME, currentLineNumber,
+                   "Stack overflow calling '%s' (stack size is %d, see --stack-size)", function->name, callStackSize);
+    }
+    char here;
+    if (&here < cStackLimit) {
+        raiseError(ERROR_RUNTIME, currentLineNumber,
+                   "Stack overflow calling '%s' (calls nest %d deep, more than the thread's stack holds)",
+                   function->name, frameCount);
+    }
+    frames[frameCount].function = function;
+    frames[frameCount].slots = slots;
+    frames[frameCount].outer = outer;
+    frameCount++;
+}
+
+void leaveFrame(void) {
+    frameCount--;
+}
+
+int frameDepth(void) {
+    return frameCount;
+}
+
+const CallFrame *currentFrame(void) {
+    return frameCount > 0 ? &frames[frameCount - 1] : NULL;
+}
+
+StackMark stackMark(void) {
+    StackMark mark = { frameCount, stackTop };
+    return mark;
+}
+
+void unwindStack(StackMark mark) {
+    while (stackTop > mark.slots) {
+        releaseValue(&frameStack[--stackTop]);
+    }
+    frameCount = mark.frames;
+    returnPending = 0;
+}
+
+void freeCallStack(void) {
+    unwindStack((StackMark){ 0, 0 });
+    memFree(frameStack);
+    memFree(frames);
+    frameStack = NULL;
+    frames = NULL;
+}
+
+// Run function with the given argument expressions. The value passed to
+// return is moved out of slot 0 into result. Calling a generator gives a
+// new coroutine without running any of its body.
+int callFunction(Function *function, Expr **args, int argCount, Variable *result) {
+    checkArgumentCount(function, argCount);
+    if (function->generator) {
+        result->name = NULL;
+        result->type = COROUTINE;
+        result->value.coroutineValue = createCoroutine(function, args, argCount);
+        return 1;
+    }
+    allocateStack();
+
+    // Slot 0 holds the return value, the locals follow it
+    int slotCount = function->localCount + 1;
+    if (stackTop + slotCount > callStackSize) {
+        raiseError(ERROR_RUNTIME, currentLineNumber,
+                   "Stack overflow calling '%s' (stack size is %d, see --stack-size)", function->name, callStackSize);
+    }
+
+    // Reserve the frame before evaluating the arguments, which may call
+    // functions themselves, but only make it visible once they are stored
+    Variable *slots = &frameStack[stackTop];
+    stackTop += slotCount;
+    for (int i = 0; i < slotCount; i++) {
+        slots[i].name = NULL;
+        slots[i].type = INT;
+    }
+
+    // Each value is only moved into its slot once it is whole, as an error
+    // drops whatever the slots hold
+    for (int i = 0; i < argCount; i++) {
+        Variable value;
+        evaluateNodeValue(args[i], &value);
+        slots[i + 1] = value;
+        slots[i + 1].name = function->localNames[i];
+    }
+
+    int callerLine = currentLineNumber;
+    int callerColumn = currentColumn;
+    enterFrame(function, slots);
+
+    executeBlock(function->script, function->bodyStart, function->bodyEnd);
+
+    returnPending = 0;
+    leaveFrame();
+    currentLineNumber = callerLine;
+    currentColumn = callerColumn;
+
+    int returned = slots[0].name != NULL;
+    if (returned) {
+        *result = slots[0];
+        result->name = NULL;
+    }
+    for (int i = 1; i < slotCount; i++) {
+        releaseValue(&slots[i]);
+    }
+    stackTop -= slotCount;
+    return returned;
+}
+
+// Handle "return" and "return value"
+void returnStatement(const char *expr) {
+    if (frameCount == 0) {
+        raiseError(ERROR_RUNTIME, currentLineNumber, "return outside of a function");
+    }
+
+    Variable *slot = &frames[frameCount - 1].slots[0];
+    while (*expr == ' ' || *expr == '\t') expr++;
+    if (*expr) {
+        Variable value;
+        evaluateValue(expr, &value);
+        *slot = value;
+        slot->name = returnMarker;
+    }
+    returnPending = 1;
+}
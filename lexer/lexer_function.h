@@ -0,0 +1,90 @@
+#ifndef LEXER_FUNCTION_H
+#define LEXER_FUNCTION_H
+
+#include "lexer_interpret.h"
+#include "lexer_script.h"
+#include "lexer_expr.h"
+
+// A function defined with "func name(a, b):". Parameters and every name the
+// body assigns to are locals; each gets a fixed slot in the call frame.
+typedef struct {
+    char *name;
+    unsigned id;         // Different for every function, block ones too
+    int paramCount;
+    char **localNames;   // Parameters first
+    int localCount;
+    Script *script;
+    int bodyStart;
+    int bodyEnd;
+    int generator;       // The body yields, so calls make a coroutine
+} Function;
+
+// Locals live in one preallocated stack of slots. Slot 0 of a frame holds
+// the return value and a slot whose name is NULL has not been assigned.
+typedef struct CallFrame {
+    Function *function;
+    Variable *slots;
+    // Frame whose locals can be read too when a name is not one of these,
+    // as the body of a parallel_for reads those of the function around it
+    const struct CallFrame *outer;
+} CallFrame;
+
+#define DEFAULT_STACK_SIZE 2048
+
+// Number of slots in the frame stack, which bounds the recursion depth
+extern int callStackSize;
+// Set by return until the running function body has unwound
+extern _Thread_local int returnPending;
+
+int defineFunction(Script *script, int index);
+Function *findFunction(const char *name);
+// Every function defined so far, in the order they were defined
+Function **definedFunctions(int *count);
+// Stores the value the call returned in result, or returns 0 if it
+// returned none
+int callFunction(Function *function, Expr **args, int argCount, Variable *result);
+void returnStatement(const char *expr);
+// Stop unless argCount is the number of parameters function takes
+void checkArgumentCount(const Function *function, int argCount);
+
+// A function for the block of the statement at index, with param as its
+// only parameter, for statements that run their block the way a call runs
+// a body. It is not defined under any name.
+Function *createBlockFunction(Script *script, int index, const char *param);
+void freeBlockFunction(Function *function);
+// Slot of a local is this plus one, or -1 if name is not a local
+int functionLocal(const Function *function, const char *name);
+// Whether the block from start to end assigns to name or loops over it,
+// which makes name a local of a function with that body
+int blockAssigns(const Script *script, int start, int end, const char *name);
+
+// Make slots the locals of function until leaveFrame, as a call does;
+// coroutines keep their locals outside the stack
+void enterFrame(Function *function, Variable *slots);
+void enterInnerFrame(Function *function, Variable *slots, const CallFrame *outer);
+void leaveFrame(void);
+int frameDepth(void);
+// The frame of the running function, or NULL outside a function
+const CallFrame *currentFrame(void);
+
+// How deep the calls on this thread are. An error raised partway through
+// calls leaves their frames behind; unwindStack drops the ones made after
+// the mark, as if each had returned.
+typedef struct {
+    int frames;
+    int slots;
+} StackMark;
+
+StackMark stackMark(void);
+void unwindStack(StackMark mark);
+// Free this thread's stack, for a thread that makes no more calls
+void freeCallStack(void);
+
+// Locals of the running function; both do nothing outside a function
+Variable *findLocal(const char *name);
+int storeLocal(const char *name, VarType type, void *value);
+// findLocal for a variable node. The slot is looked up by name once for
+// each function the node runs in, rather than on every evaluation.
+Variable *findLocalNode(Expr *expr);
+
+#endif // LEXER_FUNCTION_H
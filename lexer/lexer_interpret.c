@@ -2,44 +2,94 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <math.h>  // Add this for pow() function
 #include "lexer_display.h"
 #include "lexer_interpret.h"
+#include "lexer_array.h"
+#include "lexer_map.h"
+#include "lexer_function.h"
+#include "lexer_stream.h"
+#include "lexer_csv.h"
+#include "lexer_expr.h"
+#include "lexer_numeric.h"
+#include "lexer_coroutine.h"
+#include "lexer_parallel.h"
+#include "lexer_channel.h"
+#include "lexer_text.h"
+#include "lexer_trace.h"
+#include "lexer_prefetch.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
 
 // Remove duplicate type definitions since they're in lexar_interpret.h
-Variable *variables = NULL;
-size_t variableCount = 0;
+static _Thread_local Variable *variables = NULL;
+static _Thread_local size_t variableCount = 0;
 
 // Add global line number definition
-int currentLineNumber = 0;
+_Thread_local int currentLineNumber = 0;
 
 Variable *findVariable(const char *name) {
-    char *trimmed = strdup(name);
-    char *ptr = trimmed;
-    
-    // Trim leading whitespace
-    while (*ptr == ' ' || *ptr == '\t') ptr++;
-    
-    // Trim trailing whitespace
-    char *end = ptr + strlen(ptr) - 1;
-    while (end > ptr && (*end == ' ' || *end == '\t')) {
-        *end = '\0';
-        end--;
+    // Names from parsed expressions are trimmed already; only copy the rest
+    char trimmed[256];
+    size_t length = strlen(name);
+    if (length > 0 && (name[0] == ' ' || name[0] == '\t' ||
+                       name[length - 1] == ' ' || name[length - 1] == '\t')) {
+        while (*name == ' ' || *name == '\t') {
+            name++;
+            length--;
+        }
+        while (length > 0 && (name[length - 1] == ' ' || name[length - 1] == '\t')) length--;
+        if (length >= sizeof(trimmed)) {
+            return NULL;
+        }
+        memcpy(trimmed, name, length);
+        trimmed[length] = '\0';
+        name = trimmed;
+    }
+
+    // Locals of the running function hide globals of the same name
+    Variable *local = findLocal(name);
+    if (local) {
+        return local->name ? local : NULL;
     }
+    return findGlobal(name);
+}
 
+Variable *findGlobal(const char *name) {
     for (size_t i = 0; i < variableCount; i++) {
-        if (strcmp(variables[i].name, ptr) == 0) {
-            free(trimmed);
+        if (strcmp(variables[i].name, name) == 0) {
             return &variables[i];
         }
     }
-    free(trimmed);
     return NULL;
 }
 
+VariableTable currentVariables(void) {
+    VariableTable table = { variables, variableCount };
+    return table;
+}
+
+VariableTable useVariables(VariableTable table) {
+    VariableTable previous = currentVariables();
+    variables = table.items;
+    variableCount = table.count;
+    return previous;
+}
+
+void clearVariables(void) {
+    for (size_t i = 0; i < variableCount; i++) {
+        releaseValue(&variables[i]);
+        memFree(variables[i].name);
+    }
+    memFree(variables);
+    variables = NULL;
+    variableCount = 0;
+}
+
 void addVariable(const char *name, VarType type, void *value) {
-    variables = realloc(variables, (variableCount + 1) * sizeof(Variable));
-    variables[variableCount].name = strdup(name);
+    variables = memRealloc(variables, (variableCount + 1) * sizeof(Variable));
+    variables[variableCount].name = memStrdup(name);
     variables[variableCount].type = type;
     if (type == INT) {
         variables[variableCount].value.intValue = *(int *)value;
@@ -47,8 +97,20 @@ void addVariable(const char *name, VarType type, void *value) {
         variables[variableCount].value.floatValue = *(float *)value;
     } else if (type == BOOLEAN) {
         variables[variableCount].value.boolValue = *(int *)value;
+    } else if (type == ARRAY) {
+        variables[variableCount].value.arrayValue = *(Array **)value;
+        retainArray(variables[variableCount].value.arrayValue);
+    } else if (type == MAP) {
+        variables[variableCount].value.mapValue = *(Map **)value;
+        retainMap(variables[variableCount].value.mapValue);
+    } else if (type == COROUTINE) {
+        variables[variableCount].value.coroutineValue = *(Coroutine **)value;
+        retainCoroutine(variables[variableCount].value.coroutineValue);
+    } else if (type == CHANNEL) {
+        variables[variableCount].value.channelValue = *(Channel **)value;
+        retainChannel(variables[variableCount].value.channelValue);
     } else {
-        variables[variableCount].value.stringValue = strdup((char *)value);
+        stringCopy(&variables[variableCount].value.stringValue, (String *)value);
     }
     variableCount++;
 }
@@ -104,63 +166,59 @@ int isComparisonOperator(const char *str) {
 }
 
 Variable performOperation(Variable *left, Variable *right, const char *operator) {
-    Variable result;
-    
     // Type checking
+    if (left->type == STRING && right->type == STRING && strcmp(operator, "+") == 0) {
+        const String *parts[2] = { &left->value.stringValue, &right->value.stringValue };
+        Variable result;
+        result.type = STRING;
+        textConcat(&result.value.stringValue, parts, 2);
+        return result;
+    }
     if (left->type == STRING || right->type == STRING) {
-        fprintf(stderr, "Error on line %d: Cannot perform arithmetic operations with strings\n", currentLineNumber);
-        exit(EXIT_FAILURE);  // Changed from exit(1)
+        raiseError(ERROR_TYPE, currentLineNumber, "Cannot perform arithmetic operations with strings");
     }
 
     if (left->type == BOOLEAN || right->type == BOOLEAN) {
-        fprintf(stderr, "Error on line %d: Cannot perform arithmetic operations with booleans\n", currentLineNumber);
-        exit(EXIT_FAILURE);  // Changed from exit(1)
+        raiseError(ERROR_TYPE, currentLineNumber, "Cannot perform arithmetic operations with booleans");
     }
-    
-    float leftVal = (left->type == FLOAT) ? left->value.floatValue : (float)left->value.intValue;
-    float rightVal = (right->type == FLOAT) ? right->value.floatValue : (float)right->value.intValue;
-    
-    result.type = FLOAT;
-
-    if (strcmp(operator, "**") == 0) {
-        result.value.floatValue = pow(leftVal, rightVal);
-    } else if (strcmp(operator, "//") == 0) {
-        if (rightVal == 0) {
-            fprintf(stderr, "Error on line %d: Division by zero\n", currentLineNumber);
-            exit(EXIT_FAILURE);  // Changed from exit(1)
-        }
-        result.type = INT;
-        result.value.intValue = (int)(leftVal / rightVal);
-    } else if (strcmp(operator, "%") == 0) {
-        if (rightVal == 0) {
-            fprintf(stderr, "Error: Modulo by zero\n");
-            exit(EXIT_FAILURE);
-        }
-        result.type = INT;
-        result.value.intValue = (int)leftVal % (int)rightVal;
-    } else {
-        switch(operator[0]) {
-            case '+': result.value.floatValue = leftVal + rightVal; break;
-            case '-': result.value.floatValue = leftVal - rightVal; break;
-            case '*': result.value.floatValue = leftVal * rightVal; break;
-            case '/':
-                if (rightVal == 0) {
-                    fprintf(stderr, "Error: Division by zero\n");
-                    exit(EXIT_FAILURE);
-                }
-                result.value.floatValue = leftVal / rightVal;
-                break;
-        }
+
+    if (left->type == MAP || right->type == MAP) {
+        raiseError(ERROR_TYPE, currentLineNumber, "Cannot perform arithmetic operations with maps");
     }
 
-    // Convert to INT if result is a whole number and operation isn't division
-    if (result.type == FLOAT && operator[0] != '/' && 
-        result.value.floatValue == (int)result.value.floatValue) {
-        result.type = INT;
-        result.value.intValue = (int)result.value.floatValue;
+    if (left->type == COROUTINE || right->type == COROUTINE) {
+        raiseError(ERROR_TYPE, currentLineNumber, "Cannot perform arithmetic operations with coroutines");
     }
-    
-    return result;
+
+    if (left->type == CHANNEL || right->type == CHANNEL) {
+        raiseError(ERROR_TYPE, currentLineNumber, "Cannot perform arithmetic operations with channels");
+    }
+
+    // Whole-array arithmetic runs through the vectorized kernels
+    if (left->type == ARRAY || right->type == ARRAY) {
+        Variable result;
+        result.type = ARRAY;
+        result.value.arrayValue = arrayArithmetic(left, right, operator);
+        return result;
+    }
+
+    return numericOperation(left, right, operator);
+}
+
+// Numbers are true unless zero, strings, arrays and maps unless empty,
+// coroutines and channels always
+int isTrue(const Variable *value) {
+    switch(value->type) {
+        case BOOLEAN: return value->value.boolValue;
+        case INT: return value->value.intValue != 0;
+        case FLOAT: return value->value.floatValue != 0;
+        case STRING: return stringLength(&value->value.stringValue) > 0;
+        case ARRAY: return value->value.arrayValue->length > 0;
+        case MAP: return value->value.mapValue->liveCount > 0;
+        case COROUTINE: return 1;
+        case CHANNEL: return 1;
+    }
+    return 0;
 }
 
 Variable performLogicalOperation(Variable *left, Variable *right, const char *operator) {
@@ -168,25 +226,8 @@ Variable performLogicalOperation(Variable *left, Variable *right, const char *op
     result.type = BOOLEAN;
 
     // Convert operands to boolean values
-    int leftBool = 0, rightBool = 0;
-
-    if (left) {
-        switch(left->type) {
-            case BOOLEAN: leftBool = left->value.boolValue; break;
-            case INT: leftBool = left->value.intValue != 0; break;
-            case FLOAT: leftBool = left->value.floatValue != 0; break;
-            case STRING: leftBool = strlen(left->value.stringValue) > 0; break;
-        }
-    }
-
-    if (right) {
-        switch(right->type) {
-            case BOOLEAN: rightBool = right->value.boolValue; break;
-            case INT: rightBool = right->value.intValue != 0; break;
-            case FLOAT: rightBool = right->value.floatValue != 0; break;
-            case STRING: rightBool = strlen(right->value.stringValue) > 0; break;
-        }
-    }
+    int leftBool = left ? isTrue(left) : 0;
+    int rightBool = right ? isTrue(right) : 0;
 
     if (strcmp(operator, "AND") == 0) {
         result.value.boolValue = leftBool && rightBool;
@@ -200,9 +241,6 @@ Variable performLogicalOperation(Variable *left, Variable *right, const char *op
 }
 
 Variable performComparison(Variable *left, Variable *right, const char *operator) {
-    Variable result;
-    result.type = BOOLEAN;
-
     // Convert operands to comparable values
     float leftVal, rightVal;
 
@@ -210,271 +248,932 @@ Variable performComparison(Variable *left, Variable *right, const char *operator
         case INT: leftVal = (float)left->value.intValue; break;
         case FLOAT: leftVal = left->value.floatValue; break;
         case BOOLEAN: leftVal = (float)left->value.boolValue; break;
+        case ARRAY:
+        case MAP:
+            raiseError(ERROR_TYPE, currentLineNumber, "Cannot compare arrays or maps");
+        case COROUTINE:
+            raiseError(ERROR_TYPE, currentLineNumber, "Cannot compare coroutines");
+        case CHANNEL:
+            raiseError(ERROR_TYPE, currentLineNumber, "Cannot compare channels");
         default:
-            fprintf(stderr, "Error on line %d: Cannot compare string values\n", currentLineNumber);
-            exit(EXIT_FAILURE);
+            raiseError(ERROR_TYPE, currentLineNumber, "Cannot compare string values");
     }
 
     switch(right->type) {
         case INT: rightVal = (float)right->value.intValue; break;
         case FLOAT: rightVal = right->value.floatValue; break;
         case BOOLEAN: rightVal = (float)right->value.boolValue; break;
+        case ARRAY:
+        case MAP:
+            raiseError(ERROR_TYPE, currentLineNumber, "Cannot compare arrays or maps");
+        case COROUTINE:
+            raiseError(ERROR_TYPE, currentLineNumber, "Cannot compare coroutines");
+        case CHANNEL:
+            raiseError(ERROR_TYPE, currentLineNumber, "Cannot compare channels");
         default:
-            fprintf(stderr, "Error on line %d: Cannot compare string values\n", currentLineNumber);
-            exit(EXIT_FAILURE);
+            raiseError(ERROR_TYPE, currentLineNumber, "Cannot compare string values");
     }
 
-    if (strcmp(operator, ">") == 0) {
-        result.value.boolValue = leftVal > rightVal;
-    } else if (strcmp(operator, "<") == 0) {
-        result.value.boolValue = leftVal < rightVal;
-    } else if (strcmp(operator, ">=") == 0) {
-        result.value.boolValue = leftVal >= rightVal;
-    } else if (strcmp(operator, "<=") == 0) {
-        result.value.boolValue = leftVal <= rightVal;
-    } else if (strcmp(operator, "==") == 0) {
-        result.value.boolValue = leftVal == rightVal;
+    return compareNumbers(leftVal, rightVal, operator);
+}
+
+// Find the first occurrence of token that is not nested inside quotes,
+// brackets or parentheses
+char *findTopLevel(char *str, const char *token) {
+    size_t tokenLen = strlen(token);
+    int depth = 0;
+    char quote = 0;
+
+    for (char *c = str; *c; c++) {
+        if (quote) {
+            if (*c == quote) quote = 0;
+            continue;
+        }
+        if (depth == 0 && strncmp(c, token, tokenLen) == 0) {
+            return c;
+        }
+        if (*c == '"' || *c == '\'') {
+            quote = *c;
+        } else if (*c == '[' || *c == '(' || *c == '{') {
+            depth++;
+        } else if (*c == ']' || *c == ')' || *c == '}') {
+            depth--;
+        }
     }
+    return NULL;
+}
 
-    return result;
+char *nextArgument(char **cursor) {
+    char *start = *cursor;
+    if (!start) return NULL;
+
+    while (*start == ' ' || *start == '\t') start++;
+    if (*start == '\0') {
+        *cursor = NULL;
+        return NULL;
+    }
+
+    char *comma = findTopLevel(start, ",");
+    if (comma) {
+        *comma = '\0';
+        *cursor = comma + 1;
+    } else {
+        *cursor = NULL;
+    }
+
+    char *end = start + strlen(start) - 1;
+    while (end > start && (*end == ' ' || *end == '\t')) {
+        *end = '\0';
+        end--;
+    }
+    return start;
 }
 
-Variable *evaluateExpression(const char *expr) {
-    char *trimmed = strdup(expr);
-    char *ptr = trimmed;
-    
-    while (*ptr == ' ' || *ptr == '\t') ptr++;
-
-    // Handle single negative number directly
-    if ((*ptr == '-' && isdigit(*(ptr + 1))) && !strchr(ptr + 1, '+') && 
-        !strchr(ptr + 1, '*') && !strchr(ptr + 1, '/') && !strchr(ptr + 1, '%')) {
-        Variable *result = malloc(sizeof(Variable));
-        if (isFloat(ptr)) {
-            result->type = FLOAT;
-            result->value.floatValue = parseFloat(ptr);
+void copyValue(Variable *dest, const Variable *src) {
+    dest->name = NULL;
+    dest->type = src->type;
+    dest->value = src->value;
+    if (src->type == STRING) {
+        stringCopy(&dest->value.stringValue, &src->value.stringValue);
+    } else if (src->type == ARRAY) {
+        retainArray(src->value.arrayValue);
+    } else if (src->type == MAP) {
+        retainMap(src->value.mapValue);
+    } else if (src->type == COROUTINE) {
+        retainCoroutine(src->value.coroutineValue);
+    } else if (src->type == CHANNEL) {
+        retainChannel(src->value.channelValue);
+    }
+}
+
+void releaseValue(Variable *value) {
+    if (value->type == STRING) {
+        stringRelease(&value->value.stringValue);
+    } else if (value->type == ARRAY) {
+        releaseArray(value->value.arrayValue);
+    } else if (value->type == MAP) {
+        releaseMap(value->value.mapValue);
+    } else if (value->type == COROUTINE) {
+        releaseCoroutine(value->value.coroutineValue);
+    } else if (value->type == CHANNEL) {
+        releaseChannel(value->value.channelValue);
+    }
+}
+
+void assignVariable(const char *name, const Variable *value) {
+    Variable stored = *value;
+    switch (value->type) {
+        case INT: updateVariable(name, INT, &stored.value.intValue); break;
+        case FLOAT: updateVariable(name, FLOAT, &stored.value.floatValue); break;
+        case BOOLEAN: updateVariable(name, BOOLEAN, &stored.value.boolValue); break;
+        case STRING: updateVariable(name, STRING, &stored.value.stringValue); break;
+        case ARRAY: updateVariable(name, ARRAY, &stored.value.arrayValue); break;
+        case MAP: updateVariable(name, MAP, &stored.value.mapValue); break;
+        case COROUTINE: updateVariable(name, COROUTINE, &stored.value.coroutineValue); break;
+        case CHANNEL: updateVariable(name, CHANNEL, &stored.value.channelValue); break;
+    }
+}
+
+static Array *expectArray(Variable *value, const char *what) {
+    if (!value || value->type != ARRAY) {
+        raiseError(ERROR_TYPE, currentLineNumber, "%s expects an array", what);
+    }
+    return value->value.arrayValue;
+}
+
+static long expectIndex(Expr *expr) {
+    Variable index;
+    if (!evaluateNode(expr, &index) || index.type != INT) {
+        raiseError(ERROR_TYPE, currentLineNumber, "Array index '%.*s' must be an integer",
+                   expr->textLength, expr->text);
+    }
+    return index.value.intValue;
+}
+
+static Map *expectMap(Variable *value, const char *what) {
+    if (!value || value->type != MAP) {
+        raiseError(ERROR_TYPE, currentLineNumber, "%s expects a map", what);
+    }
+    return value->value.mapValue;
+}
+
+// Look up key in a map into result, which then holds its own reference
+static void mapLookup(Map *map, Expr *keyExpr, Variable *result) {
+    Variable key;
+    Held held;
+    evaluateNodeValue(keyExpr, &key);
+    holdValue(&held, &key);
+    Variable *found = mapGet(map, &key);
+    if (!found) {
+        raiseError(ERROR_INDEX, currentLineNumber, "Key %.*s not found", keyExpr->textLength, keyExpr->text);
+    }
+    copyValue(result, found);
+    letGo(held.next);
+    releaseValue(&key);
+}
+
+// Evaluate a container, which may be missing, for indexing or a builtin.
+// Returns NULL if it is, or else container holding its value, which is
+// held with held until the caller lets go.
+static Variable *evaluateOperand(Expr *expr, Variable *container, Held *held) {
+    if (!expr || !evaluateNode(expr, container)) {
+        return NULL;
+    }
+    holdValue(held, container);
+    return container;
+}
+
+// Evaluate "base[index]" or "map[key]"
+static void evaluateIndex(Expr *expr, Variable *result) {
+    Variable value;
+    Held held;
+    Held *mark = heldMark();
+    Variable *container = evaluateOperand(expr->children[0], &value, &held);
+
+    result->name = NULL;
+    if (container && container->type == MAP) {
+        mapLookup(container->value.mapValue, expr->children[1], result);
+    } else if (container && container->type == STRING) {
+        long index = expectIndex(expr->children[1]);
+        result->type = STRING;
+        textCharacter(&result->value.stringValue, &container->value.stringValue, index);
+    } else {
+        arrayGet(expectArray(container, "Indexing"), expectIndex(expr->children[1]), result);
+    }
+
+    letGo(mark);
+    releaseValue(container);
+}
+
+// Evaluate "base[start:end]", where either bound may be left out
+static void evaluateSlice(Expr *expr, Variable *result) {
+    Variable value;
+    Held held;
+    Held *mark = heldMark();
+    Variable *container = evaluateOperand(expr->children[0], &value, &held);
+    result->name = NULL;
+    if (container && container->type == STRING) {
+        long start = expr->children[1] ? expectIndex(expr->children[1]) : 0;
+        long end = expr->children[2] ? expectIndex(expr->children[2]) : LONG_MAX;
+        result->type = STRING;
+        textSlice(&result->value.stringValue, &container->value.stringValue, start, end);
+        letGo(mark);
+        releaseValue(container);
+        return;
+    }
+    Array *array = expectArray(container, "Indexing");
+
+    long start = expr->children[1] ? expectIndex(expr->children[1]) : 0;
+    long end = expr->children[2] ? expectIndex(expr->children[2]) : (long)array->length;
+    result->type = ARRAY;
+    result->value.arrayValue = arraySlice(array, start, end);
+
+    letGo(mark);
+    releaseValue(container);
+}
+
+// Evaluate a call to a user-defined or builtin function
+static Coroutine *expectCoroutine(Variable *value, const char *what) {
+    if (!value || value->type != COROUTINE) {
+        raiseError(ERROR_TYPE, currentLineNumber, "%s expects a generator or a task", what);
+    }
+    return value->value.coroutineValue;
+}
+
+// spawn(call) and await(task) into result. Unless a value is needed, await
+// returns 0 for a task that returned nothing.
+static int taskCall(Expr *expr, int needValue, Variable *result) {
+    Expr *arg = expr->childCount == 1 ? expr->children[0] : NULL;
+    if (strcmp(expr->name, "spawn") == 0) {
+        Function *function = arg && arg->kind == EXPR_CALL ? findFunction(arg->name) : NULL;
+        if (!function) {
+            raiseError(ERROR_TYPE, currentLineNumber, "spawn() expects a call of a function");
+        }
+        result->name = NULL;
+        result->type = COROUTINE;
+        result->value.coroutineValue = spawnTask(function, arg->children, arg->childCount);
+        return 1;
+    }
+
+    Variable value;
+    Held held;
+    Held *mark = heldMark();
+    Coroutine *task = expectCoroutine(evaluateOperand(arg, &value, &held), "await()");
+    int returned = awaitTask(task, result);
+    if (!returned && needValue) {
+        raiseError(ERROR_TYPE, currentLineNumber, "%s() did not return a value", task->function->name);
+    }
+    letGo(mark);
+    releaseValue(&value);
+    return returned;
+}
+
+static Channel *expectChannel(Variable *value, const char *what) {
+    if (!value || value->type != CHANNEL) {
+        raiseError(ERROR_TYPE, currentLineNumber, "%s expects a channel", what);
+    }
+    return value->value.channelValue;
+}
+
+static int isChannelCall(const char *name) {
+    return strcmp(name, "channel") == 0 || strcmp(name, "send") == 0 || strcmp(name, "try_send") == 0 ||
+           strcmp(name, "recv") == 0 || strcmp(name, "try_recv") == 0 || strcmp(name, "close") == 0;
+}
+
+// channel(capacity, type), send(channel, value), try_send(channel, value),
+// recv(channel), try_recv(channel, default) and close(channel) into
+// result. Unless a value is needed, send and close return 0.
+static int channelCall(Expr *expr, int needValue, Variable *result) {
+    const char *name = expr->name;
+    Expr *arg = expr->childCount > 0 ? expr->children[0] : NULL;
+    Expr *secondArg = expr->childCount > 1 ? expr->children[1] : NULL;
+    int stored = 1;
+
+    if (strcmp(name, "channel") == 0) {
+        Variable capacityValue;
+        Variable typeValue;
+        Held held[2];
+        Held *mark = heldMark();
+        Variable *capacity = evaluateOperand(arg, &capacityValue, &held[0]);
+        Variable *type = evaluateOperand(secondArg, &typeValue, &held[1]);
+        int elementType = -1;
+        if (type && type->type == STRING) {
+            char *typeName = stringToText(&type->value.stringValue);
+            elementType = channelTypeFromName(typeName);
+            memFree(typeName);
+        }
+        if (!capacity || capacity->type != INT || capacity->value.intValue < 1 || expr->childCount > 2 ||
+            (type && elementType < 0)) {
+            raiseError(ERROR_TYPE, currentLineNumber,
+                       "channel() expects a capacity of at least 1 and an optional type name");
+        }
+        result->name = NULL;
+        result->type = CHANNEL;
+        result->value.channelValue = createChannel(capacity->value.intValue, elementType);
+        letGo(mark);
+        if (type) releaseValue(type);
+        return 1;
+    }
+
+    char what[32];
+    snprintf(what, sizeof(what), "%s()", name);
+    Variable target;
+    Held held[2];
+    Held *mark = heldMark();
+    Channel *channel = expectChannel(evaluateOperand(arg, &target, &held[0]), what);
+
+    if (strcmp(name, "send") == 0 || strcmp(name, "try_send") == 0) {
+        if (!secondArg) {
+            raiseError(ERROR_TYPE, currentLineNumber, "%s expects a channel and a value", what);
+        }
+        Variable value;
+        evaluateNodeValue(secondArg, &value);
+        holdValue(&held[1], &value);
+        if (name[0] == 's') {
+            channelSend(channel, &value);
+            stored = 0;
         } else {
-            result->type = INT;
-            result->value.intValue = atoi(ptr);
+            result->name = NULL;
+            result->type = BOOLEAN;
+            result->value.boolValue = channelTrySend(channel, &value);
         }
-        free(trimmed);
-        return result;
+        letGo(&held[0]);
+        releaseValue(&value);
+    } else if (strcmp(name, "recv") == 0) {
+        if (!channelRecv(channel, result)) {
+            raiseError(ERROR_RUNTIME, currentLineNumber, "recv() on a closed channel with no values left");
+        }
+    } else if (strcmp(name, "try_recv") == 0) {
+        if (!secondArg) {
+            raiseError(ERROR_TYPE, currentLineNumber, "try_recv() expects a channel and a default value");
+        }
+        // The default is only evaluated when there is no value to take
+        if (!channelTryRecv(channel, result)) {
+            evaluateNodeValue(secondArg, result);
+        }
+    } else {
+        channelClose(channel);
+        stored = 0;
     }
 
-    // First check for comparison operators
-    char *gtOp = strstr(ptr, ">=");
-    char *ltOp = strstr(ptr, "<=");
-    char *eqOp = strstr(ptr, "==");
-    char *gt = strstr(ptr, ">");
-    char *lt = strstr(ptr, "<");
-    
-    char *op = NULL;
-    const char *opStr = NULL;
-    int opLen = 1;
-
-    // Find the leftmost operator
-    if (gtOp && (!op || gtOp < op)) { op = gtOp; opStr = ">="; opLen = 2; }
-    if (ltOp && (!op || ltOp < op)) { op = ltOp; opStr = "<="; opLen = 2; }
-    if (eqOp && (!op || eqOp < op)) { op = eqOp; opStr = "=="; opLen = 2; }
-    if (gt && (!op || gt < op) && (gt != gtOp)) { op = gt; opStr = ">"; opLen = 1; }
-    if (lt && (!op || lt < op) && (lt != ltOp)) { op = lt; opStr = "<"; opLen = 1; }
-
-    if (op) {
-        *op = '\0';
-        char *leftStr = ptr;
-        char *rightStr = op + opLen;
-
-        Variable *left = evaluateExpression(leftStr);
-        Variable *right = evaluateExpression(rightStr);
-
-        if (left && right) {
-            Variable *result = malloc(sizeof(Variable));
-            *result = performComparison(left, right, opStr);
-            free(left);
-            free(right);
-            free(trimmed);
-            return result;
-        }
-        if (left) free(left);
-        if (right) free(right);
-        free(trimmed);
-        return NULL;
+    if (!stored && needValue) {
+        raiseError(ERROR_TYPE, currentLineNumber, "%s does not return a value", what);
     }
+    letGo(mark);
+    releaseValue(&target);
+    return stored;
+}
 
-    // Check for NOT/! operator first
-    if (strncmp(ptr, "NOT ", 4) == 0 || strncmp(ptr, "! ", 2) == 0 || ptr[0] == '!') {
-        Variable *operand = evaluateExpression(ptr + (ptr[0] == 'N' ? 4 : (ptr[0] == '!' && ptr[1] == ' ' ? 2 : 1)));
-        if (operand) {
-            Variable *result = malloc(sizeof(Variable));
-            *result = performLogicalOperation(operand, NULL, "NOT");
-            free(operand);
-            free(trimmed);
-            return result;
-        }
-    }
-
-    // Check for AND/OR/&&/|| operators
-    char *andOp = strstr(ptr, " AND ");
-    char *orOp = strstr(ptr, " OR ");
-    char *andSymbolOp = strstr(ptr, "&&");
-    char *orSymbolOp = strstr(ptr, "||");
-    op = NULL;
-    opStr = NULL;
-    opLen = 0;
-
-    // Find the leftmost operator
-    if (andOp && (!op || andOp < op)) { op = andOp; opStr = "AND"; opLen = 5; }
-    if (orOp && (!op || orOp < op)) { op = orOp; opStr = "OR"; opLen = 4; }
-    if (andSymbolOp && (!op || andSymbolOp < op)) { op = andSymbolOp; opStr = "AND"; opLen = 2; }
-    if (orSymbolOp && (!op || orSymbolOp < op)) { op = orSymbolOp; opStr = "OR"; opLen = 2; }
-
-    if (op) {
-        *op = '\0';
-        char *leftStr = ptr;
-        char *rightStr = op + opLen;
-
-        // Trim spaces around operators
-        while (*rightStr == ' ') rightStr++;
-
-        Variable *left = evaluateExpression(leftStr);
-        Variable *right = evaluateExpression(rightStr);
-
-        if (left && right) {
-            Variable *result = malloc(sizeof(Variable));
-            *result = performLogicalOperation(left, right, opStr);
-            free(left);
-            free(right);
-            free(trimmed);
-            return result;
-        }
-        if (left) free(left);
-        if (right) free(right);
-        free(trimmed);
-        return NULL;
+static int isTextCall(const char *name) {
+    return strcmp(name, "find") == 0 || strcmp(name, "contains") == 0 || strcmp(name, "split") == 0 ||
+           strcmp(name, "replace") == 0 || strcmp(name, "upper") == 0 || strcmp(name, "lower") == 0 ||
+           strcmp(name, "trim") == 0;
+}
+
+static const String *expectString(Variable *value, const char *what) {
+    if (!value || value->type != STRING) {
+        raiseError(ERROR_TYPE, currentLineNumber, "%s expects a string", what);
     }
+    return &value->value.stringValue;
+}
 
-    // Check for two-character operators first
-    op = NULL;
-    for (char *c = ptr; *c; c++) {
-        if ((c[0] == '*' && c[1] == '*') || 
-            (c[0] == '/' && c[1] == '/')) {
-            op = c;
-            break;
+// find(text, part), contains(text, part), split(text, separator),
+// replace(text, old, new), upper(text), lower(text) and trim(text). The
+// separator of split is optional.
+static void textCall(Expr *expr, Variable *result) {
+    const char *name = expr->name;
+    char what[32];
+    snprintf(what, sizeof(what), "%s()", name);
+    int isSplit = strcmp(name, "split") == 0;
+    int wanted = strcmp(name, "replace") == 0 ? 3 :
+                 strcmp(name, "find") == 0 || strcmp(name, "contains") == 0 ? 2 : 1;
+    if (expr->childCount != wanted && !(isSplit && expr->childCount == 2)) {
+        raiseError(ERROR_TYPE, currentLineNumber, "%s expects %s", what,
+                   isSplit ? "a string and an optional separator" :
+                   wanted == 3 ? "a string, the text to replace and its replacement" :
+                   wanted == 2 ? "a string and the text to look for" : "a string");
+    }
+
+    Variable args[3];
+    Held held[3];
+    Held *mark = heldMark();
+    for (int i = 0; i < expr->childCount; i++) {
+        expectString(evaluateOperand(expr->children[i], &args[i], &held[i]), what);
+    }
+    const String *text = &args[0].value.stringValue;
+    result->name = NULL;
+
+    if (strcmp(name, "find") == 0) {
+        result->type = INT;
+        result->value.intValue = (int)textFind(text, &args[1].value.stringValue);
+    } else if (strcmp(name, "contains") == 0) {
+        result->type = BOOLEAN;
+        result->value.boolValue = textFind(text, &args[1].value.stringValue) >= 0;
+    } else if (strcmp(name, "split") == 0) {
+        result->type = ARRAY;
+        result->value.arrayValue = textSplit(text, expr->childCount > 1 ? &args[1].value.stringValue : NULL);
+    } else {
+        result->type = STRING;
+        if (strcmp(name, "replace") == 0) {
+            textReplace(&result->value.stringValue, text, &args[1].value.stringValue, &args[2].value.stringValue);
+        } else if (strcmp(name, "trim") == 0) {
+            textTrim(&result->value.stringValue, text);
+        } else {
+            textChangeCase(&result->value.stringValue, text, name[0] == 'u');
+        }
+    }
+
+    letGo(mark);
+    for (int i = 0; i < expr->childCount; i++) {
+        releaseValue(&args[i]);
+    }
+}
+
+static void evaluateCall(Expr *expr, Variable *result) {
+    const char *name = expr->name;
+    Function *function = findFunction(name);
+    if (function) {
+        if (!callFunction(function, expr->children, expr->childCount, result)) {
+            raiseError(ERROR_TYPE, currentLineNumber, "%s() did not return a value", name);
+        }
+        return;
+    }
+
+    Expr *arg = expr->childCount > 0 ? expr->children[0] : NULL;
+    Expr *secondArg = expr->childCount > 1 ? expr->children[1] : NULL;
+    Variable first;
+    Variable second;
+    Held held[3];
+    Held *mark = heldMark();
+    result->name = NULL;
+
+    if (strcmp(name, "len") == 0) {
+        Variable *value = evaluateOperand(arg, &first, &held[0]);
+        result->type = INT;
+        if (value && value->type == STRING) {
+            result->value.intValue = (int)textLength(&value->value.stringValue);
+        } else if (value && value->type == MAP) {
+            result->value.intValue = (int)value->value.mapValue->liveCount;
+        } else {
+            result->value.intValue = (int)expectArray(value, "len()")->length;
+        }
+        letGo(mark);
+        releaseValue(value);
+        return;
+    }
+
+    if (strcmp(name, "sum") == 0 || strcmp(name, "min") == 0 ||
+        strcmp(name, "max") == 0 || strcmp(name, "mean") == 0) {
+        Variable *value = evaluateOperand(arg, &first, &held[0]);
+        *result = arrayReduce(expectArray(value, name), name);
+        result->name = NULL;
+        letGo(mark);
+        releaseValue(value);
+        return;
+    }
+
+    if (strcmp(name, "has") == 0) {
+        Variable *container = evaluateOperand(arg, &first, &held[0]);
+        Map *map = expectMap(container, "has()");
+        if (!secondArg) {
+            raiseError(ERROR_TYPE, currentLineNumber, "has() expects a map and a key");
+        }
+        evaluateNodeValue(secondArg, &second);
+        holdValue(&held[1], &second);
+        result->type = BOOLEAN;
+        result->value.boolValue = mapGet(map, &second) != NULL;
+        letGo(mark);
+        releaseValue(&second);
+        releaseValue(container);
+        return;
+    }
+
+    if (strcmp(name, "keys") == 0) {
+        Variable *container = evaluateOperand(arg, &first, &held[0]);
+        result->type = ARRAY;
+        result->value.arrayValue = mapKeys(expectMap(container, "keys()"));
+        letGo(mark);
+        releaseValue(container);
+        return;
+    }
+
+    if (strcmp(name, "lines") == 0) {
+        Variable *path = NULL;
+        if (arg) {
+            evaluateNodeValue(arg, &first);
+            path = &first;
+            holdValue(&held[0], path);
+        }
+        LineSource source;
+        linesOpen(&source, path);
+        letGo(mark);
+        if (path) releaseValue(path);
+
+        result->type = ARRAY;
+        result->value.arrayValue = createArray(ARRAY_BOXED, 0);
+        Variable line;
+        line.name = NULL;
+        line.type = STRING;
+        while (lineSourceNext(&source, &line.value.stringValue)) {
+            arrayAppend(result->value.arrayValue, &line);
+            releaseValue(&line);
+        }
+        lineSourceClose(&source);
+        return;
+    }
+
+    if (strcmp(name, "read_csv") == 0) {
+        Variable *path = NULL;
+        Variable *delimiter = NULL;
+        if (arg) {
+            evaluateNodeValue(arg, &first);
+            path = &first;
+            holdValue(&held[0], path);
         }
-        // Check for modulo or single operators
-        if (*c == '%' || (*c == '*' || *c == '/' || *c == '+' || *c == '-')) {
-            if (*c == '-' && (c == ptr || isOperator(*(c-1)))) {
-                continue;  // Skip leading minus or minus after operator
+        if (secondArg) {
+            evaluateNodeValue(secondArg, &second);
+            delimiter = &second;
+            holdValue(&held[1], delimiter);
+        }
+        if (!path || path->type != STRING ||
+            (delimiter && (delimiter->type != STRING || stringLength(&delimiter->value.stringValue) != 1))) {
+            raiseError(ERROR_TYPE, currentLineNumber,
+                       "read_csv() expects a file name and an optional one character delimiter");
+        }
+        char *fileName = stringToText(&path->value.stringValue);
+        holdBuffer(&held[2], &fileName);
+        result->type = MAP;
+        result->value.mapValue = readCsv(fileName, delimiter ? stringData(&delimiter->value.stringValue)[0] : ',');
+        letGo(mark);
+        memFree(fileName);
+        releaseValue(path);
+        if (delimiter) releaseValue(delimiter);
+        return;
+    }
+
+    if (strcmp(name, "spawn") == 0 || strcmp(name, "await") == 0) {
+        taskCall(expr, 1, result);
+        return;
+    }
+
+    if (isTextCall(name)) {
+        textCall(expr, result);
+        return;
+    }
+
+    if (isChannelCall(name)) {
+        channelCall(expr, 1, result);
+        return;
+    }
+
+    if (strcmp(name, "next") == 0) {
+        Variable *value = evaluateOperand(arg, &first, &held[0]);
+        Coroutine *coroutine = expectCoroutine(value, "next()");
+        if (!coroutineNext(coroutine, result)) {
+            raiseError(ERROR_VALUE, currentLineNumber, "%s() has no more values", coroutine->function->name);
+        }
+        letGo(mark);
+        releaseValue(value);
+        return;
+    }
+
+    if (strcmp(name, "done") == 0) {
+        Variable *value = evaluateOperand(arg, &first, &held[0]);
+        result->type = BOOLEAN;
+        result->value.boolValue = coroutineDone(expectCoroutine(value, "done()"));
+        letGo(mark);
+        releaseValue(value);
+        return;
+    }
+
+    if (strcmp(name, "dot") == 0) {
+        Variable *left = evaluateOperand(arg, &first, &held[0]);
+        Variable *right = evaluateOperand(secondArg, &second, &held[1]);
+        *result = arrayDot(expectArray(left, "dot()"), expectArray(right, "dot()"));
+        result->name = NULL;
+        letGo(mark);
+        releaseValue(left);
+        releaseValue(right);
+        return;
+    }
+
+    raiseError(ERROR_NAME, currentLineNumber, "Unknown function '%s'", name);
+}
+
+// AND and OR only evaluate their right side when the left side does not
+// decide the result
+int evaluateTruth(Expr *expr) {
+    if (expr->kind == EXPR_LOGICAL) {
+        int left = evaluateTruth(expr->children[0]);
+        if (left < 0 || left == (expr->operator[0] == 'O')) {
+            return left;
+        }
+        return evaluateTruth(expr->children[1]);
+    }
+    if (expr->kind == EXPR_NOT) {
+        int operand = evaluateTruth(expr->children[0]);
+        return operand < 0 ? operand : !operand;
+    }
+
+    Variable value;
+    if (!evaluateNode(expr, &value)) {
+        return -1;
+    }
+    // Values the type checker proved boolean need no conversion
+    int result = expr->types == TYPE_BIT(BOOLEAN) ? value.value.boolValue : isTrue(&value);
+    releaseValue(&value);
+    return result;
+}
+
+// Terms of a sum gathered at once; a longer sum is taken in pieces
+#define CONCAT_MAX_TERMS 32
+
+// Replace the string in sum with it and the strings in rest after it,
+// releasing them all
+static void joinStrings(Variable *sum, Variable *rest, int restCount) {
+    const String *parts[CONCAT_MAX_TERMS];
+    parts[0] = &sum->value.stringValue;
+    for (int i = 0; i < restCount; i++) {
+        parts[i + 1] = &rest[i].value.stringValue;
+    }
+    String joined;
+    textConcat(&joined, parts, restCount + 1);
+    releaseValue(sum);
+    for (int i = 0; i < restCount; i++) {
+        releaseValue(&rest[i]);
+    }
+    sum->value.stringValue = joined;
+}
+
+static int isAddition(const Expr *expr) {
+    return expr->kind == EXPR_ARITHMETIC && !expr->proven && strcmp(expr->operator, "+") == 0;
+}
+
+// Add the terms of "a + b + c ..." from the left into sum. Strings next to
+// each other are held back and joined in one buffer once something else
+// comes or the terms run out, rather than making a new string for every +.
+static int evaluateSum(Expr *expr, Variable *sum) {
+    Expr *terms[CONCAT_MAX_TERMS];
+    int termCount = 0;
+    while (isAddition(expr) && termCount < CONCAT_MAX_TERMS - 1) {
+        terms[termCount++] = expr->children[1];
+        expr = expr->children[0];
+    }
+    terms[termCount++] = expr;
+
+    Variable pending[CONCAT_MAX_TERMS];
+    Held held[CONCAT_MAX_TERMS + 1];
+    Held *mark = heldMark();
+    int pendingCount = 0;
+    int hasSum = evaluateNode(terms[termCount - 1], sum);
+    if (hasSum) holdValue(&held[CONCAT_MAX_TERMS], sum);
+    Held *sumMark = heldMark();
+    int missing = !hasSum;
+    for (int i = termCount - 2; i >= 0; i--) {
+        Variable term;
+        int found = evaluateNode(terms[i], &term);
+        if (missing || !found) {
+            missing = 1;
+        } else if (sum->type == STRING && term.type == STRING) {
+            pending[pendingCount] = term;
+            holdValue(&held[pendingCount], &pending[pendingCount]);
+            pendingCount++;
+            continue;
+        } else {
+            if (pendingCount > 0) {
+                letGo(sumMark);
+                joinStrings(sum, pending, pendingCount);
+                pendingCount = 0;
             }
-            if (!op) op = c;
+            holdValue(&held[0], &term);
+            Variable added = performOperation(sum, &term, "+");
+            letGo(sumMark);
+            releaseValue(sum);
+            *sum = added;
         }
+        if (found) releaseValue(&term);
+    }
+    if (pendingCount > 0) {
+        letGo(sumMark);
+        joinStrings(sum, pending, pendingCount);
     }
+    letGo(mark);
+    if (missing && hasSum) {
+        releaseValue(sum);
+    }
+    return !missing;
+}
 
-    if (!op) {
-        // First check if it's a simple variable or value
-        if (!strchr(ptr, '+') && !strchr(ptr, '/') && !strchr(ptr, '*')) {
-            Variable *var = findVariable(ptr);
-            if (var) {
-                Variable *result = malloc(sizeof(Variable));
-                *result = *var;
-                free(trimmed);
-                return result;
+// Evaluate a binary operator. A proven node's operands were shown to be
+// numbers by the type checker, so their types need no checking here.
+static int evaluateOperator(Expr *expr, Variable *result) {
+    if (isAddition(expr)) {
+        return evaluateSum(expr, result);
+    }
+    Variable left;
+    Variable right;
+    Held held[2];
+    Held *mark = heldMark();
+    // Proven operands are numbers, which have nothing to release
+    int hasLeft = evaluateNode(expr->children[0], &left);
+    if (hasLeft && !expr->proven) holdValue(&held[0], &left);
+    int hasRight = evaluateNode(expr->children[1], &right);
+    if (hasRight && !expr->proven) holdValue(&held[1], &right);
+
+    if (hasLeft && hasRight) {
+        if (expr->kind == EXPR_ARITHMETIC) {
+            *result = expr->proven ? numericOperation(&left, &right, expr->operator)
+                                   : performOperation(&left, &right, expr->operator);
+        } else if (expr->kind == EXPR_COMPARISON && expr->proven) {
+            *result = compareNumbers(numberAsFloat(&left), numberAsFloat(&right), expr->operator);
+        } else {
+            *result = performComparison(&left, &right, expr->operator);
+        }
+    }
+
+    letGo(mark);
+    if (hasLeft) releaseValue(&left);
+    if (hasRight) releaseValue(&right);
+    return hasLeft && hasRight;
+}
+
+static int evaluateKind(Expr *expr, Variable *result) {
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            copyValue(result, &expr->value);
+            return 1;
+
+        case EXPR_VARIABLE: {
+            // The slot of a local is kept in the node; only globals are
+            // looked up by name
+            Variable *var = findLocalNode(expr);
+            if (!var) {
+                var = findGlobal(expr->name);
+            } else if (!var->name) {
+                var = NULL;
             }
-            // Try parsing as number
-            if (isdigit(*ptr) || (*ptr == '-' && isdigit(*(ptr + 1)))) {
-                Variable *result = malloc(sizeof(Variable));
-                if (isFloat(ptr)) {
-                    result->type = FLOAT;
-                    result->value.floatValue = parseFloat(ptr);
-                } else {
-                    result->type = INT;
-                    result->value.intValue = atoi(ptr);
-                }
-                free(trimmed);
-                return result;
+            if (!var) {
+                return 0;
             }
-            free(trimmed);
-            return NULL;
+            copyValue(result, var);
+            return 1;
         }
+
+        case EXPR_ARRAY: {
+            Held held[2];
+            result->type = ARRAY;
+            result->value.arrayValue = createArray(ARRAY_INT, 0);
+            holdValue(&held[0], result);
+            for (int i = 0; i < expr->childCount; i++) {
+                Variable value;
+                evaluateNodeValue(expr->children[i], &value);
+                holdValue(&held[1], &value);
+                arrayAppend(result->value.arrayValue, &value);
+                letGo(&held[0]);
+                releaseValue(&value);
+            }
+            letGo(held[0].next);
+            return 1;
+        }
+
+        case EXPR_MAP: {
+            Held held[3];
+            result->type = MAP;
+            result->value.mapValue = createMap();
+            holdValue(&held[0], result);
+            for (int i = 0; i < expr->childCount; i += 2) {
+                Variable key;
+                Variable value;
+                evaluateNodeValue(expr->children[i], &key);
+                holdValue(&held[1], &key);
+                evaluateNodeValue(expr->children[i + 1], &value);
+                holdValue(&held[2], &value);
+                mapSet(result->value.mapValue, &key, &value);
+                letGo(&held[0]);
+                releaseValue(&key);
+                releaseValue(&value);
+            }
+            letGo(held[0].next);
+            return 1;
+        }
+
+        case EXPR_INDEX:
+            evaluateIndex(expr, result);
+            return 1;
+
+        case EXPR_SLICE:
+            evaluateSlice(expr, result);
+            return 1;
+
+        case EXPR_CALL:
+            evaluateCall(expr, result);
+            return 1;
+
+        case EXPR_LOGICAL:
+        case EXPR_NOT: {
+            int truth = evaluateTruth(expr);
+            if (truth < 0) {
+                return 0;
+            }
+            result->type = BOOLEAN;
+            result->value.boolValue = truth;
+            return 1;
+        }
+
+        default:
+            return evaluateOperator(expr, result);
+    }
+}
+
+int evaluateNode(Expr *expr, Variable *result) {
+    if (!evaluateKind(expr, result)) {
+        return 0;
+    }
+    result->name = NULL;
+    return 1;
+}
+
+void evaluateNodeValue(Expr *expr, Variable *result) {
+    if (!evaluateNode(expr, result)) {
+        raiseError(ERROR_SYNTAX, currentLineNumber, "Invalid value '%.*s'", expr->textLength, expr->text);
+    }
+}
+
+int evaluateExpression(const char *expr, Variable *result) {
+    Expr *parsed = parseExpression(expr);
+    return parsed && evaluateNode(parsed, result);
+}
+
+void evaluateValue(const char *text, Variable *result) {
+    Expr *parsed = parseExpression(text);
+    if (!parsed) {
+        raiseError(ERROR_SYNTAX, currentLineNumber, "Invalid value '%s'", text);
+    }
+    evaluateNodeValue(parsed, result);
+}
+
+// Handle "append(array, value)" and "remove(map, key)"
+static void containerStatement(const char *command) {
+    int isAppend = strncmp(command, "append(", 7) == 0;
+    if (!strrchr(command, ')')) {
+        raiseError(ERROR_SYNTAX, currentLineNumber, "Missing closing parenthesis");
+    }
+
+    Expr *call = parseExpression(command);
+    if (!call || call->kind != EXPR_CALL || call->childCount != 2) {
+        raiseError(ERROR_SYNTAX, currentLineNumber, "%s expects two arguments", isAppend ? "append" : "remove");
     }
 
-    // Handle two-character operators
-    char operator[3] = {0};
-    char *rightStr;
-    if ((op[0] == '*' && op[1] == '*') || (op[0] == '/' && op[1] == '/')) {
-        operator[0] = op[0];
-        operator[1] = op[1];
-        *op = '\0';
-        rightStr = op + 2;
+    Variable containerValue;
+    Variable value;
+    Held held[2];
+    Held *mark = heldMark();
+    Variable *container = evaluateOperand(call->children[0], &containerValue, &held[0]);
+    evaluateNodeValue(call->children[1], &value);
+    holdValue(&held[1], &value);
+    if (isAppend) {
+        arrayAppend(expectArray(container, "append()"), &value);
     } else {
-        operator[0] = *op;
-        *op = '\0';
-        rightStr = op + 1;
+        mapRemove(expectMap(container, "remove()"), &value);
     }
-    char *leftStr = ptr;
 
-    // Split the expression and save the operator
-    char *left_trimmed = strdup(leftStr);
-    char *right_trimmed = strdup(rightStr);
-    
-    char *left_ptr = left_trimmed;
-    char *right_ptr = right_trimmed;
-    
-    // Trim left operand
-    while (*left_ptr == ' ' || *left_ptr == '\t') left_ptr++;
-    char *left_end = left_ptr + strlen(left_ptr) - 1;
-    while (left_end > left_ptr && (*left_end == ' ' || *left_end == '\t')) {
-        *left_end = '\0';
-        left_end--;
+    letGo(mark);
+    releaseValue(&value);
+    releaseValue(container);
+}
+
+// Handle "name[index] = value"
+static void assignElement(const char *target, const char *valueStr) {
+    Expr *element = parseExpression(target);
+    if (!element || element->kind != EXPR_INDEX) {
+        raiseError(ERROR_SYNTAX, currentLineNumber, "Invalid assignment target '%s'", target);
     }
-    
-    // Trim right operand
-    while (*right_ptr == ' ' || *right_ptr == '\t') right_ptr++;
-    char *right_end = right_ptr + strlen(right_ptr) - 1;
-    while (right_end > right_ptr && (*right_end == ' ' || *right_end == '\t')) {
-        *right_end = '\0';
-        right_end--;
-    }
-
-    // Get operands
-    Variable *left = findVariable(left_ptr);
-    Variable *right = findVariable(right_ptr);
-    Variable temp_left, temp_right;
-
-    // Handle numeric literals for left operand
-    if (!left && (isdigit(*left_ptr) || (*left_ptr == '-' && isdigit(*(left_ptr + 1))))) {
-        temp_left.type = isFloat(left_ptr) ? FLOAT : INT;
-        if (temp_left.type == FLOAT)
-            temp_left.value.floatValue = parseFloat(left_ptr);
-        else
-            temp_left.value.intValue = atoi(left_ptr);
-        left = &temp_left;
-    }
-
-    // Handle numeric literals for right operand
-    if (!right && (isdigit(*right_ptr) || (*right_ptr == '-' && isdigit(*(right_ptr + 1))))) {
-        temp_right.type = isFloat(right_ptr) ? FLOAT : INT;
-        if (temp_right.type == FLOAT)
-            temp_right.value.floatValue = parseFloat(right_ptr);
-        else
-            temp_right.value.intValue = atoi(right_ptr);
-        right = &temp_right;
-    }
-
-    // Clean up
-    free(left_trimmed);
-    free(right_trimmed);
-    
-    if (!left || !right) {
-        free(trimmed);
-        return NULL;
+
+    Variable containerValue;
+    Variable value;
+    Variable key;
+    Held held[3];
+    Held *mark = heldMark();
+    Variable *container = evaluateOperand(element->children[0], &containerValue, &held[0]);
+    evaluateValue(valueStr, &value);
+    holdValue(&held[1], &value);
+    if (container && container->type == MAP) {
+        evaluateNodeValue(element->children[1], &key);
+        holdValue(&held[2], &key);
+        mapSet(container->value.mapValue, &key, &value);
+        letGo(&held[1]);
+        releaseValue(&key);
+    } else {
+        Array *array = expectArray(container, "Element assignment");
+        arraySet(array, expectIndex(element->children[1]), &value);
     }
 
-    // Create operator string and perform operation
-    Variable *result = malloc(sizeof(Variable));
-    *result = performOperation(left, right, operator);
+    letGo(mark);
+    releaseValue(&value);
+    releaseValue(container);
+}
 
-    free(trimmed);
-    return result;
+// Handle "name(args)" as a statement when name is a user-defined function
+// or a builtin that may be used as one. Any value it returns is discarded.
+static int callStatement(const char *command) {
+    Expr *call = parseExpression(command);
+    if (!call || call->kind != EXPR_CALL) {
+        return 0;
+    }
+    Function *function = findFunction(call->name);
+    Variable result;
+    int returned;
+    if (function) {
+        returned = callFunction(function, call->children, call->childCount, &result);
+    } else if (strcmp(call->name, "spawn") == 0 || strcmp(call->name, "await") == 0) {
+        returned = taskCall(call, 0, &result);
+    } else if (isChannelCall(call->name)) {
+        returned = channelCall(call, 0, &result);
+    } else {
+        return 0;
+    }
+    if (returned) releaseValue(&result);
+    return 1;
 }
 
 // Function to interpret and execute commands
@@ -496,14 +1195,18 @@ void interpretCommand(const char *command, int lineNumber) {
 
     // Handle display command
     if (strncmp(trimmed, "display(", 8) == 0) {
-        const char *closingParenthesis = strchr(command + 8, ')');
+        // Arguments may contain calls or indexes, so match the last parenthesis
+        const char *closingParenthesis = strrchr(trimmed + 8, ')');
         if (closingParenthesis) {
-            char *content = (char *)malloc(closingParenthesis - (command + 8) + 1);
-            strncpy(content, command + 8, closingParenthesis - (command + 8));
-            content[closingParenthesis - (command + 8)] = '\0';
+            char *content = (char *)memAlloc(closingParenthesis - (trimmed + 8) + 1);
+            Held held;
+            holdBuffer(&held, &content);
+            strncpy(content, trimmed + 8, closingParenthesis - (trimmed + 8));
+            content[closingParenthesis - (trimmed + 8)] = '\0';
 
             if (strstr(content, "%var") != NULL && strchr(content, ',') != NULL) {
-                char *format = strtok(content, ",");
+                char *cursor = content;
+                char *format = nextArgument(&cursor);
                 format[strlen(format) - 1] = '\0';
                 format++;
 
@@ -511,8 +1214,10 @@ void interpretCommand(const char *command, int lineNumber) {
                 char *vars[10];  // Maximum 10 variables
                 int varCount = 0;
                 char *var;
-                while ((var = strtok(NULL, ",")) != NULL) {
-                    while (*var == ' ') var++;  // Skip leading spaces
+                while ((var = nextArgument(&cursor)) != NULL) {
+                    if (varCount == 10) {
+                        raiseError(ERROR_SYNTAX, lineNumber, "Too many variables in display");
+                    }
                     vars[varCount++] = var;
                 }
 
@@ -521,7 +1226,7 @@ void interpretCommand(const char *command, int lineNumber) {
                 // Handle regular display cases
                 char *endptr;
                 long intValue = strtol(content, &endptr, 10);
-                if (*endptr == '\0') {
+                if (*endptr == '\0' && intValue >= INT_MIN && intValue <= INT_MAX) {
                     displayInt((int)intValue);
                 } else if (isFloat(content)) {
                     displayFloat(parseFloat(content));
@@ -530,19 +1235,24 @@ void interpretCommand(const char *command, int lineNumber) {
                     content[strlen(content) - 1] = '\0';
                     display(content + 1);
                 } else {
-                    printf("Syntax error on line %d: invalid format\n", lineNumber);
-                    exit(EXIT_FAILURE);
+                    raiseError(ERROR_SYNTAX, lineNumber, "Invalid display format");
                 }
             }
-            free(content);
+            letGo(held.next);
+            memFree(content);
         } else {
-            printf("Syntax error on line %d: missing closing parenthesis\n", lineNumber);
-            exit(EXIT_FAILURE);
+            raiseError(ERROR_SYNTAX, lineNumber, "Missing closing parenthesis");
         }
+    } else if (strncmp(trimmed, "append(", 7) == 0 || strncmp(trimmed, "remove(", 7) == 0) {
+        containerStatement(trimmed);
+    } else if (callStatement(trimmed)) {
+        return;
     } else if (strchr(trimmed, '=') != NULL) {
         char *equalsSign = strchr(command, '=');
         size_t nameLength = equalsSign - command;
-        char *name = (char *)malloc(nameLength + 1);
+        char *name = (char *)memAlloc(nameLength + 1);
+        Held held[2];
+        holdBuffer(&held[0], &name);
         strncpy(name, command, nameLength);
         name[nameLength] = '\0';
 
@@ -563,218 +1273,99 @@ void interpretCommand(const char *command, int lineNumber) {
         char *value = equalsSign + 1;
         while (*value == ' ') value++;
 
-        // Check for arithmetic expression first
-        Variable *result = evaluateExpression(value);
-        if (result) {
-            if (result->type == FLOAT) {
-                float floatVal = result->value.floatValue;
-                updateVariable(name, FLOAT, &floatVal);
-            } else if (result->type == INT) {
-                int intVal = result->value.intValue;
-                updateVariable(name, INT, &intVal);
-            } else if (result->type == BOOLEAN) {
-                int boolVal = result->value.boolValue;
-                updateVariable(name, BOOLEAN, &boolVal);
-            }
-            free(result);
-        } else {
-            // Handle non-expression assignments
-            if (strcmp(value, "true") == 0) {
-                int boolValue = 1;
-                updateVariable(name, BOOLEAN, &boolValue);
-            } else if (strcmp(value, "false") == 0) {
-                int boolValue = 0;
-                updateVariable(name, BOOLEAN, &boolValue);
-            } else if (isdigit(value[0]) || (value[0] == '-' && isdigit(value[1]))) {
-                if (isFloat(value)) {
-                    float floatValue = parseFloat(value);
-                    updateVariable(name, FLOAT, &floatValue);
-                } else {
-                    int intValue = atoi(value);
-                    updateVariable(name, INT, &intValue);
-                }
-            } else if (value[0] == '"' || value[0] == '\'') {
-                size_t valueLength = strlen(value);
-                value[valueLength - 1] = '\0';
-                updateVariable(name, STRING, value + 1);
-            }
+        // Element assignment: name[index] = value
+        if (name[0] != '\0' && name[strlen(name) - 1] == ']') {
+            assignElement(name, value);
+            letGo(held[0].next);
+            memFree(name);
+            return;
+        }
+
+        // Literals, expressions, indexes and calls all evaluate to a value
+        Variable result;
+        if (evaluateExpression(value, &result)) {
+            holdValue(&held[1], &result);
+            assignVariable(name, &result);
+            letGo(&held[0]);
+            releaseValue(&result);
         }
 
-        free(name);
+        letGo(held[0].next);
+        memFree(name);
     } else {
-        printf("Unknown command on line %d: %s\n", currentLineNumber, trimmed);
-        exit(EXIT_FAILURE);
+        raiseError(ERROR_SYNTAX, currentLineNumber, "Unknown command '%s'", trimmed);
     }
 }
 
 // Add implementation for control flow handling
 int evaluateCondition(const char *condition) {
-    Variable *result = evaluateExpression(condition);
-    if (!result) return 0;
-    
-    int value;
-    if (result->type == BOOLEAN) {
-        value = result->value.boolValue;
-    } else if (result->type == INT) {
-        value = result->value.intValue != 0;
-    } else if (result->type == FLOAT) {
-        value = result->value.floatValue != 0;
-    } else if (result->type == STRING) {
-        value = strlen(result->value.stringValue) > 0;
-    } else {
-        value = 0;
-    }
-    
-    free(result);
-    return value;
-}
-
-typedef struct {
-    int indentLevel;
-    int lastConditionMet;
-    int inControlBlock;
-    int skipNextBlock;  // Add flag to skip blocks after condition is met
-    int nestingLevel;
-} BlockState;
-
-// Update BlockState initialization
-BlockState blockState = {
-    .indentLevel = 0,
-    .lastConditionMet = 0,
-    .inControlBlock = 0,
-    .skipNextBlock = 0,
-    .nestingLevel = 0
-};
-
-void executeBlock(const char *line, FILE *file) {
-    char *nextLine = NULL;
-    size_t len = 0;
-    ssize_t read;
-    int currentNestLevel = blockState.nestingLevel;
-
-    read = getline(&nextLine, &len, file);
-    if (read == -1) {
-        free(nextLine);
-        return;
-    }
-    currentLineNumber++;  // Increment line counter for each line read
-
-    // Count initial indentation
-    int baseIndent = 0;
-    while (nextLine[baseIndent] == ' ' || nextLine[baseIndent] == '\t') baseIndent++;
-
-    // Process first line
-    if (nextLine[read-1] == '\n') nextLine[read-1] = '\0';
-    if (!blockState.skipNextBlock) {
-        // Check if this is another control statement
-        if (strncmp(nextLine + baseIndent, "if(", 3) == 0 ||
-            strncmp(nextLine + baseIndent, "elseif(", 7) == 0 ||
-            strcmp(nextLine + baseIndent, "else:") == 0) {
-            blockState.nestingLevel++;
-            handleIfStatement(nextLine + baseIndent, file);
-        } else {
-            interpretCommand(nextLine + baseIndent, currentLineNumber);
-        }
-    }
-    free(nextLine);
-    nextLine = NULL;
-
-    while ((read = getline(&nextLine, &len, file)) != -1) {
-        currentLineNumber++;  // Increment line counter for each line read
-        
-        if (nextLine[read-1] == '\n') nextLine[read-1] = '\0';
-        
-        int indent = 0;
-        while (nextLine[indent] == ' ' || nextLine[indent] == '\t') indent++;
-        
-        if (indent < baseIndent) {
-            ungetc('\n', file);
-            for (int i = strlen(nextLine) - 1; i >= 0; i--) {
-                ungetc(nextLine[i], file);
-            }
-            currentLineNumber--;  // Decrement because we're putting this line back
-            break;
-        }
-        
-        if (indent == baseIndent && !blockState.skipNextBlock) {
-            char *line = nextLine + indent;
-            if (strncmp(line, "if(", 3) == 0 ||
-                strncmp(line, "elseif(", 7) == 0 ||
-                strcmp(line, "else:") == 0) {
-                blockState.nestingLevel++;
-                handleIfStatement(line, file);
-            } else {
-                interpretCommand(line, currentLineNumber);
-            }
-        }
-    }
-    
-    blockState.nestingLevel = currentNestLevel;
-    free(nextLine);
+    Expr *parsed = parseExpression(condition);
+    return parsed && evaluateTruth(parsed) > 0;
 }
 
-void handleIfStatement(const char *line, FILE *file) {
-    char condition[256];
-    int currentNestLevel = blockState.nestingLevel;
-    
-    if (strncmp(line, "if(", 3) == 0) {
-        if (sscanf(line, "if(%[^)]):", condition) != 1) {
-            fprintf(stderr, "Error: Invalid if statement syntax\n");
-            return;
-        }
-        blockState.inControlBlock = 1;
-        blockState.lastConditionMet = evaluateCondition(condition);
-        blockState.skipNextBlock = !blockState.lastConditionMet;
-        executeBlock(line, file);
+// Replace the value held by slot, which must hold a valid value already
+void setVariableValue(Variable *slot, VarType type, void *value) {
+    // Retain first so that assigning a value to itself keeps it alive
+    String text;
+    if (type == STRING) {
+        stringCopy(&text, (String *)value);
+    } else if (type == ARRAY) {
+        retainArray(*(Array **)value);
+    } else if (type == MAP) {
+        retainMap(*(Map **)value);
+    } else if (type == COROUTINE) {
+        retainCoroutine(*(Coroutine **)value);
+    } else if (type == CHANNEL) {
+        retainChannel(*(Channel **)value);
     }
-    else if (strncmp(line, "elseif(", 7) == 0) {
-        if (!blockState.inControlBlock) {
-            fprintf(stderr, "Error: elseif without if\n");
-            return;
-        }
-        if (blockState.lastConditionMet) {
-            blockState.skipNextBlock = 1;
-        } else {
-            if (sscanf(line, "elseif(%[^)]):", condition) == 1) {
-                blockState.lastConditionMet = evaluateCondition(condition);
-                blockState.skipNextBlock = !blockState.lastConditionMet;
-            }
-        }
-        executeBlock(line, file);
+
+    if (slot->type == STRING) {
+        stringRelease(&slot->value.stringValue);
+    } else if (slot->type == ARRAY) {
+        releaseArray(slot->value.arrayValue);
+    } else if (slot->type == MAP) {
+        releaseMap(slot->value.mapValue);
+    } else if (slot->type == COROUTINE) {
+        releaseCoroutine(slot->value.coroutineValue);
+    } else if (slot->type == CHANNEL) {
+        releaseChannel(slot->value.channelValue);
     }
-    else if (strcmp(line, "else:") == 0) {
-        if (!blockState.inControlBlock) {
-            fprintf(stderr, "Error: else without if\n");
-            return;
-        }
-        blockState.skipNextBlock = blockState.lastConditionMet;
-        executeBlock(line, file);
-        if (currentNestLevel == 0) {
-            blockState.inControlBlock = 0;
-            blockState.lastConditionMet = 0;
-        }
+
+    // Update type and value
+    slot->type = type;
+    if (type == STRING) {
+        slot->value.stringValue = text;
+    } else if (type == ARRAY) {
+        slot->value.arrayValue = *(Array **)value;
+    } else if (type == MAP) {
+        slot->value.mapValue = *(Map **)value;
+    } else if (type == COROUTINE) {
+        slot->value.coroutineValue = *(Coroutine **)value;
+    } else if (type == CHANNEL) {
+        slot->value.channelValue = *(Channel **)value;
+    } else if (type == INT) {
+        slot->value.intValue = *(int *)value;
+    } else if (type == FLOAT) {
+        slot->value.floatValue = *(float *)value;
+    } else if (type == BOOLEAN) {
+        slot->value.boolValue = *(int *)value;
     }
 }
 
 void updateVariable(const char *name, VarType type, void *value) {
+    traceEvent(TRACE_VARIABLE_WRITE, name);
+    // Inside a function every assignment goes to one of its locals
+    if (storeLocal(name, type, value)) {
+        return;
+    }
+    // The iterations of a parallel_for only ever write their own locals
+    if (parallelActive) {
+        raiseError(ERROR_RUNTIME, currentLineNumber, "parallel_for cannot assign to global '%s'", name);
+    }
+
     for (size_t i = 0; i < variableCount; i++) {
         if (strcmp(variables[i].name, name) == 0) {
-            // Free existing string if needed
-            if (variables[i].type == STRING && variables[i].value.stringValue) {
-                free(variables[i].value.stringValue);
-            }
-            
-            // Update type and value
-            variables[i].type = type;
-            if (type == STRING) {
-                variables[i].value.stringValue = strdup((char *)value);
-            } else if (type == INT) {
-                variables[i].value.intValue = *(int *)value;
-            } else if (type == FLOAT) {
-                variables[i].value.floatValue = *(float *)value;
-            } else if (type == BOOLEAN) {
-                variables[i].value.boolValue = *(int *)value;
-            }
+            setVariableValue(&variables[i], type, value);
             return;
         }
     }
@@ -788,36 +1379,159 @@ void parseImportStatement(const char *line, char *varName, char *fileName) {
     sscanf(line, "import %s from \"%[^\"]\"", varName, fileName);
 }
 
-void importVariableFromFile(const char *fileName, const char *varName) {
-    FILE *file = fopen(fileName, "r");
-    if (!file) {
-        fprintf(stderr, "Error: Could not open file %s\n", fileName);
-        exit(EXIT_FAILURE);
+static Module *modules = NULL;
+static int moduleCount = 0;
+
+Module *importedModules(int *count) {
+    *count = moduleCount;
+    return modules;
+}
+
+Module *addModule(const char *fileName) {
+    modules = memRealloc(modules, (moduleCount + 1) * sizeof(Module));
+    Module *module = &modules[moduleCount++];
+    module->fileName = memStrdup(fileName);
+    module->values = NULL;
+    module->count = 0;
+    return module;
+}
+
+ModuleValue *addModuleValue(Module *module, const char *name) {
+    module->values = memRealloc(module->values, (module->count + 1) * sizeof(ModuleValue));
+    ModuleValue *entry = &module->values[module->count++];
+    entry->name = memStrdup(name);
+    entry->value.name = NULL;
+    entry->known = 0;
+    return entry;
+}
+
+static void readModuleValue(ModuleValue *entry, const char *value) {
+    entry->known = 1;
+    if (value[0] == '"' && value[strlen(value) - 1] == '"') {
+        entry->value.type = STRING;
+        stringInit(&entry->value.value.stringValue, value + 1, strlen(value) - 2);
+    } else if (isFloat(value)) {
+        entry->value.type = FLOAT;
+        entry->value.value.floatValue = parseFloat(value);
+    } else if (isdigit(value[0]) || (value[0] == '-' && isdigit(value[1]))) {
+        entry->value.type = INT;
+        entry->value.value.intValue = atoi(value);
+    } else if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0) {
+        entry->value.type = BOOLEAN;
+        entry->value.value.boolValue = strcmp(value, "true") == 0;
+    } else {
+        entry->known = 0;
+    }
+}
+
+static Module *findModule(const char *fileName) {
+    for (int i = 0; i < moduleCount; i++) {
+        if (strcmp(modules[i].fileName, fileName) == 0) {
+            return &modules[i];
+        }
+    }
+    return NULL;
+}
+
+// Copy the next line of text into line as fgets would read it from a file
+static int nextTextLine(const char *text, size_t length, size_t *position, char *line, size_t size) {
+    if (*position >= length) {
+        return 0;
+    }
+    size_t count = 0;
+    while (count < size - 1 && *position < length) {
+        char c = text[(*position)++];
+        line[count++] = c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    line[count] = '\0';
+    return 1;
+}
+
+// Returns NULL if the file cannot be opened
+static Module *loadModule(const char *fileName) {
+    Module *module = findModule(fileName);
+    if (module) {
+        return module;
+    }
+    // A prefetch may have read it already
+    size_t length = 0;
+    size_t position = 0;
+    char *text = takePrefetched(fileName, &length);
+    FILE *file = NULL;
+    if (!text) {
+        file = fopen(fileName, "r");
+        if (!file) {
+            return NULL;
+        }
     }
+    traceEvent(TRACE_IMPORT, fileName);
+
+    module = addModule(fileName);
 
     char line[256];
-    while (fgets(line, sizeof(line), file)) {
+    while (text ? nextTextLine(text, length, &position, line, sizeof(line))
+                : fgets(line, sizeof(line), file) != NULL) {
         char name[256];
         char value[256];
-        if (sscanf(line, "%s = %[^\n]", name, value) == 2) {
-            if (strcmp(name, varName) == 0) {
-                if (value[0] == '"' && value[strlen(value) - 1] == '"') {
-                    value[strlen(value) - 1] = '\0';
-                    updateVariable(varName, STRING, value + 1);
-                } else if (isFloat(value)) {
-                    float floatValue = parseFloat(value);
-                    updateVariable(varName, FLOAT, &floatValue);
-                } else if (isdigit(value[0]) || (value[0] == '-' && isdigit(value[1]))) {
-                    int intValue = atoi(value);
-                    updateVariable(varName, INT, &intValue);
-                } else if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0) {
-                    int boolValue = (strcmp(value, "true") == 0) ? 1 : 0;
-                    updateVariable(varName, BOOLEAN, &boolValue);
-                }
-                break;
-            }
+        if (sscanf(line, "%s = %[^\n]", name, value) != 2) {
+            continue;
         }
+        int seen = 0;
+        for (int i = 0; i < module->count && !seen; i++) {
+            seen = strcmp(module->values[i].name, name) == 0;
+        }
+        if (seen) {
+            continue;
+        }
+        readModuleValue(addModuleValue(module, name), value);
+    }
+
+    if (file) {
+        fclose(file);
     }
+    memFree(text);
+    return module;
+}
+
+int preloadImport(const char *fileName) {
+    return loadModule(fileName) != NULL;
+}
 
-    fclose(file);
+void forgetImport(const char *fileName) {
+    Module *module = findModule(fileName);
+    if (!module) {
+        return;
+    }
+    for (int i = 0; i < module->count; i++) {
+        memFree(module->values[i].name);
+        if (module->values[i].known) {
+            releaseValue(&module->values[i].value);
+        }
+    }
+    memFree(module->values);
+    memFree(module->fileName);
+    *module = modules[--moduleCount];
+}
+
+void importVariableFromFile(const char *fileName, const char *varName) {
+    // Task blocks share the imported files
+    parallelLock();
+    Module *module = loadModule(fileName);
+    if (!module) {
+        raiseError(ERROR_IO, currentLineNumber, "Could not open file %s", fileName);
+    }
+
+    for (int i = 0; i < module->count; i++) {
+        ModuleValue *entry = &module->values[i];
+        if (strcmp(entry->name, varName) == 0) {
+            if (entry->known) {
+                assignVariable(varName, &entry->value);
+            }
+            break;
+        }
+    }
+    parallelUnlock();
 }
\ No newline at end of file
@@ -1,24 +1,51 @@
 #ifndef LEXER_INTERPRET_H
 #define LEXER_INTERPRET_H
 
-typedef enum { INT, STRING, FLOAT, BOOLEAN } VarType;
+#include "lexer_string.h"
+
+typedef enum { INT, STRING, FLOAT, BOOLEAN, ARRAY, MAP, COROUTINE, CHANNEL } VarType;
+
+struct Array;
+struct Map;
+struct Coroutine;
+struct Channel;
 
 typedef struct {
     char *name;
     VarType type;
     union {
         int intValue;
-        char *stringValue;
+        String stringValue;        // Copied in O(1), see lexer_string.h
         float floatValue;
         int boolValue;  // Using int for boolean (0/1)
+        struct Array *arrayValue;  // Shared, reference counted
+        struct Map *mapValue;      // Shared, reference counted
+        struct Coroutine *coroutineValue;  // Generator or task, reference counted
+        struct Channel *channelValue;      // Shared by every thread holding it
     } value;
 } Variable;
 
-// Add global line number
-extern int currentLineNumber;
+// Add global line number, kept for each thread
+extern _Thread_local int currentLineNumber;
 
 void interpretCommand(const char *command, int lineNumber);
 Variable *findVariable(const char *name);
+// The global named name, whatever locals there are
+Variable *findGlobal(const char *name);
+
+// Globals are kept for each thread. Threads running parallel_for
+// iterations use those of the thread that started the loop; a task block
+// gets copies of those of the thread that started it.
+typedef struct {
+    Variable *items;
+    size_t count;
+} VariableTable;
+
+VariableTable currentVariables(void);
+// Make table the globals of this thread; returns the ones it had
+VariableTable useVariables(VariableTable table);
+// Free the globals of this thread
+void clearVariables(void);
 
 // Add these helper function declarations
 int isFloat(const char *str);
@@ -30,27 +57,66 @@ int isBoolean(const char *str);
 // Add arithmetic operation helper functions
 int isOperator(char c);
 Variable performOperation(Variable *left, Variable *right, const char *operator);
-Variable *evaluateExpression(const char *expr);
+// Both store the value in result. evaluateExpression returns 0, storing
+// nothing, if expr is not an expression or uses a variable that does not
+// exist; evaluateValue stops with an error.
+int evaluateExpression(const char *expr, Variable *result);
+void evaluateValue(const char *text, Variable *result);
+
+// Results, like stored values (variables, array and map elements), own
+// their strings and hold a reference to arrays and maps. Whoever they
+// were stored for releases them with releaseValue.
+void copyValue(Variable *dest, const Variable *src);
+void releaseValue(Variable *value);
+void assignVariable(const char *name, const Variable *value);
+
+// Split comma separated arguments, ignoring commas inside quotes or brackets
+char *nextArgument(char **cursor);
+char *findTopLevel(char *str, const char *token);
 
 // Add these function declarations
 int isLogicalOperator(const char *str);
 Variable performLogicalOperation(Variable *left, Variable *right, const char *operator);
+int isTrue(const Variable *value);
 
 // Add these function declarations
 int isComparisonOperator(const char *str);
 Variable performComparison(Variable *left, Variable *right, const char *operator);
 
-// Control flow functions
-typedef struct {
-    char *condition;
-    char *code;
-} ControlBlock;
-
+// Control flow functions live in lexer_script.h
 int evaluateCondition(const char *condition);
-void executeBlock(const char *line, FILE *file);
-void handleIfStatement(const char *line, FILE *file);
+// value points to an int, float, String, Array *, Map *, Coroutine * or
+// Channel * matching type
 void updateVariable(const char *name, VarType type, void *value);
+void setVariableValue(Variable *slot, VarType type, void *value);
 void parseImportStatement(const char *line, char *varName, char *fileName);
 void importVariableFromFile(const char *fileName, const char *varName);
+// Imported files are parsed the first time they are imported and kept,
+// from the text prefetchImports read if it has.
+// preloadImport reads one ahead of time and returns 0 if it cannot be
+// opened; forgetImport drops one that has changed.
+int preloadImport(const char *fileName);
+void forgetImport(const char *fileName);
+
+// An imported file, read once. Each name keeps the value on the first line
+// that assigns to it; known is 0 when that value is not a literal import
+// understands, in which case importing the name does nothing.
+typedef struct {
+    char *name;
+    Variable value;
+    int known;
+} ModuleValue;
+
+typedef struct {
+    char *fileName;
+    ModuleValue *values;
+    int count;
+} Module;
+
+// The files read so far, and files added as if they had been read, for
+// snapshots. A new value has known set to 0.
+Module *importedModules(int *count);
+Module *addModule(const char *fileName);
+ModuleValue *addModuleValue(Module *module, const char *name);
 
 #endif // LEXER_INTERPRET_H
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "lexer_limit.h"
+#include "lexer_interpret.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// Statements run between looks at the clock
+#define LIMIT_CHECK_STEPS 4096
+
+long long statementLimit = 0;
+double timeLimit = 0;
+long long outputLimit = 0;
+
+_Thread_local long limitCountdown = 0;
+
+static int limiting = 0;
+static long long statementsLeft = 0;
+static long long outputWritten = 0;
+static double deadline = 0;
+
+static double monotonicSeconds(void) {
+#ifdef _WIN32
+    return GetTickCount64() / 1000.0;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+void startLimits(void) {
+    limiting = statementLimit > 0 || timeLimit > 0;
+    statementsLeft = statementLimit;
+    outputWritten = 0;
+    deadline = monotonicSeconds() + timeLimit;
+    limitCountdown = 0;
+}
+
+// Other threads may go over a limit at the same time; only the first one
+// reports it, the rest wait for the exit
+void stopForLimit(int status, const char *message) {
+    static int stopping = 0;
+    if (__atomic_exchange_n(&stopping, 1, __ATOMIC_SEQ_CST)) {
+        for (;;) {
+#ifdef _WIN32
+            Sleep(1000);
+#else
+            pause();
+#endif
+        }
+    }
+    fflush(stdout);
+    fprintf(stderr, "Error on line %d: %s\n", currentLineNumber, message);
+    exit(status);
+}
+
+void checkDeadline(void) {
+    if (timeLimit > 0 && monotonicSeconds() > deadline) {
+        char message[80];
+        snprintf(message, sizeof(message), "Time limit of %g seconds reached", timeLimit);
+        stopForLimit(LIMIT_EXIT_TIME, message);
+    }
+}
+
+void checkLimits(void) {
+    if (!limiting) {
+        limitCountdown = LONG_MAX;
+        return;
+    }
+    char message[80];
+    long batch = LIMIT_CHECK_STEPS;
+    if (statementLimit > 0) {
+        long long left = __atomic_load_n(&statementsLeft, __ATOMIC_RELAXED);
+        do {
+            if (left <= 0) {
+                snprintf(message, sizeof(message), "Statement limit of %lld reached", statementLimit);
+                stopForLimit(LIMIT_EXIT_STATEMENTS, message);
+            }
+            batch = left < LIMIT_CHECK_STEPS ? (long)left : LIMIT_CHECK_STEPS;
+        } while (!__atomic_compare_exchange_n(&statementsLeft, &left, left - batch, 1,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+    checkDeadline();
+    // The statement about to run is the first of the batch
+    limitCountdown = batch - 1;
+}
+
+void countOutput(size_t length) {
+    if (outputLimit <= 0) {
+        return;
+    }
+    if (__atomic_add_fetch(&outputWritten, (long long)length, __ATOMIC_RELAXED) > outputLimit) {
+        char message[80];
+        snprintf(message, sizeof(message), "Output limit of %lld bytes reached", outputLimit);
+        stopForLimit(LIMIT_EXIT_OUTPUT, message);
+    }
+}
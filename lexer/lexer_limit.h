@@ -0,0 +1,45 @@
+#ifndef LEXER_LIMIT_H
+#define LEXER_LIMIT_H
+
+#include <stddef.h>
+
+// Limits for running scripts that cannot be trusted to stop. A run that
+// goes over one ends with that limit's exit status, between statements or
+// before a line of output, so no line is ever cut short.
+#define LIMIT_EXIT_STATEMENTS 3
+#define LIMIT_EXIT_TIME 4
+#define LIMIT_EXIT_OUTPUT 5
+#define LIMIT_EXIT_MEMORY 6
+
+// 0 means no limit. Set before startLimits.
+extern long long statementLimit;
+extern double timeLimit;          // Seconds of wall-clock time
+extern long long outputLimit;     // Bytes written by display
+
+// Start the clock and the counts for a run
+void startLimits(void);
+
+// Statements this thread may run before checkLimits has to look again.
+// Threads take statements from the limit in batches, and look at the
+// clock once per batch.
+extern _Thread_local long limitCountdown;
+void checkLimits(void);
+
+// Ends the run if it is past its time limit. For threads that wait
+// rather than run statements.
+void checkDeadline(void);
+
+// Called before every statement
+static inline void countStatement(void) {
+    if (--limitCountdown < 0) {
+        checkLimits();
+    }
+}
+
+// Called before length bytes of output are written
+void countOutput(size_t length);
+
+// End the run with status after printing message as the error
+void stopForLimit(int status, const char *message);
+
+#endif // LEXER_LIMIT_H
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_map.h"
+#include "lexer_parallel.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+#define MAP_EMPTY_SLOT -1
+#define MAP_MIN_CAPACITY 8
+#define MAP_MIGRATE_STEP 16
+
+// FNV-1a for strings, a murmur finalizer for integers
+static uint32_t hashKey(const Variable *key) {
+    if (key->type == STRING) {
+        uint32_t hash = 2166136261u;
+        const unsigned char *text = (const unsigned char *)stringData(&key->value.stringValue);
+        size_t length = stringLength(&key->value.stringValue);
+        for (size_t i = 0; i < length; i++) {
+            hash = (hash ^ text[i]) * 16777619u;
+        }
+        return hash;
+    }
+    uint32_t hash = (uint32_t)key->value.intValue;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static void checkKey(const Variable *key) {
+    if (key->type != STRING && key->type != INT) {
+        raiseError(ERROR_TYPE, currentLineNumber, "Map keys must be strings or integers");
+    }
+}
+
+static int keysEqual(const Variable *a, const Variable *b) {
+    if (a->type != b->type) return 0;
+    if (a->type == STRING) return stringEquals(&a->value.stringValue, &b->value.stringValue);
+    return a->value.intValue == b->value.intValue;
+}
+
+static void initIndex(MapIndex *index, size_t capacity) {
+    index->capacity = capacity;
+    index->slots = memAlloc(capacity * sizeof(int32_t));
+    memset(index->slots, 0xff, capacity * sizeof(int32_t));  // MAP_EMPTY_SLOT
+}
+
+Map *createMap(void) {
+    Map *map = memAlloc(sizeof(Map));
+    map->refCount = 1;
+    map->epoch = parallelEpoch;
+    map->entries = NULL;
+    map->entryCount = 0;
+    map->entryCapacity = 0;
+    map->liveCount = 0;
+    initIndex(&map->index, MAP_MIN_CAPACITY);
+    map->indexUsed = 0;
+    map->oldIndex.slots = NULL;
+    map->oldIndex.capacity = 0;
+    map->migratePosition = 0;
+    return map;
+}
+
+void retainMap(Map *map) {
+    refRetain(&map->refCount);
+}
+
+void releaseMap(Map *map) {
+    if (refRelease(&map->refCount) > 0) {
+        return;
+    }
+    for (size_t i = 0; i < map->entryCount; i++) {
+        if (!map->entries[i].deleted) {
+            releaseValue(&map->entries[i].key);
+            releaseValue(&map->entries[i].value);
+        }
+    }
+    memFree(map->entries);
+    memFree(map->index.slots);
+    memFree(map->oldIndex.slots);
+    memFree(map);
+}
+
+static int32_t findInIndex(Map *map, const MapIndex *index, const Variable *key, uint32_t hash) {
+    size_t mask = index->capacity - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        int32_t position = index->slots[slot];
+        if (position == MAP_EMPTY_SLOT) {
+            return -1;
+        }
+        MapEntry *entry = &map->entries[position];
+        if (entry->hash == hash && !entry->deleted && keysEqual(&entry->key, key)) {
+            return position;
+        }
+    }
+}
+
+static void placeInIndex(MapIndex *index, uint32_t hash, int32_t position) {
+    size_t mask = index->capacity - 1;
+    size_t slot = hash & mask;
+    while (index->slots[slot] != MAP_EMPTY_SLOT) {
+        slot = (slot + 1) & mask;
+    }
+    index->slots[slot] = position;
+}
+
+// Add an entry position to the current index
+static void placeEntry(Map *map, int32_t position) {
+    placeInIndex(&map->index, map->entries[position].hash, position);
+    map->indexUsed++;
+}
+
+// Move up to steps slots of the old index into the current one. The old
+// index is never written while it is being migrated, so lookups can keep
+// probing it for entries that have not moved yet.
+static void migrate(Map *map, size_t steps) {
+    if (!map->oldIndex.slots) {
+        return;
+    }
+    size_t end = map->migratePosition + steps;
+    if (end > map->oldIndex.capacity) {
+        end = map->oldIndex.capacity;
+    }
+    for (size_t i = map->migratePosition; i < end; i++) {
+        int32_t position = map->oldIndex.slots[i];
+        if (position != MAP_EMPTY_SLOT && !map->entries[position].deleted) {
+            placeEntry(map, position);
+        }
+    }
+    map->migratePosition = end;
+    if (end == map->oldIndex.capacity) {
+        memFree(map->oldIndex.slots);
+        map->oldIndex.slots = NULL;
+        map->oldIndex.capacity = 0;
+    }
+}
+
+static int32_t findEntry(Map *map, const Variable *key, uint32_t hash) {
+    int32_t position = findInIndex(map, &map->index, key, hash);
+    if (position < 0 && map->oldIndex.slots) {
+        position = findInIndex(map, &map->oldIndex, key, hash);
+    }
+    return position;
+}
+
+// Drop deleted entries and rebuild the index in one go. Only used once
+// deleted entries make up half of the map.
+static void compact(Map *map) {
+    size_t live = 0;
+    for (size_t i = 0; i < map->entryCount; i++) {
+        if (!map->entries[i].deleted) {
+            map->entries[live++] = map->entries[i];
+        }
+    }
+    map->entryCount = live;
+
+    size_t capacity = MAP_MIN_CAPACITY;
+    while ((live + 1) * 3 > capacity * 2) {
+        capacity *= 2;
+    }
+    memFree(map->index.slots);
+    memFree(map->oldIndex.slots);
+    map->oldIndex.slots = NULL;
+    map->oldIndex.capacity = 0;
+    initIndex(&map->index, capacity);
+    map->indexUsed = 0;
+    for (size_t i = 0; i < live; i++) {
+        placeEntry(map, (int32_t)i);
+    }
+}
+
+// Make room in the index for one more entry, keeping the load below 2/3
+static void reserveSlot(Map *map) {
+    if ((map->indexUsed + 1) * 3 <= map->index.capacity * 2) {
+        return;
+    }
+
+    // A migration finishes long before the new table fills up; finish it
+    // if it somehow has not
+    migrate(map, map->oldIndex.capacity);
+
+    if (map->entryCount - map->liveCount >= map->entryCount / 2) {
+        compact(map);
+        return;
+    }
+
+    map->oldIndex = map->index;
+    map->migratePosition = 0;
+    initIndex(&map->index, map->oldIndex.capacity * 2);
+    map->indexUsed = 0;
+}
+
+Variable *mapGet(Map *map, const Variable *key) {
+    checkKey(key);
+    // Lookups leave a shared map alone while other threads may read it
+    if (!parallelActive) {
+        migrate(map, MAP_MIGRATE_STEP);
+    }
+    int32_t position = findEntry(map, key, hashKey(key));
+    return position < 0 ? NULL : &map->entries[position].value;
+}
+
+void mapSet(Map *map, const Variable *key, const Variable *value) {
+    checkWritable(map->epoch, "a map");
+    checkKey(key);
+    migrate(map, MAP_MIGRATE_STEP);
+    uint32_t hash = hashKey(key);
+    int32_t position = findEntry(map, key, hash);
+
+    if (position >= 0) {
+        // Copy first so that storing a value into itself stays valid
+        Variable old = map->entries[position].value;
+        copyValue(&map->entries[position].value, value);
+        releaseValue(&old);
+        return;
+    }
+
+    reserveSlot(map);
+    if (map->entryCount == map->entryCapacity) {
+        map->entryCapacity = map->entryCapacity ? map->entryCapacity * 2 : MAP_MIN_CAPACITY;
+        map->entries = memRealloc(map->entries, map->entryCapacity * sizeof(MapEntry));
+    }
+
+    MapEntry *entry = &map->entries[map->entryCount];
+    entry->hash = hash;
+    entry->deleted = 0;
+    copyValue(&entry->key, key);
+    copyValue(&entry->value, value);
+    placeEntry(map, (int32_t)map->entryCount);
+    map->entryCount++;
+    map->liveCount++;
+}
+
+int mapRemove(Map *map, const Variable *key) {
+    checkWritable(map->epoch, "a map");
+    checkKey(key);
+    migrate(map, MAP_MIGRATE_STEP);
+    int32_t position = findEntry(map, key, hashKey(key));
+    if (position < 0) {
+        return 0;
+    }
+
+    // The slot stays behind as a tombstone until the next resize
+    MapEntry *entry = &map->entries[position];
+    releaseValue(&entry->key);
+    releaseValue(&entry->value);
+    entry->deleted = 1;
+    map->liveCount--;
+    return 1;
+}
+
+Array *mapKeys(Map *map) {
+    Array *keys = createArray(ARRAY_INT, map->liveCount);
+    for (size_t i = 0; i < map->entryCount; i++) {
+        if (!map->entries[i].deleted) {
+            arrayAppend(keys, &map->entries[i].key);
+        }
+    }
+    return keys;
+}
@@ -0,0 +1,50 @@
+#ifndef LEXER_MAP_H
+#define LEXER_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lexer_interpret.h"
+#include "lexer_array.h"
+
+// Entries are kept densely in insertion order; the index is an open
+// addressing table of entry positions. Keys are strings or integers and
+// their hash is computed once, when the entry is created.
+typedef struct {
+    uint32_t hash;
+    int deleted;
+    Variable key;
+    Variable value;
+} MapEntry;
+
+typedef struct {
+    int32_t *slots;     // Entry position, or MAP_EMPTY_SLOT
+    size_t capacity;    // Power of two
+} MapIndex;
+
+// When the index fills up, a table twice the size is allocated and the old
+// slots are moved over a few at a time on each later operation, so no
+// single insert pays for rehashing the whole map.
+typedef struct Map {
+    int refCount;
+    unsigned epoch;         // parallelEpoch when it was made, see lexer_parallel.h
+    MapEntry *entries;
+    size_t entryCount;      // Including deleted entries
+    size_t entryCapacity;
+    size_t liveCount;
+    MapIndex index;
+    size_t indexUsed;       // Occupied slots in index
+    MapIndex oldIndex;      // Table being migrated, slots NULL otherwise
+    size_t migratePosition;
+} Map;
+
+Map *createMap(void);
+void retainMap(Map *map);
+void releaseMap(Map *map);
+
+// Lookups return NULL if the key is missing
+Variable *mapGet(Map *map, const Variable *key);
+void mapSet(Map *map, const Variable *key, const Variable *value);
+int mapRemove(Map *map, const Variable *key);
+Array *mapKeys(Map *map);
+
+#endif // LEXER_MAP_H
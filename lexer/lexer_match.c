@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <math.h>
+#include "lexer_match.h"
+#include "lexer_interpret.h"
+#include "lexer_parallel.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+// Integer cases get a jump table while at least one slot in this many is
+// used
+#define MATCH_JUMP_SPREAD 4
+#define MATCH_JUMP_MAX (1 << 16)
+
+static void matchError(const ScriptLine *line, const char *message, const char *value) {
+    raiseError(ERROR_SYNTAX, line->lineNumber, "%s '%s'", message, value);
+}
+
+static uint32_t hashText(const char *text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static MatchString *findString(const MatchTable *table, const char *text, size_t length) {
+    size_t mask = table->stringCapacity - 1;
+    for (size_t slot = hashText(text, length) & mask;; slot = (slot + 1) & mask) {
+        MatchString *entry = &table->strings[slot];
+        if (entry->arm < 0 || (stringLength(&entry->key) == length &&
+                               memcmp(stringData(&entry->key), text, length) == 0)) {
+            return entry;
+        }
+    }
+}
+
+// A whole number or decimal, stored at float precision like the values it
+// is compared with
+static int parseNumber(const char *text, double *value) {
+    char *end;
+    *value = strtod(text, &end);
+    if (end == text || *end != '\0' || !(isdigit((unsigned char)text[0]) || text[0] == '-')) {
+        return 0;
+    }
+    if (strchr(text, '.')) {
+        *value = (float)*value;
+    }
+    return 1;
+}
+
+static void addRange(MatchTable *table, double low, double high, int arm) {
+    table->ranges = memRealloc(table->ranges, (table->rangeCount + 1) * sizeof(MatchRange));
+    MatchRange *range = &table->ranges[table->rangeCount++];
+    range->low = low;
+    range->high = high;
+    range->arm = arm;
+}
+
+static void growStrings(MatchTable *table) {
+    MatchString *old = table->strings;
+    size_t oldCapacity = table->stringCapacity;
+    table->stringCapacity = oldCapacity ? oldCapacity * 2 : 16;
+    table->strings = memAlloc(table->stringCapacity * sizeof(MatchString));
+    for (size_t i = 0; i < table->stringCapacity; i++) {
+        table->strings[i].arm = -1;
+    }
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].arm >= 0) {
+            const String *key = &old[i].key;
+            *findString(table, stringData(key), stringLength(key)) = old[i];
+        }
+    }
+    memFree(old);
+}
+
+static void addString(MatchTable *table, const ScriptLine *line, const char *value, int arm) {
+    size_t length = strlen(value);
+    if (length < 2 || value[length - 1] != value[0]) {
+        matchError(line, "Invalid case value", value);
+    }
+    if ((table->stringCount + 1) * 2 > table->stringCapacity) {
+        growStrings(table);
+    }
+    MatchString *entry = findString(table, value + 1, length - 2);
+    if (entry->arm >= 0) {
+        matchError(line, "Duplicate case value", value);
+    }
+    stringInit(&entry->key, value + 1, length - 2);
+    entry->arm = arm;
+    table->stringCount++;
+}
+
+// Add the values of "case a, b, c..d:" at index
+static void addCase(MatchTable *table, Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    size_t length = strlen(line->text);
+    if (length < 7 || line->text[length - 1] != ':') {
+        matchError(line, "Invalid case", line->text);
+    }
+    char *values = memAlloc(length - 5);
+    memcpy(values, line->text + 5, length - 6);
+    values[length - 6] = '\0';
+
+    char *cursor = values;
+    char *value;
+    while ((value = nextArgument(&cursor)) != NULL) {
+        if (value[0] == '"' || value[0] == '\'') {
+            addString(table, line, value, index);
+            continue;
+        }
+
+        double low, high;
+        char *dots = strstr(value, "..");
+        if (dots) {
+            char *highText = dots + 2;
+            char *lowEnd = dots;
+            while (lowEnd > value && lowEnd[-1] == ' ') lowEnd--;
+            while (*highText == ' ') highText++;
+            char saved = *lowEnd;
+            *lowEnd = '\0';
+            int valid = parseNumber(value, &low) && parseNumber(highText, &high) && low <= high;
+            *lowEnd = saved;
+            if (!valid) {
+                matchError(line, "Invalid case range", value);
+            }
+        } else if (parseNumber(value, &low)) {
+            high = low;
+        } else {
+            matchError(line, "Invalid case value", value);
+        }
+        addRange(table, low, high, index);
+    }
+    memFree(values);
+}
+
+static int compareRanges(const void *a, const void *b) {
+    const MatchRange *left = a;
+    const MatchRange *right = b;
+    return left->low < right->low ? -1 : left->low > right->low;
+}
+
+static void buildRanges(MatchTable *table, Script *script) {
+    if (table->rangeCount == 0) {
+        return;
+    }
+    qsort(table->ranges, table->rangeCount, sizeof(MatchRange), compareRanges);
+    for (int i = 1; i < table->rangeCount; i++) {
+        if (table->ranges[i].low <= table->ranges[i - 1].high) {
+            MatchRange *later = table->ranges[i].arm > table->ranges[i - 1].arm ?
+                                &table->ranges[i] : &table->ranges[i - 1];
+            raiseError(ERROR_SYNTAX, script->lines[later->arm].lineNumber, "Case overlaps an earlier case");
+        }
+    }
+
+    // Every integer any case can match lies between the lowest and highest
+    // bound, so when the cases cover enough of that span it can be looked
+    // up directly
+    double first = ceil(table->ranges[0].low);
+    double last = table->ranges[0].high;
+    double covered = 0;
+    for (int i = 0; i < table->rangeCount; i++) {
+        MatchRange *range = &table->ranges[i];
+        if (range->high > last) last = range->high;
+        if (floor(range->high) >= ceil(range->low)) {
+            covered += floor(range->high) - ceil(range->low) + 1;
+        }
+    }
+    last = floor(last);
+    double span = last - first + 1;
+    if (span < 1 || span > MATCH_JUMP_MAX || span > covered * MATCH_JUMP_SPREAD) {
+        return;
+    }
+
+    table->jumpBase = (long)first;
+    table->jumpSize = (long)(last - first) + 1;
+    table->jump = memAlloc(table->jumpSize * sizeof(int));
+    for (long i = 0; i < table->jumpSize; i++) {
+        table->jump[i] = -1;
+    }
+    for (int i = 0; i < table->rangeCount; i++) {
+        MatchRange *range = &table->ranges[i];
+        for (double v = ceil(range->low); v <= range->high; v++) {
+            table->jump[(long)v - table->jumpBase] = range->arm;
+        }
+    }
+}
+
+static MatchTable *compileMatch(Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    const char *start = line->text + 6;
+    const char *end = start + strlen(start);
+    if (end - start < 3 || end[-1] != ':' || end[-2] != ')') {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Invalid match statement syntax");
+    }
+    char *subject = memAlloc(end - start - 1);
+    memcpy(subject, start, end - start - 2);
+    subject[end - start - 2] = '\0';
+
+    MatchTable *table = memCalloc(1, sizeof(MatchTable));
+    table->subject = parseExpression(subject);
+    if (!table->subject) {
+        matchError(line, "Invalid match value", subject);
+    }
+    memFree(subject);
+    table->defaultArm = -1;
+
+    // Arms are the lines directly inside the statement
+    int arm = index + 1;
+    if (arm == line->blockEnd) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Expected an indented block");
+    }
+    while (arm < line->blockEnd) {
+        ScriptLine *armLine = &script->lines[arm];
+        if (table->defaultArm >= 0) {
+            matchError(armLine, "Case after default", armLine->text);
+        }
+        if (strcmp(armLine->text, "default:") == 0) {
+            table->defaultArm = arm;
+        } else if (strncmp(armLine->text, "case ", 5) == 0) {
+            addCase(table, script, arm);
+        } else {
+            matchError(armLine, "Expected case or default in match, not", armLine->text);
+        }
+        if (armLine->blockEnd == arm + 1) {
+            raiseError(ERROR_SYNTAX, armLine->lineNumber, "Expected an indented block");
+        }
+        arm = armLine->blockEnd;
+    }
+
+    buildRanges(table, script);
+    return table;
+}
+
+// Index of the case line for value, or -1 if no case matches
+static int findArm(const MatchTable *table, const Variable *value) {
+    if (value->type == STRING) {
+        const String *text = &value->value.stringValue;
+        return table->strings ? findString(table, stringData(text), stringLength(text))->arm : -1;
+    }
+    if (value->type != INT && value->type != FLOAT) {
+        return -1;
+    }
+
+    if (value->type == INT && table->jump) {
+        long offset = (long)value->value.intValue - table->jumpBase;
+        return offset >= 0 && offset < table->jumpSize ? table->jump[offset] : -1;
+    }
+
+    // The last range starting at or below the value is the only candidate
+    double number = value->type == INT ? value->value.intValue : value->value.floatValue;
+    int low = 0;
+    int high = table->rangeCount - 1;
+    int found = -1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        if (table->ranges[middle].low <= number) {
+            found = middle;
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return found >= 0 && number <= table->ranges[found].high ? table->ranges[found].arm : -1;
+}
+
+int findMatchArm(Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    // Threads running a parallel_for may get here at the same time
+    MatchTable *table = __atomic_load_n(&line->match, __ATOMIC_ACQUIRE);
+    if (!table) {
+        parallelLock();
+        table = line->match;
+        if (!table) {
+            table = compileMatch(script, index);
+            __atomic_store_n(&line->match, table, __ATOMIC_RELEASE);
+        }
+        parallelUnlock();
+    }
+
+    Variable value;
+    evaluateNodeValue(table->subject, &value);
+    int arm = findArm(table, &value);
+    releaseValue(&value);
+    return arm < 0 ? table->defaultArm : arm;
+}
+
+void freeMatchTable(MatchTable *table) {
+    if (!table) {
+        return;
+    }
+    for (size_t i = 0; i < table->stringCapacity; i++) {
+        if (table->strings[i].arm >= 0) {
+            stringRelease(&table->strings[i].key);
+        }
+    }
+    memFree(table->strings);
+    memFree(table->ranges);
+    memFree(table->jump);
+    memFree(table);
+}
@@ -0,0 +1,44 @@
+#ifndef LEXER_MATCH_H
+#define LEXER_MATCH_H
+
+#include "lexer_script.h"
+#include "lexer_expr.h"
+
+// Numeric cases, from "case 5:" or "case 1..10:", as closed intervals
+typedef struct {
+    double low;
+    double high;
+    int arm;           // Index of the case line
+} MatchRange;
+
+typedef struct {
+    String key;
+    int arm;           // -1 for an empty slot
+} MatchString;
+
+// A "match(value):" statement, compiled the first time it runs. Integer
+// subjects go through a jump table when the cases are dense enough, other
+// numbers through a binary search of the sorted ranges and strings through
+// an open addressed hash table.
+typedef struct MatchTable {
+    Expr *subject;
+    int defaultArm;    // Index of the default: line, or -1
+
+    MatchRange *ranges;
+    int rangeCount;
+
+    int *jump;         // Arm for each integer from jumpBase, or -1
+    long jumpBase;
+    long jumpSize;
+
+    MatchString *strings;
+    size_t stringCount;
+    size_t stringCapacity;
+} MatchTable;
+
+// Index of the case line the statement at index picks for the current
+// value of its subject, the default: line if no case matches, or -1
+int findMatchArm(Script *script, int index);
+void freeMatchTable(MatchTable *table);
+
+#endif // LEXER_MATCH_H
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lexer_memory.h"
+#include "lexer_limit.h"
+#include "lexer_parallel.h"
+
+// Sites are found by the address of their name, which is a string literal
+#define MEMORY_MAX_SITES 2048
+
+// Put in front of every block so that memFree knows what to take off
+typedef union {
+    struct {
+        size_t size;
+        unsigned site;
+    } info;
+    max_align_t align;
+} BlockHeader;
+
+typedef struct {
+    const char *name;
+    size_t inUse;
+    size_t total;
+    size_t count;
+} MemorySite;
+
+size_t memoryLimit = 0;
+
+static size_t inUse = 0;
+static size_t peak = 0;
+// Threads allocating alongside the script, only changed by the thread
+// running it
+static int otherThreads = 0;
+static MemorySite sites[MEMORY_MAX_SITES];
+
+// Claim a slot for site the first time it allocates. Two threads may race
+// to claim a slot; the loser moves on to the next one.
+static unsigned findSite(const char *name) {
+    unsigned index = (unsigned)(((uintptr_t)name >> 3) * 2654435761u) % MEMORY_MAX_SITES;
+    for (int probes = 0; probes < MEMORY_MAX_SITES; probes++) {
+        const char *current = __atomic_load_n(&sites[index].name, __ATOMIC_ACQUIRE);
+        if (current == name) {
+            return index;
+        }
+        if (!current) {
+            const char *expected = NULL;
+            if (__atomic_compare_exchange_n(&sites[index].name, &expected, name, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) || expected == name) {
+                return index;
+            }
+        }
+        index = (index + 1) % MEMORY_MAX_SITES;
+    }
+    // Every slot is taken; the last one stands for the rest
+    return MEMORY_MAX_SITES - 1;
+}
+
+// Counts only need atomic updates while other threads allocate too
+static int countsShared(void) {
+    return sharingValues() || __atomic_load_n(&otherThreads, __ATOMIC_RELAXED);
+}
+
+static size_t addCount(size_t *count, size_t amount) {
+    if (countsShared()) {
+        return __atomic_add_fetch(count, amount, __ATOMIC_RELAXED);
+    }
+    return *count += amount;
+}
+
+static void subtractCount(size_t *count, size_t amount) {
+    if (countsShared()) {
+        __atomic_sub_fetch(count, amount, __ATOMIC_RELAXED);
+    } else {
+        *count -= amount;
+    }
+}
+
+static void outOfMemory(void) {
+    stopForLimit(LIMIT_EXIT_MEMORY, "Out of memory");
+}
+
+// Stop before asking for a block that would take the script over its limit
+static void checkQuota(size_t size) {
+    size_t used = memoryInUse();
+    if (memoryLimit > 0 && (used > memoryLimit || size > memoryLimit - used)) {
+        char message[96];
+        snprintf(message, sizeof(message), "Memory limit of %zu bytes reached", memoryLimit);
+        stopForLimit(LIMIT_EXIT_MEMORY, message);
+    }
+}
+
+static void account(BlockHeader *header, size_t size, const char *site) {
+    size_t now = addCount(&inUse, size);
+    size_t highest = __atomic_load_n(&peak, __ATOMIC_RELAXED);
+    while (now > highest && !__atomic_compare_exchange_n(&peak, &highest, now, 1,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    unsigned index = findSite(site);
+    MemorySite *entry = &sites[index];
+    addCount(&entry->inUse, size);
+    addCount(&entry->total, size);
+    addCount(&entry->count, 1);
+    header->info.size = size;
+    header->info.site = index;
+}
+
+static void unaccount(BlockHeader *header) {
+    subtractCount(&inUse, header->info.size);
+    subtractCount(&sites[header->info.site].inUse, header->info.size);
+}
+
+void *memoryAlloc(size_t size, const char *site) {
+    if (size > SIZE_MAX - sizeof(BlockHeader)) {
+        outOfMemory();
+    }
+    checkQuota(size);
+    BlockHeader *header = malloc(sizeof(BlockHeader) + size);
+    if (!header) {
+        outOfMemory();
+    }
+    account(header, size, site);
+    return header + 1;
+}
+
+void *memoryCalloc(size_t count, size_t size, const char *site) {
+    if (size != 0 && count > (SIZE_MAX - sizeof(BlockHeader)) / size) {
+        outOfMemory();
+    }
+    void *block = memoryAlloc(count * size, site);
+    memset(block, 0, count * size);
+    return block;
+}
+
+void *memoryRealloc(void *block, size_t size, const char *site) {
+    if (!block) {
+        return memoryAlloc(size, site);
+    }
+    if (size > SIZE_MAX - sizeof(BlockHeader)) {
+        outOfMemory();
+    }
+    BlockHeader *header = (BlockHeader *)block - 1;
+    unaccount(header);
+    checkQuota(size);
+    header = realloc(header, sizeof(BlockHeader) + size);
+    if (!header) {
+        outOfMemory();
+    }
+    // The block counts against whichever site grew it last
+    account(header, size, site);
+    return header + 1;
+}
+
+char *memoryStrdup(const char *text, const char *site) {
+    size_t length = strlen(text) + 1;
+    char *copy = memoryAlloc(length, site);
+    memcpy(copy, text, length);
+    return copy;
+}
+
+void *memoryTryRealloc(void *block, size_t size, const char *site) {
+    BlockHeader *header = block ? (BlockHeader *)block - 1 : NULL;
+    size_t used = memoryInUse() - (header ? header->info.size : 0);
+    if (size > SIZE_MAX - sizeof(BlockHeader) ||
+        (memoryLimit > 0 && (used > memoryLimit || size > memoryLimit - used))) {
+        return NULL;
+    }
+    BlockHeader *grown = realloc(header, sizeof(BlockHeader) + size);
+    if (!grown) {
+        return NULL;
+    }
+    // realloc kept the header, with the size the block had
+    if (header) {
+        unaccount(grown);
+    }
+    account(grown, size, site);
+    return grown + 1;
+}
+
+void memoryThreadStarting(void) {
+    __atomic_add_fetch(&otherThreads, 1, __ATOMIC_RELAXED);
+}
+
+void memoryThreadStopped(void) {
+    __atomic_sub_fetch(&otherThreads, 1, __ATOMIC_RELAXED);
+}
+
+void memoryFree(void *block) {
+    if (!block) {
+        return;
+    }
+    BlockHeader *header = (BlockHeader *)block - 1;
+    unaccount(header);
+    free(header);
+}
+
+size_t memoryInUse(void) {
+    return __atomic_load_n(&inUse, __ATOMIC_RELAXED);
+}
+
+size_t memoryPeak(void) {
+    return __atomic_load_n(&peak, __ATOMIC_RELAXED);
+}
+
+static int byTotal(const void *a, const void *b) {
+    const MemorySite *left = a;
+    const MemorySite *right = b;
+    if (left->total != right->total) {
+        return left->total < right->total ? 1 : -1;
+    }
+    return 0;
+}
+
+void memoryReport(void) {
+    MemorySite used[MEMORY_MAX_SITES];
+    int count = 0;
+    for (int i = 0; i < MEMORY_MAX_SITES; i++) {
+        if (sites[i].name) {
+            used[count++] = sites[i];
+        }
+    }
+    qsort(used, count, sizeof(MemorySite), byTotal);
+
+    fprintf(stderr, "Memory: %zu bytes in use, %zu at peak\n", memoryInUse(), memoryPeak());
+    fprintf(stderr, "%14s %12s %12s  %s\n", "allocated", "allocations", "in use", "site");
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, "%14zu %12zu %12zu  %s\n", used[i].total, used[i].count, used[i].inUse, used[i].name);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef LEXER_MEMORY_H
+#define LEXER_MEMORY_H
+
+#include <stddef.h>
+
+// Every allocation the interpreter makes goes through memAlloc and its
+// relatives, which count the bytes in use against --max-mem and by the
+// line of source that asked for them. Blocks must be freed with memFree.
+
+#define MEMORY_STRING(x) #x
+#define MEMORY_LINE(x) MEMORY_STRING(x)
+#define MEMORY_SITE __FILE__ ":" MEMORY_LINE(__LINE__)
+
+#define memAlloc(size) memoryAlloc((size), MEMORY_SITE)
+#define memCalloc(count, size) memoryCalloc((count), (size), MEMORY_SITE)
+#define memRealloc(block, size) memoryRealloc((block), (size), MEMORY_SITE)
+#define memStrdup(text) memoryStrdup((text), MEMORY_SITE)
+#define memFree(block) memoryFree(block)
+#define memTryRealloc(block, size) memoryTryRealloc((block), (size), MEMORY_SITE)
+
+void *memoryAlloc(size_t size, const char *site);
+void *memoryCalloc(size_t count, size_t size, const char *site);
+void *memoryRealloc(void *block, size_t size, const char *site);
+char *memoryStrdup(const char *text, const char *site);
+void memoryFree(void *block);
+
+// For threads that must not stop the script: returns NULL, leaving block
+// as it was, rather than going over the limit or running out of memory
+void *memoryTryRealloc(void *block, size_t size, const char *site);
+
+// The counts are only updated atomically while threads share values. A
+// thread that allocates at any other time, alongside the script, is
+// announced before it starts and after it has been joined.
+void memoryThreadStarting(void);
+void memoryThreadStopped(void);
+
+// Bytes the script may have allocated at once, 0 for no limit. Going over
+// ends the run with status LIMIT_EXIT_MEMORY.
+extern size_t memoryLimit;
+
+size_t memoryInUse(void);
+size_t memoryPeak(void);
+
+// Print the bytes in use and at peak, and what each allocation site has
+// allocated, to stderr
+void memoryReport(void);
+
+#endif // LEXER_MEMORY_H
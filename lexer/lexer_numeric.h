@@ -0,0 +1,85 @@
+#ifndef LEXER_NUMERIC_H
+#define LEXER_NUMERIC_H
+
+#include <string.h>
+#include <math.h>
+#include "lexer_interpret.h"
+#include "lexer_error.h"
+
+// Arithmetic and comparison on numbers, shared by the interpreter and the
+// C that --emit-c writes, so that both give the same results. Called with
+// a literal operator the strcmp calls fold away once these are inlined.
+
+// A number as a float. A boolean gives its 0 or 1, since boolValue shares
+// its storage with intValue.
+static inline float numberAsFloat(const Variable *value) {
+    return value->type == FLOAT ? value->value.floatValue : (float)value->value.intValue;
+}
+
+// Arithmetic on two numbers, INT or FLOAT
+static inline Variable numericOperation(const Variable *left, const Variable *right, const char *operator) {
+    Variable result;
+    float leftVal = numberAsFloat(left);
+    float rightVal = numberAsFloat(right);
+
+    result.type = FLOAT;
+
+    if (strcmp(operator, "**") == 0) {
+        result.value.floatValue = pow(leftVal, rightVal);
+    } else if (strcmp(operator, "//") == 0) {
+        if (rightVal == 0) {
+            raiseError(ERROR_ARITHMETIC, currentLineNumber, "Division by zero");
+        }
+        result.type = INT;
+        result.value.intValue = (int)(leftVal / rightVal);
+    } else if (strcmp(operator, "%") == 0) {
+        // Both sides are truncated first, so 0.5 is a zero divisor
+        if ((int)rightVal == 0) {
+            raiseError(ERROR_ARITHMETIC, currentLineNumber, "Modulo by zero");
+        }
+        result.type = INT;
+        result.value.intValue = (int)rightVal == -1 ? 0 : (int)leftVal % (int)rightVal;
+    } else {
+        switch(operator[0]) {
+            case '+': result.value.floatValue = leftVal + rightVal; break;
+            case '-': result.value.floatValue = leftVal - rightVal; break;
+            case '*': result.value.floatValue = leftVal * rightVal; break;
+            case '/':
+                if (rightVal == 0) {
+                    raiseError(ERROR_ARITHMETIC, currentLineNumber, "Division by zero");
+                }
+                result.value.floatValue = leftVal / rightVal;
+                break;
+        }
+    }
+
+    // Convert to INT if result is a whole number and operation isn't division
+    if (result.type == FLOAT && operator[0] != '/' &&
+        result.value.floatValue == (int)result.value.floatValue) {
+        result.type = INT;
+        result.value.intValue = (int)result.value.floatValue;
+    }
+
+    return result;
+}
+
+static inline Variable compareNumbers(float leftVal, float rightVal, const char *operator) {
+    Variable result;
+    result.type = BOOLEAN;
+
+    if (strcmp(operator, ">") == 0) {
+        result.value.boolValue = leftVal > rightVal;
+    } else if (strcmp(operator, "<") == 0) {
+        result.value.boolValue = leftVal < rightVal;
+    } else if (strcmp(operator, ">=") == 0) {
+        result.value.boolValue = leftVal >= rightVal;
+    } else if (strcmp(operator, "<=") == 0) {
+        result.value.boolValue = leftVal <= rightVal;
+    } else if (strcmp(operator, "==") == 0) {
+        result.value.boolValue = leftVal == rightVal;
+    }
+
+    return result;
+}
+
+#endif // LEXER_NUMERIC_H
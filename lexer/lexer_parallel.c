@@ -0,0 +1,686 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include "lexer_parallel.h"
+#include "lexer_interpret.h"
+#include "lexer_function.h"
+#include "lexer_array.h"
+#include "lexer_map.h"
+#include "lexer_expr.h"
+#include "lexer_simd.h"
+#include "lexer_thread.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// Iterations are handed out in at most this many chunks. How they are cut
+// does not depend on the number of threads, so reductions combine the same
+// partial results in the same order on every machine.
+#define PARALLEL_MAX_CHUNKS 256
+#define PARALLEL_MAX_THREADS 64
+
+int parallelThreads = 0;
+_Thread_local int parallelActive = 0;
+_Thread_local unsigned parallelEpoch = 0;
+int valuesShared = 0;
+
+// Epoch of the most recent loop on any thread
+static unsigned lastEpoch = 0;
+
+// A parallel_for statement, compiled the first time it runs. The body runs
+// like the body of a function taking the loop variable, so every name it
+// assigns to is a local of the iteration.
+typedef struct ParallelLoop {
+    ParallelHeader header;
+    Expr *start;
+    Expr *end;
+    Expr *items;
+    Function *body;
+    int *slots;        // Local holding each reduction
+} ParallelLoop;
+
+// What the iterations of one chunk left in a reduction
+typedef struct {
+    Variable value;
+    int has;
+} Partial;
+
+// The chunks a thread has still to run, from next up to end. The thread
+// takes them from the front; a thread with none left takes half of another
+// thread's from the back.
+typedef struct {
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+    int next;
+    int end;
+} ChunkQueue;
+
+typedef struct {
+    ParallelLoop *loop;
+    int lineNumber;
+    unsigned epoch;
+    VariableTable globals;
+    const CallFrame *outer;
+    int first;         // First value of a range
+    Array *items;      // Or the array looped over
+    long count;
+    long chunkSize;
+    int chunkCount;
+    Partial *partials; // One for each reduction of each chunk
+    ChunkQueue queues[PARALLEL_MAX_THREADS];
+    int workers;
+} ParallelJob;
+
+// ---------------------------------------------------------------------------
+// Header
+
+static char *trimCopy(const char *start, const char *end) {
+    while (start < end && (*start == ' ' || *start == '\t')) start++;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    char *copy = memAlloc(end - start + 1);
+    memcpy(copy, start, end - start);
+    copy[end - start] = '\0';
+    return copy;
+}
+
+static int isName(const char *name) {
+    if (!(isalpha((unsigned char)*name) || *name == '_')) return 0;
+    for (const char *c = name; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') return 0;
+    }
+    return 1;
+}
+
+// "name = start to end" or "name in items"
+static const char *parseIteration(char *text, ParallelHeader *header) {
+    char *in = findTopLevel(text, " in ");
+    char *equals = strchr(text, '=');
+    if (in && (!equals || equals > in)) {
+        header->name = trimCopy(text, in);
+        header->items = trimCopy(in + 4, in + strlen(in));
+    } else if (equals) {
+        char *to = findTopLevel(equals + 1, " to ");
+        if (!to) {
+            return "parallel_for expects 'name = start to end' or 'name in items'";
+        }
+        header->name = trimCopy(text, equals);
+        header->start = trimCopy(equals + 1, to);
+        header->end = trimCopy(to + 4, to + strlen(to));
+    } else {
+        return "parallel_for expects 'name = start to end' or 'name in items'";
+    }
+
+    if (!isName(header->name)) {
+        return "Invalid parallel_for loop variable";
+    }
+    if ((header->items && !header->items[0]) ||
+        (header->start && (!header->start[0] || !header->end[0]))) {
+        return "parallel_for expects 'name = start to end' or 'name in items'";
+    }
+    return NULL;
+}
+
+// "sum name", "min name", "max name" or "append name"
+static const char *parseReduction(const char *text, ParallelHeader *header) {
+    static const char *kinds[] = { "sum", "min", "max", "append" };
+    const char *space = text;
+    while (*space && *space != ' ' && *space != '\t') space++;
+
+    int kind = -1;
+    for (int i = 0; i < 4; i++) {
+        if ((size_t)(space - text) == strlen(kinds[i]) && strncmp(text, kinds[i], space - text) == 0) {
+            kind = i;
+        }
+    }
+    char *name = trimCopy(space, space + strlen(space));
+    if (kind < 0 || !isName(name)) {
+        memFree(name);
+        return "A reduction must be sum, min, max or append followed by a name";
+    }
+
+    int duplicate = strcmp(name, header->name) == 0;
+    for (int i = 0; i < header->reductionCount; i++) {
+        duplicate |= strcmp(header->reductions[i].name, name) == 0;
+    }
+    if (duplicate) {
+        memFree(name);
+        return "A reduction must name a variable other than the loop variable and the other reductions";
+    }
+
+    header->reductions = memRealloc(header->reductions, (header->reductionCount + 1) * sizeof(Reduction));
+    header->reductions[header->reductionCount].kind = (ReduceKind)kind;
+    header->reductions[header->reductionCount].name = name;
+    header->reductionCount++;
+    return NULL;
+}
+
+const char *parseParallelHeader(const char *text, ParallelHeader *header) {
+    memset(header, 0, sizeof(ParallelHeader));
+    const char *start = text + 13;
+    const char *end = start + strlen(start);
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    if (end - start < 2 || end[-1] != ':' || end[-2] != ')') {
+        return "Invalid parallel_for statement syntax";
+    }
+
+    char *inside = trimCopy(start, end - 2);
+    char *cursor = inside;
+    char *argument = nextArgument(&cursor);
+    const char *error = argument ? parseIteration(argument, header) : "Invalid parallel_for statement syntax";
+    while (!error && (argument = nextArgument(&cursor)) != NULL) {
+        error = parseReduction(argument, header);
+    }
+    memFree(inside);
+
+    if (error) {
+        freeParallelHeader(header);
+    }
+    return error;
+}
+
+void freeParallelHeader(ParallelHeader *header) {
+    memFree(header->name);
+    memFree(header->start);
+    memFree(header->end);
+    memFree(header->items);
+    for (int i = 0; i < header->reductionCount; i++) {
+        memFree(header->reductions[i].name);
+    }
+    memFree(header->reductions);
+    memset(header, 0, sizeof(ParallelHeader));
+}
+
+static Expr *parseBound(const ScriptLine *line, const char *text) {
+    if (!text) {
+        return NULL;
+    }
+    Expr *expr = parseExpression(text);
+    if (!expr) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Invalid value '%s'", text);
+    }
+    return expr;
+}
+
+static ParallelLoop *compileLoop(Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    ParallelLoop *loop = memCalloc(1, sizeof(ParallelLoop));
+    const char *error = parseParallelHeader(line->text, &loop->header);
+    if (error) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "%s", error);
+    }
+    if (line->blockEnd == index + 1) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Expected an indented block");
+    }
+
+    loop->start = parseBound(line, loop->header.start);
+    loop->end = parseBound(line, loop->header.end);
+    loop->items = parseBound(line, loop->header.items);
+    loop->body = createBlockFunction(script, index, loop->header.name);
+    loop->slots = memAlloc((loop->header.reductionCount + 1) * sizeof(int));
+    for (int i = 0; i < loop->header.reductionCount; i++) {
+        loop->slots[i] = functionLocal(loop->body, loop->header.reductions[i].name);
+        if (loop->slots[i] < 0) {
+            raiseError(ERROR_SYNTAX, line->lineNumber, "The body never assigns to reduction '%s'",
+                       loop->header.reductions[i].name);
+        }
+    }
+    return loop;
+}
+
+void freeParallelLoop(ParallelLoop *loop) {
+    if (!loop) {
+        return;
+    }
+    freeParallelHeader(&loop->header);
+    freeBlockFunction(loop->body);
+    memFree(loop->slots);
+    memFree(loop);
+}
+
+// ---------------------------------------------------------------------------
+// Reductions
+
+void sharedValueError(const char *what) {
+    raiseError(ERROR_RUNTIME, currentLineNumber, "parallel_for cannot change %s made outside the loop", what);
+}
+
+static void combine(ReduceKind kind, Partial *into, Variable *value) {
+    if (kind == REDUCE_APPEND) {
+        if (!into->has) {
+            into->value.name = NULL;
+            into->value.type = ARRAY;
+            into->value.value.arrayValue = createArray(ARRAY_INT, 0);
+            into->has = 1;
+        }
+        arrayAppend(into->value.value.arrayValue, value);
+        return;
+    }
+    if (!into->has) {
+        copyValue(&into->value, value);
+        into->has = 1;
+        return;
+    }
+
+    Variable result;
+    if (kind == REDUCE_SUM) {
+        result = performOperation(&into->value, value, "+");
+    } else {
+        // Ties keep the value that came first
+        Variable better = performComparison(value, &into->value, kind == REDUCE_MIN ? "<" : ">");
+        if (!better.value.boolValue) {
+            return;
+        }
+        copyValue(&result, value);
+    }
+    releaseValue(&into->value);
+    into->value = result;
+}
+
+// Fold the partial results of every chunk, in order, into the variable,
+// starting from the value it had before the loop
+static void finishReduction(ParallelJob *job, int index) {
+    ParallelLoop *loop = job->loop;
+    Reduction *reduction = &loop->header.reductions[index];
+    Partial total;
+    total.has = 0;
+
+    Variable *existing = findVariable(reduction->name);
+    if (existing) {
+        copyValue(&total.value, existing);
+        total.has = 1;
+    }
+    if (reduction->kind == REDUCE_APPEND && existing && existing->type != ARRAY) {
+        raiseError(ERROR_TYPE, currentLineNumber, "append reduction '%s' needs an array", reduction->name);
+    }
+
+    for (int chunk = 0; chunk < job->chunkCount; chunk++) {
+        Partial *part = &job->partials[chunk * loop->header.reductionCount + index];
+        if (!part->has) {
+            continue;
+        }
+        if (reduction->kind == REDUCE_APPEND && total.has) {
+            Array *from = part->value.value.arrayValue;
+            for (size_t i = 0; i < from->length; i++) {
+                Variable item;
+                arrayGet(from, (long)i, &item);
+                arrayAppend(total.value.value.arrayValue, &item);
+                releaseValue(&item);
+            }
+        } else if (reduction->kind == REDUCE_APPEND) {
+            copyValue(&total.value, &part->value);
+            total.has = 1;
+        } else {
+            combine(reduction->kind, &total, &part->value);
+        }
+        releaseValue(&part->value);
+    }
+
+    // A loop with nothing to add sums to 0 and appends to an empty array
+    if (!total.has && (reduction->kind == REDUCE_SUM || reduction->kind == REDUCE_APPEND)) {
+        total.value.name = NULL;
+        if (reduction->kind == REDUCE_SUM) {
+            total.value.type = INT;
+            total.value.value.intValue = 0;
+        } else {
+            total.value.type = ARRAY;
+            total.value.value.arrayValue = createArray(ARRAY_INT, 0);
+        }
+        total.has = 1;
+    }
+    if (total.has) {
+        assignVariable(reduction->name, &total.value);
+        releaseValue(&total.value);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Running the iterations
+
+static void runChunk(ParallelJob *job, Variable *slots, int chunk) {
+    ParallelLoop *loop = job->loop;
+    Function *body = loop->body;
+    Partial *partials = &job->partials[chunk * loop->header.reductionCount];
+    long first = chunk * job->chunkSize;
+    long last = first + job->chunkSize < job->count ? first + job->chunkSize : job->count;
+
+    for (long i = first; i < last; i++) {
+        Variable *item = &slots[1];
+        if (job->items) {
+            arrayGet(job->items, i, item);
+        } else {
+            item->type = INT;
+            item->value.intValue = job->first + (int)i;
+        }
+        item->name = body->localNames[0];
+
+        executeBlock(body->script, body->bodyStart, body->bodyEnd);
+        returnPending = 0;
+
+        currentLineNumber = job->lineNumber;
+        for (int r = 0; r < loop->header.reductionCount; r++) {
+            Variable *value = &slots[loop->slots[r] + 1];
+            if (value->name) {
+                combine(loop->header.reductions[r].kind, &partials[r], value);
+            }
+        }
+        for (int s = 0; s <= body->localCount; s++) {
+            releaseValue(&slots[s]);
+            slots[s].name = NULL;
+            slots[s].type = INT;
+        }
+    }
+}
+
+static int takeChunk(ChunkQueue *queue) {
+#ifndef _WIN32
+    pthread_mutex_lock(&queue->lock);
+#endif
+    int chunk = queue->next < queue->end ? queue->next++ : -1;
+#ifndef _WIN32
+    pthread_mutex_unlock(&queue->lock);
+#endif
+    return chunk;
+}
+
+#ifndef _WIN32
+// Move the back half of the first other queue with chunks left to the
+// thief's own, which is empty, and return the first of them to run
+static int stealChunks(ParallelJob *job, int thief) {
+    for (int k = 1; k < job->workers; k++) {
+        ChunkQueue *victim = &job->queues[(thief + k) % job->workers];
+        pthread_mutex_lock(&victim->lock);
+        int left = victim->end - victim->next;
+        if (left <= 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        int taken = (left + 1) / 2;
+        int first = victim->end - taken;
+        victim->end = first;
+        pthread_mutex_unlock(&victim->lock);
+
+        ChunkQueue *own = &job->queues[thief];
+        pthread_mutex_lock(&own->lock);
+        own->next = first + 1;
+        own->end = first + taken;
+        pthread_mutex_unlock(&own->lock);
+        return first;
+    }
+    return -1;
+}
+#endif
+
+static void runWorker(ParallelJob *job, int id) {
+    Function *body = job->loop->body;
+    Variable *slots = memAlloc((body->localCount + 1) * sizeof(Variable));
+    for (int i = 0; i <= body->localCount; i++) {
+        slots[i].name = NULL;
+        slots[i].type = INT;
+    }
+    int callerLine = currentLineNumber;
+    unsigned callerEpoch = parallelEpoch;
+    VariableTable callerGlobals = useVariables(job->globals);
+    currentLineNumber = job->lineNumber;
+    parallelActive = 1;
+    parallelEpoch = job->epoch;
+    enterInnerFrame(body, slots, job->outer);
+
+    int chunk;
+    while ((chunk = takeChunk(&job->queues[id])) >= 0
+#ifndef _WIN32
+           || (chunk = stealChunks(job, id)) >= 0
+#endif
+           ) {
+        runChunk(job, slots, chunk);
+    }
+
+    leaveFrame();
+    parallelActive = 0;
+    parallelEpoch = callerEpoch;
+    useVariables(callerGlobals);
+    currentLineNumber = callerLine;
+    memFree(slots);
+}
+
+#ifndef _WIN32
+
+// Threads are started by the first loop and then wait for the next one.
+// The thread that runs the loop statement works through chunks too. Task
+// blocks may run their first loops at the same time, so the pool is
+// started once, and poolSize set, before any of them goes on.
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t poolIdle = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t buildLock = PTHREAD_MUTEX_INITIALIZER;
+// Held by the thread whose loop the pool is running
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t poolStarted = PTHREAD_ONCE_INIT;
+static int poolSize = 0;
+static ParallelJob *poolJob = NULL;
+static unsigned long poolRound = 0;
+static int poolBusy = 0;
+
+static void *poolThread(void *argument) {
+    int id = (int)(intptr_t)argument;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&poolLock);
+    for (;;) {
+        while (poolRound == seen) {
+            pthread_cond_wait(&poolWake, &poolLock);
+        }
+        seen = poolRound;
+        ParallelJob *job = poolJob;
+        pthread_mutex_unlock(&poolLock);
+
+        if (id < job->workers) {
+            runWorker(job, id);
+        }
+
+        pthread_mutex_lock(&poolLock);
+        if (--poolBusy == 0) {
+            pthread_cond_signal(&poolIdle);
+        }
+    }
+    return NULL;
+}
+
+static void startPool(void) {
+    int threads = parallelThreads;
+    if (threads <= 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = processors > 1 ? (int)processors : 1;
+    }
+    if (threads > PARALLEL_MAX_THREADS) {
+        threads = PARALLEL_MAX_THREADS;
+    }
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    for (int id = 1; id < threads; id++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attributes, poolThread, (void *)(intptr_t)id) != 0) {
+            break;
+        }
+        poolSize++;
+    }
+    pthread_attr_destroy(&attributes);
+}
+
+static void runJob(ParallelJob *job) {
+    pthread_once(&poolStarted, startPool);
+    // While the pool runs a loop some task block started, the thread that
+    // gets here runs its loop alone rather than wait for the pool
+    int usePool = pthread_mutex_trylock(&jobLock) == 0;
+    int threads = usePool ? poolSize + 1 : 1;
+    job->workers = threads < job->chunkCount ? threads : job->chunkCount;
+    for (int id = 0; id < job->workers; id++) {
+        pthread_mutex_init(&job->queues[id].lock, NULL);
+        job->queues[id].next = (int)((long)job->chunkCount * id / job->workers);
+        job->queues[id].end = (int)((long)job->chunkCount * (id + 1) / job->workers);
+    }
+
+    if (usePool) {
+        __atomic_add_fetch(&liveThreads, job->workers - 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&poolLock);
+        poolJob = job;
+        poolBusy = poolSize;
+        poolRound++;
+        pthread_cond_broadcast(&poolWake);
+        pthread_mutex_unlock(&poolLock);
+    }
+
+    runWorker(job, 0);
+
+    if (usePool) {
+        pthread_mutex_lock(&poolLock);
+        while (poolBusy > 0) {
+            pthread_cond_wait(&poolIdle, &poolLock);
+        }
+        pthread_mutex_unlock(&poolLock);
+        __atomic_sub_fetch(&liveThreads, job->workers - 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&jobLock);
+    }
+
+    for (int id = 0; id < job->workers; id++) {
+        pthread_mutex_destroy(&job->queues[id].lock);
+    }
+}
+
+void parallelLock(void) {
+    if (sharingValues()) {
+        pthread_mutex_lock(&buildLock);
+    }
+}
+
+void parallelUnlock(void) {
+    if (sharingValues()) {
+        pthread_mutex_unlock(&buildLock);
+    }
+}
+
+#else
+
+// Without threads the iterations run one after another
+static void runJob(ParallelJob *job) {
+    job->workers = 1;
+    job->queues[0].next = 0;
+    job->queues[0].end = job->chunkCount;
+    runWorker(job, 0);
+}
+
+void parallelLock(void) {
+}
+
+void parallelUnlock(void) {
+}
+
+#endif
+
+// Evaluate what the loop runs over into job
+static void prepareJob(ParallelJob *job, const ScriptLine *line) {
+    ParallelLoop *loop = job->loop;
+    if (loop->items) {
+        Variable items;
+        evaluateNodeValue(loop->items, &items);
+        if (items.type == ARRAY) {
+            job->items = items.value.arrayValue;
+            retainArray(job->items);
+        } else if (items.type == MAP) {
+            job->items = mapKeys(items.value.mapValue);
+        } else {
+            raiseError(ERROR_TYPE, line->lineNumber, "parallel_for needs a range, an array or a map");
+        }
+        job->count = (long)job->items->length;
+        releaseValue(&items);
+        return;
+    }
+
+    Variable start;
+    Variable end;
+    evaluateNodeValue(loop->start, &start);
+    evaluateNodeValue(loop->end, &end);
+    if (start.type != INT || end.type != INT) {
+        raiseError(ERROR_TYPE, line->lineNumber, "parallel_for range bounds must be integers");
+    }
+    job->first = start.value.intValue;
+    job->count = end.value.intValue > start.value.intValue ?
+                 (long)end.value.intValue - start.value.intValue : 0;
+}
+
+// The iterations each assign to a copy of their own, which the loop then
+// drops, so a body assigning to a variable from outside the loop that is
+// not a reduction would change nothing
+static void checkOuterAssignments(const ParallelLoop *loop, int lineNumber) {
+    const Function *body = loop->body;
+    for (int i = body->paramCount; i < body->localCount; i++) {
+        int reduction = 0;
+        for (int j = 0; j < loop->header.reductionCount && !reduction; j++) {
+            reduction = loop->slots[j] == i;
+        }
+        if (!reduction && findVariable(body->localNames[i])) {
+            raiseError(ERROR_RUNTIME, lineNumber,
+                       "parallel_for body assigns to '%s' from outside the loop; make it a reduction or use another name",
+                       body->localNames[i]);
+        }
+    }
+}
+
+int parallelFor(Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    if (parallelActive) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "parallel_for loops cannot be nested");
+    }
+    // Task blocks may run the same loop at the same time
+    ParallelLoop *loop = __atomic_load_n(&line->parallel, __ATOMIC_ACQUIRE);
+    if (!loop) {
+        parallelLock();
+        loop = line->parallel;
+        if (!loop) {
+            loop = compileLoop(script, index);
+            __atomic_store_n(&line->parallel, loop, __ATOMIC_RELEASE);
+        }
+        parallelUnlock();
+    }
+    checkOuterAssignments(loop, line->lineNumber);
+
+    ParallelJob *job = memCalloc(1, sizeof(ParallelJob));
+    job->loop = loop;
+    job->lineNumber = line->lineNumber;
+    job->globals = currentVariables();
+    job->outer = currentFrame();
+    prepareJob(job, line);
+
+    int reductionCount = job->loop->header.reductionCount;
+    job->chunkSize = (job->count + PARALLEL_MAX_CHUNKS - 1) / PARALLEL_MAX_CHUNKS;
+    job->chunkCount = job->count > 0 ? (int)((job->count + job->chunkSize - 1) / job->chunkSize) : 0;
+    job->partials = memCalloc((size_t)job->chunkCount * reductionCount + 1, sizeof(Partial));
+
+    if (job->chunkCount > 0) {
+        // Picked once, before any thread could race to pick it
+        simdKernels();
+        job->epoch = __atomic_add_fetch(&lastEpoch, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&valuesShared, 1, __ATOMIC_RELAXED);
+        runJob(job);
+        __atomic_sub_fetch(&valuesShared, 1, __ATOMIC_RELAXED);
+    }
+
+    currentLineNumber = line->lineNumber;
+    for (int i = 0; i < reductionCount; i++) {
+        finishReduction(job, i);
+    }
+
+    if (job->items) {
+        releaseArray(job->items);
+    }
+    memFree(job->partials);
+    memFree(job);
+    return line->blockEnd;
+}
@@ -0,0 +1,83 @@
+#ifndef LEXER_PARALLEL_H
+#define LEXER_PARALLEL_H
+
+#include "lexer_script.h"
+
+// "parallel_for(i = 0 to n, sum total):" runs the iterations of its body on
+// a pool of threads. Each iteration gets locals of its own and the
+// reductions listed in the header combine what the iterations leave in them.
+
+typedef enum { REDUCE_SUM, REDUCE_MIN, REDUCE_MAX, REDUCE_APPEND } ReduceKind;
+
+typedef struct {
+    ReduceKind kind;
+    char *name;
+} Reduction;
+
+typedef struct {
+    char *name;        // Loop variable
+    char *start;       // "name = start to end", NULL for "name in items"
+    char *end;
+    char *items;
+    Reduction *reductions;
+    int reductionCount;
+} ParallelHeader;
+
+// Split the text of a parallel_for line. Returns NULL, or the reason the
+// line is not valid, in which case there is nothing to free.
+const char *parseParallelHeader(const char *text, ParallelHeader *header);
+void freeParallelHeader(ParallelHeader *header);
+
+// Threads in the pool, one per processor unless set before the first loop
+extern int parallelThreads;
+
+// Handle the parallel_for statement at index; returns the index after it
+int parallelFor(Script *script, int index);
+struct ParallelLoop;
+void freeParallelLoop(struct ParallelLoop *loop);
+
+// Nonzero on a thread while it runs the iterations of a loop. Values made
+// before the loop started are shared by every thread then, so they may be
+// read but not changed; parallelEpoch, stamped on arrays, maps and
+// coroutines as they are made, tells them apart from values an iteration
+// made. Every loop gets an epoch that no value had before.
+extern _Thread_local int parallelActive;
+extern _Thread_local unsigned parallelEpoch;
+
+// Nonzero while more than one thread may hold the same values: during a
+// parallel_for and while task blocks run
+extern int valuesShared;
+
+static inline int sharingValues(void) {
+    return __atomic_load_n(&valuesShared, __ATOMIC_RELAXED);
+}
+
+// Reference counts only need atomic updates while threads share values
+static inline void refRetain(int *count) {
+    if (sharingValues()) {
+        __atomic_add_fetch(count, 1, __ATOMIC_RELAXED);
+    } else {
+        (*count)++;
+    }
+}
+
+// Returns the count that is left
+static inline int refRelease(int *count) {
+    return sharingValues() ? __atomic_sub_fetch(count, 1, __ATOMIC_ACQ_REL) : --*count;
+}
+
+void sharedValueError(const char *what);
+
+// Stop unless a value stamped with epoch may be changed; what describes it
+static inline void checkWritable(unsigned epoch, const char *what) {
+    if (parallelActive && epoch != parallelEpoch) {
+        sharedValueError(what);
+    }
+}
+
+// For state that is built the first time it is used, like match tables:
+// held around building it while threads share values, a no-op otherwise
+void parallelLock(void);
+void parallelUnlock(void);
+
+#endif // LEXER_PARALLEL_H
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_prefetch.h"
+#include "lexer_interpret.h"
+#include "lexer_memory.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+
+typedef enum { PREFETCH_WAITING, PREFETCH_READ, PREFETCH_FAILED, PREFETCH_TAKEN } PrefetchState;
+
+// The text counts against --max-mem while it waits for its import. A file
+// that would take the script over the limit is left for the import to
+// open, so that the limit stops the script there.
+typedef struct {
+    char *fileName;
+    char *text;
+    size_t length;
+    PrefetchState state;
+} PrefetchFile;
+
+static PrefetchFile *files = NULL;
+static int fileCount = 0;
+static int nextFile = 0;
+static pthread_t threads[PREFETCH_THREADS];
+static int threadCount = 0;
+static pthread_mutex_t prefetchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetchDone = PTHREAD_COND_INITIALIZER;
+
+// Returns NULL if the file cannot be opened or read
+static char *readFile(const char *fileName, size_t *length) {
+    // Text mode, as import opens it
+    FILE *file = fopen(fileName, "r");
+    if (!file) {
+        return NULL;
+    }
+    size_t capacity = 4096;
+    size_t used = 0;
+    char *text = memTryRealloc(NULL, capacity);
+    while (text) {
+        used += fread(text + used, 1, capacity - used, file);
+        if (used < capacity) {
+            break;
+        }
+        capacity *= 2;
+        char *grown = memTryRealloc(text, capacity);
+        if (!grown) {
+            memFree(text);
+        }
+        text = grown;
+    }
+    if (text && ferror(file)) {
+        memFree(text);
+        text = NULL;
+    }
+    fclose(file);
+    *length = used;
+    return text;
+}
+
+static void *prefetchWorker(void *unused) {
+    (void)unused;
+    for (;;) {
+        pthread_mutex_lock(&prefetchLock);
+        int index = nextFile < fileCount ? nextFile++ : -1;
+        pthread_mutex_unlock(&prefetchLock);
+        if (index < 0) {
+            return NULL;
+        }
+
+        PrefetchFile *file = &files[index];
+        size_t length = 0;
+        char *text = readFile(file->fileName, &length);
+
+        pthread_mutex_lock(&prefetchLock);
+        file->text = text;
+        file->length = length;
+        file->state = text ? PREFETCH_READ : PREFETCH_FAILED;
+        pthread_cond_broadcast(&prefetchDone);
+        pthread_mutex_unlock(&prefetchLock);
+    }
+}
+
+static int findPrefetch(const char *fileName) {
+    for (int i = 0; i < fileCount; i++) {
+        if (strcmp(files[i].fileName, fileName) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void prefetchImports(const Script *script) {
+    finishPrefetch();
+    for (int i = 0; i < script->count; i++) {
+        const char *text = script->lines[i].text;
+        if (strncmp(text, "import", 6) != 0) {
+            continue;
+        }
+        char varName[256];
+        char fileName[256] = "";
+        parseImportStatement(text, varName, fileName);
+        if (!fileName[0] || findPrefetch(fileName) >= 0) {
+            continue;
+        }
+        files = memRealloc(files, (fileCount + 1) * sizeof(PrefetchFile));
+        PrefetchFile *file = &files[fileCount++];
+        file->fileName = memStrdup(fileName);
+        file->text = NULL;
+        file->length = 0;
+        file->state = PREFETCH_WAITING;
+    }
+
+    int wanted = fileCount < PREFETCH_THREADS ? fileCount : PREFETCH_THREADS;
+    while (threadCount < wanted) {
+        memoryThreadStarting();
+        if (pthread_create(&threads[threadCount], NULL, prefetchWorker, NULL) != 0) {
+            memoryThreadStopped();
+            break;
+        }
+        threadCount++;
+    }
+    // Without any threads the imports open the files themselves
+    if (threadCount == 0) {
+        finishPrefetch();
+    }
+}
+
+char *takePrefetched(const char *fileName, size_t *length) {
+    int index = findPrefetch(fileName);
+    if (index < 0) {
+        return NULL;
+    }
+    PrefetchFile *file = &files[index];
+    pthread_mutex_lock(&prefetchLock);
+    while (file->state == PREFETCH_WAITING) {
+        pthread_cond_wait(&prefetchDone, &prefetchLock);
+    }
+    char *text = NULL;
+    if (file->state == PREFETCH_READ) {
+        text = file->text;
+        *length = file->length;
+        file->text = NULL;
+        file->state = PREFETCH_TAKEN;
+    }
+    pthread_mutex_unlock(&prefetchLock);
+    return text;
+}
+
+void finishPrefetch(void) {
+    for (int i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+        memoryThreadStopped();
+    }
+    threadCount = 0;
+    for (int i = 0; i < fileCount; i++) {
+        memFree(files[i].text);
+        memFree(files[i].fileName);
+    }
+    memFree(files);
+    files = NULL;
+    fileCount = 0;
+    nextFile = 0;
+}
+
+#else
+
+// Without threads the imports open the files as they run
+void prefetchImports(const Script *script) {
+    (void)script;
+}
+
+char *takePrefetched(const char *fileName, size_t *length) {
+    (void)fileName;
+    (void)length;
+    return NULL;
+}
+
+void finishPrefetch(void) {
+}
+
+#endif
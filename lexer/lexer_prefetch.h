@@ -0,0 +1,25 @@
+#ifndef LEXER_PREFETCH_H
+#define LEXER_PREFETCH_H
+
+#include <stddef.h>
+#include "lexer_script.h"
+
+// Imported files are otherwise opened one at a time, as each import runs.
+// prefetchImports starts reading every file the script imports on a few
+// threads of their own, so that waiting on slow files overlaps; imports
+// then parse the text from memory. Files that cannot be read are left for
+// the import to open, so errors come when and as they always have.
+// Modules do not import, so the script's own imports are all there is.
+#define PREFETCH_THREADS 4
+
+void prefetchImports(const Script *script);
+
+// The text of fileName as a prefetch read it, waiting for the read if it
+// is still going, or NULL if no prefetch read it. The caller frees it
+// with memFree().
+char *takePrefetched(const char *fileName, size_t *length);
+
+// Wait for the reads and drop the text no import took
+void finishPrefetch(void);
+
+#endif // LEXER_PREFETCH_H
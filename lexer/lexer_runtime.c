@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_runtime.h"
+#include "lexer_interpret.h"
+#include "lexer_typecheck.h"
+#include "lexer_array.h"
+#include "lexer_map.h"
+#include "lexer_stream.h"
+#include "lexer_coroutine.h"
+#include "lexer_channel.h"
+#include "lexer_thread.h"
+#include "lexer_limit.h"
+#include "lexer_prefetch.h"
+#include "lexer_trace.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+typedef enum { LOOP_ARRAY, LOOP_LINES, LOOP_COROUTINE, LOOP_CHANNEL } LoopKind;
+
+// The loops of for statements, as the interpreter's loop frames hold them
+struct RuntimeLoop {
+    LoopKind kind;
+    char *name;
+    union {
+        struct {
+            Array *items;
+            size_t position;
+        } array;
+        LineSource *lines;
+        Coroutine *coroutine;
+        Channel *channel;
+    } source;
+};
+
+Script *runtimeStart(const char *source) {
+    Script *script = loadScript(source);
+    prefetchImports(script);
+    if (typecheckScript(script, 0) > 0) {
+        exit(EXIT_FAILURE);
+    }
+    startLimits();
+    return script;
+}
+
+void runtimeFinish(Script *script) {
+    finishTasks();
+    finishTaskBlocks();
+    finishPrefetch();
+    freeScript(script);
+}
+
+void runtimeAssign(const char *name, Expr *value) {
+    Variable result;
+    if (value && evaluateNode(value, &result)) {
+        assignVariable(name, &result);
+        releaseValue(&result);
+    }
+}
+
+int runtimeCondition(Expr *condition) {
+    return condition && evaluateTruth(condition) > 0;
+}
+
+// The slot of global in the globals of this thread, or NULL
+static Variable *globalSlot(RuntimeGlobal *global) {
+    VariableTable table = currentVariables();
+    if (global->index < table.count && strcmp(table.items[global->index].name, global->name) == 0) {
+        return &table.items[global->index];
+    }
+    for (size_t i = 0; i < table.count; i++) {
+        if (strcmp(table.items[i].name, global->name) == 0) {
+            global->index = i;
+            return &table.items[i];
+        }
+    }
+    return NULL;
+}
+
+int runtimeLoad(RuntimeGlobal *global, Variable *value) {
+    Variable *slot = globalSlot(global);
+    if (!slot) {
+        return 0;
+    }
+    // Numbers and booleans have nothing to retain
+    *value = *slot;
+    value->name = NULL;
+    return 1;
+}
+
+void runtimeStore(RuntimeGlobal *global, const Variable *value) {
+    Variable *slot = globalSlot(global);
+    if (!slot) {
+        assignVariable(global->name, value);
+        return;
+    }
+    traceEvent(TRACE_VARIABLE_WRITE, global->name);
+    setVariableValue(slot, value->type, (void *)&value->value);
+}
+
+RuntimeLoop *runtimeLoopStart(const char *name, Expr *source) {
+    RuntimeLoop *loop = memAlloc(sizeof(RuntimeLoop));
+    loop->name = memStrdup(name);
+
+    if (source && source->kind == EXPR_CALL && strcmp(source->name, "lines") == 0 && source->childCount == 1) {
+        Variable path;
+        evaluateNodeValue(source->children[0], &path);
+        loop->kind = LOOP_LINES;
+        loop->source.lines = memAlloc(sizeof(LineSource));
+        linesOpen(loop->source.lines, &path);
+        releaseValue(&path);
+        return loop;
+    }
+
+    Variable value;
+    Variable *collection = source && evaluateNode(source, &value) ? &value : NULL;
+    if (collection && collection->type == ARRAY) {
+        loop->kind = LOOP_ARRAY;
+        loop->source.array.items = collection->value.arrayValue;
+        loop->source.array.position = 0;
+        retainArray(loop->source.array.items);
+    } else if (collection && collection->type == MAP) {
+        loop->kind = LOOP_ARRAY;
+        loop->source.array.items = mapKeys(collection->value.mapValue);
+        loop->source.array.position = 0;
+    } else if (collection && collection->type == COROUTINE) {
+        loop->kind = LOOP_COROUTINE;
+        loop->source.coroutine = collection->value.coroutineValue;
+        retainCoroutine(loop->source.coroutine);
+    } else if (collection && collection->type == CHANNEL) {
+        loop->kind = LOOP_CHANNEL;
+        loop->source.channel = collection->value.channelValue;
+        retainChannel(loop->source.channel);
+    } else {
+        raiseError(ERROR_TYPE, currentLineNumber, "for needs an array or a map");
+    }
+    releaseValue(collection);
+    return loop;
+}
+
+static void freeLoop(RuntimeLoop *loop) {
+    if (loop->kind == LOOP_ARRAY) {
+        releaseArray(loop->source.array.items);
+    } else if (loop->kind == LOOP_LINES) {
+        lineSourceClose(loop->source.lines);
+        memFree(loop->source.lines);
+    } else if (loop->kind == LOOP_COROUTINE) {
+        releaseCoroutine(loop->source.coroutine);
+    } else {
+        releaseChannel(loop->source.channel);
+    }
+    memFree(loop->name);
+    memFree(loop);
+}
+
+int runtimeLoopNext(RuntimeLoop *loop) {
+    Variable item;
+    item.name = NULL;
+    int more;
+    if (loop->kind == LOOP_ARRAY) {
+        // Elements the body appends are visited too
+        more = loop->source.array.position < loop->source.array.items->length;
+        if (more) {
+            arrayGet(loop->source.array.items, (long)loop->source.array.position++, &item);
+        }
+    } else if (loop->kind == LOOP_LINES) {
+        item.type = STRING;
+        more = lineSourceNext(loop->source.lines, &item.value.stringValue);
+    } else if (loop->kind == LOOP_CHANNEL) {
+        more = channelRecv(loop->source.channel, &item);
+    } else {
+        more = coroutineNext(loop->source.coroutine, &item);
+    }
+    if (!more) {
+        freeLoop(loop);
+        return 0;
+    }
+    assignVariable(loop->name, &item);
+    releaseValue(&item);
+    return 1;
+}
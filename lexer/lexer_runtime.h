@@ -0,0 +1,45 @@
+#ifndef LEXER_RUNTIME_H
+#define LEXER_RUNTIME_H
+
+#include "lexer_script.h"
+#include "lexer_expr.h"
+#include "lexer_display.h"
+#include "lexer_numeric.h"
+
+// What the C written by --emit-c calls. The program carries the script's
+// source, so the statements it was not translated into C for still run
+// through the interpreter, and so do the expressions that are not worked
+// out in C.
+
+// Load and type check source and start the limits. A type error stops the
+// program as it stops noviq -e.
+Script *runtimeStart(const char *source);
+// Wait for the tasks the script started and free it
+void runtimeFinish(Script *script);
+
+// "name = value". A value that uses a missing variable, or a NULL one that
+// did not parse, assigns nothing.
+void runtimeAssign(const char *name, Expr *value);
+int runtimeCondition(Expr *condition);
+
+// A global that C code reads and writes itself. index is where the name
+// was last found; the globals are only ever added to at the top level, so
+// it is looked up once rather than on every use.
+typedef struct {
+    const char *name;
+    size_t index;
+} RuntimeGlobal;
+
+// Copy the number or boolean in global to value. Returns 0 if it is not
+// set, which makes the expression using it evaluate to nothing.
+int runtimeLoad(RuntimeGlobal *global, Variable *value);
+// "name = value" for a number or boolean worked out in C
+void runtimeStore(RuntimeGlobal *global, const Variable *value);
+
+// "for name in source:". Each runtimeLoopNext assigns the next item to the
+// name; once there are none left it frees the loop and returns 0.
+typedef struct RuntimeLoop RuntimeLoop;
+RuntimeLoop *runtimeLoopStart(const char *name, Expr *source);
+int runtimeLoopNext(RuntimeLoop *loop);
+
+#endif // LEXER_RUNTIME_H
@@ -0,0 +1,630 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_script.h"
+#include "lexer_interpret.h"
+#include "lexer_array.h"
+#include "lexer_map.h"
+#include "lexer_function.h"
+#include "lexer_stream.h"
+#include "lexer_expr.h"
+#include "lexer_match.h"
+#include "lexer_coroutine.h"
+#include "lexer_parallel.h"
+#include "lexer_channel.h"
+#include "lexer_thread.h"
+#include "lexer_limit.h"
+#include "lexer_trace.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+static void addLine(Script *script, int *capacity, const char *text, int indent, int lineNumber) {
+    if (script->count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        script->lines = memRealloc(script->lines, *capacity * sizeof(ScriptLine));
+    }
+    ScriptLine *line = &script->lines[script->count++];
+    line->text = memStrdup(text);
+    line->indent = indent;
+    line->lineNumber = lineNumber;
+    line->blockEnd = script->count;
+    line->match = NULL;
+    line->parallel = NULL;
+}
+
+// A line's block ends at the next line that is not indented deeper than it
+static void computeBlockEnds(Script *script) {
+    int *open = memAlloc((script->count + 1) * sizeof(int));
+    int depth = 0;
+
+    for (int i = 0; i < script->count; i++) {
+        while (depth > 0 && script->lines[open[depth - 1]].indent >= script->lines[i].indent) {
+            script->lines[open[--depth]].blockEnd = i;
+        }
+        open[depth++] = i;
+    }
+    while (depth > 0) {
+        script->lines[open[--depth]].blockEnd = script->count;
+    }
+    memFree(open);
+}
+
+// Split source into statements, dropping blank lines and comments
+Script *loadScript(const char *source) {
+    Script *script = memAlloc(sizeof(Script));
+    script->lines = NULL;
+    script->count = 0;
+
+    int capacity = 0;
+    int lineNumber = 0;
+    int inMultilineComment = 0;
+    const char *cursor = source;
+    char *line = NULL;
+    size_t lineCapacity = 0;
+
+    while (*cursor) {
+        const char *end = strchr(cursor, '\n');
+        if (!end) end = cursor + strlen(cursor);
+        size_t length = end - cursor;
+        lineNumber++;
+
+        if (length + 1 > lineCapacity) {
+            lineCapacity = length + 1;
+            line = memRealloc(line, lineCapacity);
+        }
+        memcpy(line, cursor, length);
+        line[length] = '\0';
+        if (length > 0 && line[length - 1] == '\r') {
+            line[length - 1] = '\0';
+        }
+        cursor = *end ? end + 1 : end;
+
+        // Skip empty lines or lines with only whitespace
+        int indent = 0;
+        while (line[indent] == ' ' || line[indent] == '\t') indent++;
+        char *trimmed = line + indent;
+        if (*trimmed == '\0') {
+            continue;
+        }
+
+        // Handle comments
+        if (strncmp(trimmed, "##", 2) == 0) {
+            inMultilineComment = !inMultilineComment;
+            continue;
+        }
+
+        if (inMultilineComment || strncmp(trimmed, "#", 1) == 0) {
+            continue;
+        }
+
+        // Process single-line comments
+        char *commentStart = strstr(trimmed, "#");
+        if (commentStart != NULL) {
+            *commentStart = '\0';
+            while (commentStart > trimmed && (*(commentStart-1) == ' ' || *(commentStart-1) == '\t')) {
+                commentStart--;
+            }
+            *commentStart = '\0';
+            if (*trimmed == '\0') {
+                continue;
+            }
+        }
+
+        addLine(script, &capacity, trimmed, indent, lineNumber);
+    }
+
+    memFree(line);
+    computeBlockEnds(script);
+    return script;
+}
+
+Script *loadScriptFile(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    // Load the whole script so that blocks can be run more than once
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *source = memAlloc(size + 1);
+    size_t read = fread(source, 1, size, file);
+    source[read] = '\0';
+    fclose(file);
+
+    Script *script = loadScript(source);
+    memFree(source);
+    return script;
+}
+
+void freeScript(Script *script) {
+    for (int i = 0; i < script->count; i++) {
+        memFree(script->lines[i].text);
+        freeMatchTable(script->lines[i].match);
+        freeParallelLoop(script->lines[i].parallel);
+    }
+    memFree(script->lines);
+    memFree(script);
+}
+
+typedef enum { FRAME_BLOCK, FRAME_ARRAY, FRAME_LINES, FRAME_COROUTINE, FRAME_CHANNEL } FrameKind;
+
+// A block being run, or a for loop between passes over its body
+typedef struct ExecFrame {
+    FrameKind kind;
+    Script *script;
+    int index;         // Block: next statement to run. Loop: the for line
+    int end;           // Block: first index after the block
+    char *name;        // Loop: the loop variable
+    union {
+        struct {
+            Array *items;
+            size_t position;
+        } array;
+        LineSource *lines;
+        Coroutine *coroutine;
+        Channel *channel;
+    } source;
+} ExecFrame;
+
+// Top level statements and the functions they call run here, each
+// coroutine has a runner of its own. Threads running parallel_for
+// iterations have a main runner of their own too.
+static _Thread_local Runner mainRunner = { NULL, 0, 0 };
+static _Thread_local Runner *running = NULL;
+
+static Runner *currentRunner(void) {
+    return running ? running : &mainRunner;
+}
+
+static ExecFrame *pushFrame(Runner *runner, FrameKind kind, Script *script, int index) {
+    if (runner->count == runner->capacity) {
+        runner->capacity = runner->capacity ? runner->capacity * 2 : 16;
+        runner->frames = memRealloc(runner->frames, runner->capacity * sizeof(ExecFrame));
+    }
+    ExecFrame *frame = &runner->frames[runner->count++];
+    frame->kind = kind;
+    frame->script = script;
+    frame->index = index;
+    frame->end = index;
+    frame->name = NULL;
+    return frame;
+}
+
+static void popFrame(Runner *runner) {
+    ExecFrame *frame = &runner->frames[--runner->count];
+    if (frame->kind == FRAME_ARRAY) {
+        releaseArray(frame->source.array.items);
+    } else if (frame->kind == FRAME_LINES) {
+        lineSourceClose(frame->source.lines);
+        memFree(frame->source.lines);
+    } else if (frame->kind == FRAME_COROUTINE) {
+        releaseCoroutine(frame->source.coroutine);
+    } else if (frame->kind == FRAME_CHANNEL) {
+        releaseChannel(frame->source.channel);
+    }
+    memFree(frame->name);
+}
+
+void runnerPushBlock(Runner *runner, Script *script, int start, int end) {
+    ExecFrame *frame = pushFrame(runner, FRAME_BLOCK, script, start);
+    frame->end = end;
+}
+
+void runnerClear(Runner *runner) {
+    while (runner->count > 0) {
+        popFrame(runner);
+    }
+    memFree(runner->frames);
+    runner->frames = NULL;
+    runner->capacity = 0;
+}
+
+void clearMainRunner(void) {
+    runnerClear(&mainRunner);
+}
+
+Runner *runnerSwitch(Runner *runner) {
+    Runner *previous = currentRunner();
+    running = runner;
+    return previous;
+}
+
+// Push the indented body of the compound statement at index
+static void pushBody(Runner *runner, Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    if (line->blockEnd == index + 1) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Expected an indented block");
+    }
+    runnerPushBlock(runner, script, index + 1, line->blockEnd);
+}
+
+// The condition of "if(...):", parsed where it stands in the line. The
+// condition may contain calls and indexes, so it ends at the last "):" on
+// the line.
+static Expr *extractCondition(const ScriptLine *line, size_t prefixLength) {
+    const char *start = line->text + prefixLength;
+    const char *end = start + strlen(start);
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    if (end - start < 3 || end[-1] != ':' || end[-2] != ')') {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Invalid if statement syntax");
+    }
+    return parseExpressionPart(start, (size_t)(end - 2 - start));
+}
+
+static int checkCondition(const ScriptLine *line, size_t prefixLength) {
+    currentLineNumber = line->lineNumber;
+    Expr *condition = extractCondition(line, prefixLength);
+    return condition && evaluateTruth(condition) > 0;
+}
+
+// Pick the branch of an if/elseif/else chain to run; returns the index
+// after the whole chain
+static int stepIf(Runner *runner, Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    int indent = line->indent;
+    int taken = checkCondition(line, 3) ? index : -1;
+    index = line->blockEnd;
+
+    while (index < script->count && script->lines[index].indent == indent) {
+        ScriptLine *next = &script->lines[index];
+        if (strncmp(next->text, "elseif(", 7) == 0) {
+            if (taken < 0 && checkCondition(next, 7)) {
+                taken = index;
+            }
+        } else if (strcmp(next->text, "else:") == 0) {
+            if (taken < 0) {
+                taken = index;
+            }
+            index = next->blockEnd;
+            break;
+        } else {
+            break;
+        }
+        index = next->blockEnd;
+    }
+
+    if (taken >= 0) {
+        pushBody(runner, script, taken);
+    }
+    return index;
+}
+
+// Start "for name in collection:" over an array's elements, a map's keys,
+// the values a coroutine yields, the values received from a channel until
+// it is closed or, for lines(file), a file's lines. The loop's frame hands
+// out one item per pass.
+static int stepFor(Runner *runner, Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    char *header = memStrdup(line->text + 4);
+    Held held[3];
+    holdBuffer(&held[0], &header);
+    size_t length = strlen(header);
+    char *in = strstr(header, " in ");
+
+    if (length == 0 || header[length - 1] != ':' || !in) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Invalid for statement syntax");
+    }
+    header[length - 1] = '\0';
+    *in = '\0';
+
+    char *name = header;
+    while (*name == ' ') name++;
+    char *nameEnd = name + strlen(name);
+    while (nameEnd > name && nameEnd[-1] == ' ') *--nameEnd = '\0';
+
+    // Lines are read as the loop runs, so that memory use does not grow
+    // with the size of the file
+    Expr *source = parseExpression(in + 4);
+    if (source && source->kind == EXPR_CALL && strcmp(source->name, "lines") == 0 && source->childCount == 1) {
+        Variable path;
+        evaluateNodeValue(source->children[0], &path);
+        holdValue(&held[1], &path);
+        LineSource *lines = memAlloc(sizeof(LineSource));
+        holdBuffer(&held[2], &lines);
+        linesOpen(lines, &path);
+        letGo(held[0].next);
+        releaseValue(&path);
+        ExecFrame *frame = pushFrame(runner, FRAME_LINES, script, index);
+        frame->name = memStrdup(name);
+        frame->source.lines = lines;
+        memFree(header);
+        return line->blockEnd;
+    }
+
+    Variable value;
+    Variable *collection = source && evaluateNode(source, &value) ? &value : NULL;
+    if (collection) holdValue(&held[1], collection);
+    ExecFrame *frame;
+    if (collection && collection->type == ARRAY) {
+        frame = pushFrame(runner, FRAME_ARRAY, script, index);
+        frame->source.array.items = collection->value.arrayValue;
+        frame->source.array.position = 0;
+        retainArray(frame->source.array.items);
+    } else if (collection && collection->type == MAP) {
+        frame = pushFrame(runner, FRAME_ARRAY, script, index);
+        frame->source.array.items = mapKeys(collection->value.mapValue);
+        frame->source.array.position = 0;
+    } else if (collection && collection->type == COROUTINE) {
+        frame = pushFrame(runner, FRAME_COROUTINE, script, index);
+        frame->source.coroutine = collection->value.coroutineValue;
+        retainCoroutine(frame->source.coroutine);
+    } else if (collection && collection->type == CHANNEL) {
+        frame = pushFrame(runner, FRAME_CHANNEL, script, index);
+        frame->source.channel = collection->value.channelValue;
+        retainChannel(frame->source.channel);
+    } else {
+        raiseError(ERROR_TYPE, line->lineNumber, "for needs an array or a map");
+    }
+    frame->name = memStrdup(name);
+    letGo(held[0].next);
+    releaseValue(collection);
+    memFree(header);
+    return line->blockEnd;
+}
+
+// Give the loop at top its next item and push its body. Returns 0 when
+// there are no items left.
+static int nextItem(Runner *runner, int top) {
+    ExecFrame *frame = &runner->frames[top];
+    Variable item;
+    item.name = NULL;
+    if (frame->kind == FRAME_ARRAY) {
+        // The length is rechecked every pass so elements appended by the
+        // body are visited too
+        if (frame->source.array.position >= frame->source.array.items->length) {
+            return 0;
+        }
+        arrayGet(frame->source.array.items, (long)frame->source.array.position++, &item);
+    } else if (frame->kind == FRAME_LINES) {
+        item.type = STRING;
+        if (!lineSourceNext(frame->source.lines, &item.value.stringValue)) {
+            return 0;
+        }
+    } else if (frame->kind == FRAME_CHANNEL) {
+        if (!channelRecv(frame->source.channel, &item)) {
+            return 0;
+        }
+    } else if (!coroutineNext(frame->source.coroutine, &item)) {
+        return 0;
+    }
+    assignVariable(frame->name, &item);
+    releaseValue(&item);
+    pushBody(runner, frame->script, frame->index);
+    return 1;
+}
+
+// The name of "catch name:" as a new string, "" for "catch:", or NULL if
+// text is not a catch
+static char *catchName(const ScriptLine *line) {
+    const char *text = line->text;
+    if (strcmp(text, "catch:") == 0) {
+        return memStrdup("");
+    }
+    size_t length = strlen(text);
+    if (strncmp(text, "catch ", 6) != 0 || text[length - 1] != ':') {
+        return NULL;
+    }
+    char *name = memStrdup(text + 6);
+    char *end = name + strlen(name) - 1;
+    *end = '\0';
+    while (end > name && (end[-1] == ' ' || end[-1] == '\t')) *--end = '\0';
+    Expr *parsed = parseExpression(name);
+    if (!parsed || parsed->kind != EXPR_VARIABLE) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Invalid catch statement syntax");
+    }
+    return name;
+}
+
+static void setField(Map *map, const char *name, Variable *value) {
+    Variable key;
+    key.name = NULL;
+    key.type = STRING;
+    stringFromText(&key.value.stringValue, name);
+    mapSet(map, &key, value);
+    releaseValue(&key);
+    releaseValue(value);
+}
+
+// The map "catch name:" gives name
+static void assignError(const char *name, const ScriptError *error) {
+    Map *map = createMap();
+    Variable field;
+    field.name = NULL;
+    field.type = STRING;
+    stringFromText(&field.value.stringValue, errorKindName(error->kind));
+    setField(map, "kind", &field);
+    field.type = INT;
+    field.value.intValue = error->line;
+    setField(map, "line", &field);
+    field.type = INT;
+    field.value.intValue = error->column;
+    setField(map, "column", &field);
+    field.type = STRING;
+    stringFromText(&field.value.stringValue, error->message);
+    setField(map, "message", &field);
+
+    Variable value;
+    value.name = NULL;
+    value.type = MAP;
+    value.value.mapValue = map;
+    assignVariable(name, &value);
+    releaseValue(&value);
+}
+
+// Run "try:" and then, if its block raised an error, the block of the
+// "catch name:" after it. Returns the index after both.
+static int stepTry(Runner *runner, Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    int catchIndex = line->blockEnd;
+    char *name = NULL;
+    if (catchIndex < script->count && script->lines[catchIndex].indent == line->indent) {
+        name = catchName(&script->lines[catchIndex]);
+    }
+    if (!name) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "try without catch");
+    }
+    if (line->blockEnd == index + 1 || script->lines[catchIndex].blockEnd == catchIndex + 1) {
+        memFree(name);
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Expected an indented block");
+    }
+
+    ScriptError error;
+    if (!executeProtected(script, index + 1, line->blockEnd, &error)) {
+        if (name[0]) {
+            assignError(name, &error);
+        }
+        runnerPushBlock(runner, script, catchIndex + 1, script->lines[catchIndex].blockEnd);
+    }
+    memFree(name);
+    return script->lines[catchIndex].blockEnd;
+}
+
+static int startStatement(Runner *runner, Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+
+    if (strncmp(line->text, "if(", 3) == 0) {
+        return stepIf(runner, script, index);
+    }
+    if (strncmp(line->text, "elseif(", 7) == 0) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "elseif without if");
+    }
+    if (strcmp(line->text, "else:") == 0) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "else without if");
+    }
+    if (strncmp(line->text, "for ", 4) == 0) {
+        return stepFor(runner, script, index);
+    }
+    if (strcmp(line->text, "try:") == 0) {
+        return stepTry(runner, script, index);
+    }
+    if (strcmp(line->text, "catch:") == 0 || strncmp(line->text, "catch ", 6) == 0) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "catch without try");
+    }
+    if (strncmp(line->text, "match(", 6) == 0) {
+        int arm = findMatchArm(script, index);
+        if (arm >= 0) {
+            runnerPushBlock(runner, script, arm + 1, script->lines[arm].blockEnd);
+        }
+        return line->blockEnd;
+    }
+    if (strncmp(line->text, "case ", 5) == 0 || strcmp(line->text, "default:") == 0) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "%s outside of match",
+                   line->text[0] == 'c' ? "case" : "default");
+    }
+    if (strncmp(line->text, "parallel_for(", 13) == 0) {
+        return parallelFor(script, index);
+    }
+    if (strncmp(line->text, "task", 4) == 0 && (line->text[4] == ':' || line->text[4] == ' ')) {
+        return startTaskBlock(script, index);
+    }
+    if (strncmp(line->text, "func ", 5) == 0) {
+        return defineFunction(script, index);
+    }
+    if (strcmp(line->text, "return") == 0 || strncmp(line->text, "return ", 7) == 0) {
+        returnStatement(line->text + 6);
+        return index + 1;
+    }
+    if (strcmp(line->text, "yield") == 0 || strncmp(line->text, "yield ", 6) == 0) {
+        yieldStatement(line->text + 5);
+        return index + 1;
+    }
+
+    interpretCommand(line->text, line->lineNumber);
+    return index + 1;
+}
+
+// Start the statement at index, pushing a frame for any block it opens.
+// Returns the index of the statement after it.
+static int stepStatement(Runner *runner, Script *script, int index) {
+    currentLineNumber = script->lines[index].lineNumber;
+    currentColumn = script->lines[index].indent + 1;
+    countStatement();
+    traceEvent(TRACE_STATEMENT_START, NULL);
+    int next = startStatement(runner, script, index);
+    traceEvent(TRACE_STATEMENT_END, NULL);
+    return next;
+}
+
+int runnerRun(Runner *runner, int base) {
+    while (runner->count > base) {
+        // A return inside a function skips the rest of every enclosing
+        // block and loop
+        if (returnPending) {
+            while (runner->count > base) {
+                popFrame(runner);
+            }
+            break;
+        }
+
+        int top = runner->count - 1;
+        ExecFrame *frame = &runner->frames[top];
+        if (frame->kind == FRAME_BLOCK) {
+            if (frame->index >= frame->end) {
+                popFrame(runner);
+                continue;
+            }
+            // Calls made by the statement push frames of their own, which
+            // may move the stack
+            int next = stepStatement(runner, frame->script, frame->index);
+            runner->frames[top].index = next;
+        } else if (!nextItem(runner, top)) {
+            popFrame(runner);
+        }
+
+        if (yieldPending) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void executeScript(Script *script) {
+    executeBlock(script, 0, script->count);
+    finishTasks();
+    finishTaskBlocks();
+}
+
+int executeBlock(Script *script, int start, int end) {
+    Runner *runner = currentRunner();
+    int base = runner->count;
+    runnerPushBlock(runner, script, start, end);
+    runnerRun(runner, base);
+    return end;
+}
+
+int executeProtected(Script *script, int start, int end, ScriptError *error) {
+    Runner *runner = currentRunner();
+    int base = runner->count;
+    StackMark stack = stackMark();
+    Coroutine *coroutine = runningCoroutine();
+    ErrorHandler handler;
+
+    if (catchError(&handler)) {
+        // Drop what the error left partway through: generators it was
+        // running, calls, then the blocks and loops of this runner
+        abandonCoroutines(coroutine);
+        unwindStack(stack);
+        runnerSwitch(runner);
+        while (runner->count > base) {
+            popFrame(runner);
+        }
+        yieldPending = 0;
+        *error = handler.error;
+        return 0;
+    }
+
+    runnerPushBlock(runner, script, start, end);
+    runnerRun(runner, base);
+    dropHandler(&handler);
+    return 1;
+}
+
+int executeStatement(Script *script, int index) {
+    Runner *runner = currentRunner();
+    int base = runner->count;
+    int next = stepStatement(runner, script, index);
+    runnerRun(runner, base);
+    return next;
+}
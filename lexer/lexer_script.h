@@ -0,0 +1,63 @@
+#ifndef LEXER_SCRIPT_H
+#define LEXER_SCRIPT_H
+
+#include "lexer_error.h"
+
+struct MatchTable;
+struct ParallelLoop;
+
+// One statement of a loaded script
+typedef struct {
+    char *text;        // Statement with indentation and comments removed
+    int indent;
+    int lineNumber;
+    int blockEnd;      // Index of the first line after this line's nested block
+    struct MatchTable *match;  // Jump table of a match statement, once it has run
+    struct ParallelLoop *parallel;  // A parallel_for statement, once it has run
+} ScriptLine;
+
+// A script held in memory so that blocks can be run more than once
+typedef struct {
+    ScriptLine *lines;
+    int count;
+} Script;
+
+Script *loadScript(const char *source);
+// Returns NULL if the file cannot be opened
+Script *loadScriptFile(const char *path);
+void freeScript(Script *script);
+void executeScript(Script *script);
+
+// Statements run off an explicit stack of frames rather than the C stack.
+// Every block and loop in progress has a frame, so a coroutine can stop
+// partway through its body and carry on from the same place later.
+struct ExecFrame;
+typedef struct {
+    struct ExecFrame *frames;
+    int count;
+    int capacity;
+} Runner;
+
+void runnerPushBlock(Runner *runner, Script *script, int start, int end);
+// Run the frames above base. Returns 1 if a yield stopped them and 0 once
+// they have all finished.
+int runnerRun(Runner *runner, int base);
+// Drop every frame and free the stack
+void runnerClear(Runner *runner);
+// Make runner the one nested blocks run on; returns the previous one
+Runner *runnerSwitch(Runner *runner);
+// runnerClear for this thread's main runner, once the thread is done
+void clearMainRunner(void);
+
+// Run the statement at index, and any block it opens, to the end. Returns
+// the index of the next statement to run.
+int executeStatement(Script *script, int index);
+int executeBlock(Script *script, int start, int end);
+
+// Run the block from start to end. Returns 0 if an error stopped it, with
+// the error in error and the generators, calls, blocks and loops it was
+// partway through dropped, as "try:" does. Values the failed statement
+// was still working on are not freed. For hosts as well as scripts.
+int executeProtected(Script *script, int start, int end, ScriptError *error);
+
+#endif // LEXER_SCRIPT_H
@@ -0,0 +1,697 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_simd.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NOVIQ_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Integer arithmetic goes through uint64_t so overflow wraps instead of
+// being undefined
+static inline int64_t wrapAdd(int64_t x, int64_t y) { return (int64_t)((uint64_t)x + (uint64_t)y); }
+static inline int64_t wrapSub(int64_t x, int64_t y) { return (int64_t)((uint64_t)x - (uint64_t)y); }
+static inline int64_t wrapMul(int64_t x, int64_t y) { return (int64_t)((uint64_t)x * (uint64_t)y); }
+static inline double floatAdd(double x, double y) { return x + y; }
+static inline double floatSub(double x, double y) { return x - y; }
+static inline double floatMul(double x, double y) { return x * y; }
+static inline double floatDiv(double x, double y) { return x / y; }
+
+// out[i] = a[i] op b[i], with one side optionally broadcast. VOP works on
+// WIDTH lanes at a time and SOP finishes the tail.
+#define ELEMENTWISE_LOOP(VEC, WIDTH, LOAD, STORE, SET1, VOP, SOP)              \
+    do {                                                                       \
+        size_t i = 0;                                                          \
+        if (mode == BROADCAST_NONE) {                                          \
+            for (; i + WIDTH <= n; i += WIDTH)                                 \
+                STORE(out + i, VOP(LOAD(a + i), LOAD(b + i)));                 \
+            for (; i < n; i++) out[i] = SOP(a[i], b[i]);                       \
+        } else if (mode == BROADCAST_RIGHT) {                                  \
+            VEC right = SET1(b[0]);                                            \
+            for (; i + WIDTH <= n; i += WIDTH)                                 \
+                STORE(out + i, VOP(LOAD(a + i), right));                       \
+            for (; i < n; i++) out[i] = SOP(a[i], b[0]);                       \
+        } else {                                                               \
+            VEC left = SET1(a[0]);                                             \
+            for (; i + WIDTH <= n; i += WIDTH)                                 \
+                STORE(out + i, VOP(left, LOAD(b + i)));                        \
+            for (; i < n; i++) out[i] = SOP(a[0], b[i]);                       \
+        }                                                                      \
+    } while (0)
+
+// Sign bits of a sum or difference r of x and y that wrapped: a sum has
+// the sign of neither operand, a difference of operands that differ in
+// sign loses the sign of x. WRAPPED_LOOP ORs them into lanes and bits.
+static inline int64_t addWrapBits(int64_t x, int64_t y, int64_t r) { return (x ^ r) & (y ^ r); }
+static inline int64_t subWrapBits(int64_t x, int64_t y, int64_t r) { return (x ^ y) & (x ^ r); }
+
+#define WRAPPED_LOOP(VEC, WIDTH, LOAD, SET1, OR, VBITS, SBITS)                \
+    do {                                                                       \
+        size_t i = 0;                                                          \
+        if (mode == BROADCAST_NONE) {                                          \
+            for (; i + WIDTH <= n; i += WIDTH)                                 \
+                lanes = OR(lanes, VBITS(LOAD(a + i), LOAD(b + i), LOAD(out + i))); \
+            for (; i < n; i++) bits |= SBITS(a[i], b[i], out[i]);             \
+        } else if (mode == BROADCAST_RIGHT) {                                  \
+            VEC right = SET1(b[0]);                                            \
+            for (; i + WIDTH <= n; i += WIDTH)                                 \
+                lanes = OR(lanes, VBITS(LOAD(a + i), right, LOAD(out + i)));   \
+            for (; i < n; i++) bits |= SBITS(a[i], b[0], out[i]);             \
+        } else {                                                               \
+            VEC left = SET1(a[0]);                                             \
+            for (; i + WIDTH <= n; i += WIDTH)                                 \
+                lanes = OR(lanes, VBITS(left, LOAD(b + i), LOAD(out + i)));    \
+            for (; i < n; i++) bits |= SBITS(a[0], b[i], out[i]);             \
+        }                                                                      \
+    } while (0)
+
+#define SCALAR_LOAD(p) (*(p))
+#define SCALAR_STORE(p, v) (*(p) = (v))
+#define SCALAR_SET1(x) (x)
+#define SCALAR_OR(x, y) ((x) | (y))
+
+// ---------------------------------------------------------------------------
+// Scalar fallback
+
+static void scalarIntOp(KernelOp op, int64_t *out, const int64_t *a, const int64_t *b, size_t n, BroadcastMode mode) {
+    switch (op) {
+        case KERNEL_ADD: ELEMENTWISE_LOOP(int64_t, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1, wrapAdd, wrapAdd); break;
+        case KERNEL_SUB: ELEMENTWISE_LOOP(int64_t, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1, wrapSub, wrapSub); break;
+        case KERNEL_MUL: ELEMENTWISE_LOOP(int64_t, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1, wrapMul, wrapMul); break;
+        default: break;
+    }
+}
+
+static void scalarFloatOp(KernelOp op, double *out, const double *a, const double *b, size_t n, BroadcastMode mode) {
+    switch (op) {
+        case KERNEL_ADD: ELEMENTWISE_LOOP(double, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1, floatAdd, floatAdd); break;
+        case KERNEL_SUB: ELEMENTWISE_LOOP(double, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1, floatSub, floatSub); break;
+        case KERNEL_MUL: ELEMENTWISE_LOOP(double, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1, floatMul, floatMul); break;
+        case KERNEL_DIV: ELEMENTWISE_LOOP(double, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1, floatDiv, floatDiv); break;
+    }
+}
+
+static int scalarIntWrapped(KernelOp op, const int64_t *out, const int64_t *a, const int64_t *b, size_t n,
+                            BroadcastMode mode) {
+    int64_t lanes = 0, bits = 0;
+    if (op == KERNEL_ADD) {
+        WRAPPED_LOOP(int64_t, 1, SCALAR_LOAD, SCALAR_SET1, SCALAR_OR, addWrapBits, addWrapBits);
+    } else {
+        WRAPPED_LOOP(int64_t, 1, SCALAR_LOAD, SCALAR_SET1, SCALAR_OR, subWrapBits, subWrapBits);
+    }
+    return (lanes | bits) < 0;
+}
+
+static uint64_t magnitudeFrom(const int64_t *a, size_t start, size_t n) {
+    uint64_t bits = 0;
+    for (size_t i = start; i < n; i++) bits |= (uint64_t)(a[i] ^ (a[i] >> 63));
+    return bits;
+}
+
+static uint64_t scalarIntMagnitude(const int64_t *a, size_t n) {
+    return magnitudeFrom(a, 0, n);
+}
+
+static int64_t scalarIntSum(const int64_t *a, size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum = wrapAdd(sum, a[i]);
+    return sum;
+}
+
+static double scalarFloatSum(const double *a, size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) sum += a[i];
+    return sum;
+}
+
+static int64_t scalarIntDot(const int64_t *a, const int64_t *b, size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum = wrapAdd(sum, wrapMul(a[i], b[i]));
+    return sum;
+}
+
+static double scalarFloatDot(const double *a, const double *b, size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+static int64_t scalarIntMinMax(const int64_t *a, size_t n, int wantMax) {
+    int64_t best = a[0];
+    for (size_t i = 1; i < n; i++) {
+        if (wantMax ? a[i] > best : a[i] < best) best = a[i];
+    }
+    return best;
+}
+
+static double scalarFloatMinMax(const double *a, size_t n, int wantMax) {
+    double best = a[0];
+    for (size_t i = 1; i < n; i++) {
+        if (wantMax ? a[i] > best : a[i] < best) best = a[i];
+    }
+    return best;
+}
+
+// Scan text[start..n) one byte at a time; also finishes the vector loops
+static size_t findCharsFrom(const char *text, size_t start, size_t n, const char chars[3], uint32_t *positions) {
+    size_t count = 0;
+    for (size_t i = start; i < n; i++) {
+        if (text[i] == chars[0] || text[i] == chars[1] || text[i] == chars[2]) {
+            positions[count++] = (uint32_t)i;
+        }
+    }
+    return count;
+}
+
+static size_t scalarFindChars(const char *text, size_t n, const char chars[3], uint32_t *positions) {
+    return findCharsFrom(text, 0, n, chars, positions);
+}
+
+// Check the candidates at text[start..n - m] one at a time
+static size_t findTextFrom(const char *text, size_t start, size_t n, const char *needle, size_t m) {
+    for (size_t i = start; i + m <= n; i++) {
+        if (text[i] == needle[0] && memcmp(text + i, needle, m) == 0) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static size_t scalarFindText(const char *text, size_t n, const char *needle, size_t m) {
+    return findTextFrom(text, 0, n, needle, m);
+}
+
+static size_t countCharactersFrom(const char *text, size_t start, size_t n) {
+    size_t count = 0;
+    for (size_t i = start; i < n; i++) {
+        count += ((unsigned char)text[i] & 0xc0) != 0x80;
+    }
+    return count;
+}
+
+static size_t scalarCountCharacters(const char *text, size_t n) {
+    return countCharactersFrom(text, 0, n);
+}
+
+static void changeCaseFrom(char *out, const char *text, size_t start, size_t n, int upper) {
+    char first = upper ? 'a' : 'A';
+    for (size_t i = start; i < n; i++) {
+        char c = text[i];
+        out[i] = c >= first && c <= first + 25 ? (char)(c ^ 0x20) : c;
+    }
+}
+
+static void scalarChangeCase(char *out, const char *text, size_t n, int upper) {
+    changeCaseFrom(out, text, 0, n, upper);
+}
+
+static const SimdKernels scalarKernels = {
+    "scalar",
+    scalarIntOp, scalarFloatOp,
+    scalarIntWrapped, scalarIntMagnitude,
+    scalarIntSum, scalarFloatSum,
+    scalarIntDot, scalarFloatDot,
+    scalarIntMinMax, scalarFloatMinMax,
+    scalarFindChars,
+    scalarFindText, scalarCountCharacters, scalarChangeCase
+};
+
+#ifdef NOVIQ_X86
+
+// ---------------------------------------------------------------------------
+// SSE2: two lanes per vector. There is no 64-bit integer compare before
+// SSE4.2, so integer min/max stay scalar.
+
+#define SSE2_LOADI(p) _mm_loadu_si128((const __m128i *)(p))
+#define SSE2_STOREI(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+
+// Low 64 bits of a 64x64 multiply built from 32x32->64 products
+TARGET_SSE2 static inline __m128i sse2MulInt64(__m128i a, __m128i b) {
+    __m128i low = _mm_mul_epu32(a, b);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+                                  _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+}
+
+TARGET_SSE2 static void sse2IntOp(KernelOp op, int64_t *out, const int64_t *a, const int64_t *b, size_t n, BroadcastMode mode) {
+    switch (op) {
+        case KERNEL_ADD: ELEMENTWISE_LOOP(__m128i, 2, SSE2_LOADI, SSE2_STOREI, _mm_set1_epi64x, _mm_add_epi64, wrapAdd); break;
+        case KERNEL_SUB: ELEMENTWISE_LOOP(__m128i, 2, SSE2_LOADI, SSE2_STOREI, _mm_set1_epi64x, _mm_sub_epi64, wrapSub); break;
+        case KERNEL_MUL: ELEMENTWISE_LOOP(__m128i, 2, SSE2_LOADI, SSE2_STOREI, _mm_set1_epi64x, sse2MulInt64, wrapMul); break;
+        default: break;
+    }
+}
+
+TARGET_SSE2 static void sse2FloatOp(KernelOp op, double *out, const double *a, const double *b, size_t n, BroadcastMode mode) {
+    switch (op) {
+        case KERNEL_ADD: ELEMENTWISE_LOOP(__m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_add_pd, floatAdd); break;
+        case KERNEL_SUB: ELEMENTWISE_LOOP(__m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_sub_pd, floatSub); break;
+        case KERNEL_MUL: ELEMENTWISE_LOOP(__m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_mul_pd, floatMul); break;
+        case KERNEL_DIV: ELEMENTWISE_LOOP(__m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_div_pd, floatDiv); break;
+    }
+}
+
+TARGET_SSE2 static inline __m128i sse2AddWrapBits(__m128i x, __m128i y, __m128i r) {
+    return _mm_and_si128(_mm_xor_si128(x, r), _mm_xor_si128(y, r));
+}
+
+TARGET_SSE2 static inline __m128i sse2SubWrapBits(__m128i x, __m128i y, __m128i r) {
+    return _mm_and_si128(_mm_xor_si128(x, y), _mm_xor_si128(x, r));
+}
+
+TARGET_SSE2 static int sse2IntWrapped(KernelOp op, const int64_t *out, const int64_t *a, const int64_t *b, size_t n,
+                                      BroadcastMode mode) {
+    __m128i lanes = _mm_setzero_si128();
+    int64_t bits = 0;
+    if (op == KERNEL_ADD) {
+        WRAPPED_LOOP(__m128i, 2, SSE2_LOADI, _mm_set1_epi64x, _mm_or_si128, sse2AddWrapBits, addWrapBits);
+    } else {
+        WRAPPED_LOOP(__m128i, 2, SSE2_LOADI, _mm_set1_epi64x, _mm_or_si128, sse2SubWrapBits, subWrapBits);
+    }
+    return bits < 0 || _mm_movemask_pd(_mm_castsi128_pd(lanes)) != 0;
+}
+
+// Without a 64-bit arithmetic shift, the sign of each lane comes from the
+// shifted high halves
+TARGET_SSE2 static uint64_t sse2IntMagnitude(const int64_t *a, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = SSE2_LOADI(a + i);
+        __m128i sign = _mm_shuffle_epi32(_mm_srai_epi32(x, 31), _MM_SHUFFLE(3, 3, 1, 1));
+        acc = _mm_or_si128(acc, _mm_xor_si128(x, sign));
+    }
+    uint64_t lanes[2];
+    SSE2_STOREI(lanes, acc);
+    return lanes[0] | lanes[1] | magnitudeFrom(a, i, n);
+}
+
+TARGET_SSE2 static int64_t sse2IntSum(const int64_t *a, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) acc = _mm_add_epi64(acc, SSE2_LOADI(a + i));
+    int64_t lanes[2];
+    SSE2_STOREI(lanes, acc);
+    int64_t sum = wrapAdd(lanes[0], lanes[1]);
+    for (; i < n; i++) sum = wrapAdd(sum, a[i]);
+    return sum;
+}
+
+TARGET_SSE2 static double sse2FloatSum(const double *a, size_t n) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; i++) sum += a[i];
+    return sum;
+}
+
+TARGET_SSE2 static int64_t sse2IntDot(const int64_t *a, const int64_t *b, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) acc = _mm_add_epi64(acc, sse2MulInt64(SSE2_LOADI(a + i), SSE2_LOADI(b + i)));
+    int64_t lanes[2];
+    SSE2_STOREI(lanes, acc);
+    int64_t sum = wrapAdd(lanes[0], lanes[1]);
+    for (; i < n; i++) sum = wrapAdd(sum, wrapMul(a[i], b[i]));
+    return sum;
+}
+
+TARGET_SSE2 static double sse2FloatDot(const double *a, const double *b, size_t n) {
+    __m128d acc = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+TARGET_SSE2 static double sse2FloatMinMax(const double *a, size_t n, int wantMax) {
+    if (n < 2) return a[0];
+    // min_pd(x, best) picks x only when x < best, like the scalar loop
+    __m128d best = _mm_loadu_pd(a);
+    size_t i = 2;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(a + i);
+        best = wantMax ? _mm_max_pd(x, best) : _mm_min_pd(x, best);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, best);
+    double result = lanes[0];
+    if (wantMax ? lanes[1] > result : lanes[1] < result) result = lanes[1];
+    for (; i < n; i++) {
+        if (wantMax ? a[i] > result : a[i] < result) result = a[i];
+    }
+    return result;
+}
+
+// Compare a block against all three bytes at once and walk the set bits
+// of the combined mask
+TARGET_SSE2 static size_t sse2FindChars(const char *text, size_t n, const char chars[3], uint32_t *positions) {
+    __m128i first = _mm_set1_epi8(chars[0]);
+    __m128i second = _mm_set1_epi8(chars[1]);
+    __m128i third = _mm_set1_epi8(chars[2]);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = SSE2_LOADI(text + i);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, first), _mm_cmpeq_epi8(block, second)),
+                                    _mm_cmpeq_epi8(block, third));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+        while (mask) {
+            positions[count++] = (uint32_t)(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return count + findCharsFrom(text, i, n, chars, positions + count);
+}
+
+// Positions where both the first and the last byte of the needle match
+// are the only ones compared in full
+TARGET_SSE2 static size_t sse2FindText(const char *text, size_t n, const char *needle, size_t m) {
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i hits = _mm_and_si128(_mm_cmpeq_epi8(SSE2_LOADI(text + i), first),
+                                     _mm_cmpeq_epi8(SSE2_LOADI(text + i + m - 1), last));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(text + at + 1, needle + 1, m - 1) == 0) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return findTextFrom(text, i, n, needle, m);
+}
+
+// Continuation bytes are -128 to -65 as signed bytes
+TARGET_SSE2 static size_t sse2CountCharacters(const char *text, size_t n) {
+    __m128i limit = _mm_set1_epi8(-65);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        count += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpgt_epi8(SSE2_LOADI(text + i), limit)));
+    }
+    return count + countCharactersFrom(text, i, n);
+}
+
+// Bytes of multibyte characters are negative, so never in the letter range
+TARGET_SSE2 static void sse2ChangeCase(char *out, const char *text, size_t n, int upper) {
+    __m128i below = _mm_set1_epi8(upper ? 'a' - 1 : 'A' - 1);
+    __m128i above = _mm_set1_epi8(upper ? 'z' + 1 : 'Z' + 1);
+    __m128i flip = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = SSE2_LOADI(text + i);
+        __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(block, below), _mm_cmpgt_epi8(above, block));
+        SSE2_STOREI(out + i, _mm_xor_si128(block, _mm_and_si128(letters, flip)));
+    }
+    changeCaseFrom(out, text, i, n, upper);
+}
+
+static const SimdKernels sse2Kernels = {
+    "sse2",
+    sse2IntOp, sse2FloatOp,
+    sse2IntWrapped, sse2IntMagnitude,
+    sse2IntSum, sse2FloatSum,
+    sse2IntDot, sse2FloatDot,
+    scalarIntMinMax, sse2FloatMinMax,
+    sse2FindChars,
+    sse2FindText, sse2CountCharacters, sse2ChangeCase
+};
+
+// ---------------------------------------------------------------------------
+// AVX2: four lanes per vector
+
+#define AVX2_LOADI(p) _mm256_loadu_si256((const __m256i *)(p))
+#define AVX2_STOREI(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+
+TARGET_AVX2 static inline __m256i avx2MulInt64(__m256i a, __m256i b) {
+    __m256i low = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+TARGET_AVX2 static void avx2IntOp(KernelOp op, int64_t *out, const int64_t *a, const int64_t *b, size_t n, BroadcastMode mode) {
+    switch (op) {
+        case KERNEL_ADD: ELEMENTWISE_LOOP(__m256i, 4, AVX2_LOADI, AVX2_STOREI, _mm256_set1_epi64x, _mm256_add_epi64, wrapAdd); break;
+        case KERNEL_SUB: ELEMENTWISE_LOOP(__m256i, 4, AVX2_LOADI, AVX2_STOREI, _mm256_set1_epi64x, _mm256_sub_epi64, wrapSub); break;
+        case KERNEL_MUL: ELEMENTWISE_LOOP(__m256i, 4, AVX2_LOADI, AVX2_STOREI, _mm256_set1_epi64x, avx2MulInt64, wrapMul); break;
+        default: break;
+    }
+}
+
+TARGET_AVX2 static void avx2FloatOp(KernelOp op, double *out, const double *a, const double *b, size_t n, BroadcastMode mode) {
+    switch (op) {
+        case KERNEL_ADD: ELEMENTWISE_LOOP(__m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_add_pd, floatAdd); break;
+        case KERNEL_SUB: ELEMENTWISE_LOOP(__m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_sub_pd, floatSub); break;
+        case KERNEL_MUL: ELEMENTWISE_LOOP(__m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_mul_pd, floatMul); break;
+        case KERNEL_DIV: ELEMENTWISE_LOOP(__m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_div_pd, floatDiv); break;
+    }
+}
+
+TARGET_AVX2 static inline __m256i avx2AddWrapBits(__m256i x, __m256i y, __m256i r) {
+    return _mm256_and_si256(_mm256_xor_si256(x, r), _mm256_xor_si256(y, r));
+}
+
+TARGET_AVX2 static inline __m256i avx2SubWrapBits(__m256i x, __m256i y, __m256i r) {
+    return _mm256_and_si256(_mm256_xor_si256(x, y), _mm256_xor_si256(x, r));
+}
+
+TARGET_AVX2 static int avx2IntWrapped(KernelOp op, const int64_t *out, const int64_t *a, const int64_t *b, size_t n,
+                                      BroadcastMode mode) {
+    __m256i lanes = _mm256_setzero_si256();
+    int64_t bits = 0;
+    if (op == KERNEL_ADD) {
+        WRAPPED_LOOP(__m256i, 4, AVX2_LOADI, _mm256_set1_epi64x, _mm256_or_si256, avx2AddWrapBits, addWrapBits);
+    } else {
+        WRAPPED_LOOP(__m256i, 4, AVX2_LOADI, _mm256_set1_epi64x, _mm256_or_si256, avx2SubWrapBits, subWrapBits);
+    }
+    return bits < 0 || _mm256_movemask_pd(_mm256_castsi256_pd(lanes)) != 0;
+}
+
+TARGET_AVX2 static uint64_t avx2IntMagnitude(const int64_t *a, size_t n) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = AVX2_LOADI(a + i);
+        acc = _mm256_or_si256(acc, _mm256_xor_si256(x, _mm256_cmpgt_epi64(zero, x)));
+    }
+    uint64_t lanes[4];
+    AVX2_STOREI(lanes, acc);
+    return lanes[0] | lanes[1] | lanes[2] | lanes[3] | magnitudeFrom(a, i, n);
+}
+
+TARGET_AVX2 static int64_t avx2IntSum(const int64_t *a, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) acc = _mm256_add_epi64(acc, AVX2_LOADI(a + i));
+    int64_t lanes[4];
+    AVX2_STOREI(lanes, acc);
+    int64_t sum = wrapAdd(wrapAdd(lanes[0], lanes[1]), wrapAdd(lanes[2], lanes[3]));
+    for (; i < n; i++) sum = wrapAdd(sum, a[i]);
+    return sum;
+}
+
+TARGET_AVX2 static double avx2FloatSum(const double *a, size_t n) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; i++) sum += a[i];
+    return sum;
+}
+
+TARGET_AVX2 static int64_t avx2IntDot(const int64_t *a, const int64_t *b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) acc = _mm256_add_epi64(acc, avx2MulInt64(AVX2_LOADI(a + i), AVX2_LOADI(b + i)));
+    int64_t lanes[4];
+    AVX2_STOREI(lanes, acc);
+    int64_t sum = wrapAdd(wrapAdd(lanes[0], lanes[1]), wrapAdd(lanes[2], lanes[3]));
+    for (; i < n; i++) sum = wrapAdd(sum, wrapMul(a[i], b[i]));
+    return sum;
+}
+
+TARGET_AVX2 static double avx2FloatDot(const double *a, const double *b, size_t n) {
+    __m256d acc = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+TARGET_AVX2 static int64_t avx2IntMinMax(const int64_t *a, size_t n, int wantMax) {
+    if (n < 4) return scalarIntMinMax(a, n, wantMax);
+    __m256i best = AVX2_LOADI(a);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = AVX2_LOADI(a + i);
+        __m256i better = wantMax ? _mm256_cmpgt_epi64(x, best) : _mm256_cmpgt_epi64(best, x);
+        best = _mm256_blendv_epi8(best, x, better);
+    }
+    int64_t lanes[4];
+    AVX2_STOREI(lanes, best);
+    int64_t result = scalarIntMinMax(lanes, 4, wantMax);
+    for (; i < n; i++) {
+        if (wantMax ? a[i] > result : a[i] < result) result = a[i];
+    }
+    return result;
+}
+
+TARGET_AVX2 static double avx2FloatMinMax(const double *a, size_t n, int wantMax) {
+    if (n < 4) return scalarFloatMinMax(a, n, wantMax);
+    __m256d best = _mm256_loadu_pd(a);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(a + i);
+        best = wantMax ? _mm256_max_pd(x, best) : _mm256_min_pd(x, best);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, best);
+    double result = scalarFloatMinMax(lanes, 4, wantMax);
+    for (; i < n; i++) {
+        if (wantMax ? a[i] > result : a[i] < result) result = a[i];
+    }
+    return result;
+}
+
+TARGET_AVX2 static size_t avx2FindChars(const char *text, size_t n, const char chars[3], uint32_t *positions) {
+    __m256i first = _mm256_set1_epi8(chars[0]);
+    __m256i second = _mm256_set1_epi8(chars[1]);
+    __m256i third = _mm256_set1_epi8(chars[2]);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = AVX2_LOADI(text + i);
+        __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, first), _mm256_cmpeq_epi8(block, second)),
+                                       _mm256_cmpeq_epi8(block, third));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hits);
+        while (mask) {
+            positions[count++] = (uint32_t)(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return count + findCharsFrom(text, i, n, chars, positions + count);
+}
+
+TARGET_AVX2 static size_t avx2FindText(const char *text, size_t n, const char *needle, size_t m) {
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i hits = _mm256_and_si256(_mm256_cmpeq_epi8(AVX2_LOADI(text + i), first),
+                                        _mm256_cmpeq_epi8(AVX2_LOADI(text + i + m - 1), last));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hits);
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(text + at + 1, needle + 1, m - 1) == 0) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return findTextFrom(text, i, n, needle, m);
+}
+
+TARGET_AVX2 static size_t avx2CountCharacters(const char *text, size_t n) {
+    __m256i limit = _mm256_set1_epi8(-65);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        count += __builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(AVX2_LOADI(text + i), limit)));
+    }
+    return count + countCharactersFrom(text, i, n);
+}
+
+TARGET_AVX2 static void avx2ChangeCase(char *out, const char *text, size_t n, int upper) {
+    __m256i below = _mm256_set1_epi8(upper ? 'a' - 1 : 'A' - 1);
+    __m256i above = _mm256_set1_epi8(upper ? 'z' + 1 : 'Z' + 1);
+    __m256i flip = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = AVX2_LOADI(text + i);
+        __m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(block, below), _mm256_cmpgt_epi8(above, block));
+        AVX2_STOREI(out + i, _mm256_xor_si256(block, _mm256_and_si256(letters, flip)));
+    }
+    changeCaseFrom(out, text, i, n, upper);
+}
+
+static const SimdKernels avx2Kernels = {
+    "avx2",
+    avx2IntOp, avx2FloatOp,
+    avx2IntWrapped, avx2IntMagnitude,
+    avx2IntSum, avx2FloatSum,
+    avx2IntDot, avx2FloatDot,
+    avx2IntMinMax, avx2FloatMinMax,
+    avx2FindChars,
+    avx2FindText, avx2CountCharacters, avx2ChangeCase
+};
+
+#endif // NOVIQ_X86
+
+static const SimdKernels *selectKernels(void) {
+    const char *limit = getenv("NOVIQ_SIMD");
+    if (limit && strcmp(limit, "scalar") == 0) {
+        return &scalarKernels;
+    }
+#ifdef NOVIQ_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && !(limit && strcmp(limit, "sse2") == 0)) {
+        return &avx2Kernels;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return &sse2Kernels;
+    }
+#endif
+    return &scalarKernels;
+}
+
+static const SimdKernels *kernels = NULL;
+
+static void chooseKernels(void) {
+    kernels = selectKernels();
+}
+
+#ifndef _WIN32
+// Task blocks and parallel_for threads may make the first call together
+static pthread_once_t kernelsChosen = PTHREAD_ONCE_INIT;
+
+const SimdKernels *simdKernels(void) {
+    pthread_once(&kernelsChosen, chooseKernels);
+    return kernels;
+}
+#else
+const SimdKernels *simdKernels(void) {
+    if (!kernels) {
+        chooseKernels();
+    }
+    return kernels;
+}
+#endif
@@ -0,0 +1,56 @@
+#ifndef LEXER_SIMD_H
+#define LEXER_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Numeric kernels over contiguous buffers. The best implementation for the
+// running CPU (AVX2, SSE2 or plain C) is picked once on first use; setting
+// NOVIQ_SIMD=scalar|sse2|avx2 caps the level, which is handy for testing.
+//
+// Integer kernels wrap around on overflow and give bit-identical results on
+// every level. Float min/max are exact for inputs without NaNs. Float sums
+// and dot products add lanes in a different order than the scalar loop, so
+// they may differ in the last bits: the difference is bounded by
+// n * DBL_EPSILON * (sum of |x|).
+
+typedef enum { KERNEL_ADD, KERNEL_SUB, KERNEL_MUL, KERNEL_DIV } KernelOp;
+
+// Which operand of an elementwise kernel is a single value repeated n times
+typedef enum { BROADCAST_NONE, BROADCAST_LEFT, BROADCAST_RIGHT } BroadcastMode;
+
+typedef struct {
+    const char *name;
+    // KERNEL_DIV is not available for integers
+    void (*intOp)(KernelOp op, int64_t *out, const int64_t *a, const int64_t *b, size_t n, BroadcastMode mode);
+    void (*floatOp)(KernelOp op, double *out, const double *a, const double *b, size_t n, BroadcastMode mode);
+    // Whether out, which intOp worked out as a op b for KERNEL_ADD or
+    // KERNEL_SUB, wrapped around anywhere
+    int (*intWrapped)(KernelOp op, const int64_t *out, const int64_t *a, const int64_t *b, size_t n,
+                      BroadcastMode mode);
+    // OR of the elements' magnitudes, taking x as ~x when it is negative,
+    // which bounds the bits a product of them needs
+    uint64_t (*intMagnitude)(const int64_t *a, size_t n);
+    int64_t (*intSum)(const int64_t *a, size_t n);
+    double (*floatSum)(const double *a, size_t n);
+    int64_t (*intDot)(const int64_t *a, const int64_t *b, size_t n);
+    double (*floatDot)(const double *a, const double *b, size_t n);
+    // n must be at least 1
+    int64_t (*intMinMax)(const int64_t *a, size_t n, int wantMax);
+    double (*floatMinMax)(const double *a, size_t n, int wantMax);
+    // Store the offsets of bytes equal to any of chars[0..2] in positions,
+    // which must have room for n entries, and return how many there are
+    size_t (*findChars)(const char *text, size_t n, const char chars[3], uint32_t *positions);
+    // Offset of the first copy of needle, m >= 1 bytes long, in text, or n
+    // if there is none
+    size_t (*findText)(const char *text, size_t n, const char *needle, size_t m);
+    // Bytes that start a UTF-8 character, which is every byte but 10xxxxxx
+    size_t (*countCharacters)(const char *text, size_t n);
+    // Copy text to out with the ASCII letters in upper or lower case. Other
+    // bytes, so all those of multibyte characters, are copied unchanged.
+    void (*changeCase)(char *out, const char *text, size_t n, int upper);
+} SimdKernels;
+
+const SimdKernels *simdKernels(void);
+
+#endif // LEXER_SIMD_H
@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lexer_snapshot.h"
+#include "lexer_interpret.h"
+#include "lexer_array.h"
+#include "lexer_map.h"
+#include "lexer_function.h"
+#include "lexer_coroutine.h"
+#include "lexer_stream.h"
+#include "lexer_thread.h"
+#include "lexer_typecheck.h"
+#include "lexer_memory.h"
+
+// Layout of an image, with numbers in the byte order of the machine that
+// wrote it:
+//   "NVQS", version, index of the statement to resume at, hash of the
+//   statements before it
+//   functions: count, then the index of each definition
+//   imports: count, then for each file its name and its names and values
+//   globals: count, then each name and value
+// A value is its type and its contents. Arrays and maps held in more than
+// one place are written once; later places refer back to them by number.
+#define SNAPSHOT_MAGIC "NVQS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_SHARED 0xff
+
+// ---------------------------------------------------------------------------
+// Common
+
+// FNV-1a over the text of the statements before resume
+static uint64_t hashPreamble(const Script *script, int resume) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < resume; i++) {
+        for (const char *c = script->lines[i].text; ; c++) {
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+            if (!*c) {
+                break;
+            }
+        }
+    }
+    return hash;
+}
+
+// Index of the first top level statement after lineNumber
+static int findResume(const Script *script, int lineNumber) {
+    int index = 0;
+    while (index < script->count && script->lines[index].lineNumber <= lineNumber) {
+        index = script->lines[index].blockEnd;
+    }
+    if (index < script->count && (strncmp(script->lines[index].text, "elseif(", 7) == 0 ||
+                                  strcmp(script->lines[index].text, "else:") == 0)) {
+        fprintf(stderr, "Error: Line %d is inside an if statement, which cannot be split by a snapshot\n",
+                lineNumber);
+        exit(EXIT_FAILURE);
+    }
+    return index;
+}
+
+// ---------------------------------------------------------------------------
+// Writing
+
+typedef struct {
+    FILE *file;
+    const char *path;
+    const void **objects;     // Arrays and maps written so far
+    size_t objectCount;
+    size_t objectCapacity;
+} SnapshotWriter;
+
+static void writeBytes(SnapshotWriter *writer, const void *bytes, size_t length) {
+    if (length > 0 && fwrite(bytes, 1, length, writer->file) != length) {
+        fprintf(stderr, "Error: Could not write snapshot %s\n", writer->path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void writeU8(SnapshotWriter *writer, uint8_t value) {
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeU32(SnapshotWriter *writer, uint32_t value) {
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeU64(SnapshotWriter *writer, uint64_t value) {
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeName(SnapshotWriter *writer, const char *name) {
+    size_t length = strlen(name);
+    writeU32(writer, (uint32_t)length);
+    writeBytes(writer, name, length);
+}
+
+// Writes the reference and returns 1 if object was written before;
+// otherwise numbers it for the places that follow
+static int writeShared(SnapshotWriter *writer, const void *object) {
+    for (size_t i = 0; i < writer->objectCount; i++) {
+        if (writer->objects[i] == object) {
+            writeU8(writer, SNAPSHOT_SHARED);
+            writeU32(writer, (uint32_t)i);
+            return 1;
+        }
+    }
+    if (writer->objectCount == writer->objectCapacity) {
+        writer->objectCapacity = writer->objectCapacity ? writer->objectCapacity * 2 : 16;
+        writer->objects = memRealloc(writer->objects, writer->objectCapacity * sizeof(void *));
+    }
+    writer->objects[writer->objectCount++] = object;
+    return 0;
+}
+
+static void writeValue(SnapshotWriter *writer, const Variable *value, const char *name) {
+    switch (value->type) {
+        case INT:
+            writeU8(writer, INT);
+            writeBytes(writer, &value->value.intValue, sizeof(value->value.intValue));
+            break;
+        case FLOAT:
+            writeU8(writer, FLOAT);
+            writeBytes(writer, &value->value.floatValue, sizeof(value->value.floatValue));
+            break;
+        case BOOLEAN:
+            writeU8(writer, BOOLEAN);
+            writeU8(writer, value->value.boolValue != 0);
+            break;
+        case STRING: {
+            size_t length = stringLength(&value->value.stringValue);
+            writeU8(writer, STRING);
+            writeU64(writer, length);
+            writeBytes(writer, stringData(&value->value.stringValue), length);
+            break;
+        }
+        case ARRAY: {
+            Array *array = value->value.arrayValue;
+            if (writeShared(writer, array)) {
+                break;
+            }
+            writeU8(writer, ARRAY);
+            writeU8(writer, (uint8_t)array->kind);
+            writeU64(writer, array->length);
+            if (array->kind == ARRAY_BOXED) {
+                for (size_t i = 0; i < array->length; i++) {
+                    writeValue(writer, &array->data.boxed[i], name);
+                }
+            } else {
+                // Ints and floats are both eight bytes
+                writeBytes(writer, array->data.ints, array->length * sizeof(int64_t));
+            }
+            break;
+        }
+        case MAP: {
+            Map *map = value->value.mapValue;
+            if (writeShared(writer, map)) {
+                break;
+            }
+            writeU8(writer, MAP);
+            writeU64(writer, map->liveCount);
+            for (size_t i = 0; i < map->entryCount; i++) {
+                if (!map->entries[i].deleted) {
+                    writeValue(writer, &map->entries[i].key, name);
+                    writeValue(writer, &map->entries[i].value, name);
+                }
+            }
+            break;
+        }
+        case COROUTINE:
+        case CHANNEL:
+            fprintf(stderr, "Error: Cannot save '%s' in a snapshot, it holds a %s\n", name,
+                    value->type == CHANNEL ? "channel" : "generator or task");
+            exit(EXIT_FAILURE);
+    }
+}
+
+void snapshotScript(Script *script, int lineNumber, const char *imagePath) {
+    int resume = findResume(script, lineNumber);
+    executeBlock(script, 0, resume);
+    finishTasks();
+    finishTaskBlocks();
+
+    SnapshotWriter writer = { fopen(imagePath, "wb"), imagePath, NULL, 0, 0 };
+    if (!writer.file) {
+        fprintf(stderr, "Error: Could not create snapshot %s\n", imagePath);
+        exit(EXIT_FAILURE);
+    }
+    writeBytes(&writer, SNAPSHOT_MAGIC, 4);
+    writeU32(&writer, SNAPSHOT_VERSION);
+    writeU32(&writer, (uint32_t)resume);
+    writeU64(&writer, hashPreamble(script, resume));
+
+    int functionCount;
+    Function **functions = definedFunctions(&functionCount);
+    writeU32(&writer, (uint32_t)functionCount);
+    for (int i = 0; i < functionCount; i++) {
+        writeU32(&writer, (uint32_t)(functions[i]->bodyStart - 1));
+    }
+
+    int moduleCount;
+    Module *modules = importedModules(&moduleCount);
+    writeU32(&writer, (uint32_t)moduleCount);
+    for (int i = 0; i < moduleCount; i++) {
+        writeName(&writer, modules[i].fileName);
+        writeU32(&writer, (uint32_t)modules[i].count);
+        for (int j = 0; j < modules[i].count; j++) {
+            ModuleValue *entry = &modules[i].values[j];
+            writeName(&writer, entry->name);
+            writeU8(&writer, (uint8_t)entry->known);
+            if (entry->known) {
+                writeValue(&writer, &entry->value, entry->name);
+            }
+        }
+    }
+
+    VariableTable globals = currentVariables();
+    writeU32(&writer, (uint32_t)globals.count);
+    for (size_t i = 0; i < globals.count; i++) {
+        writeName(&writer, globals.items[i].name);
+        writeValue(&writer, &globals.items[i], globals.items[i].name);
+    }
+
+    if (fclose(writer.file) != 0) {
+        fprintf(stderr, "Error: Could not write snapshot %s\n", imagePath);
+        exit(EXIT_FAILURE);
+    }
+    memFree(writer.objects);
+}
+
+// ---------------------------------------------------------------------------
+// Reading
+
+typedef struct {
+    StringBuffer *image;
+    const char *path;
+    const char *at;
+    const char *end;
+    Variable *objects;        // Arrays and maps read so far
+    size_t objectCount;
+    size_t objectCapacity;
+} SnapshotReader;
+
+static void damaged(SnapshotReader *reader) {
+    fprintf(stderr, "Error: Snapshot %s is damaged\n", reader->path);
+    exit(EXIT_FAILURE);
+}
+
+static const char *readBytes(SnapshotReader *reader, size_t length) {
+    if (length > (size_t)(reader->end - reader->at)) {
+        damaged(reader);
+    }
+    const char *bytes = reader->at;
+    reader->at += length;
+    return bytes;
+}
+
+static uint8_t readU8(SnapshotReader *reader) {
+    return (uint8_t)*readBytes(reader, 1);
+}
+
+static uint32_t readU32(SnapshotReader *reader) {
+    uint32_t value;
+    memcpy(&value, readBytes(reader, sizeof(value)), sizeof(value));
+    return value;
+}
+
+static uint64_t readU64(SnapshotReader *reader) {
+    uint64_t value;
+    memcpy(&value, readBytes(reader, sizeof(value)), sizeof(value));
+    return value;
+}
+
+static char *readName(SnapshotReader *reader) {
+    uint32_t length = readU32(reader);
+    const char *bytes = readBytes(reader, length);
+    char *name = memAlloc(length + 1);
+    memcpy(name, bytes, length);
+    name[length] = '\0';
+    return name;
+}
+
+// Arrays and maps are numbered before their contents are read, which may
+// refer back to them
+static void addObject(SnapshotReader *reader, const Variable *value) {
+    if (reader->objectCount == reader->objectCapacity) {
+        reader->objectCapacity = reader->objectCapacity ? reader->objectCapacity * 2 : 16;
+        reader->objects = memRealloc(reader->objects, reader->objectCapacity * sizeof(Variable));
+    }
+    copyValue(&reader->objects[reader->objectCount++], value);
+}
+
+static void readValue(SnapshotReader *reader, Variable *value) {
+    value->name = NULL;
+    uint8_t type = readU8(reader);
+    switch (type) {
+        case INT:
+            value->type = INT;
+            memcpy(&value->value.intValue, readBytes(reader, sizeof(int)), sizeof(int));
+            return;
+        case FLOAT:
+            value->type = FLOAT;
+            memcpy(&value->value.floatValue, readBytes(reader, sizeof(float)), sizeof(float));
+            return;
+        case BOOLEAN:
+            value->type = BOOLEAN;
+            value->value.boolValue = readU8(reader);
+            return;
+        case STRING: {
+            uint64_t length = readU64(reader);
+            const char *text = readBytes(reader, length);
+            value->type = STRING;
+            stringView(&value->value.stringValue, reader->image, text, length);
+            return;
+        }
+        case ARRAY: {
+            uint8_t kind = readU8(reader);
+            uint64_t length = readU64(reader);
+            if (kind > ARRAY_BOXED || length > (uint64_t)(reader->end - reader->at)) {
+                damaged(reader);
+            }
+            Array *array = createArray((ArrayKind)kind, length);
+            value->type = ARRAY;
+            value->value.arrayValue = array;
+            addObject(reader, value);
+            if (kind == ARRAY_BOXED) {
+                for (size_t i = 0; i < length; i++) {
+                    readValue(reader, &array->data.boxed[i]);
+                    array->length = i + 1;
+                }
+            } else {
+                memcpy(array->data.ints, readBytes(reader, length * sizeof(int64_t)), length * sizeof(int64_t));
+                array->length = length;
+            }
+            return;
+        }
+        case MAP: {
+            uint64_t count = readU64(reader);
+            Map *map = createMap();
+            value->type = MAP;
+            value->value.mapValue = map;
+            addObject(reader, value);
+            for (uint64_t i = 0; i < count; i++) {
+                Variable key;
+                Variable entry;
+                readValue(reader, &key);
+                readValue(reader, &entry);
+                mapSet(map, &key, &entry);
+                releaseValue(&key);
+                releaseValue(&entry);
+            }
+            return;
+        }
+        case SNAPSHOT_SHARED: {
+            uint32_t index = readU32(reader);
+            if (index >= reader->objectCount) {
+                damaged(reader);
+            }
+            copyValue(value, &reader->objects[index]);
+            return;
+        }
+        default:
+            damaged(reader);
+    }
+}
+
+void restoreScript(Script *script, const char *imagePath) {
+    SnapshotReader reader = { loadFile(imagePath), imagePath, NULL, NULL, NULL, 0, 0 };
+    if (!reader.image) {
+        fprintf(stderr, "Error: Could not open snapshot %s\n", imagePath);
+        exit(EXIT_FAILURE);
+    }
+    reader.at = reader.image->text;
+    reader.end = reader.image->text + reader.image->length;
+
+    if (reader.image->length < 4 || memcmp(readBytes(&reader, 4), SNAPSHOT_MAGIC, 4) != 0 ||
+        readU32(&reader) != SNAPSHOT_VERSION) {
+        fprintf(stderr, "Error: %s is not a snapshot this version of Noviq can read\n", imagePath);
+        exit(EXIT_FAILURE);
+    }
+    uint32_t resume = readU32(&reader);
+    uint64_t hash = readU64(&reader);
+    if (resume > (uint32_t)script->count || hashPreamble(script, (int)resume) != hash) {
+        fprintf(stderr, "Error: Snapshot %s was taken from a different version of the script\n", imagePath);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t functionCount = readU32(&reader);
+    for (uint32_t i = 0; i < functionCount; i++) {
+        uint32_t index = readU32(&reader);
+        if (index >= resume || strncmp(script->lines[index].text, "func ", 5) != 0) {
+            damaged(&reader);
+        }
+        defineFunction(script, (int)index);
+    }
+
+    uint32_t moduleCount = readU32(&reader);
+    for (uint32_t i = 0; i < moduleCount; i++) {
+        char *fileName = readName(&reader);
+        Module *module = addModule(fileName);
+        memFree(fileName);
+        uint32_t valueCount = readU32(&reader);
+        for (uint32_t j = 0; j < valueCount; j++) {
+            char *name = readName(&reader);
+            ModuleValue *entry = addModuleValue(module, name);
+            memFree(name);
+            entry->known = readU8(&reader);
+            if (entry->known) {
+                readValue(&reader, &entry->value);
+            }
+        }
+    }
+
+    uint32_t globalCount = readU32(&reader);
+    if (globalCount > (size_t)(reader.end - reader.at)) {
+        damaged(&reader);
+    }
+    VariableTable globals = { memAlloc(globalCount * sizeof(Variable)), globalCount };
+    for (uint32_t i = 0; i < globalCount; i++) {
+        char *name = readName(&reader);
+        readValue(&reader, &globals.items[i]);
+        globals.items[i].name = name;
+    }
+    clearVariables();
+    useVariables(globals);
+
+    // Values read from the image keep it alive while they hold views of it
+    for (size_t i = 0; i < reader.objectCount; i++) {
+        releaseValue(&reader.objects[i]);
+    }
+    memFree(reader.objects);
+    stringBufferRelease(reader.image);
+
+    if (typecheckRest(script, (int)resume, globals) > 0) {
+        exit(EXIT_FAILURE);
+    }
+    executeBlock(script, (int)resume, script->count);
+    finishTasks();
+    finishTaskBlocks();
+}
@@ -0,0 +1,21 @@
+#ifndef LEXER_SNAPSHOT_H
+#define LEXER_SNAPSHOT_H
+
+#include "lexer_script.h"
+
+// A snapshot is the state of a script after its first top level
+// statements: the globals, the functions defined and the files imported.
+// Restoring one carries on with the statements after them, without
+// running the ones before again.
+
+// Run every top level statement that starts on or before lineNumber, then
+// save the state to imagePath instead of running the rest
+void snapshotScript(Script *script, int lineNumber, const char *imagePath);
+
+// Load the state saved in imagePath and run the rest of script. The image
+// is mapped into memory, and long strings are read straight from it. The
+// statements before the snapshot must not have changed since it was taken;
+// only the ones after it are type checked again.
+void restoreScript(Script *script, const char *imagePath);
+
+#endif // LEXER_SNAPSHOT_H
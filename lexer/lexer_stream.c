@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_stream.h"
+#include "lexer_interpret.h"
+#include "lexer_array.h"
+#include "lexer_thread.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+void lineReaderInit(LineReader *reader, FILE *file) {
+    reader->file = file;
+    reader->capacity = STREAM_CHUNK_SIZE;
+    reader->chunk = stringBufferCreate(reader->capacity);
+    reader->start = 0;
+    reader->end = 0;
+    reader->atEnd = 0;
+}
+
+// Move the unfinished line to the front of a chunk and read more after it
+static void refill(LineReader *reader) {
+    size_t pending = reader->end - reader->start;
+    char *data = reader->chunk->data;
+
+    if (reader->chunk->refCount == 1 && pending < reader->capacity) {
+        memmove(data, data + reader->start, pending);
+    } else {
+        // Views still point into the chunk, or a line does not fit in it
+        if (pending == reader->capacity) {
+            reader->capacity *= 2;
+        }
+        StringBuffer *chunk = stringBufferCreate(reader->capacity);
+        memcpy(chunk->data, data + reader->start, pending);
+        stringBufferRelease(reader->chunk);
+        reader->chunk = chunk;
+        data = chunk->data;
+    }
+
+    size_t read = fread(data + pending, 1, reader->capacity - pending, reader->file);
+    if (read == 0) {
+        reader->atEnd = 1;
+    }
+    reader->start = 0;
+    reader->end = pending + read;
+    reader->chunk->length = reader->end;
+}
+
+int lineReaderNext(LineReader *reader, String *line) {
+    for (;;) {
+        const char *text = reader->chunk->data + reader->start;
+        size_t available = reader->end - reader->start;
+        const char *newline = memchr(text, '\n', available);
+
+        if (newline || (reader->atEnd && available > 0)) {
+            size_t length = newline ? (size_t)(newline - text) : available;
+            reader->start += newline ? length + 1 : length;
+            if (length > 0 && text[length - 1] == '\r') {
+                length--;
+            }
+            stringView(line, reader->chunk, text, length);
+            return 1;
+        }
+        if (reader->atEnd) {
+            return 0;
+        }
+        refill(reader);
+    }
+}
+
+void lineReaderClose(LineReader *reader) {
+    stringBufferRelease(reader->chunk);
+    reader->chunk = NULL;
+}
+
+#ifndef _WIN32
+static void unmapBuffer(StringBuffer *buffer) {
+    munmap((void *)buffer->text, buffer->length);
+}
+
+// Map a regular file; returns NULL for anything that cannot be mapped, so
+// the caller falls back to reading it
+static StringBuffer *mapFile(const char *fileName) {
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    StringBuffer *buffer = NULL;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 &&
+        (unsigned long long)info.st_size <= (size_t)-1) {
+        void *mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+            madvise(mapping, (size_t)info.st_size, MADV_SEQUENTIAL);
+#endif
+            buffer = stringBufferCreate(0);
+            buffer->text = mapping;
+            buffer->length = (size_t)info.st_size;
+            buffer->onFree = unmapBuffer;
+        }
+    }
+    close(fd);
+    return buffer;
+}
+#endif
+
+StringBuffer *loadFile(const char *fileName) {
+#ifndef _WIN32
+    StringBuffer *mapping = mapFile(fileName);
+    if (mapping) {
+        return mapping;
+    }
+#endif
+
+    FILE *file = fopen(fileName, "rb");
+    if (!file) {
+        return NULL;
+    }
+    size_t capacity = 1 << 16;
+    StringBuffer *buffer = stringBufferCreate(capacity);
+    size_t read;
+    while ((read = fread(buffer->data + buffer->length, 1, capacity - buffer->length, file)) > 0) {
+        buffer->length += read;
+        if (buffer->length == capacity) {
+            capacity *= 2;
+            buffer = memRealloc(buffer, sizeof(StringBuffer) + capacity + 1);
+            buffer->text = buffer->data;
+        }
+    }
+    fclose(file);
+    return buffer;
+}
+
+int lineSourceOpen(LineSource *source, const char *fileName) {
+    source->mapping = NULL;
+    source->position = 0;
+    source->file = NULL;
+
+    if (strcmp(fileName, "-") == 0) {
+        lineReaderInit(&source->reader, stdin);
+        return 1;
+    }
+
+#ifndef _WIN32
+    source->mapping = mapFile(fileName);
+    if (source->mapping) {
+        return 1;
+    }
+#endif
+
+    source->file = fopen(fileName, "rb");
+    if (!source->file) {
+        return 0;
+    }
+    lineReaderInit(&source->reader, source->file);
+    return 1;
+}
+
+int lineSourceNext(LineSource *source, String *line) {
+    if (!source->mapping) {
+        return lineReaderNext(&source->reader, line);
+    }
+
+    StringBuffer *mapping = source->mapping;
+    if (source->position == mapping->length) {
+        return 0;
+    }
+    const char *text = mapping->text + source->position;
+    size_t available = mapping->length - source->position;
+    const char *newline = memchr(text, '\n', available);
+    size_t length = newline ? (size_t)(newline - text) : available;
+    source->position += newline ? length + 1 : length;
+    if (length > 0 && text[length - 1] == '\r') {
+        length--;
+    }
+    stringView(line, mapping, text, length);
+    return 1;
+}
+
+void lineSourceClose(LineSource *source) {
+    // Lines still in use keep the mapping alive
+    if (source->mapping) {
+        stringBufferRelease(source->mapping);
+        return;
+    }
+    lineReaderClose(&source->reader);
+    if (source->file) {
+        fclose(source->file);
+    }
+}
+
+void linesOpen(LineSource *source, const Variable *path) {
+    if (!path || path->type != STRING) {
+        raiseError(ERROR_TYPE, currentLineNumber, "lines() expects a file name");
+    }
+    char *fileName = stringToText(&path->value.stringValue);
+    Held held;
+    holdBuffer(&held, &fileName);
+    if (!lineSourceOpen(source, fileName)) {
+        raiseError(ERROR_IO, currentLineNumber, "Could not open file %s", fileName);
+    }
+    letGo(held.next);
+    memFree(fileName);
+}
+
+static void appendField(Array *fields, const String *line, size_t start, size_t length) {
+    Variable field;
+    field.name = NULL;
+    field.type = STRING;
+    stringSlice(&field.value.stringValue, line, start, length);
+    arrayAppend(fields, &field);
+    releaseValue(&field);
+}
+
+static Array *splitFields(const String *line, char separator) {
+    const char *text = stringData(line);
+    size_t length = stringLength(line);
+    Array *fields = createArray(ARRAY_BOXED, 8);
+
+    size_t start = 0;
+    if (separator) {
+        for (size_t i = 0; i <= length; i++) {
+            if (i == length || text[i] == separator) {
+                appendField(fields, line, start, i - start);
+                start = i + 1;
+            }
+        }
+        return fields;
+    }
+
+    while (start < length) {
+        while (start < length && (text[start] == ' ' || text[start] == '\t')) start++;
+        size_t end = start;
+        while (end < length && text[end] != ' ' && text[end] != '\t') end++;
+        if (end > start) {
+            appendField(fields, line, start, end - start);
+        }
+        start = end;
+    }
+    return fields;
+}
+
+// Run the top level statements that are not in a begin or end block, or
+// only the body of the named block
+static void executeSection(Script *script, const char *block) {
+    int index = 0;
+    while (index < script->count) {
+        ScriptLine *line = &script->lines[index];
+        int isSection = strcmp(line->text, "begin:") == 0 || strcmp(line->text, "end:") == 0;
+        if (block && isSection && strcmp(line->text, block) == 0) {
+            executeBlock(script, index + 1, line->blockEnd);
+        }
+        if (block || isSection) {
+            index = line->blockEnd;
+        } else {
+            index = executeStatement(script, index);
+        }
+    }
+}
+
+static int scriptMentions(const Script *script, const char *name) {
+    for (int i = 0; i < script->count; i++) {
+        if (strstr(script->lines[i].text, name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void executeEachRecord(Script *script, FILE *input, char separator) {
+    // Splitting every record is wasted work for scripts that never look at
+    // the fields
+    int usesFields = scriptMentions(script, "fields");
+    setvbuf(stdout, NULL, _IOFBF, STREAM_OUTPUT_BUFFER_SIZE);
+
+    executeSection(script, "begin:");
+
+    // Assigned after each record so that no variable keeps a view of the
+    // chunk, which then gets reused for the next lines
+    String empty;
+    stringInit(&empty, "", 0);
+    Array *noFields = createArray(ARRAY_BOXED, 0);
+
+    LineReader reader;
+    lineReaderInit(&reader, input);
+    String line;
+    int recordNumber = 0;
+    while (lineReaderNext(&reader, &line)) {
+        recordNumber++;
+        updateVariable("NR", INT, &recordNumber);
+        updateVariable("line", STRING, &line);
+        if (usesFields) {
+            Array *fields = splitFields(&line, separator);
+            updateVariable("fields", ARRAY, &fields);
+            releaseArray(fields);
+        }
+        stringRelease(&line);
+        executeSection(script, NULL);
+
+        updateVariable("line", STRING, &empty);
+        if (usesFields) {
+            updateVariable("fields", ARRAY, &noFields);
+        }
+    }
+    lineReaderClose(&reader);
+    releaseArray(noFields);
+
+    executeSection(script, "end:");
+    finishTaskBlocks();
+    fflush(stdout);
+}
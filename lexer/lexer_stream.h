@@ -0,0 +1,56 @@
+#ifndef LEXER_STREAM_H
+#define LEXER_STREAM_H
+
+#include <stdio.h>
+#include "lexer_string.h"
+#include "lexer_script.h"
+#include "lexer_interpret.h"
+
+#define STREAM_CHUNK_SIZE (1 << 20)
+#define STREAM_OUTPUT_BUFFER_SIZE (1 << 16)
+
+// Reads lines through a large chunk. Lines are handed out as views into the
+// chunk, which is only reused once no view of it is left.
+typedef struct {
+    FILE *file;
+    StringBuffer *chunk;
+    size_t capacity;
+    size_t start;      // First unread byte in chunk
+    size_t end;        // End of the bytes read into chunk
+    int atEnd;
+} LineReader;
+
+void lineReaderInit(LineReader *reader, FILE *file);
+// Store the next line, without its line ending, in line. Returns 0 at the
+// end of the input.
+int lineReaderNext(LineReader *reader, String *line);
+void lineReaderClose(LineReader *reader);
+
+// Lines of a named file. Regular files are mapped into memory and their
+// lines handed out as views of the mapping; anything else, including "-"
+// for standard input, is read through a LineReader.
+typedef struct {
+    StringBuffer *mapping;
+    size_t position;
+    LineReader reader;
+    FILE *file;
+} LineSource;
+
+// Returns 0 if the file cannot be opened
+int lineSourceOpen(LineSource *source, const char *fileName);
+int lineSourceNext(LineSource *source, String *line);
+void lineSourceClose(LineSource *source);
+// The whole contents of a file, mapped when possible. Returns NULL if the
+// file cannot be read.
+StringBuffer *loadFile(const char *fileName);
+
+// Open the file named by path, the argument of lines(), stopping on errors
+void linesOpen(LineSource *source, const Variable *path);
+
+// Run the script once per line of input, awk style. Each record is exposed
+// as line, its fields as fields and its number as NR. Top level "begin:"
+// and "end:" blocks run before the first and after the last record.
+// separator 0 splits fields on runs of spaces and tabs.
+void executeEachRecord(Script *script, FILE *input, char separator);
+
+#endif // LEXER_STREAM_H
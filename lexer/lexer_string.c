@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_string.h"
+#include "lexer_parallel.h"
+#include "lexer_memory.h"
+
+#define STRING_HEAP_TAG 0xff
+
+static int isInline(const String *string) {
+    return (unsigned char)string->small[STRING_INLINE_CAPACITY] != STRING_HEAP_TAG;
+}
+
+static void initInline(String *string, const char *text, size_t length) {
+    memcpy(string->small, text, length);
+    memset(string->small + length, 0, STRING_INLINE_CAPACITY - length);
+    string->small[STRING_INLINE_CAPACITY] = (char)(STRING_INLINE_CAPACITY - length);
+}
+
+static void initHeap(String *string, StringBuffer *buffer) {
+    string->buffer = buffer;
+    string->small[STRING_INLINE_CAPACITY] = (char)STRING_HEAP_TAG;
+}
+
+StringBuffer *stringBufferCreate(size_t capacity) {
+    StringBuffer *buffer = memAlloc(sizeof(StringBuffer) + capacity + 1);
+    buffer->refCount = 1;
+    buffer->length = 0;
+    buffer->text = buffer->data;
+    buffer->parent = NULL;
+    buffer->onFree = NULL;
+    return buffer;
+}
+
+void stringBufferRelease(StringBuffer *buffer) {
+    while (buffer && refRelease(&buffer->refCount) == 0) {
+        StringBuffer *parent = buffer->parent;
+        if (buffer->onFree) {
+            buffer->onFree(buffer);
+        }
+        memFree(buffer);
+        buffer = parent;
+    }
+}
+
+void stringInit(String *string, const char *text, size_t length) {
+    if (length <= STRING_INLINE_CAPACITY) {
+        initInline(string, text, length);
+        return;
+    }
+
+    StringBuffer *buffer = stringBufferCreate(length);
+    buffer->length = length;
+    memcpy(buffer->data, text, length);
+    buffer->data[length] = '\0';
+    initHeap(string, buffer);
+}
+
+void stringFromText(String *string, const char *text) {
+    stringInit(string, text, strlen(text));
+}
+
+char *stringReserve(String *string, size_t length) {
+    if (length <= STRING_INLINE_CAPACITY) {
+        memset(string->small, 0, STRING_INLINE_CAPACITY);
+        string->small[STRING_INLINE_CAPACITY] = (char)(STRING_INLINE_CAPACITY - length);
+        return string->small;
+    }
+
+    StringBuffer *buffer = stringBufferCreate(length);
+    buffer->length = length;
+    buffer->data[length] = '\0';
+    initHeap(string, buffer);
+    return buffer->data;
+}
+
+void stringView(String *string, StringBuffer *parent, const char *text, size_t length) {
+    if (length <= STRING_INLINE_CAPACITY) {
+        initInline(string, text, length);
+        return;
+    }
+
+    StringBuffer *view = memAlloc(sizeof(StringBuffer));
+    view->refCount = 1;
+    view->length = length;
+    view->text = text;
+    view->parent = parent;
+    view->onFree = NULL;
+    refRetain(&parent->refCount);
+    initHeap(string, view);
+}
+
+void stringSlice(String *dest, const String *src, size_t start, size_t length) {
+    const char *text = stringData(src) + start;
+    if (isInline(src) || length <= STRING_INLINE_CAPACITY) {
+        initInline(dest, text, length);
+        return;
+    }
+    // Views of views point straight at the buffer holding the text
+    StringBuffer *owner = src->buffer->parent ? src->buffer->parent : src->buffer;
+    stringView(dest, owner, text, length);
+}
+
+char *stringToText(const String *string) {
+    size_t length = stringLength(string);
+    char *text = memAlloc(length + 1);
+    memcpy(text, stringData(string), length);
+    text[length] = '\0';
+    return text;
+}
+
+void stringCopy(String *dest, const String *src) {
+    *dest = *src;
+    if (!isInline(src)) {
+        refRetain(&src->buffer->refCount);
+    }
+}
+
+void stringOwnCopy(String *dest, const String *src) {
+    if (!isInline(src) && (src->buffer->parent || src->buffer->onFree)) {
+        stringInit(dest, stringData(src), stringLength(src));
+    } else {
+        stringCopy(dest, src);
+    }
+}
+
+void stringRelease(String *string) {
+    if (!isInline(string)) {
+        stringBufferRelease(string->buffer);
+    }
+}
+
+const char *stringData(const String *string) {
+    return isInline(string) ? string->small : string->buffer->text;
+}
+
+size_t stringLength(const String *string) {
+    if (isInline(string)) {
+        return STRING_INLINE_CAPACITY - (unsigned char)string->small[STRING_INLINE_CAPACITY];
+    }
+    return string->buffer->length;
+}
+
+int stringEquals(const String *a, const String *b) {
+    size_t length = stringLength(a);
+    return length == stringLength(b) && memcmp(stringData(a), stringData(b), length) == 0;
+}
@@ -0,0 +1,54 @@
+#ifndef LEXER_STRING_H
+#define LEXER_STRING_H
+
+#include <stddef.h>
+
+#define STRING_INLINE_CAPACITY 15
+
+// Text of a long string, shared by every copy and never modified. A view
+// points into the text of its parent and keeps the parent alive.
+typedef struct StringBuffer {
+    int refCount;
+    size_t length;
+    const char *text;
+    struct StringBuffer *parent;
+    void (*onFree)(struct StringBuffer *buffer);  // For text not in data
+    char data[];
+} StringBuffer;
+
+// Strings of up to 15 bytes are stored inline. The last byte holds the
+// unused inline capacity, so it doubles as the terminator of a full inline
+// string, or STRING_HEAP_TAG when the text lives in a shared buffer.
+typedef union {
+    char small[STRING_INLINE_CAPACITY + 1];
+    StringBuffer *buffer;
+} String;
+
+void stringInit(String *string, const char *text, size_t length);
+// Refer to part of parent's text without copying it
+void stringView(String *string, StringBuffer *parent, const char *text, size_t length);
+void stringSlice(String *dest, const String *src, size_t start, size_t length);
+void stringFromText(String *string, const char *text);
+// Make string a new string of length bytes and return where its text goes,
+// for text that is put together in place. It must be filled in before the
+// string is used.
+char *stringReserve(String *string, size_t length);
+// A new terminated copy of the text
+char *stringToText(const String *string);
+// Copies are O(1): short strings are copied inline, long ones shared
+void stringCopy(String *dest, const String *src);
+// A copy that keeps no view alive, for another thread: readers recycle the
+// buffers their views point into from the thread that reads
+void stringOwnCopy(String *dest, const String *src);
+void stringRelease(String *string);
+
+// The text of a view is not terminated, so always pair it with the length
+const char *stringData(const String *string);
+size_t stringLength(const String *string);
+int stringEquals(const String *a, const String *b);
+
+// A buffer with room for capacity bytes of text, for readers to fill in
+StringBuffer *stringBufferCreate(size_t capacity);
+void stringBufferRelease(StringBuffer *buffer);
+
+#endif // LEXER_STRING_H
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_text.h"
+#include "lexer_simd.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+// Bytes scanned at a time while looking for a character position or for
+// the whitespace split() breaks on
+#define TEXT_BLOCK 4096
+
+static int isLead(char c) {
+    return ((unsigned char)c & 0xc0) != 0x80;
+}
+
+static int isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+size_t textLength(const String *string) {
+    return simdKernels()->countCharacters(stringData(string), stringLength(string));
+}
+
+// Byte offset of character index in text, or n if it has no more than
+// index characters
+static size_t byteOffset(const char *text, size_t n, size_t index) {
+    const SimdKernels *kernels = simdKernels();
+    size_t at = 0;
+    // Whole blocks are skipped while the character is past them. A block may
+    // end partway through a character; its other bytes are not leads.
+    while (n - at >= 64) {
+        size_t count = kernels->countCharacters(text + at, 64);
+        if (count > index) {
+            break;
+        }
+        index -= count;
+        at += 64;
+    }
+    for (; at < n; at++) {
+        if (isLead(text[at])) {
+            if (index == 0) {
+                return at;
+            }
+            index--;
+        }
+    }
+    return n;
+}
+
+void textSlice(String *out, const String *string, long start, long end) {
+    const char *text = stringData(string);
+    size_t bytes = stringLength(string);
+    long length = (long)textLength(string);
+    if (start < 0) start += length;
+    if (end < 0) end += length;
+    if (start < 0) start = 0;
+    if (end > length) end = length;
+    if (end < start) end = start;
+
+    // Plain ASCII needs no search for the bytes
+    if ((size_t)length == bytes) {
+        stringSlice(out, string, (size_t)start, (size_t)(end - start));
+        return;
+    }
+    size_t from = byteOffset(text, bytes, (size_t)start);
+    size_t to = from + byteOffset(text + from, bytes - from, (size_t)(end - start));
+    stringSlice(out, string, from, to - from);
+}
+
+void textCharacter(String *out, const String *string, long index) {
+    size_t length = textLength(string);
+    if (index < 0) {
+        index += (long)length;
+    }
+    if (index < 0 || (size_t)index >= length) {
+        raiseError(ERROR_INDEX, currentLineNumber, "String index %ld out of range (length %zu)",
+                   index, length);
+    }
+    textSlice(out, string, index, index + 1);
+}
+
+void textConcat(String *out, const String *const *parts, int count) {
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += stringLength(parts[i]);
+    }
+    char *at = stringReserve(out, total);
+    for (int i = 0; i < count; i++) {
+        size_t length = stringLength(parts[i]);
+        memcpy(at, stringData(parts[i]), length);
+        at += length;
+    }
+}
+
+// Byte offset of the first needle in text at or after from, or n
+static size_t findFrom(const char *text, size_t n, size_t from, const String *needle) {
+    size_t m = stringLength(needle);
+    if (m == 0) {
+        return from;
+    }
+    size_t found = simdKernels()->findText(text + from, n - from, stringData(needle), m);
+    return from + found;
+}
+
+long textFind(const String *string, const String *needle) {
+    const char *text = stringData(string);
+    size_t n = stringLength(string);
+    size_t found = findFrom(text, n, 0, needle);
+    if (found == n && stringLength(needle) > 0) {
+        return -1;
+    }
+    return (long)simdKernels()->countCharacters(text, found);
+}
+
+static void appendPiece(Array *array, const String *string, size_t start, size_t length) {
+    Variable piece;
+    piece.name = NULL;
+    piece.type = STRING;
+    stringSlice(&piece.value.stringValue, string, start, length);
+    arrayAppend(array, &piece);
+    releaseValue(&piece);
+}
+
+// Runs of spaces and tabs end the pieces, and none are empty
+static void splitWhitespace(Array *array, const String *string) {
+    const SimdKernels *kernels = simdKernels();
+    static const char blanks[3] = { ' ', '\t', '\t' };
+    uint32_t positions[TEXT_BLOCK];
+    const char *text = stringData(string);
+    size_t n = stringLength(string);
+    size_t start = 0;
+
+    for (size_t block = 0; block < n; block += TEXT_BLOCK) {
+        size_t length = n - block < TEXT_BLOCK ? n - block : TEXT_BLOCK;
+        size_t found = kernels->findChars(text + block, length, blanks, positions);
+        for (size_t i = 0; i < found; i++) {
+            size_t at = block + positions[i];
+            if (at > start) {
+                appendPiece(array, string, start, at - start);
+            }
+            start = at + 1;
+        }
+    }
+    if (n > start) {
+        appendPiece(array, string, start, n - start);
+    }
+}
+
+Array *textSplit(const String *string, const String *separator) {
+    Array *array = createArray(ARRAY_BOXED, 0);
+    const char *text = stringData(string);
+    size_t n = stringLength(string);
+
+    if (!separator) {
+        splitWhitespace(array, string);
+    } else if (stringLength(separator) == 0) {
+        size_t start = 0;
+        for (size_t at = 1; at <= n; at++) {
+            if (at == n || isLead(text[at])) {
+                appendPiece(array, string, start, at - start);
+                start = at;
+            }
+        }
+    } else {
+        size_t m = stringLength(separator);
+        size_t start = 0;
+        for (;;) {
+            size_t found = findFrom(text, n, start, separator);
+            appendPiece(array, string, start, found - start);
+            if (found == n) {
+                break;
+            }
+            start = found + m;
+        }
+    }
+    return array;
+}
+
+void textReplace(String *out, const String *string, const String *old, const String *replacement) {
+    const char *text = stringData(string);
+    size_t n = stringLength(string);
+    size_t m = stringLength(old);
+    size_t count = 0;
+    for (size_t at = m ? findFrom(text, n, 0, old) : n; at < n; at = findFrom(text, n, at + m, old)) {
+        count++;
+    }
+    if (count == 0) {
+        stringCopy(out, string);
+        return;
+    }
+
+    size_t replacementLength = stringLength(replacement);
+    char *write = stringReserve(out, n - count * m + count * replacementLength);
+    size_t start = 0;
+    for (size_t at = findFrom(text, n, 0, old); at < n; at = findFrom(text, n, start, old)) {
+        memcpy(write, text + start, at - start);
+        write += at - start;
+        memcpy(write, stringData(replacement), replacementLength);
+        write += replacementLength;
+        start = at + m;
+    }
+    memcpy(write, text + start, n - start);
+}
+
+void textChangeCase(String *out, const String *string, int upper) {
+    size_t n = stringLength(string);
+    simdKernels()->changeCase(stringReserve(out, n), stringData(string), n, upper);
+}
+
+void textTrim(String *out, const String *string) {
+    const char *text = stringData(string);
+    size_t start = 0;
+    size_t end = stringLength(string);
+    while (start < end && isBlank(text[start])) start++;
+    while (end > start && isBlank(text[end - 1])) end--;
+    stringSlice(out, string, start, end - start);
+}
@@ -0,0 +1,35 @@
+#ifndef LEXER_TEXT_H
+#define LEXER_TEXT_H
+
+#include "lexer_string.h"
+#include "lexer_array.h"
+
+// Operations on the text of strings. Strings hold UTF-8, so lengths and
+// positions count characters rather than bytes, and no character is ever
+// split. The scans run through the kernels in lexer_simd.h. Results are
+// written to out, and parts of the text are shared rather than copied
+// wherever they can be.
+
+size_t textLength(const String *string);
+// The characters from start up to end, with the bounds of an array slice
+void textSlice(String *out, const String *string, long start, long end);
+// The character at index; a negative index counts from the end
+void textCharacter(String *out, const String *string, long index);
+
+// All the parts one after the other, written once into a buffer of the
+// final length
+void textConcat(String *out, const String *const *parts, int count);
+
+// Position of the first copy of needle, or -1
+long textFind(const String *string, const String *needle);
+// The pieces between separators. A NULL separator splits on runs of spaces
+// and tabs, an empty one into characters.
+Array *textSplit(const String *string, const String *separator);
+// Every copy of old replaced; an empty old leaves the text as it is
+void textReplace(String *out, const String *string, const String *old, const String *replacement);
+// ASCII letters only; other characters are left as they are
+void textChangeCase(String *out, const String *string, int upper);
+// Without the spaces, tabs and line endings at either end
+void textTrim(String *out, const String *string);
+
+#endif // LEXER_TEXT_H
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_thread.h"
+#include "lexer_array.h"
+#include "lexer_map.h"
+#include "lexer_function.h"
+#include "lexer_coroutine.h"
+#include "lexer_channel.h"
+#include "lexer_parallel.h"
+#include "lexer_simd.h"
+#include "lexer_error.h"
+#include "lexer_memory.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+// Values nested deeper than this are taken to contain themselves
+#define ISOLATE_MAX_DEPTH 1000
+
+int liveThreads = 1;
+
+// ---------------------------------------------------------------------------
+// Copies
+
+static int isolate(Variable *dest, const Variable *src, int depth);
+
+static Array *isolateArray(Array *array, int depth) {
+    Array *copy = createArray(array->kind, array->length);
+    if (array->kind != ARRAY_BOXED) {
+        size_t size = array->kind == ARRAY_INT ? sizeof(int64_t) : sizeof(double);
+        memcpy(copy->data.ints, array->data.ints, array->length * size);
+        copy->length = array->length;
+        return copy;
+    }
+    for (size_t i = 0; i < array->length; i++) {
+        if (!isolate(&copy->data.boxed[i], &array->data.boxed[i], depth)) {
+            releaseArray(copy);
+            return NULL;
+        }
+        copy->length = i + 1;
+    }
+    return copy;
+}
+
+static Map *isolateMap(Map *map, int depth) {
+    Map *copy = createMap();
+    for (size_t i = 0; i < map->entryCount; i++) {
+        MapEntry *entry = &map->entries[i];
+        if (entry->deleted) {
+            continue;
+        }
+        Variable key;
+        Variable value;
+        if (!isolate(&value, &entry->value, depth)) {
+            releaseMap(copy);
+            return NULL;
+        }
+        isolate(&key, &entry->key, depth);
+        mapSet(copy, &key, &value);
+        releaseValue(&key);
+        releaseValue(&value);
+    }
+    return copy;
+}
+
+static int isolate(Variable *dest, const Variable *src, int depth) {
+    if (depth > ISOLATE_MAX_DEPTH) {
+        raiseError(ERROR_RUNTIME, currentLineNumber, "Value is nested too deeply to copy to another thread");
+    }
+    dest->name = NULL;
+    dest->type = src->type;
+    switch (src->type) {
+        case STRING:
+            stringOwnCopy(&dest->value.stringValue, &src->value.stringValue);
+            return 1;
+        case ARRAY:
+            dest->value.arrayValue = isolateArray(src->value.arrayValue, depth + 1);
+            return dest->value.arrayValue != NULL;
+        case MAP:
+            dest->value.mapValue = isolateMap(src->value.mapValue, depth + 1);
+            return dest->value.mapValue != NULL;
+        case COROUTINE:
+            return 0;
+        case CHANNEL:
+            retainChannel(src->value.channelValue);
+            dest->value.channelValue = src->value.channelValue;
+            return 1;
+        default:
+            dest->value = src->value;
+            return 1;
+    }
+}
+
+int isolateValue(Variable *dest, const Variable *src) {
+    return isolate(dest, src, 0);
+}
+
+// ---------------------------------------------------------------------------
+// Task blocks
+
+#ifndef _WIN32
+
+// Add a copy of value to table, replacing any variable of the same name.
+// Generators and tasks stay behind.
+static void addCopy(VariableTable *table, const char *name, const Variable *value) {
+    Variable copy;
+    if (!isolateValue(&copy, value)) {
+        return;
+    }
+    for (size_t i = 0; i < table->count; i++) {
+        if (strcmp(table->items[i].name, name) == 0) {
+            char *existing = table->items[i].name;
+            releaseValue(&table->items[i]);
+            table->items[i] = copy;
+            table->items[i].name = existing;
+            return;
+        }
+    }
+    table->items = memRealloc(table->items, (table->count + 1) * sizeof(Variable));
+    table->items[table->count] = copy;
+    table->items[table->count].name = memStrdup(name);
+    table->count++;
+}
+
+// Copies of the globals and of the locals of the running function
+static VariableTable copyVisible(void) {
+    VariableTable table = { NULL, 0 };
+    VariableTable globals = currentVariables();
+    for (size_t i = 0; i < globals.count; i++) {
+        addCopy(&table, globals.items[i].name, &globals.items[i]);
+    }
+    const CallFrame *frame = currentFrame();
+    if (frame) {
+        for (int i = 0; i < frame->function->localCount; i++) {
+            if (frame->slots[i + 1].name) {
+                addCopy(&table, frame->function->localNames[i], &frame->slots[i + 1]);
+            }
+        }
+    }
+    return table;
+}
+
+typedef struct TaskBlock {
+    Script *script;
+    int start;
+    int end;
+    int lineNumber;
+    VariableTable globals;
+    pthread_t thread;
+    struct TaskBlock *next;
+} TaskBlock;
+
+// Task blocks may start task blocks of their own
+static pthread_mutex_t startedLock = PTHREAD_MUTEX_INITIALIZER;
+static TaskBlock *started = NULL;
+
+static void *runTaskBlock(void *argument) {
+    TaskBlock *task = argument;
+    useVariables(task->globals);
+    currentLineNumber = task->lineNumber;
+    executeBlock(task->script, task->start, task->end);
+    finishTasks();
+    clearMainRunner();
+    freeCallStack();
+    clearVariables();
+    __atomic_sub_fetch(&liveThreads, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+#endif
+
+int startTaskBlock(Script *script, int index) {
+    ScriptLine *line = &script->lines[index];
+    if (strcmp(line->text, "task:") != 0) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Invalid task statement syntax");
+    }
+    if (line->blockEnd == index + 1) {
+        raiseError(ERROR_SYNTAX, line->lineNumber, "Expected an indented block");
+    }
+    if (parallelActive) {
+        raiseError(ERROR_RUNTIME, line->lineNumber, "parallel_for cannot start a task block");
+    }
+
+#ifndef _WIN32
+    TaskBlock *task = memAlloc(sizeof(TaskBlock));
+    task->script = script;
+    task->start = index + 1;
+    task->end = line->blockEnd;
+    task->lineNumber = line->lineNumber;
+    task->globals = copyVisible();
+
+    // Picked once, before any thread could race to pick it
+    simdKernels();
+    __atomic_add_fetch(&valuesShared, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&liveThreads, 1, __ATOMIC_SEQ_CST);
+    if (pthread_create(&task->thread, NULL, runTaskBlock, task) != 0) {
+        raiseError(ERROR_RUNTIME, line->lineNumber, "Could not start a thread for the task block");
+    }
+
+    pthread_mutex_lock(&startedLock);
+    task->next = started;
+    started = task;
+    pthread_mutex_unlock(&startedLock);
+#else
+    raiseError(ERROR_RUNTIME, line->lineNumber, "task blocks need threads, which this build does not have");
+#endif
+    return line->blockEnd;
+}
+
+void finishTaskBlocks(void) {
+#ifndef _WIN32
+    // The thread that waits runs no statements meanwhile
+    __atomic_sub_fetch(&liveThreads, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        pthread_mutex_lock(&startedLock);
+        TaskBlock *task = started;
+        if (task) {
+            started = task->next;
+        }
+        pthread_mutex_unlock(&startedLock);
+        if (!task) {
+            break;
+        }
+        pthread_join(task->thread, NULL);
+        __atomic_sub_fetch(&valuesShared, 1, __ATOMIC_RELAXED);
+        memFree(task);
+    }
+    __atomic_add_fetch(&liveThreads, 1, __ATOMIC_SEQ_CST);
+#endif
+}
@@ -0,0 +1,27 @@
+#ifndef LEXER_THREAD_H
+#define LEXER_THREAD_H
+
+#include "lexer_script.h"
+#include "lexer_interpret.h"
+
+// "task:" runs its block on a thread of its own, alongside the statements
+// after it. The block starts with copies of the variables it can see and
+// shares nothing with the rest of the script but channels.
+
+// Start the task block at index; returns the index after it
+int startTaskBlock(Script *script, int index);
+// Wait for every task block started so far, once the script has ended
+void finishTaskBlocks(void);
+
+// Copy src into dest so that no other thread can change or free what dest
+// holds: arrays and maps are copied deeply, channels stay shared. Returns
+// 0, leaving dest unset, if src holds a generator or task, which belong to
+// the thread that made them.
+int isolateValue(Variable *dest, const Variable *src);
+
+// Threads running statements: the main one, task blocks, and the ones
+// working on a parallel_for. Once every one of them waits on a channel,
+// none can ever be woken.
+extern int liveThreads;
+
+#endif // LEXER_THREAD_H
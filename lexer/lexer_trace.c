@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_trace.h"
+#include "lexer_interpret.h"
+#include "lexer_memory.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// A trace file holds "NVQT", the version, the names as id, length and
+// text, then every event, each thread's from oldest to newest
+#define TRACE_MAGIC "NVQT"
+#define TRACE_VERSION 1
+// Names past this many are all recorded as TRACE_NO_NAME
+#define TRACE_MAX_NAMES 4096
+#define TRACE_NO_NAME 0xffffffffu
+
+typedef struct {
+    uint64_t time;       // Nanoseconds since the trace started
+    uint32_t line;
+    uint32_t name;       // Id of the name, or TRACE_NO_NAME
+    uint16_t kind;
+    uint16_t thread;
+    uint32_t unused;
+} TraceRecord;
+
+// Only the thread that owns a ring writes to it. written counts every
+// event ever recorded; the one at written - 1 is complete once it is.
+typedef struct TraceRing {
+    TraceRecord *records;
+    uint64_t written;
+    uint16_t thread;
+    struct TraceRing *next;
+} TraceRing;
+
+TraceHook traceHook = NULL;
+
+static const char *tracePath = NULL;
+static uint64_t traceStart = 0;
+static TraceRing *rings = NULL;
+static uint16_t lastThread = 0;
+static _Thread_local TraceRing *ownRing = NULL;
+
+// A name's id is its slot. Slots are claimed with a compare-and-swap and
+// never change after, so lookups take no lock.
+static char *names[TRACE_MAX_NAMES];
+
+static uint64_t traceClock(void) {
+#ifdef _WIN32
+    return GetTickCount64() * 1000000ULL;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static uint32_t nameId(const char *name) {
+    if (!name) {
+        return TRACE_NO_NAME;
+    }
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c; c++) {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+    char *copy = NULL;
+    for (uint32_t probes = 0; probes < TRACE_MAX_NAMES; probes++) {
+        uint32_t slot = (hash + probes) % TRACE_MAX_NAMES;
+        char *existing = __atomic_load_n(&names[slot], __ATOMIC_ACQUIRE);
+        if (!existing) {
+            if (!copy) {
+                copy = memStrdup(name);
+            }
+            if (__atomic_compare_exchange_n(&names[slot], &existing, copy, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return slot;
+            }
+        }
+        if (strcmp(existing, name) == 0) {
+            memFree(copy);
+            return slot;
+        }
+    }
+    memFree(copy);
+    return TRACE_NO_NAME;
+}
+
+static TraceRing *addRing(void) {
+    TraceRing *ring = memAlloc(sizeof(TraceRing));
+    ring->records = memAlloc(TRACE_RING_EVENTS * sizeof(TraceRecord));
+    ring->written = 0;
+    ring->thread = __atomic_add_fetch(&lastThread, 1, __ATOMIC_RELAXED);
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    ownRing = ring;
+    return ring;
+}
+
+static void recordEvent(TraceKind kind, const char *name) {
+    TraceRing *ring = ownRing ? ownRing : addRing();
+    uint64_t position = ring->written;
+    TraceRecord *record = &ring->records[position % TRACE_RING_EVENTS];
+    record->time = traceClock() - traceStart;
+    record->line = (uint32_t)currentLineNumber;
+    record->name = nameId(name);
+    record->kind = (uint16_t)kind;
+    record->thread = ring->thread;
+    record->unused = 0;
+    __atomic_store_n(&ring->written, position + 1, __ATOMIC_RELEASE);
+}
+
+static void writeTrace(void) {
+    FILE *file = fopen(tracePath, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Could not write trace %s\n", tracePath);
+        return;
+    }
+    uint32_t version = TRACE_VERSION;
+    fwrite(TRACE_MAGIC, 1, 4, file);
+    fwrite(&version, sizeof(version), 1, file);
+
+    uint32_t nameCount = 0;
+    for (uint32_t i = 0; i < TRACE_MAX_NAMES; i++) {
+        nameCount += __atomic_load_n(&names[i], __ATOMIC_ACQUIRE) != NULL;
+    }
+    fwrite(&nameCount, sizeof(nameCount), 1, file);
+    for (uint32_t i = 0; i < TRACE_MAX_NAMES; i++) {
+        const char *name = __atomic_load_n(&names[i], __ATOMIC_ACQUIRE);
+        if (name) {
+            uint32_t length = (uint32_t)strlen(name);
+            fwrite(&i, sizeof(i), 1, file);
+            fwrite(&length, sizeof(length), 1, file);
+            fwrite(name, 1, length, file);
+        }
+    }
+
+    for (TraceRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        uint64_t written = __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE);
+        uint64_t first = written > TRACE_RING_EVENTS ? written - TRACE_RING_EVENTS : 0;
+        for (uint64_t position = first; position < written; position++) {
+            fwrite(&ring->records[position % TRACE_RING_EVENTS], sizeof(TraceRecord), 1, file);
+        }
+    }
+    fclose(file);
+}
+
+void startTrace(const char *path) {
+    tracePath = path;
+    traceStart = traceClock();
+    traceHook = recordEvent;
+    atexit(writeTrace);
+}
+
+// ---------------------------------------------------------------------------
+// Converting to JSON
+
+static void printJsonString(const char *text) {
+    putchar('"');
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            printf("\\%c", *c);
+        } else if (*c < 0x20) {
+            printf("\\u%04x", *c);
+        } else {
+            putchar(*c);
+        }
+    }
+    putchar('"');
+}
+
+int traceToJson(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    char magic[4];
+    uint32_t version;
+    uint32_t nameCount;
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, TRACE_MAGIC, 4) != 0 ||
+        fread(&version, sizeof(version), 1, file) != 1 || version != TRACE_VERSION ||
+        fread(&nameCount, sizeof(nameCount), 1, file) != 1) {
+        fclose(file);
+        return 0;
+    }
+
+    char **table = memCalloc(TRACE_MAX_NAMES, sizeof(char *));
+    for (uint32_t i = 0; i < nameCount; i++) {
+        uint32_t id;
+        uint32_t length;
+        if (fread(&id, sizeof(id), 1, file) != 1 || fread(&length, sizeof(length), 1, file) != 1 ||
+            id >= TRACE_MAX_NAMES) {
+            break;
+        }
+        table[id] = memAlloc(length + 1);
+        table[id][fread(table[id], 1, length, file)] = '\0';
+    }
+
+    // A ring that wrapped around starts partway through statements; their
+    // ends are left out
+    static int depths[65536];
+    static const char *kinds[] = { "statement", "statement", "write", "import", "display" };
+    printf("{\"traceEvents\":[\n");
+    TraceRecord record;
+    int first = 1;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.kind > TRACE_DISPLAY) {
+            continue;
+        }
+        if (record.kind == TRACE_STATEMENT_END) {
+            if (depths[record.thread] == 0) {
+                continue;
+            }
+            depths[record.thread]--;
+        }
+        const char *name = record.name < TRACE_MAX_NAMES ? table[record.name] : NULL;
+        printf("%s{\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"cat\":\"%s\",\"name\":",
+               first ? "" : ",\n", record.kind == TRACE_STATEMENT_START ? "B" :
+               record.kind == TRACE_STATEMENT_END ? "E" : "i",
+               record.time / 1000.0, record.thread, kinds[record.kind]);
+        if (record.kind == TRACE_STATEMENT_START) {
+            depths[record.thread]++;
+        }
+        if (record.kind <= TRACE_STATEMENT_END) {
+            printf("\"line %u\"", record.line);
+        } else if (name) {
+            printJsonString(name);
+        } else {
+            printf("\"%s\"", kinds[record.kind]);
+        }
+        if (record.kind >= TRACE_VARIABLE_WRITE) {
+            printf(",\"s\":\"t\"");
+        }
+        printf(",\"args\":{\"line\":%u}}", record.line);
+        first = 0;
+    }
+    printf("\n]}\n");
+
+    for (int i = 0; i < TRACE_MAX_NAMES; i++) {
+        memFree(table[i]);
+    }
+    memFree(table);
+    fclose(file);
+    return 1;
+}
@@ -0,0 +1,40 @@
+#ifndef LEXER_TRACE_H
+#define LEXER_TRACE_H
+
+#include <stdint.h>
+
+// Points in a run a tracer can watch. name is the variable written or the
+// file imported, and NULL for the others. A statement that opens a block
+// ends once its header has run; the statements of the block come after.
+typedef enum {
+    TRACE_STATEMENT_START,
+    TRACE_STATEMENT_END,
+    TRACE_VARIABLE_WRITE,
+    TRACE_IMPORT,
+    TRACE_DISPLAY
+} TraceKind;
+
+// The line is currentLineNumber. Set before the script starts; hooks may
+// be called from any thread.
+typedef void (*TraceHook)(TraceKind kind, const char *name);
+extern TraceHook traceHook;
+
+// With no hook set this is one load and a branch that is never taken
+static inline void traceEvent(TraceKind kind, const char *name) {
+    if (__builtin_expect(traceHook != NULL, 0)) {
+        traceHook(kind, name);
+    }
+}
+
+// The tracer behind --trace. Each thread records fixed-size events into a
+// ring of its own, keeping the last TRACE_RING_EVENTS; the rings are
+// written to path when the process exits, however it exits.
+#define TRACE_RING_EVENTS (1 << 16)
+void startTrace(const char *path);
+
+// Convert a file written by --trace to the JSON of the Trace Event Format
+// that chrome://tracing and Perfetto read, on standard output. Returns 0
+// if the file cannot be read.
+int traceToJson(const char *path);
+
+#endif // LEXER_TRACE_H
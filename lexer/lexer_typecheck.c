@@ -0,0 +1,1069 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "lexer_typecheck.h"
+#include "lexer_interpret.h"
+#include "lexer_expr.h"
+#include "lexer_function.h"
+#include "lexer_parallel.h"
+#include "lexer_memory.h"
+
+// Types each variable can have at one point of the script. A variable that
+// is not listed may be anything, or not be set at all.
+typedef struct {
+    const char *name;
+    unsigned types;
+} Binding;
+
+typedef struct {
+    Binding *bindings;
+    int count;
+} TypeEnv;
+
+#define TYPE_COMPARABLE (TYPE_NUMERIC | TYPE_BIT(BOOLEAN))
+
+static Script *checkedScript = NULL;
+static int errorCount = 0;
+static int lineNumber = 0;
+// Nonzero while a loop is being run to a fixed point; the types seen on the
+// way are incomplete, so errors are only reported on the last pass
+static int quiet = 0;
+// Nonzero inside a try block, where a type error is only a warning: when
+// the statement runs, the catch gets it
+static int inTry = 0;
+
+// Parses on behalf of the line being checked, so that a literal the parser
+// rejects is reported against that line
+static Expr *parseChecked(const char *text) {
+    currentLineNumber = lineNumber;
+    return parseExpression(text);
+}
+
+// Names written by import, which reaches globals even from inside a
+// function, and names of user-defined functions
+static char **importedNames = NULL;
+static int importedCount = 0;
+static char **functionNames = NULL;
+static int functionCount = 0;
+
+static int listContains(char **names, int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void listAdd(char ***names, int *count, const char *start, size_t length) {
+    *names = memRealloc(*names, (*count + 1) * sizeof(char *));
+    char *name = memAlloc(length + 1);
+    memcpy(name, start, length);
+    name[length] = '\0';
+    (*names)[(*count)++] = name;
+}
+
+static void listClear(char ***names, int *count) {
+    for (int i = 0; i < *count; i++) {
+        memFree((*names)[i]);
+    }
+    memFree(*names);
+    *names = NULL;
+    *count = 0;
+}
+
+static void reportError(const char *kind, const char *message) {
+    if (!quiet) {
+        fprintf(stderr, "%s on line %d: %s\n", kind, lineNumber, message);
+        errorCount++;
+    }
+}
+
+static void typeError(const char *message) {
+    if (inTry) {
+        if (!quiet) {
+            fprintf(stderr, "Type warning on line %d: %s\n", lineNumber, message);
+        }
+        return;
+    }
+    reportError("Type error", message);
+}
+
+// ---------------------------------------------------------------------------
+// Environments
+
+static TypeEnv envCopy(const TypeEnv *env) {
+    TypeEnv copy;
+    copy.count = env->count;
+    copy.bindings = memAlloc((env->count ? env->count : 1) * sizeof(Binding));
+    if (env->count > 0) {
+        memcpy(copy.bindings, env->bindings, env->count * sizeof(Binding));
+    }
+    return copy;
+}
+
+static void envFree(TypeEnv *env) {
+    memFree(env->bindings);
+    env->bindings = NULL;
+    env->count = 0;
+}
+
+static Binding *envFind(const TypeEnv *env, const char *name) {
+    for (int i = 0; i < env->count; i++) {
+        if (strcmp(env->bindings[i].name, name) == 0) {
+            return &env->bindings[i];
+        }
+    }
+    return NULL;
+}
+
+static unsigned envLookup(const TypeEnv *env, const char *name) {
+    Binding *binding = envFind(env, name);
+    if (!binding || listContains(importedNames, importedCount, name)) {
+        return TYPE_ANY | TYPE_UNSET;
+    }
+    return binding->types;
+}
+
+static void envAssign(TypeEnv *env, const char *name, unsigned types) {
+    Binding *binding = envFind(env, name);
+    if (!binding) {
+        // The name must outlive the environment
+        env->bindings = memRealloc(env->bindings, (env->count + 1) * sizeof(Binding));
+        binding = &env->bindings[env->count++];
+        binding->name = name;
+    }
+    binding->types = types;
+}
+
+// Merge other into env, where control flow from both meets
+static void envJoin(TypeEnv *env, const TypeEnv *other) {
+    int kept = 0;
+    for (int i = 0; i < env->count; i++) {
+        Binding *binding = envFind(other, env->bindings[i].name);
+        if (binding) {
+            env->bindings[kept] = env->bindings[i];
+            env->bindings[kept++].types |= binding->types;
+        }
+    }
+    env->count = kept;
+}
+
+static int envEquals(const TypeEnv *a, const TypeEnv *b) {
+    if (a->count != b->count) {
+        return 0;
+    }
+    for (int i = 0; i < a->count; i++) {
+        Binding *binding = envFind(b, a->bindings[i].name);
+        if (!binding || binding->types != a->bindings[i].types) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Expressions
+
+// Nodes are shared by every statement with the same text, so a node only
+// stays proven if it is proven everywhere it is used
+static unsigned annotate(Expr *expr, unsigned types, int provable) {
+    expr->proven = expr->types ? expr->proven && provable : provable;
+    expr->types |= types;
+    return types;
+}
+
+static const char *arithmeticError(unsigned types) {
+    if (types & TYPE_BIT(STRING)) return "Cannot perform arithmetic operations with strings";
+    if (types & TYPE_BIT(BOOLEAN)) return "Cannot perform arithmetic operations with booleans";
+    if (types & TYPE_BIT(MAP)) return "Cannot perform arithmetic operations with maps";
+    if (types & TYPE_BIT(CHANNEL)) return "Cannot perform arithmetic operations with channels";
+    return "Cannot perform arithmetic operations with coroutines";
+}
+
+static unsigned builtinTypes(const char *name) {
+    if (strcmp(name, "len") == 0 || strcmp(name, "find") == 0) return TYPE_BIT(INT);
+    if (strcmp(name, "mean") == 0) return TYPE_BIT(FLOAT);
+    if (strcmp(name, "has") == 0 || strcmp(name, "done") == 0 ||
+        strcmp(name, "try_send") == 0 || strcmp(name, "contains") == 0) return TYPE_BIT(BOOLEAN);
+    if (strcmp(name, "replace") == 0 || strcmp(name, "upper") == 0 ||
+        strcmp(name, "lower") == 0 || strcmp(name, "trim") == 0) return TYPE_BIT(STRING);
+    if (strcmp(name, "spawn") == 0) return TYPE_BIT(COROUTINE);
+    if (strcmp(name, "channel") == 0) return TYPE_BIT(CHANNEL);
+    if (strcmp(name, "keys") == 0 || strcmp(name, "lines") == 0 ||
+        strcmp(name, "split") == 0) return TYPE_BIT(ARRAY);
+    if (strcmp(name, "read_csv") == 0) return TYPE_BIT(MAP);
+    if (strcmp(name, "sum") == 0 || strcmp(name, "min") == 0 ||
+        strcmp(name, "max") == 0 || strcmp(name, "dot") == 0) {
+        return TYPE_NUMERIC;
+    }
+    return TYPE_ANY;
+}
+
+static unsigned checkExpr(Expr *expr, TypeEnv *env);
+
+// Only + takes strings, and only two of them
+static unsigned checkArithmetic(Expr *expr, unsigned left, unsigned right) {
+    int joins = strcmp(expr->operator, "+") == 0;
+    unsigned allowed = TYPE_NUMERIC | TYPE_BIT(ARRAY) | (joins ? TYPE_BIT(STRING) : 0);
+    int leftBad = (left & ~TYPE_UNSET) && !(left & (allowed | TYPE_UNSET));
+    int rightBad = (right & ~TYPE_UNSET) && !(right & (allowed | TYPE_UNSET));
+    if (leftBad || rightBad) {
+        typeError(arithmeticError(leftBad ? left : right));
+    }
+    unsigned leftSet = left & ~TYPE_UNSET;
+    unsigned rightSet = right & ~TYPE_UNSET;
+    if (joins && !leftBad && !rightBad && leftSet && rightSet &&
+        ((leftSet == TYPE_BIT(STRING) && !(rightSet & TYPE_BIT(STRING))) ||
+         (rightSet == TYPE_BIT(STRING) && !(leftSet & TYPE_BIT(STRING))))) {
+        typeError(arithmeticError(TYPE_BIT(STRING)));
+    }
+
+    unsigned number;
+    if (expr->operator[0] == '/' && expr->operator[1] == '\0') {
+        number = TYPE_BIT(FLOAT);
+    } else if (strcmp(expr->operator, "//") == 0 || strcmp(expr->operator, "%") == 0) {
+        number = TYPE_BIT(INT);
+    } else {
+        number = TYPE_NUMERIC;
+    }
+
+    unsigned types = 0;
+    if ((left & TYPE_NUMERIC) && (right & TYPE_NUMERIC)) {
+        types |= number;
+    }
+    if (joins && (left & TYPE_BIT(STRING)) && (right & TYPE_BIT(STRING))) {
+        types |= TYPE_BIT(STRING);
+    }
+    if ((left | right) & TYPE_BIT(ARRAY)) {
+        types |= TYPE_BIT(ARRAY);
+    }
+    if (!types) {
+        types = number;
+    }
+    types |= (left | right) & TYPE_UNSET;
+
+    int provable = !(left & ~(TYPE_NUMERIC | TYPE_UNSET)) && !(right & ~(TYPE_NUMERIC | TYPE_UNSET));
+    return annotate(expr, types, provable);
+}
+
+static unsigned checkComparison(Expr *expr, unsigned left, unsigned right) {
+    unsigned bad = (left & ~TYPE_UNSET) && !(left & (TYPE_COMPARABLE | TYPE_UNSET)) ? left :
+                   (right & ~TYPE_UNSET) && !(right & (TYPE_COMPARABLE | TYPE_UNSET)) ? right : 0;
+    if (bad & TYPE_BIT(STRING)) {
+        typeError("Cannot compare string values");
+    } else if (bad & (TYPE_BIT(ARRAY) | TYPE_BIT(MAP))) {
+        typeError("Cannot compare arrays or maps");
+    } else if (bad & TYPE_BIT(CHANNEL)) {
+        typeError("Cannot compare channels");
+    } else if (bad) {
+        typeError("Cannot compare coroutines");
+    }
+
+    int provable = !(left & ~(TYPE_COMPARABLE | TYPE_UNSET)) && !(right & ~(TYPE_COMPARABLE | TYPE_UNSET));
+    return annotate(expr, TYPE_BIT(BOOLEAN) | ((left | right) & TYPE_UNSET), provable);
+}
+
+static unsigned checkCall(Expr *expr, TypeEnv *env) {
+    for (int i = 0; i < expr->childCount; i++) {
+        checkExpr(expr->children[i], env);
+    }
+    // User-defined functions are looked up first
+    if (listContains(functionNames, functionCount, expr->name)) {
+        return annotate(expr, TYPE_ANY, 0);
+    }
+    return annotate(expr, builtinTypes(expr->name), 0);
+}
+
+// Returns the types expr can evaluate to. A parse failure or a missing
+// variable evaluates to nothing, which TYPE_UNSET stands for.
+static unsigned checkExpr(Expr *expr, TypeEnv *env) {
+    if (!expr) {
+        return TYPE_ANY | TYPE_UNSET;
+    }
+
+    switch (expr->kind) {
+        case EXPR_LITERAL:
+            return annotate(expr, TYPE_BIT(expr->value.type), 1);
+
+        case EXPR_VARIABLE:
+            return annotate(expr, envLookup(env, expr->name), 0);
+
+        case EXPR_ARRAY:
+        case EXPR_MAP:
+            for (int i = 0; i < expr->childCount; i++) {
+                checkExpr(expr->children[i], env);
+            }
+            return annotate(expr, TYPE_BIT(expr->kind == EXPR_ARRAY ? ARRAY : MAP), 0);
+
+        case EXPR_INDEX:
+        case EXPR_SLICE:
+            for (int i = 0; i < expr->childCount; i++) {
+                if (expr->children[i]) checkExpr(expr->children[i], env);
+            }
+            return annotate(expr, expr->kind == EXPR_SLICE ? TYPE_BIT(ARRAY) | TYPE_BIT(STRING) : TYPE_ANY, 0);
+
+        case EXPR_CALL:
+            return checkCall(expr, env);
+
+        case EXPR_NOT:
+            return annotate(expr, TYPE_BIT(BOOLEAN) | (checkExpr(expr->children[0], env) & TYPE_UNSET), 0);
+
+        case EXPR_LOGICAL: {
+            unsigned left = checkExpr(expr->children[0], env);
+            unsigned right = checkExpr(expr->children[1], env);
+            return annotate(expr, TYPE_BIT(BOOLEAN) | ((left | right) & TYPE_UNSET), 0);
+        }
+
+        case EXPR_COMPARISON: {
+            unsigned left = checkExpr(expr->children[0], env);
+            unsigned right = checkExpr(expr->children[1], env);
+            return checkComparison(expr, left, right);
+        }
+
+        case EXPR_ARITHMETIC: {
+            unsigned left = checkExpr(expr->children[0], env);
+            unsigned right = checkExpr(expr->children[1], env);
+            return checkArithmetic(expr, left, right);
+        }
+    }
+    return TYPE_ANY | TYPE_UNSET;
+}
+
+static unsigned checkText(const char *text, TypeEnv *env) {
+    return checkExpr(parseChecked(text), env);
+}
+
+// ---------------------------------------------------------------------------
+// Statements. These follow the interpreter, but go through every branch and
+// stop on nothing; syntax errors are left for the interpreter to report.
+
+static void checkBlock(int start, int end, TypeEnv *env);
+
+// Text between the prefix and the closing "):" of an if, elseif or func
+// line as a new string, or NULL if the line does not end that way
+static char *headerArgument(const char *text, size_t prefixLength) {
+    const char *start = text + prefixLength;
+    const char *end = start + strlen(start);
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    if (end - start < 2 || end[-1] != ':' || end[-2] != ')') {
+        return NULL;
+    }
+    size_t length = (size_t)(end - 2 - start);
+    char *argument = memAlloc(length + 1);
+    memcpy(argument, start, length);
+    argument[length] = '\0';
+    return argument;
+}
+
+static void checkCondition(const ScriptLine *line, size_t prefixLength, TypeEnv *env) {
+    lineNumber = line->lineNumber;
+    char *condition = headerArgument(line->text, prefixLength);
+    if (condition) {
+        checkText(condition, env);
+        memFree(condition);
+    }
+}
+
+// Check the body of the statement at index on a copy of env
+static TypeEnv checkBranch(int index, const TypeEnv *env) {
+    TypeEnv branch = envCopy(env);
+    checkBlock(index + 1, checkedScript->lines[index].blockEnd, &branch);
+    return branch;
+}
+
+static int checkIf(int index, TypeEnv *env) {
+    ScriptLine *line = &checkedScript->lines[index];
+    int indent = line->indent;
+    int hasElse = 0;
+
+    checkCondition(line, 3, env);
+    TypeEnv result = checkBranch(index, env);
+    index = line->blockEnd;
+
+    while (index < checkedScript->count && checkedScript->lines[index].indent == indent) {
+        ScriptLine *next = &checkedScript->lines[index];
+        if (strncmp(next->text, "elseif(", 7) == 0) {
+            checkCondition(next, 7, env);
+        } else if (strcmp(next->text, "else:") == 0) {
+            hasElse = 1;
+        } else {
+            break;
+        }
+        TypeEnv branch = checkBranch(index, env);
+        envJoin(&result, &branch);
+        envFree(&branch);
+        index = next->blockEnd;
+        if (hasElse) {
+            break;
+        }
+    }
+
+    // Without an else, every condition may be false
+    if (!hasElse) {
+        envJoin(&result, env);
+    }
+    envFree(env);
+    *env = result;
+    return index;
+}
+
+// Any one arm of a match runs, or none of them without a default
+static int checkMatch(int index, TypeEnv *env) {
+    ScriptLine *line = &checkedScript->lines[index];
+    char *subject = headerArgument(line->text, 6);
+    if (subject) {
+        checkText(subject, env);
+        memFree(subject);
+    }
+
+    TypeEnv result = envCopy(env);
+    int first = 1;
+    int hasDefault = 0;
+    for (int arm = index + 1; arm < line->blockEnd; arm = checkedScript->lines[arm].blockEnd) {
+        hasDefault |= strcmp(checkedScript->lines[arm].text, "default:") == 0;
+        TypeEnv branch = checkBranch(arm, env);
+        if (first) {
+            envFree(&result);
+            result = branch;
+            first = 0;
+        } else {
+            envJoin(&result, &branch);
+            envFree(&branch);
+        }
+    }
+
+    if (!hasDefault) {
+        envJoin(&result, env);
+    }
+    envFree(env);
+    *env = result;
+    return line->blockEnd;
+}
+
+// Run the body of a loop to a fixed point, then check it once more for
+// errors with the types of every pass
+static int checkFor(int index, TypeEnv *env) {
+    ScriptLine *line = &checkedScript->lines[index];
+    lineNumber = line->lineNumber;
+    const char *in = strstr(line->text, " in ");
+    size_t length = strlen(line->text);
+    if (!in || line->text[length - 1] != ':') {
+        return line->blockEnd;
+    }
+
+    // Parsed names stay in the cache, so the environments can keep them
+    char *nameText = memAlloc(in - line->text - 3);
+    memcpy(nameText, line->text + 4, in - line->text - 4);
+    nameText[in - line->text - 4] = '\0';
+    Expr *target = parseChecked(nameText);
+    memFree(nameText);
+    if (!target || target->kind != EXPR_VARIABLE) {
+        return line->blockEnd;
+    }
+    const char *name = target->name;
+
+    char *sourceText = memStrdup(in + 4);
+    sourceText[strlen(sourceText) - 1] = '\0';
+    Expr *source = parseChecked(sourceText);
+    memFree(sourceText);
+
+    unsigned itemTypes = TYPE_ANY;
+    if (source && source->kind == EXPR_CALL && strcmp(source->name, "lines") == 0 && source->childCount == 1) {
+        checkExpr(source->children[0], env);
+        itemTypes = TYPE_BIT(STRING);
+    } else {
+        checkExpr(source, env);
+    }
+
+    TypeEnv state = envCopy(env);
+    int done = 0;
+    quiet++;
+    while (!done) {
+        TypeEnv body = envCopy(&state);
+        envAssign(&body, name, itemTypes);
+        checkBlock(index + 1, line->blockEnd, &body);
+        TypeEnv next = envCopy(&state);
+        envJoin(&next, &body);
+        done = envEquals(&next, &state);
+        envFree(&state);
+        envFree(&body);
+        state = next;
+    }
+    quiet--;
+
+    TypeEnv body = envCopy(&state);
+    envAssign(&body, name, itemTypes);
+    checkBlock(index + 1, line->blockEnd, &body);
+    envFree(&body);
+
+    envFree(env);
+    *env = state;
+    return line->blockEnd;
+}
+
+// An error may stop the try block at any statement, so the catch block
+// starts from the types before it joined with those after it
+static int checkTry(int index, TypeEnv *env) {
+    ScriptLine *line = &checkedScript->lines[index];
+    int catchIndex = line->blockEnd;
+    if (catchIndex >= checkedScript->count || checkedScript->lines[catchIndex].indent != line->indent) {
+        return catchIndex;
+    }
+    ScriptLine *catchLine = &checkedScript->lines[catchIndex];
+    size_t length = strlen(catchLine->text);
+    if (strcmp(catchLine->text, "catch:") != 0 &&
+        (strncmp(catchLine->text, "catch ", 6) != 0 || catchLine->text[length - 1] != ':')) {
+        return catchIndex;
+    }
+
+    int outerTry = inTry;
+    inTry = 1;
+    TypeEnv result = checkBranch(index, env);
+    inTry = outerTry;
+    TypeEnv handler = envCopy(env);
+    envJoin(&handler, &result);
+    if (length > 6) {
+        char *nameText = memStrdup(catchLine->text + 6);
+        nameText[length - 7] = '\0';
+        Expr *target = parseChecked(nameText);
+        memFree(nameText);
+        if (target && target->kind == EXPR_VARIABLE) {
+            envAssign(&handler, target->name, TYPE_BIT(MAP));
+        }
+    }
+    checkBlock(catchIndex + 1, catchLine->blockEnd, &handler);
+    envJoin(&result, &handler);
+    envFree(&handler);
+    envFree(env);
+    *env = result;
+    return catchLine->blockEnd;
+}
+
+// A function can be called from anywhere, so its body is checked on its
+// own: parameters may be anything and so may every global it reads
+static int checkFunction(int index) {
+    ScriptLine *line = &checkedScript->lines[index];
+    const char *open = strchr(line->text, '(');
+    char *params = open ? headerArgument(open, 1) : NULL;
+    if (!params) {
+        return line->blockEnd;
+    }
+
+    TypeEnv env = { NULL, 0 };
+    char *cursor = params;
+    // Parameter names point into params, which outlives env
+    char *param;
+    while ((param = nextArgument(&cursor)) != NULL) {
+        envAssign(&env, param, TYPE_ANY);
+    }
+    // It may be called from outside the try it is defined in
+    int outerTry = inTry;
+    inTry = 0;
+    checkBlock(index + 1, line->blockEnd, &env);
+    inTry = outerTry;
+    envFree(&env);
+    memFree(params);
+    return line->blockEnd;
+}
+
+// ---------------------------------------------------------------------------
+// parallel_for. The iterations run at the same time, so the body may write
+// nothing but its own locals. Whatever it, or a function it calls, does
+// that could change something the iterations share is an error here.
+
+// Names private to a block: the ones it assigns to or loops over, and the
+// parameters of the function or loop it is the body of
+typedef struct {
+    int start;
+    int end;
+    char **params;
+    int paramCount;
+} Scope;
+
+static int isPrivate(const Scope *scope, const char *name) {
+    return listContains(scope->params, scope->paramCount, name) ||
+           blockAssigns(checkedScript, scope->start, scope->end, name);
+}
+
+static void sharedError(const char *via, const char *action, const char *name) {
+    char message[512];
+    char detail[256];
+    snprintf(detail, sizeof(detail), action, name ? name : "");
+    if (via) {
+        snprintf(message, sizeof(message), "parallel_for body calls %s(), which %s", via, detail);
+    } else {
+        snprintf(message, sizeof(message), "parallel_for body %s", detail);
+    }
+    reportError("Error", message);
+}
+
+// The variable an element assignment, append or remove changes
+static const char *changedName(Expr *expr) {
+    while (expr && (expr->kind == EXPR_INDEX || expr->kind == EXPR_SLICE)) {
+        expr = expr->children[0];
+    }
+    return expr && expr->kind == EXPR_VARIABLE ? expr->name : NULL;
+}
+
+static int functionLine(const char *name) {
+    size_t length = strlen(name);
+    for (int i = 0; i < checkedScript->count; i++) {
+        const char *text = checkedScript->lines[i].text;
+        if (strncmp(text, "func ", 5) != 0) {
+            continue;
+        }
+        text += 5;
+        while (*text == ' ') text++;
+        if (strncmp(text, name, length) == 0 && (text[length] == '(' || text[length] == ' ')) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void checkShared(const Scope *scope, const char *via, char ***visited, int *visitedCount);
+
+// Check every function the statement calls, each only once
+static void checkCalls(const char *text, const char *via, char ***visited, int *visitedCount) {
+    char quote = 0;
+    for (const char *c = text; *c; c++) {
+        if (quote) {
+            if (*c == quote) quote = 0;
+            continue;
+        }
+        if (*c == '"' || *c == '\'') {
+            quote = *c;
+            continue;
+        }
+        if (!(isalpha((unsigned char)*c) || *c == '_') ||
+            (c > text && (isalnum((unsigned char)c[-1]) || c[-1] == '_'))) {
+            continue;
+        }
+        const char *end = c;
+        while (isalnum((unsigned char)*end) || *end == '_') end++;
+        if (*end != '(') {
+            c = end - 1;
+            continue;
+        }
+
+        char name[256];
+        size_t length = (size_t)(end - c) < sizeof(name) ? (size_t)(end - c) : sizeof(name) - 1;
+        memcpy(name, c, length);
+        name[length] = '\0';
+        c = end - 1;
+
+        if (strcmp(name, "spawn") == 0 || strcmp(name, "await") == 0) {
+            sharedError(via, "spawns or awaits a task", NULL);
+        } else if (listContains(functionNames, functionCount, name) &&
+                   !listContains(*visited, *visitedCount, name)) {
+            listAdd(visited, visitedCount, name, length);
+            int index = functionLine(name);
+            const char *open = index >= 0 ? strchr(checkedScript->lines[index].text, '(') : NULL;
+            char *params = open ? headerArgument(open, 1) : NULL;
+            if (!params) {
+                continue;
+            }
+            Scope scope = { index + 1, checkedScript->lines[index].blockEnd, NULL, 0 };
+            char *cursor = params;
+            char *param;
+            while ((param = nextArgument(&cursor)) != NULL) {
+                listAdd(&scope.params, &scope.paramCount, param, strlen(param));
+            }
+            checkShared(&scope, via ? via : name, visited, visitedCount);
+            listClear(&scope.params, &scope.paramCount);
+            memFree(params);
+        }
+    }
+}
+
+// via is the function the body called to get here, or NULL in the body
+static void checkShared(const Scope *scope, const char *via, char ***visited, int *visitedCount) {
+    int callLine = lineNumber;
+    for (int i = scope->start; i < scope->end; i++) {
+        const ScriptLine *line = &checkedScript->lines[i];
+        const char *text = line->text;
+        lineNumber = via ? callLine : line->lineNumber;
+
+        if (strncmp(text, "func ", 5) == 0) {
+            sharedError(via, "defines a function", NULL);
+            i = line->blockEnd - 1;
+            continue;
+        }
+        if (strncmp(text, "import", 6) == 0) {
+            sharedError(via, "imports a variable", NULL);
+            continue;
+        }
+        if (strncmp(text, "parallel_for(", 13) == 0) {
+            sharedError(via, "runs another parallel_for", NULL);
+        } else if (strcmp(text, "task:") == 0) {
+            sharedError(via, "starts a task block", NULL);
+        } else if (!via && (strcmp(text, "return") == 0 || strncmp(text, "return ", 7) == 0)) {
+            sharedError(NULL, "cannot return", NULL);
+        } else if (!via && (strcmp(text, "yield") == 0 || strncmp(text, "yield ", 6) == 0)) {
+            sharedError(NULL, "cannot yield", NULL);
+        } else if (strncmp(text, "append(", 7) == 0 || strncmp(text, "remove(", 7) == 0) {
+            Expr *call = parseChecked(text);
+            const char *name = call && call->kind == EXPR_CALL && call->childCount > 0 ?
+                               changedName(call->children[0]) : NULL;
+            if (name && !isPrivate(scope, name)) {
+                sharedError(via, "changes shared variable '%s'", name);
+            }
+        } else if (strchr(text, '=') && strncmp(text, "if(", 3) != 0 && strncmp(text, "elseif(", 7) != 0 &&
+                   strncmp(text, "display(", 8) != 0 && strncmp(text, "match(", 6) != 0) {
+            const char *equals = strchr(text, '=');
+            const char *targetEnd = equals;
+            while (targetEnd > text && (targetEnd[-1] == ' ' || targetEnd[-1] == '\t')) targetEnd--;
+            if (equals[1] != '=' && targetEnd > text && targetEnd[-1] == ']') {
+                char *target = memAlloc(targetEnd - text + 1);
+                memcpy(target, text, targetEnd - text);
+                target[targetEnd - text] = '\0';
+                const char *name = changedName(parseChecked(target));
+                if (name && !isPrivate(scope, name)) {
+                    sharedError(via, "changes shared variable '%s'", name);
+                }
+                memFree(target);
+            }
+        }
+        checkCalls(text, via, visited, visitedCount);
+    }
+    lineNumber = callLine;
+}
+
+static int isReduction(const ParallelHeader *header, const char *name) {
+    for (int i = 0; i < header->reductionCount; i++) {
+        Expr *reduction = parseChecked(header->reductions[i].name);
+        if (reduction && reduction->kind == EXPR_VARIABLE && strcmp(reduction->name, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Each iteration would only change a copy of its own, which the loop then
+// drops. Reported on the first statement of the body that assigns to it.
+static void outerAssignment(int index, const char *name) {
+    const ScriptLine *line = &checkedScript->lines[index];
+    for (int i = index + 1; i < line->blockEnd; i++) {
+        if (blockAssigns(checkedScript, i, i + 1, name)) {
+            lineNumber = checkedScript->lines[i].lineNumber;
+            break;
+        }
+    }
+    sharedError(NULL, "assigns to '%s' from outside the loop; make it a reduction or use another name", name);
+    lineNumber = line->lineNumber;
+}
+
+// Each iteration starts with none of the body's locals set, so one pass
+// over the body covers them all
+static int checkParallel(int index, TypeEnv *env) {
+    ScriptLine *line = &checkedScript->lines[index];
+    lineNumber = line->lineNumber;
+    ParallelHeader header;
+    if (parseParallelHeader(line->text, &header)) {
+        return line->blockEnd;
+    }
+
+    unsigned itemTypes = TYPE_BIT(INT);
+    if (header.items) {
+        checkText(header.items, env);
+        itemTypes = TYPE_ANY;
+    } else {
+        checkText(header.start, env);
+        checkText(header.end, env);
+    }
+
+    // Parsed names stay in the cache, so the environments can keep them
+    Expr *target = parseChecked(header.name);
+    TypeEnv body = envCopy(env);
+    for (int i = 0; i < body.count; i++) {
+        const char *name = body.bindings[i].name;
+        if (blockAssigns(checkedScript, index + 1, line->blockEnd, name)) {
+            body.bindings[i].types = TYPE_UNSET;
+            if (strcmp(name, header.name) != 0 && !isReduction(&header, name)) {
+                outerAssignment(index, name);
+            }
+        }
+    }
+    if (target && target->kind == EXPR_VARIABLE) {
+        envAssign(&body, target->name, itemTypes);
+    }
+    // Errors stop the script while the iterations run, try or not
+    int outerTry = inTry;
+    inTry = 0;
+    checkBlock(index + 1, line->blockEnd, &body);
+    inTry = outerTry;
+
+    // A sum of nothing is 0, a min or max of nothing leaves the variable as
+    // it was
+    for (int i = 0; i < header.reductionCount; i++) {
+        Reduction *reduction = &header.reductions[i];
+        Expr *name = parseChecked(reduction->name);
+        if (!name || name->kind != EXPR_VARIABLE) {
+            continue;
+        }
+        unsigned before = envFind(env, name->name) ? envLookup(env, name->name) : TYPE_ANY | TYPE_UNSET;
+        unsigned parts = envLookup(&body, name->name) & ~TYPE_UNSET;
+        unsigned types;
+        if (reduction->kind == REDUCE_APPEND) {
+            types = TYPE_BIT(ARRAY);
+        } else if (reduction->kind == REDUCE_SUM) {
+            types = parts | (before & ~TYPE_UNSET) | (before & TYPE_UNSET ? TYPE_BIT(INT) : 0);
+        } else {
+            types = parts | before;
+        }
+        envAssign(env, name->name, types);
+    }
+    envFree(&body);
+
+    Scope scope = { index + 1, line->blockEnd, NULL, 0 };
+    listAdd(&scope.params, &scope.paramCount, header.name, strlen(header.name));
+    char **visited = NULL;
+    int visitedCount = 0;
+    checkShared(&scope, NULL, &visited, &visitedCount);
+    listClear(&visited, &visitedCount);
+    listClear(&scope.params, &scope.paramCount);
+    lineNumber = line->lineNumber;
+
+    freeParallelHeader(&header);
+    return line->blockEnd;
+}
+
+static void checkDisplay(const char *text, TypeEnv *env) {
+    const char *closing = strrchr(text + 8, ')');
+    if (!closing || !strstr(text, "%var") || !strchr(text, ',')) {
+        return;
+    }
+    char *content = memAlloc(closing - (text + 8) + 1);
+    memcpy(content, text + 8, closing - (text + 8));
+    content[closing - (text + 8)] = '\0';
+
+    char *cursor = content;
+    nextArgument(&cursor);  // The format
+    char *arg;
+    while ((arg = nextArgument(&cursor)) != NULL) {
+        checkText(arg, env);
+    }
+    memFree(content);
+}
+
+static void checkAssignment(const char *text, TypeEnv *env) {
+    const char *equals = strchr(text, '=');
+    const char *nameStart = text;
+    const char *nameEnd = equals;
+    while (nameEnd > nameStart && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) nameEnd--;
+    const char *value = equals + 1;
+    while (*value == ' ') value++;
+
+    char *name = memAlloc(nameEnd - nameStart + 1);
+    memcpy(name, nameStart, nameEnd - nameStart);
+    name[nameEnd - nameStart] = '\0';
+
+    if (name[0] != '\0' && name[strlen(name) - 1] == ']') {
+        // Element assignment changes no variable's type
+        Expr *element = parseChecked(name);
+        if (element && element->kind == EXPR_INDEX) {
+            checkExpr(element->children[0], env);
+            checkExpr(element->children[1], env);
+        }
+        checkText(value, env);
+        memFree(name);
+        return;
+    }
+
+    // An assignment whose value turns out to be missing is skipped
+    unsigned types = checkText(value, env);
+    if (types & TYPE_UNSET) {
+        types |= envLookup(env, name);
+    }
+    Expr *target = parseChecked(name);
+    if (target && target->kind == EXPR_VARIABLE) {
+        envAssign(env, target->name, types);
+    }
+    memFree(name);
+}
+
+static int checkStatement(int index, TypeEnv *env) {
+    ScriptLine *line = &checkedScript->lines[index];
+    const char *text = line->text;
+    lineNumber = line->lineNumber;
+
+    if (strncmp(text, "if(", 3) == 0) {
+        return checkIf(index, env);
+    }
+    if (strncmp(text, "for ", 4) == 0) {
+        return checkFor(index, env);
+    }
+    if (strcmp(text, "try:") == 0) {
+        return checkTry(index, env);
+    }
+    if (strncmp(text, "match(", 6) == 0) {
+        return checkMatch(index, env);
+    }
+    if (strncmp(text, "parallel_for(", 13) == 0) {
+        return checkParallel(index, env);
+    }
+    if (strcmp(text, "task:") == 0) {
+        // The block runs on copies, so what it assigns stays in the block.
+        // Its errors stop the script, try or not.
+        TypeEnv copies = envCopy(env);
+        int outerTry = inTry;
+        inTry = 0;
+        checkBlock(index + 1, line->blockEnd, &copies);
+        inTry = outerTry;
+        envFree(&copies);
+        return line->blockEnd;
+    }
+    if (strncmp(text, "func ", 5) == 0) {
+        return checkFunction(index);
+    }
+    if (strcmp(text, "return") == 0 || strncmp(text, "return ", 7) == 0) {
+        if (text[6]) checkText(text + 6, env);
+        return index + 1;
+    }
+    if (strcmp(text, "yield") == 0 || strncmp(text, "yield ", 6) == 0) {
+        if (text[5]) checkText(text + 5, env);
+        return index + 1;
+    }
+    if (strncmp(text, "elseif(", 7) == 0 || strcmp(text, "else:") == 0 ||
+        strncmp(text, "case ", 5) == 0 || strcmp(text, "default:") == 0 ||
+        strcmp(text, "begin:") == 0 || strcmp(text, "end:") == 0 ||
+        strcmp(text, "catch:") == 0 || strncmp(text, "catch ", 6) == 0 ||
+        strncmp(text, "import", 6) == 0) {
+        return line->blockEnd;
+    }
+
+    if (strncmp(text, "display(", 8) == 0) {
+        checkDisplay(text, env);
+    } else if (strncmp(text, "append(", 7) == 0 || strncmp(text, "remove(", 7) == 0) {
+        checkText(text, env);
+    } else {
+        Expr *call = parseChecked(text);
+        if (call && call->kind == EXPR_CALL && (listContains(functionNames, functionCount, call->name) ||
+                                                strcmp(call->name, "send") == 0 || strcmp(call->name, "close") == 0)) {
+            checkExpr(call, env);
+        } else if (strchr(text, '=')) {
+            checkAssignment(text, env);
+        }
+    }
+    return index + 1;
+}
+
+static void checkBlock(int start, int end, TypeEnv *env) {
+    int index = start;
+    while (index < end) {
+        index = checkStatement(index, env);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Record mode: begin blocks, then the rest of the top level once per record
+// with the variables of the records before it, then end blocks
+
+static void checkSection(TypeEnv *env, const char *block) {
+    int index = 0;
+    while (index < checkedScript->count) {
+        ScriptLine *line = &checkedScript->lines[index];
+        int isSection = strcmp(line->text, "begin:") == 0 || strcmp(line->text, "end:") == 0;
+        if (block && isSection && strcmp(line->text, block) == 0) {
+            checkBlock(index + 1, line->blockEnd, env);
+        }
+        if (block || isSection) {
+            index = line->blockEnd;
+        } else {
+            index = checkStatement(index, env);
+        }
+    }
+}
+
+static void checkRecord(const TypeEnv *state, TypeEnv *record) {
+    *record = envCopy(state);
+    envAssign(record, "NR", TYPE_BIT(INT));
+    envAssign(record, "line", TYPE_BIT(STRING));
+    envAssign(record, "fields", TYPE_BIT(ARRAY));
+    checkSection(record, NULL);
+    envAssign(record, "line", TYPE_BIT(STRING));
+    envAssign(record, "fields", TYPE_BIT(ARRAY));
+}
+
+static void checkRecords(TypeEnv *env) {
+    checkSection(env, "begin:");
+
+    // There may be no records at all, so the start state stays in the join
+    int done = 0;
+    quiet++;
+    while (!done) {
+        TypeEnv record;
+        checkRecord(env, &record);
+        TypeEnv next = envCopy(env);
+        envJoin(&next, &record);
+        done = envEquals(&next, env);
+        envFree(env);
+        envFree(&record);
+        *env = next;
+    }
+    quiet--;
+
+    TypeEnv record;
+    checkRecord(env, &record);
+    envFree(&record);
+
+    checkSection(env, "end:");
+}
+
+// Names that import or func may give a value anywhere in the script
+static void collectNames(void) {
+    listClear(&importedNames, &importedCount);
+    listClear(&functionNames, &functionCount);
+    for (int i = 0; i < checkedScript->count; i++) {
+        const char *text = checkedScript->lines[i].text;
+        if (strncmp(text, "import ", 7) == 0) {
+            const char *start = text + 7;
+            while (*start == ' ') start++;
+            const char *end = start;
+            while (*end && *end != ' ') end++;
+            listAdd(&importedNames, &importedCount, start, end - start);
+        } else if (strncmp(text, "func ", 5) == 0 && strchr(text, '(')) {
+            const char *start = text + 5;
+            const char *end = strchr(text, '(');
+            while (*start == ' ') start++;
+            while (end > start && end[-1] == ' ') end--;
+            listAdd(&functionNames, &functionCount, start, end - start);
+        }
+    }
+}
+
+int typecheckScript(Script *script, int recordMode) {
+    checkedScript = script;
+    errorCount = 0;
+    inTry = 0;
+    collectNames();
+
+    TypeEnv env = { NULL, 0 };
+    if (recordMode) {
+        checkRecords(&env);
+    } else {
+        checkBlock(0, script->count, &env);
+    }
+    envFree(&env);
+    return errorCount;
+}
+
+int typecheckRest(Script *script, int start, VariableTable globals) {
+    checkedScript = script;
+    errorCount = 0;
+    inTry = 0;
+    collectNames();
+
+    // The globals have the one type they hold now. Their names are all
+    // different, so there is nothing to look up.
+    TypeEnv env = { memAlloc(globals.count * sizeof(Binding)), (int)globals.count };
+    for (size_t i = 0; i < globals.count; i++) {
+        env.bindings[i].name = globals.items[i].name;
+        env.bindings[i].types = TYPE_BIT(globals.items[i].type);
+    }
+    checkBlock(start, script->count, &env);
+    envFree(&env);
+    return errorCount;
+}
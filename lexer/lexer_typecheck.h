@@ -0,0 +1,18 @@
+#ifndef LEXER_TYPECHECK_H
+#define LEXER_TYPECHECK_H
+
+#include "lexer_script.h"
+#include "lexer_interpret.h"
+
+// Work out the types variables can have at each statement before the script
+// runs. Definite type errors are reported, as warnings inside try blocks,
+// and operations whose operand types are proven get marked so that they
+// skip their checks at run time.
+// recordMode checks the script the way --each runs it. Returns the number
+// of errors found.
+int typecheckScript(Script *script, int recordMode);
+// Check the statements from start on, with the globals as they are now, for
+// a script that carries on from a snapshot
+int typecheckRest(Script *script, int start, VariableTable globals);
+
+#endif // LEXER_TYPECHECK_H
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer_watch.h"
+#include "lexer_script.h"
+#include "lexer_interpret.h"
+#include "lexer_expr.h"
+#include "lexer_typecheck.h"
+#include "lexer_limit.h"
+#include "lexer_memory.h"
+
+#ifdef _WIN32
+
+void watchScript(const char *path, int checkOnly) {
+    (void)path;
+    (void)checkOnly;
+    fprintf(stderr, "Error: --watch is not supported on Windows\n");
+    exit(EXIT_FAILURE);
+}
+
+#else
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+// How often files are looked at when inotify is not available, and how long
+// to wait after a change for the rest of an editor's save to land
+#define WATCH_POLL_MS 250
+#define WATCH_SETTLE_MS 50
+
+// The script is always the first file, the files it imports follow it
+typedef struct {
+    char *path;
+    struct stat info;
+    int exists;
+    int changed;
+} WatchedFile;
+
+static WatchedFile *files = NULL;
+static int fileCount = 0;
+
+static void sleepMs(int ms) {
+    struct timespec delay = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&delay, NULL);
+}
+
+static void recordFile(WatchedFile *file) {
+    file->exists = stat(file->path, &file->info) == 0;
+    file->changed = 0;
+}
+
+static int fileDiffers(const WatchedFile *file) {
+    struct stat info;
+    int exists = stat(file->path, &info) == 0;
+    if (exists != file->exists) {
+        return 1;
+    }
+    return exists && (info.st_mtime != file->info.st_mtime ||
+                      info.st_size != file->info.st_size ||
+                      info.st_ino != file->info.st_ino);
+}
+
+static int findFile(const char *path) {
+    for (int i = 0; i < fileCount; i++) {
+        if (strcmp(files[i].path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void addFile(const char *path) {
+    if (findFile(path) >= 0) {
+        return;
+    }
+    files = memRealloc(files, (fileCount + 1) * sizeof(WatchedFile));
+    WatchedFile *file = &files[fileCount++];
+    file->path = memStrdup(path);
+    recordFile(file);
+}
+
+// Watch the script and every file it imports. Files it no longer imports
+// are dropped from the import cache, since they are not watched while out
+// of the script and may have changed by the time they come back.
+static void watchFiles(const char *path, const Script *script) {
+    WatchedFile *old = files;
+    int oldCount = fileCount;
+    files = NULL;
+    fileCount = 0;
+
+    addFile(path);
+    for (int i = 0; script && i < script->count; i++) {
+        const char *text = script->lines[i].text;
+        if (strncmp(text, "import", 6) != 0) {
+            continue;
+        }
+        char varName[256];
+        char fileName[256] = "";
+        parseImportStatement(text, varName, fileName);
+        if (fileName[0] && findFile(fileName) < 0) {
+            addFile(fileName);
+            preloadImport(fileName);
+        }
+    }
+
+    for (int i = 0; i < oldCount; i++) {
+        if (i > 0 && findFile(old[i].path) < 0) {
+            forgetImport(old[i].path);
+        }
+        memFree(old[i].path);
+    }
+    memFree(old);
+}
+
+#ifdef __linux__
+static const char *baseName(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+// Editors often save by writing a new file and renaming it over the old
+// one, so the directories are watched rather than the files themselves.
+// Returns 0 if inotify cannot be used.
+static int waitInotify(void) {
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    int *watches = memAlloc(fileCount * sizeof(int));
+    for (int i = 0; i < fileCount; i++) {
+        size_t length = baseName(files[i].path) - files[i].path;
+        char *directory = memAlloc(length + 2);
+        if (length) {
+            memcpy(directory, files[i].path, length);
+            directory[length] = '\0';
+        } else {
+            strcpy(directory, ".");
+        }
+        watches[i] = inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO |
+                                       IN_CREATE | IN_DELETE | IN_MOVED_FROM);
+        memFree(directory);
+        if (watches[i] < 0) {
+            memFree(watches);
+            close(fd);
+            return 0;
+        }
+    }
+
+    // Anything that changed before the watches were in place
+    int changed = 0;
+    for (int i = 0; i < fileCount; i++) {
+        if (fileDiffers(&files[i])) {
+            files[i].changed = changed = 1;
+        }
+    }
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int timeout = changed ? WATCH_SETTLE_MS : -1;
+    for (;;) {
+        struct pollfd ready = { fd, POLLIN, 0 };
+        int result = poll(&ready, 1, timeout);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+        for (char *cursor = buffer; cursor < buffer + length;) {
+            const struct inotify_event *event = (const struct inotify_event *)cursor;
+            for (int i = 0; event->len && i < fileCount; i++) {
+                if (watches[i] == event->wd && strcmp(baseName(files[i].path), event->name) == 0) {
+                    files[i].changed = changed = 1;
+                }
+            }
+            cursor += sizeof(struct inotify_event) + event->len;
+        }
+        if (changed) {
+            timeout = WATCH_SETTLE_MS;
+        }
+    }
+
+    memFree(watches);
+    close(fd);
+    return changed;
+}
+#endif
+
+static void waitPolling(void) {
+    for (;;) {
+        sleepMs(WATCH_POLL_MS);
+        int changed = 0;
+        for (int i = 0; i < fileCount; i++) {
+            if (fileDiffers(&files[i])) {
+                files[i].changed = changed = 1;
+            }
+        }
+        if (changed) {
+            sleepMs(WATCH_SETTLE_MS);
+            return;
+        }
+    }
+}
+
+static void waitForChange(void) {
+#ifdef __linux__
+    if (waitInotify()) {
+        return;
+    }
+#endif
+    waitPolling();
+}
+
+// Errors in the script exit, so every run gets a process of its own. It
+// starts with the parsed expressions and imports the watch has cached.
+static void runScript(Script *script) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t child = fork();
+    if (child < 0) {
+        perror("Error starting script");
+        return;
+    }
+    if (child == 0) {
+        startLimits();
+        executeScript(script);
+        exit(EXIT_SUCCESS);
+    }
+    int status;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+    }
+}
+
+void watchScript(const char *path, int checkOnly) {
+    Script *script = NULL;
+    int errors = 0;
+    int reload = 1;
+
+    for (;;) {
+        if (reload) {
+            if (script) {
+                freeScript(script);
+            }
+            // Looked at before reading so that a save during the read is
+            // not missed
+            WatchedFile before = { (char *)path, { 0 }, 0, 0 };
+            recordFile(&before);
+            script = loadScriptFile(path);
+            if (script) {
+                refreshExpressionCache();
+                errors = typecheckScript(script, 0);
+            }
+            watchFiles(path, script);
+            files[0].info = before.info;
+            files[0].exists = before.exists;
+        }
+
+        if (!script) {
+            fprintf(stderr, "Error: Could not open file %s\n", path);
+        } else if (errors == 0 && !checkOnly) {
+            runScript(script);
+        }
+        fprintf(stderr, "Watching %d file%s for changes\n", fileCount, fileCount == 1 ? "" : "s");
+
+        waitForChange();
+        reload = files[0].changed;
+        for (int i = 1; i < fileCount; i++) {
+            if (files[i].changed) {
+                forgetImport(files[i].path);
+                recordFile(&files[i]);
+                preloadImport(files[i].path);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef LEXER_WATCH_H
+#define LEXER_WATCH_H
+
+// Run the script at path, then run it again every time it or a file it
+// imports changes, until interrupted. Each run happens in a child process,
+// so an error in the script ends that run and not the watch. Statements
+// that did not change keep their parsed expressions and unchanged imports
+// are not read again. With checkOnly the script is only type checked.
+void watchScript(const char *path, int checkOnly);
+
+#endif // LEXER_WATCH_H
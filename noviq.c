@@ -2,70 +2,55 @@
 #include <stdlib.h>
 #include <string.h>
 #include "lexer/lexer_interpret.h"
+#include "lexer/lexer_script.h"
+#include "lexer/lexer_function.h"
+#include "lexer/lexer_stream.h"
+#include "lexer/lexer_typecheck.h"
+#include "lexer/lexer_watch.h"
+#include "lexer/lexer_parallel.h"
+#include "lexer/lexer_limit.h"
+#include "lexer/lexer_memory.h"
+#include "lexer/lexer_snapshot.h"
+#include "lexer/lexer_trace.h"
+#include "lexer/lexer_emit.h"
+#include "lexer/lexer_prefetch.h"
 
 #define LITECODE_VERSION "prealpha-v2.0"
 
-#ifdef _WIN32
-// Windows implementation of getline
-ssize_t getline(char **lineptr, size_t *n, FILE *stream) {
-    char *bufptr = NULL;
-    char *p = bufptr;
-    size_t size;
-    int c;
-
-    if (lineptr == NULL) {
-        return -1;
-    }
-    if (stream == NULL) {
-        return -1;
-    }
-    if (n == NULL) {
-        return -1;
-    }
-    bufptr = *lineptr;
-    size = *n;
-
-    c = fgetc(stream);
-    if (c == EOF) {
-        return -1;
-    }
-    if (bufptr == NULL) {
-        size = 128;
-        bufptr = (char *)malloc(size);
-        if (bufptr == NULL) {
-            return -1;
-        }
-    }
-    p = bufptr;
-    while (c != EOF) {
-        if ((p - bufptr) > (size - 1)) {
-            size = size + 128;
-            bufptr = realloc(bufptr, size);
-            if (bufptr == NULL) {
-                return -1;
-            }
-            p = bufptr + (p - bufptr);
-        }
-        *p++ = c;
-        if (c == '\n') {
-            break;
-        }
-        c = fgetc(stream);
-    }
-
-    *p++ = '\0';
-    *lineptr = bufptr;
-    *n = size;
-
-    return p - bufptr - 1;
-}
-#endif
+// Set by --each, -F, --typecheck, --watch, --snapshot-after, -o, --restore
+// and --emit-c
+static int eachRecord = 0;
+static char fieldSeparator = 0;
+static int typecheckOnly = 0;
+static int watchMode = 0;
+static int snapshotLine = 0;
+static const char *snapshotPath = NULL;
+static const char *restorePath = NULL;
+static int emitMode = 0;
 
 void displayHelp(const char *programName) {
     printf("Noviq Interpreter\n");
     printf("Usage: %s [options] or %s -e <filename>\n\n", programName, programName);
     printf("Options:\n");
     printf("  -e <filename>    Execute a Noviq script file\n");
+    printf("  --each          Run the script once for every line of standard input\n");
+    printf("  -F <character>   Split fields on character instead of whitespace (--each)\n");
+    printf("  --stack-size <n> Slots for function locals, %d by default\n", DEFAULT_STACK_SIZE);
+    printf("  --threads <n>    Threads for parallel_for, one per processor by default\n");
+    printf("  --max-statements <n>  Stop after running n statements (exit status %d)\n", LIMIT_EXIT_STATEMENTS);
+    printf("  --time-limit <s>      Stop after s seconds (exit status %d)\n", LIMIT_EXIT_TIME);
+    printf("  --max-output <n>      Stop before writing more than n bytes of output (exit status %d)\n",
+           LIMIT_EXIT_OUTPUT);
+    printf("  --max-mem <n>         Stop before using more than n bytes of memory (exit status %d)\n",
+           LIMIT_EXIT_MEMORY);
+    printf("  --memory-report       Print the memory each allocation site used when the script ends\n");
+    printf("  --snapshot-after <line> -o <file>  Save the state after line to file instead of running the rest\n");
+    printf("  --restore <file>      Carry on from the state saved in file\n");
+    printf("  --trace <file>        Record the last %d events of each thread to file\n", TRACE_RING_EVENTS);
+    printf("  --trace-json <file>   Print a file written by --trace as Trace Event Format JSON\n");
+    printf("  --emit-c <filename>   Print the script's top level as C that calls the interpreter, see make runtime\n");
+    printf("  --typecheck     Check the script for type errors without running it\n");
+    printf("  --watch         Run the script again whenever it or a file it imports changes\n");
     printf("  --help          Display this help message\n");
     printf("  --version       Display Noviq version\n");
 }
@@ -79,69 +64,51 @@ void executeFile(const char *filename) {
         exit(EXIT_FAILURE);
     }
 
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error opening file");
+    if (emitMode) {
+        if (!emitC(filename)) {
+            perror("Error opening file");
+            exit(EXIT_FAILURE);
+        }
         return;
     }
 
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
-    currentLineNumber = 0;
-    int inMultilineComment = 0;
-    
-    while ((read = getline(&line, &len, file)) != -1) {
-        currentLineNumber++;  // Increment at start of each line
-        
-        if (line[read - 1] == '\n') {
-            line[read - 1] = '\0';
-        }
-        
-        // Skip empty lines or lines with only whitespace
-        char *trimmed = line;
-        while (*trimmed == ' ' || *trimmed == '\t') trimmed++;
-        if (*trimmed == '\0') {
-            continue;
-        }
-
-        // Handle comments
-        if (strncmp(trimmed, "##", 2) == 0) {
-            inMultilineComment = !inMultilineComment;
-            continue;
-        }
-        
-        if (inMultilineComment || strncmp(trimmed, "#", 1) == 0) {
-            continue;
-        }
+    if (watchMode) {
+        watchScript(filename, typecheckOnly);
+        return;
+    }
 
-        // Process single-line comments
-        char *commentStart = strstr(trimmed, "#");
-        if (commentStart != NULL) {
-            *commentStart = '\0';
-            while (commentStart > trimmed && (*(commentStart-1) == ' ' || *(commentStart-1) == '\t')) {
-                commentStart--;
-            }
-            *commentStart = '\0';
-            if (*trimmed == '\0') {
-                continue;
-            }
-        }
+    Script *script = loadScriptFile(filename);
+    if (!script) {
+        perror("Error opening file");
+        return;
+    }
+    // The imported files are read while the script is checked and run
+    if (!typecheckOnly) {
+        prefetchImports(script);
+    }
 
-        // Execute the line
-        if (*trimmed) {
-            if (strncmp(trimmed, "if(", 3) == 0 || 
-                strncmp(trimmed, "elseif(", 7) == 0 || 
-                strcmp(trimmed, "else:") == 0) {
-                handleIfStatement(trimmed, file);
-            } else {
-                interpretCommand(trimmed, currentLineNumber);
-            }
-        }
+    // Definite type errors stop the script before any of it runs. A restored
+    // script is checked from the snapshot on once its state is loaded.
+    if ((!restorePath || typecheckOnly) && typecheckScript(script, eachRecord) > 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (typecheckOnly) {
+        freeScript(script);
+        return;
     }
 
-    free(line);
-    fclose(file);
+    startLimits();
+    if (eachRecord) {
+        executeEachRecord(script, stdin, fieldSeparator);
+    } else if (snapshotLine) {
+        snapshotScript(script, snapshotLine, snapshotPath);
+    } else if (restorePath) {
+        restoreScript(script, restorePath);
+    } else {
+        executeScript(script);
+    }
+    finishPrefetch();
+    freeScript(script);
 }
 
 int main(int argc, char *argv[]) {
@@ -150,28 +117,151 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    if (strcmp(argv[1], "--help") == 0) {
-        displayHelp(argv[0]);
-        return 0;
-    }
+    const char *filename = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            displayHelp(argv[0]);
+            return 0;
+        }
 
-    if (strcmp(argv[1], "--version") == 0) {
-        printf("%s\n", LITECODE_VERSION);
-        return 0;
-    }
+        if (strcmp(argv[i], "--version") == 0) {
+            printf("%s\n", LITECODE_VERSION);
+            return 0;
+        }
+
+        if (strcmp(argv[i], "--trace-json") == 0) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "Error: --trace-json needs a trace file\n");
+                return 1;
+            }
+            if (!traceToJson(argv[i + 1])) {
+                fprintf(stderr, "Error: Could not read trace %s\n", argv[i + 1]);
+                return 1;
+            }
+            return 0;
+        }
 
-    if (strcmp(argv[1], "-e") == 0) {
-        if (argc != 3) {
-            fprintf(stderr, "Error: No input file specified\n");
+        if (strcmp(argv[i], "-e") == 0) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "Error: No input file specified\n");
+                displayHelp(argv[0]);
+                return 1;
+            }
+            filename = argv[++i];
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "Error: --emit-c needs a script\n");
+                return 1;
+            }
+            filename = argv[++i];
+            emitMode = 1;
+        } else if (strcmp(argv[i], "--each") == 0) {
+            eachRecord = 1;
+        } else if (strcmp(argv[i], "-F") == 0) {
+            if (i + 1 == argc || strlen(argv[i + 1]) != 1) {
+                fprintf(stderr, "Error: -F needs a single character\n");
+                return 1;
+            }
+            fieldSeparator = argv[++i][0];
+        } else if (strcmp(argv[i], "--typecheck") == 0) {
+            typecheckOnly = 1;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watchMode = 1;
+        } else if (strcmp(argv[i], "--stack-size") == 0) {
+            if (i + 1 == argc || atoi(argv[i + 1]) <= 0) {
+                fprintf(stderr, "Error: --stack-size needs a positive number\n");
+                return 1;
+            }
+            callStackSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 == argc || atoi(argv[i + 1]) <= 0) {
+                fprintf(stderr, "Error: --threads needs a positive number\n");
+                return 1;
+            }
+            parallelThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-statements") == 0) {
+            if (i + 1 == argc || atoll(argv[i + 1]) <= 0) {
+                fprintf(stderr, "Error: --max-statements needs a positive number\n");
+                return 1;
+            }
+            statementLimit = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--time-limit") == 0) {
+            if (i + 1 == argc || atof(argv[i + 1]) <= 0) {
+                fprintf(stderr, "Error: --time-limit needs a positive number of seconds\n");
+                return 1;
+            }
+            timeLimit = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-output") == 0) {
+            if (i + 1 == argc || atoll(argv[i + 1]) <= 0) {
+                fprintf(stderr, "Error: --max-output needs a positive number of bytes\n");
+                return 1;
+            }
+            outputLimit = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--max-mem") == 0) {
+            if (i + 1 == argc || atoll(argv[i + 1]) <= 0) {
+                fprintf(stderr, "Error: --max-mem needs a positive number of bytes\n");
+                return 1;
+            }
+            memoryLimit = (size_t)atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot-after") == 0) {
+            if (i + 1 == argc || atoi(argv[i + 1]) <= 0) {
+                fprintf(stderr, "Error: --snapshot-after needs a line number\n");
+                return 1;
+            }
+            snapshotLine = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "Error: -o needs a file name\n");
+                return 1;
+            }
+            snapshotPath = argv[++i];
+        } else if (strcmp(argv[i], "--restore") == 0) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "Error: --restore needs a snapshot file\n");
+                return 1;
+            }
+            restorePath = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "Error: --trace needs a file name\n");
+                return 1;
+            }
+            startTrace(argv[++i]);
+        } else if (strcmp(argv[i], "--memory-report") == 0) {
+            // Printed however the script ends, errors included
+            atexit(memoryReport);
+        } else {
+            fprintf(stderr, "Error: Invalid argument '%s'\n", argv[i]);
             displayHelp(argv[0]);
             return 1;
         }
-        const char *filename = argv[2];
-        executeFile(filename);
-        return 0;
     }
 
-    fprintf(stderr, "Error: Invalid argument '%s'\n", argv[1]);
-    displayHelp(argv[0]);
-    return 1;
+    if (!filename) {
+        fprintf(stderr, "Error: No input file specified\n");
+        displayHelp(argv[0]);
+        return 1;
+    }
+    if (watchMode && eachRecord) {
+        fprintf(stderr, "Error: --watch cannot be used with --each\n");
+        return 1;
+    }
+    if ((snapshotLine != 0) != (snapshotPath != NULL)) {
+        fprintf(stderr, "Error: --snapshot-after and -o go together\n");
+        return 1;
+    }
+    if ((snapshotLine || restorePath) && (eachRecord || watchMode)) {
+        fprintf(stderr, "Error: Snapshots cannot be used with --each or --watch\n");
+        return 1;
+    }
+    if (emitMode && (eachRecord || watchMode || typecheckOnly || snapshotLine || restorePath)) {
+        fprintf(stderr, "Error: --emit-c cannot be used with --each, --watch, --typecheck or snapshots\n");
+        return 1;
+    }
+    if (snapshotLine && restorePath) {
+        fprintf(stderr, "Error: --snapshot-after cannot be used with --restore\n");
+        return 1;
+    }
+    executeFile(filename);
+    return 0;
 }
\ No newline at end of file